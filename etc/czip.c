@@ -30,7 +30,7 @@
 #include <libfam/main.h>
 #include <libfam/version.h>
 
-#define CZIP_VERSION 0
+#define CZIP_VERSION 1
 #define CZIP_MAGIC 0xCC337711
 #define MAX_PATH 1024
 
@@ -40,7 +40,16 @@ typedef struct {
 	bool version;
 	bool help;
 	bool keep;
+	bool long_range;
+	bool no_check;
+	bool test;
+	bool archive;
+	bool list;
+	u8 level;
 	const u8 *file;
+	const u8 *patch_from;
+	u8 **members;
+	i32 member_count;
 	i32 return_value;
 } CzipConfig;
 
@@ -53,9 +62,20 @@ typedef struct {
 	const u8 *file;
 } CzipFileHeader;
 
+/* Returns the value of a '--name=value' option, or NULL */
+static const u8 *optval(const u8 *arg, const u8 *name) {
+	u64 len = strlen(name);
+	if (strlen(arg) <= len + 1 || fastmemcmp(arg, name, len) ||
+	    arg[len] != '=')
+		return NULL;
+	return arg + len + 1;
+}
+
 static CzipConfig parse_argv(i32 argc, u8 **argv) {
 	CzipConfig ret = {0};
+	const u8 *val;
 	i32 i;
+	ret.level = COMPRESS_LEVEL_DEFAULT;
 	for (i = 1; i < argc; i++) {
 		u8 *arg = argv[i];
 		if (*arg == '-') {
@@ -75,6 +95,18 @@ static CzipConfig parse_argv(i32 argc, u8 **argv) {
 				} else if (!strcmp(arg, "keep")) {
 					ret.keep = true;
 					return ret;
+				} else if (!strcmp(arg, "long")) {
+					ret.long_range = true;
+				} else if (!strcmp(arg, "no-check")) {
+					ret.no_check = true;
+				} else if (!strcmp(arg, "test")) {
+					ret.test = true;
+				} else if (!strcmp(arg, "archive")) {
+					ret.archive = true;
+				} else if (!strcmp(arg, "list")) {
+					ret.list = true;
+				} else if ((val = optval(arg, "patch-from"))) {
+					ret.patch_from = val;
 				} else {
 					println("Illegal option: '{}'",
 						argv[i]);
@@ -98,6 +130,14 @@ static CzipConfig parse_argv(i32 argc, u8 **argv) {
 						ret.version = true;
 					else if (ch == 'k')
 						ret.keep = true;
+					else if (ch == 't')
+						ret.test = true;
+					else if (ch == 'a')
+						ret.archive = true;
+					else if (ch == 'l')
+						ret.list = true;
+					else if (ch >= '1' && ch <= '9')
+						ret.level = ch - '0';
 					else {
 						println("Illegal option: '{c}'",
 							ch);
@@ -108,24 +148,136 @@ static CzipConfig parse_argv(i32 argc, u8 **argv) {
 					}
 				}
 			}
-		} else {
-			if (ret.file) {
-				println("Error: Multiple files specified!");
-				ret.help = true;
-				ret.return_value = -1;
-				return ret;
-			}
+		} else if (ret.file) {
+			/* extra names are archive members, gathered in place */
+			argv[++ret.member_count] = arg;
+		} else
 			ret.file = arg;
-		}
+	}
+	ret.members = argv + 1;
+	if (ret.member_count && !ret.archive && !ret.decompress) {
+		println("Error: Multiple files specified!");
+		ret.help = true;
+		ret.return_value = -1;
 	}
 	return ret;
 }
 
+/* Patches are only made from and restored to regular files */
+static i32 open_reference(CzipConfig *config, bool use_stdin) {
+	i32 reffd;
+
+	if (config->console || use_stdin) {
+		println("--patch-from needs an input and an output file.");
+		_exit(-1);
+	}
+	if (!exists(config->patch_from) ||
+	    (reffd = file(config->patch_from)) < 0) {
+		println("Could not open reference file '{}'",
+			config->patch_from);
+		_exit(-1);
+	}
+	return reffd;
+}
+
+static i32 find_member(Archive *a, const u8 *name) {
+	for (u32 i = 0; i < archive_count(a); i++)
+		if (!strcmp(archive_entry(a, i)->name, name)) return i;
+	return -1;
+}
+
+static void extract_member(CzipConfig *config, Archive *a, i32 index) {
+	const ArchiveEntry *entry = archive_entry(a, index);
+	struct timeval ts[2] = {0};
+	i32 outfd;
+
+	outfd = config->console ? 1 : archive_create_member(NULL, entry);
+	if (outfd < 0) {
+		println("Could not open output file '{}'", entry->name);
+		_exit(-1);
+	}
+	if (archive_extract(a, index, outfd) < 0) {
+		println("Warning: extracting '{}' failed!", entry->name);
+		_exit(-1);
+	}
+	if (config->console) return;
+	ts[0].tv_sec = ts[1].tv_sec = entry->mtime;
+	if (fchmod(outfd, entry->mode ? entry->mode : 0600) < 0 ||
+	    utimesat(outfd, NULL, ts, 0) < 0) {
+		println("Could not set file attributes.");
+		_exit(-1);
+	}
+	close(outfd);
+}
+
+/* Archives are kept after extraction, and only listed members are extracted */
+static void unarchive(CzipConfig *config, i32 infd) {
+	const ArchiveEntry *entry;
+	Archive *a;
+	i32 index;
+
+	if (archive_open(&a, infd, 0) < 0) {
+		println("Magic error! '{}' is not a czip file.", config->file);
+		_exit(-1);
+	}
+	if (config->list) {
+		for (u32 i = 0; i < archive_count(a); i++) {
+			entry = archive_entry(a, i);
+			println("{} {}", entry->size, entry->name);
+		}
+	} else if (config->test) {
+		if (archive_verify(a) < 0) {
+			println("Integrity check failed!");
+			_exit(-1);
+		}
+	} else if (config->member_count) {
+		for (i32 i = 0; i < config->member_count; i++) {
+			if ((index = find_member(a, config->members[i])) < 0) {
+				println("'{}' is not in the archive.",
+					config->members[i]);
+				_exit(-1);
+			}
+			extract_member(config, a, index);
+		}
+	} else if (archive_extract_all(a, NULL) < 0) {
+		println("Warning: extraction failed!");
+		_exit(-1);
+	}
+	archive_close(a);
+	close(infd);
+}
+
+static void archive(CzipConfig *config) {
+	u32 flags = config->no_check ? 0 : COMPRESS_CHECK;
+	i32 outfd;
+
+	if (!config->file || !config->member_count) {
+		println("Usage: czip -a ARCHIVE FILE...");
+		_exit(-1);
+	}
+	if (exists(config->file)) {
+		println("Archive '{}' already exists.", config->file);
+		_exit(-1);
+	}
+	if ((outfd = file(config->file)) < 0) {
+		println("Could not open output file '{}'", config->file);
+		_exit(-1);
+	}
+	if (compress_archive((const u8 **)config->members, config->member_count,
+			     outfd, 0, config->level, flags) < 0) {
+		println("Warning: compression failed!");
+		close(outfd);
+		unlink(config->file);
+		_exit(-1);
+	}
+	close(outfd);
+}
+
 static void decompress(CzipConfig *config) {
 	i32 res;
 	u32 magic, mode;
 	u8 version;
-	i32 infd, outfd;
+	i32 infd, outfd, reffd = -1;
 	u64 atime, mtime;
 	u8 outpath[MAX_PATH] = {0};
 	bool use_stdin = !config->file;
@@ -148,6 +300,10 @@ static void decompress(CzipConfig *config) {
 		println("Magic read error.");
 		_exit(-1);
 	}
+	if (magic != CZIP_MAGIC && !use_stdin) {
+		unarchive(config, infd);
+		return;
+	}
 	if (pread(infd, &version, sizeof(u8), 4) != sizeof(u8)) {
 		println("Version read error.");
 		_exit(-1);
@@ -174,7 +330,7 @@ static void decompress(CzipConfig *config) {
 		_exit(-1);
 	}
 
-	if (magic != CZIP_MAGIC || version != CZIP_VERSION) {
+	if (magic != CZIP_MAGIC || version > CZIP_VERSION) {
 		println("Magic error! {}/{} (expected {}/{}", magic, version,
 			CZIP_MAGIC, CZIP_VERSION);
 		_exit(-1);
@@ -185,9 +341,38 @@ static void decompress(CzipConfig *config) {
 		_exit(-1);
 	}
 
+	if (config->list) {
+		println("{}", outpath);
+		if (!use_stdin) close(infd);
+		return;
+	}
+	if (config->member_count) {
+		println("Error: '{}' is not an archive.", config->file);
+		_exit(-1);
+	}
+
+	if (config->test && config->patch_from) {
+		reffd = open_reference(config, use_stdin);
+		res = decompress_verify_delta(reffd, infd, 26 + flen);
+		close(reffd);
+	} else if (config->test)
+		res = decompress_verify(infd, 26 + flen);
+	if (config->test) {
+		if (res < 0) {
+			println("Integrity check failed!");
+			_exit(-1);
+		}
+		if (!use_stdin) close(infd);
+		return;
+	}
+
+	if (config->patch_from) reffd = open_reference(config, use_stdin);
 	outfd = config->console ? 1 : file(outpath);
 
-	if (config->console || use_stdin) {
+	if (config->patch_from) {
+		res = decompress_delta(reffd, infd, 26 + flen, outfd, 0);
+		close(reffd);
+	} else if (config->console || use_stdin) {
 		res = decompress_stream(infd, 26 + flen, outfd, 0);
 	} else
 		res = decompress_file(infd, 26 + flen, outfd, 0);
@@ -212,15 +397,19 @@ static void decompress(CzipConfig *config) {
 
 		close(outfd);
 	}
-	if (res < 0) println("Warning: decompression failed!");
+	if (res < 0) {
+		println("Warning: decompression failed!");
+		/* whatever was written is not the original file */
+		if (!config->console) unlink(outpath);
+	}
 	if (res >= 0 && !config->keep && !config->console && !use_stdin)
 		unlink(config->file);
 }
 
 static void compress(CzipConfig *config) {
 	u8 vval;
-	u32 wval;
-	i32 infd, outfd, res;
+	u32 wval, flags;
+	i32 infd, outfd, res, reffd = -1;
 	u8 outpath[MAX_PATH] = {0};
 	bool use_stdin = !config->file;
 
@@ -234,6 +423,7 @@ static void compress(CzipConfig *config) {
 		_exit(-1);
 	}
 
+	if (config->patch_from) reffd = open_reference(config, use_stdin);
 	if (use_stdin)
 		infd = 0;
 	else
@@ -310,10 +500,18 @@ static void compress(CzipConfig *config) {
 		_exit(-1);
 	}
 
-	if (config->console || use_stdin) {
-		res = compress_stream(infd, 0, outfd, 26 + flen);
+	flags = config->no_check ? 0 : COMPRESS_CHECK;
+	if (config->patch_from) {
+		res = compress_delta(reffd, infd, 0, outfd, 26 + flen,
+				     config->level, flags);
+		close(reffd);
+	} else if (config->console || use_stdin) {
+		res = compress_stream_flags(infd, 0, outfd, 26 + flen,
+					    config->level, flags);
 	} else {
-		res = compress_file(infd, 0, outfd, 26 + flen);
+		if (config->long_range) flags |= COMPRESS_LONG;
+		res = compress_file_flags(infd, 0, outfd, 26 + flen,
+					  config->level, flags);
 	}
 
 	if (!use_stdin) close(infd);
@@ -338,14 +536,30 @@ i32 main(i32 argc, u8 **argv, u8 **envp) {
 		println("-h, --help          print this message");
 		println("-v, --version       print version");
 		println("-k, --keep          keep original file");
+		println("-t, --test          check compressed file integrity");
+		println(
+		    "    --long          match repeats across the whole file");
+		println("    --no-check      do not store block checksums");
+		println("    --patch-from=F  store only what differs from F");
+		println("-a, --archive       pack files into an archive");
+		println("-l, --list          list the files in an archive");
+		println(
+		    "\nArchives: 'czip -a out.cza FILE...' packs, "
+		    "'czip -d out.cza' extracts\nevery member and "
+		    "'czip -d out.cza NAME...' only the named ones.");
+		println(
+		    "-1 .. -9            compression level (1 = fastest, "
+		    "9 = best)");
 		println(
 		    "\nNote: if no file is specified stdin will be "
 		    "used as "
 		    "the "
 		    "input file.");
 		return config.return_value;
-	} else if (config.decompress) {
+	} else if (config.decompress || config.test || config.list) {
 		decompress(&config);
+	} else if (config.archive) {
+		archive(&config);
 	} else {
 		compress(&config);
 	}
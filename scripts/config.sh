@@ -105,23 +105,21 @@ esac
 ARCH=$(uname -m);
 case "${ARCH}" in
     x86_64)
-        MARCH="haswell"
-	mkdir -p ${BINDIR}
-	${CC} etc/mvaes.c -o ${BINDIR}/mvaes
-	${BINDIR}/mvaes
-	if [ "$?" = "1" ]; then
-            MARCH_EXTRA="-maes"
-	else
-            MARCH_EXTRA="-mvaes"
-	fi
+        # Generic code targets x86-64-v2. AVX2, AES-NI and VAES kernels are
+        # built alongside it and picked at runtime (see cpu_features).
+        MARCH="x86-64-v2"
+        MARCH_EXTRA=""
+        AVX2_MARCH="-march=haswell -maes"
         ;;
     aarch64)
         MARCH="armv8-a+crypto"
         MARCH_EXTRA="-mno-outline-atomics"
+        AVX2_MARCH=""
         ;;
     *)
         MARCH="native"
         MARCH_EXTRA=""
+        AVX2_MARCH=""
         ;;
 esac
 
@@ -153,7 +151,7 @@ export LDFLAGS="$LDFLAGS \
     $COVERAGE \
     $EXTRA_LDFLAGS"
 
-export CDEFS
+export CDEFS AVX2_MARCH
 
 # For debugging – uncomment if you ever need to see what’s being used
 # echo "BUILD_MODE=$BUILD_MODE  CC=$CC  CFLAGS=$CFLAGS" >&2
@@ -63,6 +63,12 @@ build_subdir() {
 
     local srcdir="$PROJECT_DIR/src/$subdir"
     local objdir="$OBJDIR/$subdir" 
+    local march=""
+
+    # AVX2 backends are only called once cpu_features() reports AVX2
+    case "$subdir" in
+        *_avx2) march="$AVX2_MARCH" ;;
+    esac
 
     mkdir -p "$objdir"
 
@@ -74,7 +80,7 @@ build_subdir() {
         obj="$objdir/${basename%.c}.o"
 
         if [ ! -f "$obj" ] || [ "$src" -nt "$obj" ]; then
-            COMMAND="$CC -I$PROJECT_DIR/$INCDIR $CFLAGS $CDEFS -c $src -o $obj";
+            COMMAND="$CC -I$PROJECT_DIR/$INCDIR $CFLAGS $march $CDEFS -c $src -o $obj";
             [ "$SILENT" != "1" ] && echo ${COMMAND};
 	    ${COMMAND} || exit $?;
         fi
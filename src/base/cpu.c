@@ -0,0 +1,103 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#include <libfam/cpu.h>
+#include <libfam/utils.h>
+
+#if defined(__x86_64__) && !defined(NO_VECTOR)
+#define USE_CPUID
+#endif /* __x86_64__ && !NO_VECTOR */
+
+#define CPU_DETECTED 0x80000000
+
+#define CPUID1_ECX_FMA (1U << 12)
+#define CPUID1_ECX_MOVBE (1U << 22)
+#define CPUID1_ECX_AES (1U << 25)
+#define CPUID1_ECX_OSXSAVE (1U << 27)
+#define CPUID1_ECX_AVX (1U << 28)
+#define CPUID7_EBX_BMI1 (1U << 3)
+#define CPUID7_EBX_AVX2 (1U << 5)
+#define CPUID7_EBX_BMI2 (1U << 8)
+#define CPUID7_ECX_VAES (1U << 9)
+#define CPUIDX1_ECX_LZCNT (1U << 5)
+#define XCR0_SSE_AVX 0x6
+
+#define CPUID1_ECX_HASWELL                                      \
+	(CPUID1_ECX_FMA | CPUID1_ECX_MOVBE | CPUID1_ECX_OSXSAVE | \
+	 CPUID1_ECX_AVX)
+#define CPUID7_EBX_HASWELL (CPUID7_EBX_BMI1 | CPUID7_EBX_AVX2 | CPUID7_EBX_BMI2)
+
+static u32 cpu_feature_bits = 0;
+
+#ifdef USE_CPUID
+STATIC void cpu_cpuid(u32 leaf, u32 sub, u32 regs[4]) {
+	__asm__ volatile("cpuid"
+			 : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]),
+			   "=d"(regs[3])
+			 : "a"(leaf), "c"(sub));
+}
+
+STATIC u32 cpu_detect(void) {
+	u32 r1[4], r7[4] = {0}, rx[4] = {0}, max, eax, edx, bits = 0;
+
+	cpu_cpuid(0, 0, r1);
+	max = r1[0];
+	cpu_cpuid(1, 0, r1);
+	if (max >= 7) cpu_cpuid(7, 0, r7);
+	cpu_cpuid(0x80000000, 0, rx);
+	if (rx[0] >= 0x80000001)
+		cpu_cpuid(0x80000001, 0, rx);
+	else
+		rx[2] = 0;
+
+	if (r1[2] & CPUID1_ECX_AES) bits |= CPU_AES;
+
+	/* the OS must also save the ymm registers across context switches */
+	if ((r1[2] & CPUID1_ECX_HASWELL) != CPUID1_ECX_HASWELL) return bits;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	if ((eax & XCR0_SSE_AVX) != XCR0_SSE_AVX) return bits;
+	if ((r7[1] & CPUID7_EBX_HASWELL) != CPUID7_EBX_HASWELL) return bits;
+	if (!(rx[2] & CPUIDX1_ECX_LZCNT)) return bits;
+	bits |= CPU_AVX2;
+
+	if ((bits & CPU_AES) && (r7[2] & CPUID7_ECX_VAES)) bits |= CPU_VAES;
+	return bits;
+}
+#else
+STATIC u32 cpu_detect(void) { return 0; }
+#endif /* !USE_CPUID */
+
+/*
+ * Features are read once and cached; every later call is a single load.
+ * Racing first callers store the same value.
+ */
+PUBLIC u32 cpu_features(void) {
+	u32 bits = __atomic_load_n(&cpu_feature_bits, __ATOMIC_RELAXED);
+	if (__builtin_expect(!bits, 0)) {
+		bits = cpu_detect() | CPU_DETECTED;
+		__atomic_store_n(&cpu_feature_bits, bits, __ATOMIC_RELAXED);
+	}
+	return bits & ~CPU_DETECTED;
+}
@@ -24,14 +24,20 @@
  *******************************************************************************/
 
 #include <libfam/errno.h>
+#include <libfam/pool.h>
 #include <libfam/string.h>
 #include <libfam/syscall.h>
 #include <libfam/sysext.h>
 #include <libfam/utils.h>
 
 i32 __err_value = 0;
-PUBLIC i32 *__error(void) { return &__err_value; }
-PUBLIC i32 *__err_location(void) { return &__err_value; }
+
+/* Pool workers run concurrently with the caller, so each has its own. */
+PUBLIC i32 *__error(void) {
+	i32 *err = pool_errno();
+	return err ? err : &__err_value;
+}
+PUBLIC i32 *__err_location(void) { return __error(); }
 
 void perror(const char *s) {
 	const u8 *err_msg;
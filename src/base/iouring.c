@@ -133,6 +133,12 @@ i32 iouring_init_pread(IoUring *iou, i32 fd, void *buf, u64 len, u64 foffset,
 
 i32 iouring_init_pwrite(IoUring *iou, i32 fd, const void *buf, u64 len,
 			u64 foffset, u64 id) {
+	return iouring_init_pwrite_flags(iou, fd, buf, len, foffset, id,
+					 IOSQE_IO_LINK);
+}
+
+i32 iouring_init_pwrite_flags(IoUring *iou, i32 fd, const void *buf, u64 len,
+			      u64 foffset, u64 id, u8 flags) {
 	struct io_uring_sqe *sqe;
 	sqe = iouring_get_sqe(iou);
 	if (!sqe) {
@@ -143,7 +149,7 @@ i32 iouring_init_pwrite(IoUring *iou, i32 fd, const void *buf, u64 len,
 	fastmemset(sqe, 0, sizeof(*sqe));
 
 	sqe->opcode = IORING_OP_WRITE;
-	sqe->flags = IOSQE_IO_LINK;
+	sqe->flags = flags;
 	sqe->fd = fd;
 	sqe->addr = (u64)buf;
 	sqe->len = len;
@@ -232,6 +238,25 @@ i32 iouring_submit(IoUring *iou, u32 count) {
 	return io_uring_enter2(iou->ring_fd, count, 0, 0, NULL, 0);
 }
 
+i32 iouring_submit_wait(IoUring *iou, u32 count, u32 min) {
+	return io_uring_enter2(iou->ring_fd, count, min,
+			       min ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+u32 iouring_reap(IoUring *iou, u64 *ids, i32 *res, u32 max) {
+	u32 head = __aload32(iou->cq_head), mask = *iou->cq_mask, count = 0;
+	u32 tail = __aload32(iou->cq_tail);
+
+	while (head != tail && count < max) {
+		struct io_uring_cqe *cqe = &iou->cqes[head & mask];
+		ids[count] = cqe->user_data;
+		res[count++] = cqe->res;
+		head++;
+	}
+	__astore32(iou->cq_head, head);
+	return count;
+}
+
 i32 iouring_spin(IoUring *iou, u64 *id) {
 	u32 mask = *iou->cq_mask;
 	i32 res;
@@ -304,6 +329,7 @@ void iouring_destroy(IoUring *iou) {
 	if (iou->sq_ring) munmap(iou->sq_ring, iou->sq_ring_size);
 	if (iou->cq_ring) munmap(iou->cq_ring, iou->cq_ring_size);
 	if (iou->sqes) munmap(iou->sqes, iou->sqes_size);
+	if (iou->ring_fd >= 0) close_raw(iou->ring_fd);
 	iou->sq_ring = NULL;
 	iou->cq_ring = NULL;
 	iou->sqes = NULL;
@@ -0,0 +1,273 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#include <libfam/atomic.h>
+#include <libfam/builtin.h>
+#include <libfam/linux.h>
+#include <libfam/pool.h>
+#include <libfam/syscall.h>
+#include <libfam/sysext.h>
+#include <libfam/utils.h>
+
+#define POOL_STACK_SIZE (8 * 1024 * 1024)
+#define POOL_MAX_STACKS (4 * MAX_POOL_THREADS)
+
+typedef struct {
+	ThreadPool *pool;
+	u8 *stack;
+	u32 id;
+	u32 wake;
+	i32 tid;
+} PoolWorker;
+
+struct ThreadPool {
+	u32 threads;
+	u32 lock;
+	u32 pending;
+	u32 stop;
+	i32 owner;
+	void (*fn)(u32 id, void *arg);
+	void *arg;
+	PoolWorker workers[MAX_POOL_THREADS];
+};
+
+ThreadPool *__global_pool__ = NULL;
+
+/*
+ * Bases of the live worker stacks, hashed by base with linear probing. Each
+ * stack is aligned to its size, so the base of the stack a thread runs on is
+ * its stack pointer rounded down. A worker keeps its errno in the lowest
+ * bytes of its stack, which the stack never grows into, so errno is found
+ * with one lookup. Removed bases become POOL_STACK_GONE, which keeps later
+ * entries of a probe reachable and never matches an aligned base.
+ */
+#define POOL_STACK_GONE 1
+STATIC u64 pool_stacks[POOL_MAX_STACKS];
+
+STATIC u32 pool_stack_slot(u64 base) {
+	return (base / POOL_STACK_SIZE) % POOL_MAX_STACKS;
+}
+
+STATIC i32 pool_stack_register(u8 *stack) {
+	u32 slot = pool_stack_slot((u64)stack);
+	u64 expected;
+
+	for (u32 i = 0; i < POOL_MAX_STACKS; i++) {
+		expected = __aload64(&pool_stacks[slot]);
+		if ((expected == 0 || expected == POOL_STACK_GONE) &&
+		    __cas64(&pool_stacks[slot], &expected, (u64)stack))
+			return 0;
+		slot = (slot + 1) % POOL_MAX_STACKS;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+STATIC void pool_stack_unregister(u8 *stack) {
+	u32 slot = pool_stack_slot((u64)stack);
+	u64 base;
+
+	for (u32 i = 0; i < POOL_MAX_STACKS; i++) {
+		if (!(base = __aload64(&pool_stacks[slot]))) return;
+		if (base == (u64)stack) {
+			__astore64(&pool_stacks[slot], POOL_STACK_GONE);
+			return;
+		}
+		slot = (slot + 1) % POOL_MAX_STACKS;
+	}
+}
+
+i32 *pool_errno(void) {
+	u64 sp = (u64)__builtin_frame_address(0), base, entry;
+	u32 slot;
+
+	base = sp & ~(u64)(POOL_STACK_SIZE - 1);
+	slot = pool_stack_slot(base);
+	for (u32 i = 0; i < POOL_MAX_STACKS; i++) {
+		if (!(entry = __aload64(&pool_stacks[slot]))) return NULL;
+		if (entry == base) return (i32 *)base;
+		slot = (slot + 1) % POOL_MAX_STACKS;
+	}
+	return NULL;
+}
+
+/* Maps a stack aligned to its size by trimming a mapping of twice that */
+STATIC u8 *pool_stack_map(void) {
+	u8 *p, *stack;
+	u64 head;
+
+	if (!(p = map(2 * POOL_STACK_SIZE))) return NULL;
+	stack = (u8 *)(((u64)p + POOL_STACK_SIZE - 1) &
+		       ~(u64)(POOL_STACK_SIZE - 1));
+	head = stack - p;
+	if (head) munmap(p, head);
+	munmap(stack + POOL_STACK_SIZE, POOL_STACK_SIZE - head);
+	return stack;
+}
+
+STATIC void pool_worker(void *ptr) {
+	PoolWorker *worker = ptr;
+	ThreadPool *pool = worker->pool;
+	u32 seen = 0;
+
+	while (true) {
+		while (__aload32(&worker->wake) == seen)
+			futex(&worker->wake, FUTEX_WAIT_PRIVATE, seen, NULL);
+		seen = __aload32(&worker->wake);
+		if (__aload32(&pool->stop)) return;
+		pool->fn(worker->id, pool->arg);
+		if (__asub32(&pool->pending, 1) == 1)
+			futex(&pool->pending, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+}
+
+i32 pool_init(ThreadPool **res, u32 threads) {
+	ThreadPool *pool = NULL;
+	PoolWorker *worker;
+INIT:
+	if (threads > MAX_POOL_THREADS) ERROR(EINVAL);
+	pool = map(sizeof(ThreadPool));
+	if (!pool) ERROR();
+
+	for (u32 i = 0; i < threads; i++) {
+		worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->id = i;
+		worker->stack = pool_stack_map();
+		if (!worker->stack) ERROR();
+		if (pool_stack_register(worker->stack) < 0) {
+			munmap(worker->stack, POOL_STACK_SIZE);
+			worker->stack = NULL;
+			ERROR();
+		}
+		if (clone_thread(pool_worker, worker,
+				 worker->stack + POOL_STACK_SIZE,
+				 &worker->tid) < 0) {
+			pool_stack_unregister(worker->stack);
+			munmap(worker->stack, POOL_STACK_SIZE);
+			worker->stack = NULL;
+			ERROR();
+		}
+		pool->threads++;
+	}
+
+	*res = pool;
+CLEANUP:
+	if (!IS_OK) pool_destroy(pool);
+	RETURN;
+}
+
+/* True if tid is running a job of pool, as a worker or as the caller. */
+STATIC bool pool_busy_in(ThreadPool *pool, i32 tid) {
+	if (__aload32((u32 *)&pool->owner) == (u32)tid) return true;
+	for (u32 i = 0; i < pool->threads; i++)
+		if (__aload32((u32 *)&pool->workers[i].tid) == (u32)tid)
+			return true;
+	return false;
+}
+
+/*
+ * Runs fn(id, arg) for every id in [0, n) and returns once all of them have
+ * finished. The caller runs id n - 1 itself, so n may be up to threads + 1.
+ * Concurrent callers are serialised. A call from inside a job of the same
+ * pool would wait on itself, so it fails with EDEADLK instead.
+ */
+i32 pool_run(ThreadPool *pool, void (*fn)(u32 id, void *arg), void *arg,
+	     u32 n) {
+	u32 expected = 0, pending;
+	i32 tid;
+
+	if (!pool || !fn || !n || n > pool->threads + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((tid = gettid()) < 0) return -1;
+	if (pool_busy_in(pool, tid)) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	while (!__cas32(&pool->lock, &expected, 1)) {
+		futex(&pool->lock, FUTEX_WAIT_PRIVATE, 1, NULL);
+		expected = 0;
+	}
+
+	__astore32((u32 *)&pool->owner, tid);
+	pool->fn = fn;
+	pool->arg = arg;
+	__astore32(&pool->pending, n - 1);
+	for (u32 i = 0; i < n - 1; i++) {
+		__aadd32(&pool->workers[i].wake, 1);
+		futex(&pool->workers[i].wake, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+
+	fn(n - 1, arg);
+
+	while ((pending = __aload32(&pool->pending)))
+		futex(&pool->pending, FUTEX_WAIT_PRIVATE, pending, NULL);
+
+	__astore32((u32 *)&pool->owner, 0);
+	__astore32(&pool->lock, 0);
+	futex(&pool->lock, FUTEX_WAKE_PRIVATE, 1, NULL);
+	return 0;
+}
+
+u32 pool_threads(ThreadPool *pool) { return pool ? pool->threads : 0; }
+
+void pool_destroy(ThreadPool *pool) {
+	PoolWorker *worker;
+	i32 tid;
+
+	if (!pool) return;
+	__astore32(&pool->stop, 1);
+	for (u32 i = 0; i < pool->threads; i++) {
+		__aadd32(&pool->workers[i].wake, 1);
+		futex(&pool->workers[i].wake, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+	for (u32 i = 0; i < pool->threads; i++) {
+		worker = &pool->workers[i];
+		/* the kernel clears tid once the thread is off its stack */
+		while ((tid = __aload32((u32 *)&worker->tid)))
+			futex((u32 *)&worker->tid, FUTEX_WAIT, tid, NULL);
+		pool_stack_unregister(worker->stack);
+		munmap(worker->stack, POOL_STACK_SIZE);
+	}
+	munmap(pool, sizeof(ThreadPool));
+}
+
+ThreadPool *global_pool(void) {
+	ThreadPool *pool = (ThreadPool *)__aload64((u64 *)&__global_pool__);
+	u64 expected = 0;
+	u32 threads;
+
+	if (pool) return pool;
+	threads = min(get_physical_cores_cpuid(), MAX_POOL_THREADS + 1) - 1;
+	if (pool_init(&pool, threads) < 0) return NULL;
+	if (!__cas64((u64 *)&__global_pool__, &expected, (u64)pool)) {
+		pool_destroy(pool);
+		return __global_pool__;
+	}
+	return pool;
+}
@@ -29,14 +29,14 @@
 #include <libfam/utils.h>
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
+#ifdef __SSE2__
+#define USE_SSE2
+#endif /* __SSE2__ */
 #endif /* NO_VECTOR */
 
-#ifdef USE_AVX2
+#ifdef USE_SSE2
 #include <immintrin.h>
-#endif /* USE_AVX2 */
+#endif /* USE_SSE2 */
 #include <libfam/types.h>
 
 PUBLIC u64 strlen(const char *x) {
@@ -107,9 +107,14 @@ PUBLIC i32 memcmp(const void *s1, const void *s2, u64 n) {
 }
 
 void *memmove(void *dest, const void *src, u64 n) {
-	u8 *d = (void *)((u8 *)dest + n);
-	u8 *s = (void *)((u8 *)src + n);
-	while (n--) d--, s--, *d = *s;
+	u8 *d = dest;
+	const u8 *s = src;
+	if (d <= s) {
+		while (n--) *d++ = *s++;
+	} else {
+		d += n, s += n;
+		while (n--) *--d = *--s;
+	}
 	return dest;
 }
 
@@ -210,12 +215,13 @@ u8 f64_to_string(u8 buf[MAX_F64_STRING_LEN], f64 v, i32 max_decimals,
 }
 
 void secure_zero32(u8 buf[32]) {
-#ifdef USE_AVX2
-	__m256i zero = _mm256_setzero_si256();
-	_mm256_store_si256((__m256i *)buf, zero);
+#ifdef USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)buf, zero);
+	_mm_storeu_si128((__m128i *)buf + 1, zero);
 	__asm__ __volatile__("" ::: "memory");	// barrier
 #else
 	secure_zero(buf, 32);
-#endif /* !USE_AVX2 */
+#endif /* !USE_SSE2 */
 }
 
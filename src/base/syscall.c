@@ -35,8 +35,12 @@
 #define PAGE_MASK (~(PAGE_SIZE - 1))
 
 #ifdef __aarch64__
+#define SYS_mkdirat 34
 #define SYS_unlinkat 35
 #define SYS_fchmod 52
+#define SYS_close 57
+#define SYS_exit 93
+#define SYS_futex 98
 #define SYS_fstat 80
 #define SYS_utimesat 88
 #define SYS_waitid 95
@@ -44,27 +48,35 @@
 #define SYS_kill 129
 #define SYS_rt_sigaction 134
 #define SYS_getpid 172
+#define SYS_gettid 178
 #define SYS_munmap 215
 #define SYS_clone 220
 #define SYS_mmap 222
+#define SYS_memfd_create 279
 #define SYS_clock_gettime 113
 #define SYS_io_uring_setup 425
 #define SYS_io_uring_enter 426
 #define SYS_io_uring_register 427
 #elif defined(__x86_64__)
+#define SYS_close 3
+#define SYS_exit 60
+#define SYS_futex 202
 #define SYS_fstat 5
 #define SYS_mmap 9
 #define SYS_munmap 11
 #define SYS_rt_sigaction 13
 #define SYS_nanosleep 35
 #define SYS_getpid 39
+#define SYS_gettid 186
 #define SYS_clone 56
 #define SYS_kill 62
 #define SYS_fchmod 91
 #define SYS_clock_gettime 228
 #define SYS_waitid 247
+#define SYS_mkdirat 258
 #define SYS_utimesat 261
 #define SYS_unlinkat 263
+#define SYS_memfd_create 319
 #define SYS_io_uring_setup 425
 #define SYS_io_uring_enter 426
 #define SYS_io_uring_register 427
@@ -156,6 +168,16 @@ CLEANUP:
 	RETURN;
 }
 
+i32 gettid(void) {
+	i32 v;
+INIT:
+	v = (i32)raw_syscall(SYS_gettid, 0, 0, 0, 0, 0, 0);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
+
 i32 kill(i32 pid, i32 signal) {
 	i32 v;
 INIT:
@@ -215,6 +237,87 @@ CLEANUP:
 	RETURN;
 }
 
+/*
+ * The child of a CLONE_VM clone starts on a fresh stack, so it cannot return
+ * through the caller's frame. This stub leaves fn and arg on the new stack,
+ * calls fn in the child and exits the thread when it returns.
+ */
+i64 __clone_thread(i64 flags, void *sp, i32 *tid, void (*fn)(void *),
+		   void *arg);
+#ifdef __aarch64__
+__asm__(
+    ".text\n"
+    ".global __clone_thread\n"
+    "__clone_thread:\n"
+    "    and x1, x1, #-16\n"
+    "    stp x3, x4, [x1, #-16]!\n"
+    "    mov x4, x2\n"
+    "    mov x3, xzr\n"
+    "    mov x8, #220\n"
+    "    svc #0\n"
+    "    cbnz x0, 1f\n"
+    "    ldp x3, x0, [sp], #16\n"
+    "    blr x3\n"
+    "    mov x0, xzr\n"
+    "    mov x8, #93\n"
+    "    svc #0\n"
+    "1:\n"
+    "    ret\n");
+#elif defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".global __clone_thread\n"
+    "__clone_thread:\n"
+    "    and $-16, %rsi\n"
+    "    sub $16, %rsi\n"
+    "    mov %rcx, (%rsi)\n"
+    "    mov %r8, 8(%rsi)\n"
+    "    mov %rdx, %r10\n"
+    "    xor %r8d, %r8d\n"
+    "    mov $56, %eax\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    jnz 1f\n"
+    "    pop %rax\n"
+    "    pop %rdi\n"
+    "    xor %ebp, %ebp\n"
+    "    call *%rax\n"
+    "    xor %edi, %edi\n"
+    "    mov $60, %eax\n"
+    "    syscall\n"
+    "1:\n"
+    "    ret\n");
+#endif /* __x86_64__ */
+
+i32 clone_thread(void (*fn)(void *), void *arg, void *stack_top, i32 *tid) {
+	i64 flags = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND |
+		    CLONE_THREAD | CLONE_SYSVSEM | CLONE_PARENT_SETTID |
+		    CLONE_CHILD_CLEARTID;
+	i32 v;
+INIT:
+
+#if TEST == 1
+	if (_debug_fail_clone) ERROR(EAGAIN);
+#endif
+
+	v = (i32)__clone_thread(flags, stack_top, tid, fn, arg);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
+
+i32 futex(u32 *uaddr, i32 op, u32 val, const struct timespec *timeout) {
+	i32 v;
+INIT:
+	v = (i32)raw_syscall(SYS_futex, (i64)uaddr, (i64)op, (i64)val,
+			     (i64)timeout, 0, 0);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
+
 i32 rt_sigaction(i32 signum, const struct rt_sigaction *act,
 		 struct rt_sigaction *oldact, u64 sigsetsize) {
 	i32 v;
@@ -260,6 +363,16 @@ CLEANUP:
 	RETURN;
 }
 
+i32 close_raw(i32 fd) {
+	i32 v;
+INIT:
+	v = (i32)raw_syscall(SYS_close, (i64)fd, 0, 0, 0, 0, 0);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
+
 i32 waitid(i32 idtype, i32 id, void *infop, i32 options) {
 	i32 v;
 INIT:
@@ -342,6 +455,17 @@ CLEANUP:
 	RETURN;
 }
 
+i32 mkdirat(i32 dfd, const char *path, u32 mode) {
+	i32 v;
+INIT:
+	v = (i32)raw_syscall(SYS_mkdirat, (i64)dfd, (i64)path, (i64)mode, 0, 0,
+			     0);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
+
 PUBLIC i32 fchmod(i32 fd, u32 mode) {
 	i32 v;
 INIT:
@@ -363,3 +487,14 @@ INIT:
 CLEANUP:
 	RETURN;
 }
+
+PUBLIC i32 memfd_create(const u8 *name, u32 flags) {
+	i32 v;
+INIT:
+	v = (i32)raw_syscall(SYS_memfd_create, (i64)name, (i64)flags, 0, 0, 0,
+			     0);
+	if (v < 0) ERROR(-v);
+	OK(v);
+CLEANUP:
+	RETURN;
+}
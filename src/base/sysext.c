@@ -29,12 +29,14 @@
 #include <libfam/iouring.h>
 #include <libfam/limits.h>
 #include <libfam/linux.h>
+#include <libfam/pool.h>
 #include <libfam/syscall.h>
 #include <libfam/sysext.h>
 #include <libfam/utils.h>
 
 u64 open_fds = 0;
 IoUring *__global_iou__ = NULL;
+extern ThreadPool *__global_pool__;
 
 i32 global_iou_init(void) {
 	if (__global_iou__) return 0;
@@ -149,7 +151,10 @@ PUBLIC i32 fork(void) {
 	if (_debug_fork_fail) return -1;
 #endif /* TEST */
 	i32 ret = clone(SIGCHLD, 0);
-	if (!ret) __global_iou__ = NULL;
+	if (!ret) {
+		__global_iou__ = NULL;
+		__global_pool__ = NULL;
+	}
 	return ret;
 }
 
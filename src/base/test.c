@@ -25,11 +25,13 @@
 
 #include <libfam/atomic.h>
 #include <libfam/builtin.h>
+#include <libfam/cpu.h>
 #include <libfam/debug.h>
 #include <libfam/env.h>
 #include <libfam/iouring.h>
 #include <libfam/limits.h>
 #include <libfam/linux.h>
+#include <libfam/pool.h>
 #include <libfam/rbtree.h>
 #include <libfam/string.h>
 #include <libfam/syscall.h>
@@ -687,6 +689,12 @@ Test(memmove) {
 	memcpy(out + 5, "bbbbbbbb", 8);
 	memmove(out + 5, out, 8);
 	ASSERT(!memcmp(out, "aaa", 3), "memmove cmp");
+	memcpy(out, "abcdefgh", 8);
+	memmove(out, out + 2, 6);
+	ASSERT(!memcmp(out, "cdefghgh", 8), "memmove down");
+	memcpy(out, "abcdefgh", 8);
+	memmove(out + 2, out, 6);
+	ASSERT(!memcmp(out, "ababcdef", 8), "memmove up");
 }
 
 void __stack_chk_fail(void);
@@ -904,6 +912,139 @@ Test(iouring_wait_err) {
 	iouring_destroy(iou);
 }
 
+Test(iouring_batch) {
+	u64 ids[4] = {0}, sum = 0;
+	i32 res[4] = {0}, fd;
+	u8 buf[2][8] = {"abcdefgh", "ijklmnop"}, verify[16] = {0};
+	IoUring *iou = NULL;
+	u32 count = 0;
+
+	unlink("/tmp/iouring_batch.dat");
+	fd = open("/tmp/iouring_batch.dat", O_RDWR | O_CREAT, 0600);
+	ASSERT(fd > 0, "fd>0");
+	ASSERT(!iouring_init(&iou, 4), "iouring_init");
+
+	ASSERT(!iouring_init_pwrite_flags(iou, fd, buf[1], 8, 8, 1, 0),
+	       "pwrite1");
+	ASSERT(!iouring_init_pwrite_flags(iou, fd, buf[0], 8, 0, 0, 0),
+	       "pwrite0");
+	ASSERT_EQ(iouring_submit_wait(iou, 2, 2), 2, "submit_wait");
+	while (count < 2) {
+		u32 n = iouring_reap(iou, ids + count, res + count, 4);
+		if (!n) iouring_submit_wait(iou, 0, 1);
+		count += n;
+	}
+	ASSERT_EQ(ids[0] + ids[1], 1, "ids");
+	ASSERT_EQ(res[0] + res[1], 16, "res");
+	ASSERT_EQ(iouring_reap(iou, ids, res, 4), 0, "empty");
+
+	ASSERT(!iouring_init_pread(iou, fd, verify, 16, 0, 7), "pread");
+	ASSERT(!iouring_init_pread(iou, -1, verify, 16, 0, 8), "bad fd");
+	ASSERT_EQ(iouring_submit_wait(iou, 2, 2), 2, "submit_wait2");
+	for (count = 0; count < 2;) {
+		u32 n = iouring_reap(iou, ids + count, res + count, 4);
+		if (!n) iouring_submit_wait(iou, 0, 1);
+		count += n;
+	}
+	for (u32 i = 0; i < 2; i++) sum += ids[i] == 7 ? res[i] : -res[i];
+	ASSERT_EQ(sum, 16 + EBADF, "pread res");
+	ASSERT(!memcmp(verify, "abcdefghijklmnop", 16), "verify");
+
+	iouring_destroy(iou);
+	close(fd);
+	unlink("/tmp/iouring_batch.dat");
+}
+
+static void pool_test_fn(u32 id, void *arg) {
+	u64 *counts = arg;
+	__aadd64(&counts[id], id + 1);
+	__aadd64(&counts[MAX_POOL_THREADS + 1], 1);
+}
+
+Test(pool) {
+	u64 counts[MAX_POOL_THREADS + 2] = {0};
+	ThreadPool *pool = NULL;
+
+	ASSERT_EQ(pool_init(&pool, MAX_POOL_THREADS + 1), -1, "too many");
+	ASSERT_EQ(errno, EINVAL, "einval");
+	_debug_fail_clone = true;
+	ASSERT_EQ(pool_init(&pool, 2), -1, "clone fail");
+	_debug_fail_clone = false;
+
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+	ASSERT_EQ(pool_threads(pool), 3, "threads");
+	ASSERT_EQ(pool_run(pool, pool_test_fn, counts, 5), -1, "n too big");
+	ASSERT_EQ(pool_run(pool, NULL, counts, 1), -1, "null fn");
+	for (u32 i = 0; i < 100; i++)
+		ASSERT(!pool_run(pool, pool_test_fn, counts, 1 + i % 4),
+		       "pool_run");
+	ASSERT_EQ(counts[MAX_POOL_THREADS + 1], 250, "calls");
+	ASSERT_EQ(counts[0], 100, "id 0");
+	ASSERT_EQ(counts[1], 2 * 75, "id 1");
+	ASSERT_EQ(counts[2], 3 * 50, "id 2");
+	ASSERT_EQ(counts[3], 4 * 25, "id 3");
+	pool_destroy(pool);
+
+	ASSERT(global_pool(), "global_pool");
+	ASSERT_EQ(global_pool(), global_pool(), "same pool");
+}
+
+static void pool_errno_fn(u32 id, void *arg) {
+	u32 *state = arg;
+	errno = 100 + id;
+	/* every thread sets errno before any of them reads it back */
+	__aadd32(&state[0], 1);
+	while (__aload32(&state[0]) < 4);
+	state[1 + id] = errno;
+}
+
+Test(pool_errno) {
+	u32 state[5] = {0};
+	ThreadPool *pool = NULL;
+
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+	ASSERT(!pool_errno(), "caller is not a worker");
+	ASSERT(!pool_run(pool, pool_errno_fn, state, 4), "pool_run");
+	for (u32 i = 0; i < 4; i++)
+		ASSERT_EQ(state[1 + i], 100 + i, "own errno");
+	ASSERT_EQ(errno, 103, "caller errno");
+	errno = SUCCESS;
+	pool_destroy(pool);
+}
+
+static void pool_nested_fn(u32 id, void *arg) {
+	void **state = arg;
+	i32 *res = state[1];
+	res[2 * id] = pool_run(state[0], pool_test_fn, state[2], 1);
+	res[2 * id + 1] = errno;
+}
+
+Test(pool_nested) {
+	u64 counts[MAX_POOL_THREADS + 2] = {0};
+	i32 res[6] = {0};
+	ThreadPool *pool = NULL, *other = NULL;
+	void *state[3];
+
+	ASSERT(!pool_init(&pool, 2), "pool_init");
+	ASSERT(!pool_init(&other, 1), "pool_init other");
+	state[0] = pool;
+	state[1] = res;
+	state[2] = counts;
+	ASSERT(!pool_run(pool, pool_nested_fn, state, 3), "pool_run");
+	for (u32 i = 0; i < 3; i++) {
+		ASSERT_EQ(res[2 * i], -1, "nested");
+		ASSERT_EQ(res[2 * i + 1], EDEADLK, "edeadlk");
+	}
+	/* another pool is free to run */
+	state[0] = other;
+	ASSERT(!pool_run(pool, pool_nested_fn, state, 3), "pool_run other");
+	for (u32 i = 0; i < 3; i++) ASSERT_EQ(res[2 * i], 0, "other pool");
+	ASSERT_EQ(counts[MAX_POOL_THREADS + 1], 3, "calls");
+	errno = SUCCESS;
+	pool_destroy(other);
+	pool_destroy(pool);
+}
+
 Test(settime) {
 	struct timespec ts = {0};
 	ASSERT_EQ(clock_gettime(CLOCK_REALTIME, &ts), 0, "gettime");
@@ -1118,3 +1259,14 @@ Test(iouring2) {
 	unlink(path);
 	iouring_destroy(iou);
 }
+
+Test(cpu_features) {
+	u32 features = cpu_features();
+	ASSERT_EQ(features, cpu_features(), "stable");
+	if (features & CPU_VAES)
+		ASSERT_EQ(features & (CPU_AVX2 | CPU_AES), CPU_AVX2 | CPU_AES,
+			  "vaes implies avx2 and aes");
+#ifndef __x86_64__
+	ASSERT_EQ(features, 0, "no x86 features");
+#endif /* __x86_64__ */
+}
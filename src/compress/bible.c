@@ -23,16 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
 #include <libfam/bible.h>
 #include <libfam/compress.h>
 #include <libfam/storm.h>
@@ -198,11 +188,7 @@ PUBLIC void bible_hash(const Bible *b, const u8 input[HASH_INPUT_LEN],
 		const u8 *quarter_data = input + quarter * 32;
 		const u8 *in = (const u8 *)d;
 
-#ifdef USE_AVX2
-		*(__m256i *)d = _mm256_load_si256((const __m256i *)r);
-#else
 		fastmemcpy(d, (void *)r, 32);
-#endif /* !USE_AVX2 */
 
 		d[0] ^= ((u64 *)quarter_data)[0];
 		d[1] ^= ((u64 *)quarter_data)[1];
@@ -222,11 +208,7 @@ PUBLIC void bible_hash(const Bible *b, const u8 input[HASH_INPUT_LEN],
 		    (u64)b->data +
 		    (((s[0] ^ s[1] ^ s[2] ^ s[3]) & BIBLE_EXTENDED_MASK) << 5);
 		const u8 *in = (const u8 *)d;
-#ifdef USE_AVX2
-		*(__m256i *)d = _mm256_load_si256((const __m256i *)r);
-#else
 		fastmemcpy(d, (void *)r, 32);
-#endif /* !USE_AVX2 */
 
 		for (i32 lane = 0; lane < 4; lane++) {
 			u8 idx = in[lane] ^ in[lane + 4] ^ in[lane + 8] ^
@@ -237,11 +219,7 @@ PUBLIC void bible_hash(const Bible *b, const u8 input[HASH_INPUT_LEN],
 		}
 	}
 
-#ifdef USE_AVX2
-	_mm256_store_si256((__m256i *)out, *((__m256i *)s));
-#else
 	fastmemcpy(out, s, 32);
-#endif /* !USE_AVX2 */
 }
 
 i32 mine_block(const Bible *bible, const u8 header[HASH_INPUT_LEN],
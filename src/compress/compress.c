@@ -23,16 +23,20 @@
  *
  *******************************************************************************/
 
+#include <libfam/atomic.h>
 #include <libfam/builtin.h>
 #include <libfam/compress.h>
+#include <libfam/compress_impl.h>
 #include <libfam/debug.h>
 #include <libfam/format.h>
 #include <libfam/limits.h>
+#include <libfam/syscall.h>
+#include <libfam/sysext.h>
 #include <libfam/utils.h>
 
-#ifdef __AVX2__
+#ifdef __SSSE3__
 #include <immintrin.h>
-#endif /* __AVX2__ */
+#endif /* __SSSE3__ */
 
 #define MAX_MATCH_LEN 256
 #define MIN_MATCH_LEN 4
@@ -49,6 +53,35 @@
 #define REPEAT_VALUE_INDEX (MAX_CODE_LENGTH + 1)
 #define REPEAT_ZERO_LONG_INDEX (MAX_CODE_LENGTH + 2)
 #define REPEAT_ZERO_SHORT_INDEX (MAX_CODE_LENGTH + 3)
+#define MAX_MATCH_DIST 0xFFFF
+#define CHAIN_HASH_BITS 16
+#define CHAIN_WINDOW (1 << 16)
+#define CHAIN_MASK (CHAIN_WINDOW - 1)
+#define TOO_FAR 4096
+#define HASH_TABLE_SIZE (1 << 16)
+#define CTX_RESET_LIMIT (1 << 14)
+#define REUSE_MAX_LEN (1 << 16)
+#define STREAM_COUNT 4
+#define STREAM_JUMP_LEN (STREAM_COUNT * sizeof(u32))
+#define STREAMS_MIN_SYMBOLS 1024
+#define WINDOW_PAD (32 + MAX_MATCH_LEN)
+#define WINDOW_LEN (MAX_DICT_LEN + MAX_COMPRESS_LEN + WINDOW_PAD)
+#define CTX_ALLOC_LEN (sizeof(CompressCtx) + WINDOW_LEN)
+#define DICT_MAGIC 0xCD1C7001U
+#define DICT_HEADER_LEN (sizeof(u32) + SYMBOL_COUNT)
+#define DICT_TABLE_SYMBOLS 4096
+#define DICT_DGRAM 8
+#define DICT_SEGMENT_LEN 64
+#define DICT_HASH_BITS 20
+#define DICT_HASH_CONSTANT 0x9E3779B97F4A7C15ULL
+#define SAMPLE_MIN_LEN (1 << 14)
+#define SAMPLE_WINDOWS 8
+#define SAMPLE_WINDOW_LEN 512
+#define SAMPLE_HASH_BITS 10
+#define SAMPLE_MATCH_SHARE 64
+#define SAMPLE_RAW_BITS (256 * 79 / 10)
+#define SAMPLE_STORE_BITS (256 * 76 / 10)
+#define STORE_RUN 4
 
 typedef struct {
 	u16 code;
@@ -71,8 +104,85 @@ typedef struct {
 	u8 length;
 } HuffmanLookup;
 
-#define SET_HASH(table, in, i) \
-	table[((*(u32 *)((in) + (i))) * HASH_CONSTANT) >> 16] = i;
+/* a block compress_block_begin matched for compress_block_end to code */
+typedef struct {
+	const u8 *in;
+	u8 *out;
+	u32 frequencies[SYMBOL_COUNT];
+	u32 len;
+	u32 bit_offset;
+	u32 symbols;
+	i32 res;
+} PendingBlock;
+
+struct CompressCtx {
+	u16 match_array[MAX_COMPRESS_LEN + 2];
+	u16 table[HASH_TABLE_SIZE];
+	u32 head[1 << CHAIN_HASH_BITS];
+	u16 prev[CHAIN_WINDOW];
+	CodeLength reuse_lengths[SYMBOL_COUNT];
+	u32 table_bits;
+	u8 reuse_age;
+	u8 raw_run;
+	u64 dict_id;
+	PendingBlock pending;
+	/* dictionary content followed by the block, only in mapped contexts */
+	u8 *window;
+};
+
+struct DecompressCtx {
+	HuffmanLookup book_lookup_table[1U << MAX_BOOK_CODE_LENGTH];
+	HuffmanLookup lookup_table[1U << MAX_CODE_LENGTH];
+	u16 symbols[MAX_COMPRESS_LEN];
+	bool has_table;
+};
+
+struct CompressDict {
+	u64 id;
+	u32 len;
+	CodeLength code_lengths[SYMBOL_COUNT];
+	HuffmanLookup lookup_table[1U << MAX_CODE_LENGTH];
+	u16 table[HASH_TABLE_SIZE];
+	u8 data[MAX_DICT_LEN];
+};
+
+STATIC_ASSERT(MAX_DICT_SIZE == MAX_DICT_LEN + DICT_HEADER_LEN, dict_size);
+STATIC_ASSERT(SYMBOL_COUNT == BLOCK_TABLE_SYMBOLS, table_symbols);
+/* a table starting mid-byte, and the u64 loads that read it */
+STATIC_ASSERT(sizeof(u32) + 1 +
+			  (MAX_BOOK_CODES * 3 +
+			   SYMBOL_COUNT * MAX_BOOK_CODE_LENGTH + 7) /
+			      8 +
+			  sizeof(u64) <=
+		      BLOCK_TABLE_MAX,
+	      table_max);
+
+static u64 compress_dict_next_id = 0;
+
+typedef struct {
+	u16 max_chain;
+	u16 nice_len;
+	u8 lazy;
+} CompressLevel;
+
+/* Level 1 is the single-probe greedy matcher (find_matches). Higher levels
+ * walk bounded hash chains and defer matches when the next one or two
+ * positions produce a longer match. */
+static const CompressLevel compress_levels[COMPRESS_LEVEL_MAX + 1] = {
+    {0, 0, 0},	   {0, 0, 0},	  {4, 16, 0},	 {8, 32, 1},   {16, 64, 1},
+    {32, 96, 1},   {64, 128, 1},  {128, 256, 2}, {512, 256, 2}, {4096, 256, 2}};
+
+#define HASH(in, i) (((*(u32 *)((in) + (i))) * HASH_CONSTANT) >> 16)
+
+#define MATCH_END(len) ((len) >= WINDOW_PAD ? (len) - WINDOW_PAD : 0)
+
+#define DGRAM_HASH(p) \
+	((*(u64 *)(p) * DICT_HASH_CONSTANT) >> (64 - DICT_HASH_BITS))
+
+#define SET_HASH(table, in, i) table[HASH(in, i)] = i;
+
+#define CHAIN_HASH(in, i) \
+	(((*(u32 *)((in) + (i))) * HASH_CONSTANT) >> (32 - CHAIN_HASH_BITS))
 
 #define MATCH_CODE(len, dist) \
 	(((31 - clz_u32((len) - 3)) << LEN_SHIFT) | (31 - clz_u32(dist)))
@@ -109,6 +219,23 @@ typedef struct {
 		buffer = bits_in_buffer = 0;                                  \
 	} while (0);
 
+#define EMIT_MATCH(buffer, bits_in_buffer, out_bit_offset, data,              \
+		   frequencies, match_array, maitt, mlen, mdist)              \
+	do {                                                                  \
+		u8 _mc__ = MATCH_CODE(mlen, mdist);                           \
+		u8 _extra__ = LEN_EXTRA_BITS(_mc__) + DIST_EXTRA_BITS(_mc__); \
+		u64 _value__ = ((u32)DIST_EXTRA_BITS_VALUE(_mc__, mdist)      \
+				<< LEN_EXTRA_BITS(_mc__)) |                   \
+			       LEN_EXTRA_BITS_VALUE(_mc__, mlen);             \
+		if (__builtin_expect(bits_in_buffer + _extra__ > 64, 0))      \
+			FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset,  \
+				     data);                                   \
+		buffer |= _value__ << bits_in_buffer;                         \
+		bits_in_buffer += _extra__;                                   \
+		frequencies[(u16)_mc__ + MATCH_OFFSET]++;                     \
+		match_array[maitt++] = (u16)_mc__ + MATCH_OFFSET;             \
+	} while (0);
+
 #define WRITE(buffer, bits_in_buffer, out_bit_offset, data, value, len)      \
 	do {                                                                 \
 		if ((bits_in_buffer) + (len) > 64)                           \
@@ -160,6 +287,137 @@ typedef struct {
 		bits_in_buffer -= (num_bits);            \
 	} while (0);
 
+#ifdef __SSSE3__
+#define COPY_MATCH(dst, src, mlen)                                           \
+	do {                                                                 \
+		u8 *_dst__ = (dst);                                          \
+		const u8 *_src__ = (src);                                    \
+		u32 _len__ = (mlen);                                         \
+		if (__builtin_expect(_src__ + 16 <= _dst__, 1)) {            \
+			u64 _chunks__ = (_len__ + 15) >> 4;                  \
+			while (_chunks__--) {                                \
+				__m128i _vec__ =                             \
+				    _mm_loadu_si128((__m128i *)_src__);      \
+				_mm_storeu_si128((__m128i *)_dst__, _vec__); \
+				_src__ += 16;                                \
+				_dst__ += 16;                                \
+			}                                                    \
+		} else if (__builtin_expect(_src__ + 8 <= _dst__, 1)) {      \
+			u64 _chunks__ = (_len__ + 7) >> 3;                   \
+			while (_chunks__--) {                                \
+				_mm_storel_epi64(                            \
+				    (__m128i *)_dst__,                       \
+				    _mm_loadl_epi64((__m128i *)_src__));     \
+				_src__ += 8;                                 \
+				_dst__ += 8;                                 \
+			}                                                    \
+		} else {                                                     \
+			u32 _dist__ = _dst__ - _src__;                       \
+			u8 *_end__ = _dst__ + _len__;                        \
+			__m128i _vec__ = _mm_shuffle_epi8(                   \
+			    _mm_loadl_epi64((__m128i *)_src__),              \
+			    _mm_load_si128(                                  \
+				(__m128i *)match_patterns[_dist__]));        \
+			while (_dst__ < _end__) {                            \
+				_mm_storeu_si128((__m128i *)_dst__, _vec__); \
+				_dst__ += match_steps[_dist__];              \
+			}                                                    \
+		}                                                            \
+	} while (0);
+#else
+#define COPY_MATCH(dst, src, mlen)                                    \
+	do {                                                          \
+		u8 *_dst__ = (dst);                                   \
+		const u8 *_src__ = (src);                             \
+		u8 *_end__ = _dst__ + (mlen);                         \
+		u64 _word__;                                          \
+		if (__builtin_expect(_src__ + 8 <= _dst__, 1)) {      \
+			while (_dst__ < _end__) {                     \
+				fastmemcpy(&_word__, _src__, 8);      \
+				fastmemcpy(_dst__, &_word__, 8);      \
+				_src__ += 8;                          \
+				_dst__ += 8;                          \
+			}                                             \
+		} else {                                              \
+			u32 _dist__ = _dst__ - _src__;                \
+			for (u32 _k__ = 0; _k__ < 8; _k__++)          \
+				_dst__[_k__] = _src__[_k__];          \
+			fastmemcpy(&_word__, _dst__, 8);              \
+			_dst__ += match_steps[_dist__];               \
+			while (_dst__ < _end__) {                     \
+				fastmemcpy(_dst__, &_word__, 8);      \
+				_dst__ += match_steps[_dist__];       \
+			}                                             \
+		}                                                     \
+	} while (0);
+#endif /* !__SSSE3__ */
+
+#define DECODE_MATCH(symbol, extra_bits_buffer, extra_bits_bits_in_buffer,     \
+		     extra_bits_offset, in, len, out, itt, capacity,           \
+		     history, history_len)                                     \
+	do {                                                                   \
+		u8 _mc__ = (symbol) - MATCH_OFFSET;                            \
+		u8 _deb__ = DIST_EXTRA_BITS(_mc__);                            \
+		u8 _leb__ = LEN_EXTRA_BITS(_mc__);                             \
+		u32 _dist__ = DIST_BASE(_mc__);                                \
+		u16 _mlen__ = LEN_BASE(_mc__) + 4;                             \
+		if (__builtin_expect(extra_bits_bits_in_buffer < 22, 0))       \
+			TRY_LOAD(extra_bits_buffer, extra_bits_bits_in_buffer, \
+				 extra_bits_offset, in, len);                  \
+		_mlen__ += PEEK_READER(extra_bits_buffer, _leb__);             \
+		ADVANCE_READER(extra_bits_buffer, extra_bits_bits_in_buffer,   \
+			       _leb__);                                        \
+		_dist__ += PEEK_READER(extra_bits_buffer, _deb__);             \
+		ADVANCE_READER(extra_bits_buffer, extra_bits_bits_in_buffer,   \
+			       _deb__);                                        \
+		if (__builtin_expect(                                          \
+			_mlen__ + 32 + itt > capacity || _dist__ > itt, 0)) {  \
+			if (_mlen__ + itt > capacity ||                        \
+			    _dist__ > itt + history_len) {                     \
+				errno = EOVERFLOW;                             \
+				return -1;                                     \
+			}                                                      \
+			const u8 *_hist__ = (history) + (history_len);         \
+			for (u32 _k__ = 0; _k__ < _mlen__; _k__++, itt++) {    \
+				i32 _src__ = (i32)itt - (i32)_dist__;          \
+				out[itt] = _src__ < 0 ? _hist__[_src__]        \
+						      : out[_src__];           \
+			}                                                      \
+		} else {                                                       \
+			COPY_MATCH(out + itt, out + itt - _dist__, _mlen__);   \
+			itt += _mlen__;                                        \
+		}                                                              \
+	} while (0);
+
+#define DECODE_SYMBOL(buffer, bits_in_buffer, lookup_table, dst)         \
+	do {                                                             \
+		HuffmanLookup _entry__ =                                 \
+		    lookup_table[PEEK_READER(buffer, MAX_CODE_LENGTH)];  \
+		dst = _entry__.symbol;                                   \
+		ADVANCE_READER(buffer, bits_in_buffer, _entry__.length); \
+	} while (0);
+
+/*
+ * Matches closer than 8 bytes overlap their own output. The first dist bytes
+ * of the match are repeated across a vector, which is then stored every
+ * match_steps[dist] bytes, the largest multiple of dist that fits.
+ */
+#ifdef __SSSE3__
+static const u8 match_patterns[8][16] __attribute__((aligned(16))) = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1},
+    {0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0},
+    {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+    {0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0},
+    {0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3},
+    {0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1}};
+
+static const u8 match_steps[8] = {0, 16, 16, 15, 16, 15, 12, 14};
+#else
+static const u8 match_steps[8] = {0, 8, 8, 6, 8, 5, 6, 7};
+#endif /* !__SSSE3__ */
+
 static const u8 bitstream_partial_masks[8][9] = {
     {255, 254, 252, 248, 240, 224, 192, 128, 0},
     {255, 253, 249, 241, 225, 193, 129, 1, 1},
@@ -194,15 +452,19 @@ static const u64 bitstream_masks[65] = {
     0x0FFFFFFFFFFFFFFFULL, 0x1FFFFFFFFFFFFFFFULL, 0x3FFFFFFFFFFFFFFFULL,
     0x7FFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL};
 
-STATIC u32 find_matches(const u8 *in, u32 len,
+/*
+ * Level 1 matcher over in[start, end). Positions before start (a dictionary)
+ * are only used as match sources; table must already hold their hashes.
+ * Matching stops at max, which may only exceed MATCH_END(end) when the
+ * buffer has WINDOW_PAD readable bytes after end.
+ */
+STATIC u32 find_matches(const u8 *in, u32 start, u32 max, u32 end,
 			u16 match_array[MAX_COMPRESS_LEN + 2],
-			u32 frequencies[SYMBOL_COUNT], u8 *out) {
-	u32 i = 0, max, maitt = 0, out_bit_offset = 0;
+			u32 frequencies[SYMBOL_COUNT], u8 *out,
+			u16 table[HASH_TABLE_SIZE]) {
+	u32 i = start, maitt = 0, out_bit_offset = 0;
 	u64 buffer = 0, bits_in_buffer = 0;
 	u8 *data = out + sizeof(u32);
-	u16 table[1 << 16] = {0};
-
-	max = len >= 32 + MAX_MATCH_LEN ? len - (32 + MAX_MATCH_LEN) : 0;
 
 	while (i < max) {
 		u32 key = *(u32 *)(in + i);
@@ -212,43 +474,29 @@ STATIC u32 find_matches(const u8 *in, u32 len,
 		u16 len = 0;
 		u32 mpos = i - dist;
 		if (dist) {
-#ifdef __AVX2__
+#ifdef __SSSE3__
 			u32 mask;
 			do {
-				__m256i vec1 = _mm256_loadu_si256(
-				    (__m256i *)(in + mpos + len));
-				__m256i vec2 = _mm256_loadu_si256(
-				    (__m256i *)(in + i + len));
-				__m256i cmp = _mm256_cmpeq_epi8(vec1, vec2);
-				mask = _mm256_movemask_epi8(cmp);
-
-				len += (mask != 0xFFFFFFFF) * ctz_u32(~mask) +
-				       (mask == 0xFFFFFFFF) * 32;
-			} while (mask == 0xFFFFFFFF && len < MAX_MATCH_LEN);
+				__m128i vec1 = _mm_loadu_si128(
+				    (__m128i *)(in + mpos + len));
+				__m128i vec2 = _mm_loadu_si128(
+				    (__m128i *)(in + i + len));
+				__m128i cmp = _mm_cmpeq_epi8(vec1, vec2);
+				mask = _mm_movemask_epi8(cmp);
+
+				len += (mask != 0xFFFF) * ctz_u32(~mask) +
+				       (mask == 0xFFFF) * 16;
+			} while (mask == 0xFFFF && len < MAX_MATCH_LEN);
 #else
 			while (len < MAX_MATCH_LEN &&
 			       in[i + len] == in[mpos + len])
 				len++;
-#endif /* !__AVX2__ */
+#endif /* !__SSSE3__ */
+			if (len > end - i) len = end - i;
 		}
 		if (len >= MIN_MATCH_LEN) {
-			u8 mc = MATCH_CODE(len, dist);
-			u8 extra_sum = LEN_EXTRA_BITS(mc) + DIST_EXTRA_BITS(mc);
-			u64 combined_extra =
-			    ((u32)DIST_EXTRA_BITS_VALUE(mc, dist)
-			     << LEN_EXTRA_BITS(mc)) |
-			    LEN_EXTRA_BITS_VALUE(mc, len);
-			if (__builtin_expect(bits_in_buffer + extra_sum > 64,
-					     0))
-				FLUSH_STREAM(buffer, bits_in_buffer,
-					     out_bit_offset, data);
-
-			buffer |= combined_extra << bits_in_buffer;
-			bits_in_buffer += extra_sum;
-
-			u16 match_symbol = (u16)mc + MATCH_OFFSET;
-			frequencies[match_symbol]++;
-			match_array[maitt++] = match_symbol;
+			EMIT_MATCH(buffer, bits_in_buffer, out_bit_offset, data,
+				   frequencies, match_array, maitt, len, dist);
 			SET_HASH(table, in, i + 1);
 			SET_HASH(table, in, i + 2);
 			SET_HASH(table, in, i + 3);
@@ -258,6 +506,141 @@ STATIC u32 find_matches(const u8 *in, u32 len,
 			match_array[maitt++] = in[i++];
 		}
 	}
+	while (i < end) {
+		frequencies[in[i]]++;
+		match_array[maitt++] = in[i++];
+	}
+
+	FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset, data);
+	fastmemcpy(out, &out_bit_offset, sizeof(u32));
+
+	match_array[maitt] = SYMBOL_TERM;
+	frequencies[SYMBOL_TERM]++;
+	return out_bit_offset;
+}
+
+STATIC u32 compress_match_len(const u8 *a, const u8 *b) {
+	u32 len = 0;
+#ifdef __SSSE3__
+	u32 mask;
+	do {
+		__m128i vec1 = _mm_loadu_si128((__m128i *)(a + len));
+		__m128i vec2 = _mm_loadu_si128((__m128i *)(b + len));
+		__m128i cmp = _mm_cmpeq_epi8(vec1, vec2);
+		mask = _mm_movemask_epi8(cmp);
+
+		len += (mask != 0xFFFF) * ctz_u32(~mask) +
+		       (mask == 0xFFFF) * 16;
+	} while (mask == 0xFFFF && len < MAX_MATCH_LEN);
+#else
+	while (len < MAX_MATCH_LEN && a[len] == b[len]) len++;
+#endif /* !__SSSE3__ */
+	return len;
+}
+
+STATIC void compress_chain_insert(const u8 *in, u32 pos, u32 *head,
+				  u16 *prev) {
+	u32 entry = CHAIN_HASH(in, pos);
+	u32 last = head[entry];
+	prev[pos & CHAIN_MASK] =
+	    last && pos - (last - 1) <= MAX_MATCH_DIST ? pos - (last - 1) : 0;
+	head[entry] = pos + 1;
+}
+
+STATIC u32 compress_chain_longest(const u8 *in, u32 pos, const u32 *head,
+				  const u16 *prev, const CompressLevel *level,
+				  u32 *dist) {
+	u32 best = 0, chain = level->max_chain;
+	u32 next = head[CHAIN_HASH(in, pos)];
+
+	while (next && chain--) {
+		u32 cand = next - 1;
+		u32 d = pos - cand;
+		if (d > MAX_MATCH_DIST) break;
+		if (in[cand + best] == in[pos + best]) {
+			u32 l = compress_match_len(in + cand, in + pos);
+			if (l > best) {
+				best = l;
+				*dist = d;
+				if (l >= level->nice_len) break;
+			}
+		}
+		u16 step = prev[cand & CHAIN_MASK];
+		if (!step) break;
+		next -= step;
+	}
+
+	if (best == MIN_MATCH_LEN && *dist > TOO_FAR) best = 0;
+	return best;
+}
+
+STATIC u32 find_matches_chain(const u8 *in, u32 len,
+			      u16 match_array[MAX_COMPRESS_LEN + 2],
+			      u32 frequencies[SYMBOL_COUNT], u8 *out,
+			      const CompressLevel *level,
+			      u32 head[1 << CHAIN_HASH_BITS],
+			      u16 prev[CHAIN_WINDOW]) {
+	u32 i = 0, max, maitt = 0, out_bit_offset = 0, inserted = 0;
+	u32 mlen = 0, mdist = 0, nlen, ndist = 0;
+	u64 buffer = 0, bits_in_buffer = 0;
+	u8 *data = out + sizeof(u32);
+	bool have_match = false;
+
+	max = MATCH_END(len);
+
+	while (i < max) {
+		if (!have_match) {
+			while (inserted < i)
+				compress_chain_insert(in, inserted++, head,
+						      prev);
+			mlen = compress_chain_longest(in, i, head, prev, level,
+						      &mdist);
+		}
+		have_match = false;
+
+		if (mlen >= MIN_MATCH_LEN && level->lazy &&
+		    mlen < level->nice_len) {
+			while (inserted <= i)
+				compress_chain_insert(in, inserted++, head,
+						      prev);
+			nlen = compress_chain_longest(in, i + 1, head, prev,
+						      level, &ndist);
+			if (nlen > mlen) {
+				frequencies[in[i]]++;
+				match_array[maitt++] = in[i++];
+				mlen = nlen;
+				mdist = ndist;
+				have_match = true;
+				continue;
+			}
+			if (level->lazy > 1 && i + 1 < max) {
+				compress_chain_insert(in, inserted++, head,
+						      prev);
+				nlen = compress_chain_longest(
+				    in, i + 2, head, prev, level, &ndist);
+				if (nlen > mlen + 1) {
+					frequencies[in[i]]++;
+					match_array[maitt++] = in[i++];
+					frequencies[in[i]]++;
+					match_array[maitt++] = in[i++];
+					mlen = nlen;
+					mdist = ndist;
+					have_match = true;
+					continue;
+				}
+			}
+		}
+
+		if (mlen >= MIN_MATCH_LEN) {
+			EMIT_MATCH(buffer, bits_in_buffer, out_bit_offset, data,
+				   frequencies, match_array, maitt, mlen,
+				   mdist);
+			i += mlen;
+		} else {
+			frequencies[in[i]]++;
+			match_array[maitt++] = in[i++];
+		}
+	}
 	while (i < len) {
 		frequencies[in[i]]++;
 		match_array[maitt++] = in[i++];
@@ -518,10 +901,55 @@ STATIC void compress_build_code_book(
 	compress_calculate_codes(book, MAX_BOOK_CODES);
 }
 
-STATIC i32 compress_write(const CodeLength code_lengths[SYMBOL_COUNT],
-			  const CodeLength book[MAX_BOOK_CODES],
-			  const u16 match_array[MAX_COMPRESS_LEN + 2], u8 *out,
-			  u32 out_bit_offset) {
+STATIC void compress_set_flags(u8 *out, u32 flags) {
+	u32 hdr;
+	fastmemcpy(&hdr, out, sizeof(u32));
+	hdr |= flags;
+	fastmemcpy(out, &hdr, sizeof(u32));
+}
+
+/*
+ * Splits the symbols into STREAM_COUNT byte-aligned substreams that the
+ * decoder walks in lockstep. A jump table after the code lengths holds the
+ * symbol count followed by the byte offsets of substreams 1 and up.
+ */
+STATIC i32 compress_write_streams(const CodeLength code_lengths[SYMBOL_COUNT],
+				  const u16 match_array[MAX_COMPRESS_LEN + 2],
+				  u8 *out, u32 out_bit_offset, u32 symbols) {
+	u32 i, s, jump, pad, per = symbols / STREAM_COUNT;
+	u32 starts[STREAM_COUNT];
+	u64 buffer = 0, bits_in_buffer = 0;
+	u8 *data = out + sizeof(u32);
+
+	jump = out_bit_offset >> 3;
+	out_bit_offset += STREAM_JUMP_LEN << 3;
+	for (s = 0; s < STREAM_COUNT; s++) {
+		u32 end = s == STREAM_COUNT - 1 ? symbols : (s + 1) * per;
+		starts[s] = sizeof(u32) + (out_bit_offset >> 3);
+		for (i = s * per; i < end; i++) {
+			u16 symbol = match_array[i];
+			WRITE(buffer, bits_in_buffer, out_bit_offset, data,
+			      code_lengths[symbol].code,
+			      code_lengths[symbol].length);
+		}
+		pad = (8 - ((out_bit_offset + bits_in_buffer) & 7)) & 7;
+		WRITE(buffer, bits_in_buffer, out_bit_offset, data, 0, pad);
+		FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset, data);
+	}
+	WRITE(buffer, bits_in_buffer, out_bit_offset, data, 0, 64);
+	WRITE(buffer, bits_in_buffer, out_bit_offset, data, 0, 64);
+	FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset, data);
+
+	starts[0] = symbols;
+	fastmemcpy(data + jump, starts, sizeof(starts));
+	compress_set_flags(out, BLOCK_STREAMS_FLAG);
+
+	return (out_bit_offset + 7) / 8;
+}
+
+STATIC u32 compress_write_table(const CodeLength code_lengths[SYMBOL_COUNT],
+				const CodeLength book[MAX_BOOK_CODES], u8 *out,
+				u32 out_bit_offset) {
 	u32 i;
 	u64 buffer = 0, bits_in_buffer = 0;
 	u8 last_length = 0;
@@ -588,6 +1016,35 @@ STATIC i32 compress_write(const CodeLength code_lengths[SYMBOL_COUNT],
 		}
 	}
 
+	FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset, data);
+	return out_bit_offset;
+}
+
+/*
+ * Without a book the table is not sent; flags tell the decoder where to find
+ * it.
+ */
+STATIC i32 compress_write(const CodeLength code_lengths[SYMBOL_COUNT],
+			  const CodeLength book[MAX_BOOK_CODES], u32 flags,
+			  const u16 match_array[MAX_COMPRESS_LEN + 2], u8 *out,
+			  u32 out_bit_offset, u32 symbols) {
+	u32 i;
+	u64 buffer = 0, bits_in_buffer = 0;
+	u8 *data = out + sizeof(u32);
+
+	if (book)
+		out_bit_offset = compress_write_table(code_lengths, book, out,
+						      out_bit_offset);
+	compress_set_flags(out, flags);
+
+	if (symbols >= STREAMS_MIN_SYMBOLS) {
+		u32 pad = (8 - ((out_bit_offset + bits_in_buffer) & 7)) & 7;
+		WRITE(buffer, bits_in_buffer, out_bit_offset, data, 0, pad);
+		FLUSH_STREAM(buffer, bits_in_buffer, out_bit_offset, data);
+		return compress_write_streams(code_lengths, match_array, out,
+					      out_bit_offset, symbols);
+	}
+
 	i = 0;
 	while (match_array[i] != SYMBOL_TERM) {
 		u16 symbol = match_array[i++];
@@ -609,6 +1066,17 @@ STATIC void compress_build_lookup_table(const CodeLength *code_lengths,
 					u16 count, HuffmanLookup *lookup_table,
 					u8 max_length) {
 	i32 i, j;
+	u32 filled = 0;
+
+	/* A complete code overwrites every entry, so stale entries from an
+	 * earlier block only need clearing when the code leaves holes. */
+	for (i = 0; i < count; i++)
+		if (code_lengths[i].length)
+			filled += 1U << (max_length - code_lengths[i].length);
+	if (filled != 1U << max_length)
+		fastmemset(lookup_table, 0,
+			   sizeof(HuffmanLookup) << max_length);
+
 	for (i = 0; i < count; i++) {
 		if (code_lengths[i].length) {
 			i32 index = code_lengths[i].code &
@@ -627,24 +1095,111 @@ STATIC void compress_build_lookup_table(const CodeLength *code_lengths,
 	}
 }
 
-STATIC i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
-	CodeLength code_lengths[SYMBOL_COUNT] = {0};
-	u32 i;
-	u32 in_bit_offset;
-	u64 buffer = 0;
-	u32 bits_in_buffer = 0;
-	CodeLength book_code_lengths[MAX_BOOK_CODES] = {0};
-	u16 last_length = 0;
-	HuffmanLookup book_lookup_table[(1U << MAX_BOOK_CODE_LENGTH)] = {0};
+/*
+ * Decodes a block written by compress_write_streams. The substreams are
+ * decoded into ctx->symbols in lockstep so that their table lookups overlap,
+ * then the symbols are replayed against the extra bits stream.
+ */
+STATIC i32 compress_read_streams(DecompressCtx *ctx,
+				 const HuffmanLookup *lookup_table,
+				 const u8 *history, u32 history_len,
+				 const u8 *in, u32 len, u8 *out, u32 capacity,
+				 u32 jump) {
+	u32 i, j, n, per, starts[STREAM_COUNT], itt = 0;
+	u64 b0 = 0, b1 = 0, b2 = 0, b3 = 0;
+	u32 c0 = 0, c1 = 0, c2 = 0, c3 = 0, o0, o1, o2, o3;
+	u32 extra_bits_offset = 32, extra_bits_bits_in_buffer = 0;
+	u64 extra_bits_buffer = 0;
+	u16 *s0, *s1, *s2, *s3;
 
-	if (len < sizeof(u32)) {
+	if (jump + STREAM_JUMP_LEN > len) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	fastmemcpy(starts, in + jump, sizeof(starts));
+	n = starts[0];
+	starts[0] = jump + STREAM_JUMP_LEN;
+	if (n > capacity || n > MAX_COMPRESS_LEN) {
 		errno = EOVERFLOW;
 		return -1;
 	}
+	for (i = 1; i < STREAM_COUNT; i++) {
+		if (starts[i] < starts[i - 1] || starts[i] > len) {
+			errno = EPROTO;
+			return -1;
+		}
+	}
 
-	fastmemcpy(&in_bit_offset, in, sizeof(u32));
+	per = n / STREAM_COUNT;
+	o0 = starts[0] << 3;
+	o1 = starts[1] << 3;
+	o2 = starts[2] << 3;
+	o3 = starts[3] << 3;
+	s0 = ctx->symbols;
+	s1 = s0 + per;
+	s2 = s1 + per;
+	s3 = s2 + per;
+
+	for (i = 0; i + 4 <= per; i += 4) {
+		if (c0 < 4 * MAX_CODE_LENGTH) TRY_LOAD(b0, c0, o0, in, len);
+		if (c1 < 4 * MAX_CODE_LENGTH) TRY_LOAD(b1, c1, o1, in, len);
+		if (c2 < 4 * MAX_CODE_LENGTH) TRY_LOAD(b2, c2, o2, in, len);
+		if (c3 < 4 * MAX_CODE_LENGTH) TRY_LOAD(b3, c3, o3, in, len);
+		for (j = i; j < i + 4; j++) {
+			DECODE_SYMBOL(b0, c0, lookup_table, s0[j]);
+			DECODE_SYMBOL(b1, c1, lookup_table, s1[j]);
+			DECODE_SYMBOL(b2, c2, lookup_table, s2[j]);
+			DECODE_SYMBOL(b3, c3, lookup_table, s3[j]);
+		}
+	}
+	for (j = i; i < per; i++) {
+		if (c0 < MAX_CODE_LENGTH) TRY_LOAD(b0, c0, o0, in, len);
+		if (c1 < MAX_CODE_LENGTH) TRY_LOAD(b1, c1, o1, in, len);
+		if (c2 < MAX_CODE_LENGTH) TRY_LOAD(b2, c2, o2, in, len);
+		DECODE_SYMBOL(b0, c0, lookup_table, s0[i]);
+		DECODE_SYMBOL(b1, c1, lookup_table, s1[i]);
+		DECODE_SYMBOL(b2, c2, lookup_table, s2[i]);
+	}
+	for (; j < n - 3 * per; j++) {
+		if (c3 < MAX_CODE_LENGTH) TRY_LOAD(b3, c3, o3, in, len);
+		DECODE_SYMBOL(b3, c3, lookup_table, s3[j]);
+	}
+
+	for (i = 0; i < n; i++) {
+		u16 symbol = ctx->symbols[i];
+		if (__builtin_expect(symbol < SYMBOL_TERM, 0)) {
+			if (itt >= capacity) {
+				errno = EOVERFLOW;
+				return -1;
+			}
+			out[itt++] = symbol;
+		} else if (__builtin_expect(symbol == SYMBOL_TERM, 0)) {
+			errno = EPROTO;
+			return -1;
+		} else {
+			DECODE_MATCH(symbol, extra_bits_buffer,
+				     extra_bits_bits_in_buffer,
+				     extra_bits_offset, in, len, out, itt,
+				     capacity, history, history_len);
+		}
+	}
+
+	return itt;
+}
+
+/*
+ * Reads the book and code lengths starting at bit *offset, builds
+ * ctx->lookup_table and moves *offset past the table.
+ */
+STATIC i32 compress_read_table(DecompressCtx *ctx, const u8 *in, u32 len,
+			       u32 *offset) {
+	CodeLength code_lengths[SYMBOL_COUNT];
+	CodeLength book_code_lengths[MAX_BOOK_CODES];
+	u32 i, in_bit_offset = *offset, bits_in_buffer = 0;
+	u64 buffer = 0;
+	u16 last_length = 0;
+	HuffmanLookup *book_lookup_table = ctx->book_lookup_table;
 
-	in_bit_offset += 32;
 	for (i = 0; i < MAX_BOOK_CODES; i++) {
 		book_code_lengths[i].length =
 		    TRY_READ(buffer, bits_in_buffer, in_bit_offset, in, len, 3);
@@ -681,7 +1236,7 @@ STATIC i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
 			u8 zeros = TRY_READ(buffer, bits_in_buffer,
 					    in_bit_offset, in, len, 7) +
 				   11;
-			if (i + zeros > SYMBOL_COUNT) errno = EPROTO;
+			if (i + zeros > SYMBOL_COUNT) return -1;
 			for (u32 j = 0; j < zeros; j++)
 				code_lengths[i++].length = 0;
 		} else if (code == REPEAT_ZERO_SHORT_INDEX) {
@@ -696,14 +1251,51 @@ STATIC i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
 	errno = SUCCESS;
 
 	compress_calculate_codes(code_lengths, SYMBOL_COUNT);
+	compress_build_lookup_table(code_lengths, SYMBOL_COUNT,
+				    ctx->lookup_table, MAX_CODE_LENGTH);
+	ctx->has_table = true;
+	*offset = in_bit_offset - bits_in_buffer;
+	return 0;
+}
 
-	u32 itt = 0;
+STATIC i32 compress_read_block_ctx(DecompressCtx *ctx,
+				   const CompressDict *dict, const u8 *in,
+				   u32 len, u8 *out, u32 capacity) {
+	u32 in_bit_offset, flags, bits_in_buffer = 0, itt = 0;
 	u32 extra_bits_offset = 32, extra_bits_bits_in_buffer = 0;
-	u64 extra_bits_buffer = 0;
+	u64 buffer = 0, extra_bits_buffer = 0;
+	const HuffmanLookup *lookup_table = ctx->lookup_table;
+	const u8 *history = dict ? dict->data : NULL;
+	u32 history_len = dict ? dict->len : 0;
+
+	if (len < sizeof(u32)) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	fastmemcpy(&in_bit_offset, in, sizeof(u32));
+	flags = in_bit_offset & BLOCK_FLAGS;
+	in_bit_offset = (in_bit_offset & ~BLOCK_FLAGS) + 32;
+
+	if (flags & BLOCK_DICT_TABLE_FLAG) {
+		if (!dict) {
+			errno = EPROTO;
+			return -1;
+		}
+		lookup_table = dict->lookup_table;
+	} else if (flags & BLOCK_REUSE_FLAG) {
+		/* ctx still holds the table of an earlier block */
+		if (!ctx->has_table) {
+			errno = EPROTO;
+			return -1;
+		}
+	} else if (compress_read_table(ctx, in, len, &in_bit_offset) < 0)
+		return -1;
 
-	HuffmanLookup lookup_table[(1U << MAX_CODE_LENGTH)] = {0};
-	compress_build_lookup_table(code_lengths, SYMBOL_COUNT, lookup_table,
-				    MAX_CODE_LENGTH);
+	if (flags & BLOCK_STREAMS_FLAG)
+		return compress_read_streams(
+		    ctx, lookup_table, history, history_len, in, len, out,
+		    capacity, (in_bit_offset + 7) >> 3);
 
 	while (true) {
 		if (__builtin_expect(bits_in_buffer < MAX_CODE_LENGTH, 0))
@@ -722,78 +1314,19 @@ STATIC i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
 		} else if (__builtin_expect(symbol == SYMBOL_TERM, 0)) {
 			break;
 		} else {
-			u8 mc = entry.symbol - MATCH_OFFSET;
-			u8 deb = DIST_EXTRA_BITS(mc);
-			u8 leb = LEN_EXTRA_BITS(mc);
-			u32 dist = DIST_BASE(mc);
-			u16 mlen = LEN_BASE(mc) + 4;
-			if (__builtin_expect(extra_bits_bits_in_buffer < 22,
-					     0)) {
-				TRY_LOAD(extra_bits_buffer,
-					 extra_bits_bits_in_buffer,
-					 extra_bits_offset, in, len);
-			}
-			mlen += PEEK_READER(extra_bits_buffer, leb);
-			ADVANCE_READER(extra_bits_buffer,
-				       extra_bits_bits_in_buffer, leb);
-			dist += PEEK_READER(extra_bits_buffer, deb);
-			ADVANCE_READER(extra_bits_buffer,
-				       extra_bits_bits_in_buffer, deb);
-			if (__builtin_expect(
-				mlen + 32 + itt > capacity || dist > itt, 0)) {
-				errno = EOVERFLOW;
-				return -1;
-			}
-			u8 *out_dst = out + itt;
-			u8 *out_src = out + itt - dist;
-			itt += mlen;
-#ifdef __AVX2__
-			if (__builtin_expect(out_src + 32 <= out_dst, 1)) {
-				u64 chunks = (mlen + 31) >> 5;
-				while (chunks--) {
-					__m256i vec = _mm256_loadu_si256(
-					    (__m256i *)out_src);
-					_mm256_storeu_si256((__m256i *)out_dst,
-							    vec);
-					out_src += 32;
-					out_dst += 32;
-				}
-			} else if (__builtin_expect(out_src + 16 <= out_dst,
-						    1)) {
-				u64 chunks = (mlen + 15) >> 4;
-				while (chunks--) {
-					__m128i vec =
-					    _mm_loadu_si128((__m128i *)out_src);
-					_mm_storeu_si128((__m128i *)out_dst,
-							 vec);
-					out_src += 16;
-					out_dst += 16;
-				}
-			} else if (__builtin_expect(out_src + 8 <= out_dst,
-						    1)) {
-				u64 chunks = (mlen + 7) >> 3;
-				while (chunks--) {
-					*((u64 *)out_dst) = *((u64 *)out_src);
-					out_src += 8;
-					out_dst += 8;
-				}
-			} else {
-				while (mlen--) *out_dst++ = *out_src++;
-			}
-#else
-			while (mlen--) *out_dst++ = *out_src++;
-#endif
+			DECODE_MATCH(symbol, extra_bits_buffer,
+				     extra_bits_bits_in_buffer,
+				     extra_bits_offset, in, len, out, itt,
+				     capacity, history, history_len);
 		}
 	}
 
 	return itt;
 }
 
-STATIC i32
-compress_calculate_block_type(const u32 frequencies[SYMBOL_COUNT],
-			      const u32 book_frequencies[MAX_BOOK_CODES],
-			      const CodeLength code_lengths[SYMBOL_COUNT],
-			      const CodeLength book[MAX_BOOK_CODES], u32 len) {
+STATIC u32 compress_symbol_bits(const u32 frequencies[SYMBOL_COUNT],
+				const CodeLength code_lengths[SYMBOL_COUNT],
+				u32 symbols) {
 	u32 sum = 0;
 	for (u32 i = 0; i < SYMBOL_COUNT; i++) {
 		sum += frequencies[i] * code_lengths[i].length;
@@ -802,7 +1335,16 @@ compress_calculate_block_type(const u32 frequencies[SYMBOL_COUNT],
 			       (DIST_EXTRA_BITS(i - MATCH_OFFSET) +
 				LEN_EXTRA_BITS(i - MATCH_OFFSET));
 	}
-	sum += MAX_BOOK_CODES * 3;
+	sum += 7 + 64 + 64;
+	if (symbols >= STREAMS_MIN_SYMBOLS)
+		sum += (STREAM_JUMP_LEN + STREAM_COUNT) << 3;
+	return sum;
+}
+
+/* bits taken by the code book and the code lengths it codes */
+STATIC u32 compress_table_bits(const u32 book_frequencies[MAX_BOOK_CODES],
+			       const CodeLength book[MAX_BOOK_CODES]) {
+	u32 sum = MAX_BOOK_CODES * 3;
 	for (u32 i = 0; i < MAX_BOOK_CODES; i++) {
 		sum += book_frequencies[i] * book[i].length;
 		if (i == REPEAT_VALUE_INDEX) sum += book_frequencies[i] * 2;
@@ -810,9 +1352,7 @@ compress_calculate_block_type(const u32 frequencies[SYMBOL_COUNT],
 		if (i == REPEAT_ZERO_SHORT_INDEX)
 			sum += book_frequencies[i] * 3;
 	}
-	sum += 7 + 64 + 64;
-	sum >>= 3;
-	return sum > len;
+	return sum;
 }
 
 STATIC i32 compress_write_raw(const u8 *in, u32 len, u8 *out) {
@@ -823,7 +1363,7 @@ STATIC i32 compress_write_raw(const u8 *in, u32 len, u8 *out) {
 		out[2] = 0x80;
 		return 3;
 	}
-	value = len | 0x00800000;
+	value = len | BLOCK_RAW_FLAG;
 	fastmemcpy(out, &value, 3);
 	fastmemcpy(out + 3, in, len);
 	return len + 3;
@@ -862,15 +1402,279 @@ STATIC i32 compress_read_raw(const u8 *in, u32 len, u8 *out, u32 capacity) {
 	return block_len;
 }
 
-PUBLIC u64 compress_bound(u64 source_len) { return source_len + 3; }
+#if TEST == 1
+STATIC i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
+	DecompressCtx ctx;
+	ctx.has_table = false;
+	return compress_read_block_ctx(&ctx, NULL, in, len, out, capacity);
+}
+#endif /* TEST */
 
-PUBLIC i32 compress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
-	u16 match_array[MAX_COMPRESS_LEN + 2] = {0};
-	u32 frequencies[SYMBOL_COUNT] = {0};
+/*
+ * Dictionary windows are padded (see compress_block_dict), so matching can
+ * run to the last position that still holds a minimum-length match.
+ */
+STATIC u32 compress_match_limit(const CompressDict *dict, u32 len) {
+	if (!dict) return MATCH_END(len);
+	return len > MIN_MATCH_LEN ? len - MIN_MATCH_LEN : 0;
+}
+
+/*
+ * Restores the hash state left behind by the last block, either to zero or
+ * to the dictionary's primed table. Only positions in [start, max + 3) are
+ * ever hashed, so small inputs re-hash those positions instead of rewriting
+ * the whole table.
+ */
+STATIC void compress_ctx_reset(CompressCtx *ctx, const CompressDict *dict,
+			       const u8 *in, u32 start, u32 len, u8 level) {
+	u32 i, end;
+
+	end = compress_match_limit(dict, len);
+	end = end ? end + 3 : 0;
+	if (level == 1) {
+		if (end <= start) return;
+		if (end - start > CTX_RESET_LIMIT) {
+			if (dict)
+				fastmemcpy(ctx->table, dict->table,
+					   sizeof(ctx->table));
+			else
+				fastmemset(ctx->table, 0, sizeof(ctx->table));
+		} else if (dict) {
+			for (i = start; i < end; i++) {
+				u32 entry = HASH(in, i);
+				ctx->table[entry] = dict->table[entry];
+			}
+		} else {
+			for (i = start; i < end; i++)
+				ctx->table[HASH(in, i)] = 0;
+		}
+	} else {
+		if (end > CTX_RESET_LIMIT)
+			fastmemset(ctx->head, 0, sizeof(ctx->head));
+		else
+			for (i = 0; i < end; i++)
+				ctx->head[CHAIN_HASH(in, i)] = 0;
+	}
+}
+
+/* log2(x) in 1/256 bits, within 0.01 bits for x > 0 */
+STATIC u32 compress_log2(u32 x) {
+	u32 e = 31 - clz_u32(x), f = ((u64)x << 8 >> e) & 0xFF;
+	/* log2(1 + f) ~ f + 0.34 f (1 - f) */
+	return (e << 8) + f + ((f * (256 - f) * 87) >> 16);
+}
+
+/*
+ * Returns the bits needed to code the block with the last table sent on ctx,
+ * or U32_MAX if that table is too far back or lacks a symbol the block uses.
+ * excess is how far the codes of that table are above the order-0 entropy
+ * of the block, which bounds what a table built for it could save.
+ */
+STATIC u32 compress_reuse_bits(CompressCtx *ctx,
+			       const u32 frequencies[SYMBOL_COUNT],
+			       u32 symbols, u32 *excess) {
+	u32 log_total = compress_log2(symbols + 1);
+	u64 coded = 0, entropy = 0;
+
+	if (!ctx->reuse_age) return U32_MAX;
+	for (u32 i = 0; i < SYMBOL_COUNT; i++) {
+		if (!frequencies[i]) continue;
+		if (!ctx->reuse_lengths[i].length) return U32_MAX;
+		coded += (u64)frequencies[i] * ctx->reuse_lengths[i].length;
+		entropy += (u64)frequencies[i] *
+			   (log_total - compress_log2(frequencies[i]));
+	}
+	coded <<= 8;
+	*excess = coded > entropy ? (coded - entropy) >> 8 : 0;
+	return compress_symbol_bits(frequencies, ctx->reuse_lengths, symbols);
+}
+
+STATIC i32 compress_write_reuse(CompressCtx *ctx, u8 *out, u32 out_bit_offset,
+				u32 symbols) {
+	return compress_write(ctx->reuse_lengths, NULL,
+			      BLOCK_REUSE_FLAG |
+				  ((ctx->reuse_age - 1) << BLOCK_REUSE_SHIFT),
+			      ctx->match_array, out, out_bit_offset, symbols);
+}
+
+/*
+ * Estimates the order-0 entropy of in[0, len) from SAMPLE_WINDOWS evenly
+ * spaced windows, in 1/256 bits per byte. Returns 0 if more than 1 in
+ * SAMPLE_MATCH_SHARE sampled positions repeat an earlier 4-byte sequence,
+ * since the matcher can still do well on such data.
+ */
+STATIC u32 compress_sample(const u8 *in, u32 len) {
+	u32 counts[256] = {0}, table[1 << SAMPLE_HASH_BITS] = {0};
+	u32 step = len / SAMPLE_WINDOWS, n = 0, matches = 0, bits = 0;
+
+	for (u32 w = 0; w < SAMPLE_WINDOWS; w++) {
+		u32 pos = w * step;
+		for (u32 i = pos; i < pos + SAMPLE_WINDOW_LEN; i++, n++) {
+			u32 v, prev, *entry;
+			counts[in[i]]++;
+			fastmemcpy(&v, in + i, sizeof(u32));
+			entry = &table[(v * HASH_CONSTANT) >>
+				       (32 - SAMPLE_HASH_BITS)];
+			if (*entry) {
+				fastmemcpy(&prev, in + *entry - 1, sizeof(u32));
+				matches += prev == v;
+			}
+			*entry = i + 1;
+		}
+	}
+	if (matches * SAMPLE_MATCH_SHARE > n) return 0;
+	for (u32 i = 0; i < 256; i++)
+		if (counts[i])
+			bits += counts[i] *
+				(compress_log2(n) - compress_log2(counts[i]));
+	return bits / n;
+}
+
+/*
+ * Matches in[start, len) into ctx->match_array and counts its symbols.
+ * Returns the bit offset in out where the symbols end.
+ */
+STATIC u32 compress_block_match(CompressCtx *ctx, const CompressDict *dict,
+				const u8 *in, u32 start, u32 len, u8 *out,
+				u8 level, u32 frequencies[SYMBOL_COUNT],
+				u32 *symbols) {
+	u32 out_bit_offset;
+
+	if (level == 1)
+		out_bit_offset =
+		    find_matches(in, start, compress_match_limit(dict, len),
+				 len, ctx->match_array, frequencies, out,
+				 ctx->table);
+	else
+		out_bit_offset = find_matches_chain(
+		    in, len, ctx->match_array, frequencies, out,
+		    &compress_levels[level], ctx->head, ctx->prev);
+
+	/* every symbol but SYMBOL_TERM */
+	*symbols = 0;
+	for (u32 i = 0; i < SYMBOL_COUNT; i++) *symbols += frequencies[i];
+	(*symbols)--;
+	return out_bit_offset;
+}
+
+/*
+ * Codes the matched literals in[0, len) with a table built for them or, with
+ * reuse, with the last table sent on ctx when that is close enough or
+ * smaller. With keep, a new table keeps codes for the symbols the last one
+ * had, so later blocks fit it too.
+ */
+STATIC i32 compress_block_code(CompressCtx *ctx, const u8 *in, u32 len,
+			       u8 *out, u32 out_bit_offset,
+			       const u32 frequencies[SYMBOL_COUNT],
+			       u32 symbols, bool reuse, bool keep) {
+	u32 size, reuse_size = U32_MAX, excess, table, weights[SYMBOL_COUNT];
 	CodeLength code_lengths[SYMBOL_COUNT] = {0};
 	u32 book_frequencies[MAX_BOOK_CODES] = {0};
 	CodeLength book[MAX_BOOK_CODES] = {0};
 
+	if (reuse)
+		reuse_size =
+		    compress_reuse_bits(ctx, frequencies, symbols, &excess);
+	if (reuse_size != U32_MAX) {
+		reuse_size = (reuse_size + 7) >> 3;
+		/* a new table would cost about what it could save */
+		if (excess <= ctx->table_bits && reuse_size <= len)
+			return compress_write_reuse(ctx, out, out_bit_offset,
+						    symbols);
+	}
+
+	for (u32 i = 0; i < SYMBOL_COUNT; i++)
+		weights[i] = frequencies[i]
+				 ? frequencies[i]
+				 : keep && ctx->reuse_lengths[i].length;
+	compress_calculate_lengths(weights, code_lengths, SYMBOL_COUNT,
+				   MAX_CODE_LENGTH);
+	compress_calculate_codes(code_lengths, SYMBOL_COUNT);
+	compress_build_code_book(code_lengths, book, book_frequencies);
+
+	table = compress_table_bits(book_frequencies, book);
+	size = (compress_symbol_bits(frequencies, code_lengths, symbols) +
+		table) >>
+	       3;
+	if (reuse_size < size && reuse_size <= len) {
+		return compress_write_reuse(ctx, out, out_bit_offset, symbols);
+	} else if (size > len) {
+		return compress_write_raw(in, len, out);
+	} else {
+		/* the decoder now holds this table */
+		fastmemcpy(ctx->reuse_lengths, code_lengths,
+			   sizeof(code_lengths));
+		ctx->reuse_age = 1;
+		ctx->table_bits = table;
+		return compress_write(code_lengths, book, 0, ctx->match_array,
+				      out, out_bit_offset, symbols);
+	}
+}
+
+/*
+ * Compresses in[start, len). With a dictionary, in[0, start) holds its
+ * content, and small blocks use its Huffman table instead of sending one.
+ * With reuse, the block codes with the last table sent on ctx when that is
+ * smaller than sending a new one.
+ */
+STATIC i32 compress_block_encode(CompressCtx *ctx, const CompressDict *dict,
+				 const u8 *in, u32 start, u32 len, u8 *out,
+				 u32 capacity, u8 level, bool reuse) {
+	u32 out_bit_offset, symbols, size;
+	u32 frequencies[SYMBOL_COUNT] = {0};
+
+	out_bit_offset = compress_block_match(ctx, dict, in, start, len, out,
+					      level, frequencies, &symbols);
+
+	if (dict && symbols < DICT_TABLE_SYMBOLS) {
+		size = compress_symbol_bits(frequencies, dict->code_lengths,
+					    symbols) >>
+		       3;
+		if (size > len - start)
+			return compress_write_raw(in + start, len - start, out);
+		return compress_write(dict->code_lengths, NULL,
+				      BLOCK_DICT_TABLE_FLAG, ctx->match_array,
+				      out, out_bit_offset, symbols);
+	}
+
+	/* above REUSE_MAX_LEN the table is too small a share to matter */
+	reuse = reuse && len - start <= REUSE_MAX_LEN;
+	return compress_block_code(ctx, in + start, len - start, out,
+				   out_bit_offset, frequencies, symbols, reuse,
+				   reuse);
+}
+
+/*
+ * Stores blocks whose sample looks incompressible without running the
+ * matcher. After STORE_RUN raw blocks in a row ctx is in store mode, and
+ * the sample needs less to send a block straight to raw.
+ */
+STATIC i32 compress_block_impl(CompressCtx *ctx, const CompressDict *dict,
+			       const u8 *in, u32 start, u32 len, u8 *out,
+			       u32 capacity, u8 level, bool reuse) {
+	u32 limit = ctx->raw_run >= STORE_RUN ? SAMPLE_STORE_BITS
+					      : SAMPLE_RAW_BITS;
+	i32 res;
+
+	/* blocks since the last table was sent plus one, 0 once out of reach */
+	if (ctx->reuse_age)
+		ctx->reuse_age =
+		    ctx->reuse_age <= MAX_REUSE_DIST ? ctx->reuse_age + 1 : 0;
+
+	if (len - start >= SAMPLE_MIN_LEN &&
+	    compress_sample(in + start, len - start) >= limit)
+		res = compress_write_raw(in + start, len - start, out);
+	else
+		res = compress_block_encode(ctx, dict, in, start, len, out,
+					    capacity, level, reuse);
+	if (res >= 0)
+		ctx->raw_run =
+		    (out[2] & 0x80) ? min(ctx->raw_run + 1, STORE_RUN) : 0;
+	return res;
+}
+
+STATIC i32 compress_check_args(const u8 *in, u32 len, u8 *out, u32 capacity,
+			       u8 level) {
 #if TEST == 1
 	if (_debug_compress_fail) return -1;
 #endif /* TEST */
@@ -880,33 +1684,196 @@ PUBLIC i32 compress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
 		return -1;
 	}
 
-	if (capacity < compress_bound(len) || len > MAX_COMPRESS_LEN) {
+	if (capacity < compress_bound(len) || len > MAX_COMPRESS_LEN ||
+	    level < COMPRESS_LEVEL_MIN || level > COMPRESS_LEVEL_MAX) {
 		errno = EINVAL;
 		return -1;
 	}
+	return 0;
+}
 
-	u32 out_bit_offset =
-	    find_matches(in, len, match_array, frequencies, out);
-	compress_calculate_lengths(frequencies, code_lengths, SYMBOL_COUNT,
-				   MAX_CODE_LENGTH);
-	compress_calculate_codes(code_lengths, SYMBOL_COUNT);
-	compress_build_code_book(code_lengths, book, book_frequencies);
+PUBLIC u64 compress_bound(u64 source_len) { return source_len + 3; }
 
-	if (compress_calculate_block_type(frequencies, book_frequencies,
-					  code_lengths, book, len)) {
-		return compress_write_raw(in, len, out);
-	} else {
-		return compress_write(code_lengths, book, match_array, out,
-				      out_bit_offset);
+PUBLIC i32 compress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
+	return compress_block_level(in, len, out, capacity,
+				    COMPRESS_LEVEL_DEFAULT);
+}
+
+/*
+ * The context is too large for the stack. Fresh pages are zero, so nothing
+ * needs clearing, and only the pages the block touches are ever faulted in.
+ */
+PUBLIC i32 compress_block_level(const u8 *in, u32 len, u8 *out, u32 capacity,
+				u8 level) {
+	CompressCtx *ctx;
+	i32 res;
+
+	if (compress_check_args(in, len, out, capacity, level) < 0) return -1;
+	if (!(ctx = map(sizeof(CompressCtx)))) return -1;
+	res = compress_block_impl(ctx, NULL, in, 0, len, out, capacity, level,
+				  false);
+	munmap(ctx, sizeof(CompressCtx));
+	return res;
+}
+
+PUBLIC i32 compress_ctx_init(CompressCtx **ctx) {
+	if (!ctx) {
+		errno = EFAULT;
+		return -1;
 	}
+	if (!(*ctx = map(CTX_ALLOC_LEN))) return -1;
+	(*ctx)->window = (u8 *)(*ctx + 1);
+	return 0;
 }
 
-PUBLIC i32 decompress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
+PUBLIC void compress_ctx_destroy(CompressCtx *ctx) {
+	if (ctx) munmap(ctx, CTX_ALLOC_LEN);
+}
+
+STATIC i32 compress_block_ctx_impl(CompressCtx *ctx, const u8 *in, u32 len,
+				   u8 *out, u32 capacity, u8 level,
+				   bool reuse) {
+	i32 res;
+
+	if (!ctx) {
+		errno = EFAULT;
+		return -1;
+	}
+	if (compress_check_args(in, len, out, capacity, level) < 0) return -1;
+
+	if (ctx->dict_id) {
+		fastmemset(ctx->table, 0, sizeof(ctx->table));
+		ctx->dict_id = 0;
+	}
+
+	res = compress_block_impl(ctx, NULL, in, 0, len, out, capacity, level,
+				  reuse);
+	compress_ctx_reset(ctx, NULL, in, 0, len, level);
+	return res;
+}
+
+PUBLIC i32 compress_block_ctx(CompressCtx *ctx, const u8 *in, u32 len,
+			      u8 *out, u32 capacity, u8 level) {
+	return compress_block_ctx_impl(ctx, in, len, out, capacity, level,
+				       false);
+}
+
+/*
+ * Compresses a block on its own, exactly as compress_block_level would, with
+ * ctx only as scratch. Workers keep one ctx for every block they handle.
+ */
+i32 compress_block_scratch(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			   u32 capacity, u8 level) {
+	if (ctx) ctx->reuse_age = ctx->raw_run = 0;
+	return compress_block_ctx(ctx, in, len, out, capacity, level);
+}
+
+/*
+ * Matches a block like compress_block_scratch, leaving the Huffman coding to
+ * compress_block_end. Blocks on different contexts can be matched at once and
+ * still pass a table from one to the next, as compress_block_reuse does
+ * without padding tables for later blocks. Returns 0, or -1 on error.
+ */
+i32 compress_block_begin(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			 u32 capacity, u8 level) {
+	PendingBlock *p;
+
+	if (!ctx) {
+		errno = EFAULT;
+		return -1;
+	}
+	if (compress_check_args(in, len, out, capacity, level) < 0) return -1;
+
+	if (ctx->dict_id) {
+		fastmemset(ctx->table, 0, sizeof(ctx->table));
+		ctx->dict_id = 0;
+	}
+	ctx->raw_run = 0;
+
+	p = &ctx->pending;
+	p->in = NULL;
+	if (len >= SAMPLE_MIN_LEN &&
+	    compress_sample(in, len) >= SAMPLE_RAW_BITS) {
+		p->res = compress_write_raw(in, len, out);
+		return 0;
+	}
+	fastmemset(p->frequencies, 0, sizeof(p->frequencies));
+	p->bit_offset = compress_block_match(ctx, NULL, in, 0, len, out, level,
+					     p->frequencies, &p->symbols);
+	compress_ctx_reset(ctx, NULL, in, 0, len, level);
+	p->in = in;
+	p->out = out;
+	p->len = len;
+	return 0;
+}
+
+/*
+ * Codes the block compress_block_begin matched, with table holding the last
+ * table sent before it, and leaves the table sent last in table for the
+ * next block. Returns the length of the block, or -1 on error.
+ */
+i32 compress_block_end(CompressCtx *ctx, CompressTable *table) {
+	PendingBlock *p = &ctx->pending;
+	i32 res;
+
+	if (table->age)
+		table->age = table->age <= MAX_REUSE_DIST ? table->age + 1 : 0;
+	if (!p->in) return p->res;
+
+	if ((ctx->reuse_age = table->age)) {
+		for (u32 i = 0; i < SYMBOL_COUNT; i++)
+			ctx->reuse_lengths[i].length = table->lengths[i];
+		compress_calculate_codes(ctx->reuse_lengths, SYMBOL_COUNT);
+		ctx->table_bits = table->bits;
+	}
+	res = compress_block_code(ctx, p->in, p->len, p->out, p->bit_offset,
+				  p->frequencies, p->symbols, table->age != 0,
+				  false);
+	p->in = NULL;
+
+	/* a block that reuses a table leaves reuse_age above 1 */
+	if (res >= 0 && ctx->reuse_age == 1) {
+		for (u32 i = 0; i < SYMBOL_COUNT; i++)
+			table->lengths[i] = ctx->reuse_lengths[i].length;
+		table->bits = ctx->table_bits;
+		table->age = 1;
+	}
+	return res;
+}
+
+/*
+ * Like compress_block_ctx, but the block may reuse the Huffman table of one
+ * of the previous MAX_REUSE_DIST blocks compressed with ctx. Such blocks
+ * decode with a DecompressCtx that decoded the same sequence, or with
+ * decompress_block_reuse given the block holding the table.
+ */
+PUBLIC i32 compress_block_reuse(CompressCtx *ctx, const u8 *in, u32 len,
+				u8 *out, u32 capacity, u8 level) {
+	return compress_block_ctx_impl(ctx, in, len, out, capacity, level,
+				       true);
+}
+
+PUBLIC i32 decompress_ctx_init(DecompressCtx **ctx) {
+	if (!ctx) {
+		errno = EFAULT;
+		return -1;
+	}
+	if (!(*ctx = map(sizeof(DecompressCtx)))) return -1;
+	return 0;
+}
+
+PUBLIC void decompress_ctx_destroy(DecompressCtx *ctx) {
+	if (ctx) munmap(ctx, sizeof(DecompressCtx));
+}
+
+STATIC i32 decompress_block_impl(DecompressCtx *ctx, const CompressDict *dict,
+				 const u8 *in, u32 len, u8 *out,
+				 u32 capacity) {
 #if TEST == 1
 	if (_debug_compress_fail) return -1;
 #endif /* TEST */
 
-	if (in == NULL || out == NULL) {
+	if (ctx == NULL || in == NULL || out == NULL) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -917,7 +1884,265 @@ PUBLIC i32 decompress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
 	if ((in[2] & 0x80) != 0) {
 		return compress_read_raw(in, len, out, capacity);
 	} else {
-		return compress_read_block(in, len, out, capacity);
+		return compress_read_block_ctx(ctx, dict, in, len, out,
+					       capacity);
 	}
 }
 
+PUBLIC i32 decompress_block_ctx(DecompressCtx *ctx, const u8 *in, u32 len,
+				u8 *out, u32 capacity) {
+	return decompress_block_impl(ctx, NULL, in, len, out, capacity);
+}
+
+PUBLIC i32 decompress_block(const u8 *in, u32 len, u8 *out, u32 capacity) {
+	DecompressCtx ctx;
+	ctx.has_table = false;
+	return decompress_block_ctx(&ctx, in, len, out, capacity);
+}
+
+/*
+ * Returns how many blocks back the table of a block was sent, or 0 if the
+ * block decodes on its own.
+ */
+PUBLIC u32 decompress_block_source(const u8 *in, u32 len) {
+	u32 hdr;
+
+	if (!in || len < sizeof(u32) || (in[2] & 0x80) != 0) return 0;
+	fastmemcpy(&hdr, in, sizeof(u32));
+	if (!(hdr & BLOCK_REUSE_FLAG)) return 0;
+	return (hdr & BLOCK_REUSE_MASK) >> BLOCK_REUSE_SHIFT;
+}
+
+/*
+ * Decodes a block that reuses the table sent with src, the block
+ * decompress_block_source(in) blocks back.
+ */
+PUBLIC i32 decompress_block_reuse(const u8 *src, u32 src_len, const u8 *in,
+				  u32 len, u8 *out, u32 capacity) {
+	DecompressCtx ctx;
+	u32 hdr;
+
+	if (!src || !in) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (src_len < sizeof(u32)) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	fastmemcpy(&hdr, src, sizeof(u32));
+	if ((src[2] & 0x80) != 0 ||
+	    (hdr & (BLOCK_DICT_TABLE_FLAG | BLOCK_REUSE_FLAG))) {
+		errno = EPROTO;
+		return -1;
+	}
+	hdr = (hdr & ~BLOCK_FLAGS) + 32;
+	ctx.has_table = false;
+	if (compress_read_table(&ctx, src, src_len, &hdr) < 0) return -1;
+	return decompress_block_ctx(&ctx, in, len, out, capacity);
+}
+
+STATIC void compress_dict_prime(CompressDict *dict) {
+	for (u32 i = 0; i + sizeof(u32) <= dict->len; i++)
+		SET_HASH(dict->table, dict->data, i);
+}
+
+PUBLIC i32 compress_dict_init(CompressDict **dict, const u8 *data, u32 len) {
+	CompressDict *d = NULL;
+	u32 magic, kraft = 0;
+INIT:
+	if (!dict || !data) ERROR(EFAULT);
+	if (len < DICT_HEADER_LEN || len > MAX_DICT_SIZE) ERROR(EINVAL);
+	fastmemcpy(&magic, data, sizeof(u32));
+	if (magic != DICT_MAGIC) ERROR(EPROTO);
+	if (!(d = map(sizeof(CompressDict)))) ERROR();
+
+	for (u32 i = 0; i < SYMBOL_COUNT; i++) {
+		u8 length = data[sizeof(u32) + i];
+		if (!length || length > MAX_CODE_LENGTH) ERROR(EPROTO);
+		d->code_lengths[i].length = length;
+		kraft += 1U << (MAX_CODE_LENGTH - length);
+	}
+	if (kraft > 1U << MAX_CODE_LENGTH) ERROR(EPROTO);
+
+	compress_calculate_codes(d->code_lengths, SYMBOL_COUNT);
+	compress_build_lookup_table(d->code_lengths, SYMBOL_COUNT,
+				    d->lookup_table, MAX_CODE_LENGTH);
+	d->len = len - DICT_HEADER_LEN;
+	fastmemcpy(d->data, data + DICT_HEADER_LEN, d->len);
+	compress_dict_prime(d);
+	d->id = __aadd64(&compress_dict_next_id, 1) + 1;
+	*dict = d;
+CLEANUP:
+	if (!IS_OK && d) munmap(d, sizeof(CompressDict));
+	RETURN;
+}
+
+PUBLIC void compress_dict_destroy(CompressDict *dict) {
+	if (dict) munmap(dict, sizeof(CompressDict));
+}
+
+/*
+ * The input is copied in after the dictionary content so matches can reach
+ * back into it. The window and primed table are reloaded only when ctx last
+ * saw a different dictionary.
+ */
+PUBLIC i32 compress_block_dict(CompressCtx *ctx, const CompressDict *dict,
+			       const u8 *in, u32 len, u8 *out, u32 capacity) {
+	i32 res;
+	u32 end;
+
+	if (!ctx || !dict) {
+		errno = EFAULT;
+		return -1;
+	}
+	if (compress_check_args(in, len, out, capacity, 1) < 0) return -1;
+
+	if (ctx->dict_id != dict->id) {
+		fastmemcpy(ctx->table, dict->table, sizeof(ctx->table));
+		fastmemcpy(ctx->window, dict->data, dict->len);
+		ctx->dict_id = dict->id;
+	}
+	end = dict->len + len;
+	fastmemcpy(ctx->window + dict->len, in, len);
+	fastmemset(ctx->window + end, 0, WINDOW_PAD);
+
+	res = compress_block_impl(ctx, dict, ctx->window, dict->len, end, out,
+				  capacity, 1, false);
+	compress_ctx_reset(ctx, dict, ctx->window, dict->len, end, 1);
+	return res;
+}
+
+PUBLIC i32 decompress_block_dict(DecompressCtx *ctx, const CompressDict *dict,
+				 const u8 *in, u32 len, u8 *out,
+				 u32 capacity) {
+	if (!dict) {
+		errno = EINVAL;
+		return -1;
+	}
+	return decompress_block_impl(ctx, dict, in, len, out, capacity);
+}
+
+/*
+ * Picks the content of a trained dictionary. Samples are split into epochs
+ * and the segment whose d-grams are most common across all samples is taken
+ * from each, filling out from the end so the best material sits closest to
+ * the input. The d-grams of a chosen segment are zeroed so later epochs
+ * favour different content.
+ */
+STATIC u32 compress_dict_select(const u8 *samples, const u32 *sizes,
+				u32 count, u64 total, u8 *out, u32 capacity,
+				u32 *counts) {
+	u64 base = 0, epoch, best = 0;
+	u32 pos = capacity, s = 0, best_len = 0, best_score;
+
+	for (u32 i = 0; i < count; base += sizes[i++])
+		for (u32 j = 0; j + DICT_DGRAM <= sizes[i]; j++)
+			counts[DGRAM_HASH(samples + base + j)]++;
+
+	epoch = total / (capacity / DICT_SEGMENT_LEN + 1);
+	if (epoch < DICT_SEGMENT_LEN) epoch = DICT_SEGMENT_LEN;
+
+	base = 0;
+	for (u64 e = 0; e < total && pos; e += epoch) {
+		u64 end = e + epoch < total ? e + epoch : total, b;
+		best_score = 0;
+		while (s < count && base + sizes[s] <= e) base += sizes[s++];
+		b = base;
+		for (u32 t = s; t < count && b < end; b += sizes[t++]) {
+			u32 seg = sizes[t] < DICT_SEGMENT_LEN
+				      ? sizes[t]
+				      : DICT_SEGMENT_LEN;
+			u64 p = e > b ? e : b;
+			for (; p + seg <= b + sizes[t] && p < end; p++) {
+				u32 score = 0;
+				for (u32 j = 0; j + DICT_DGRAM <= seg; j++)
+					score += counts[DGRAM_HASH(
+					    samples + p + j)];
+				if (score > best_score) {
+					best_score = score;
+					best = p;
+					best_len = seg;
+				}
+			}
+		}
+		if (!best_score) continue;
+
+		if (best_len > pos) best_len = pos;
+		pos -= best_len;
+		fastmemcpy(out + pos, samples + best, best_len);
+		for (u32 j = 0; j + DICT_DGRAM <= best_len; j++)
+			counts[DGRAM_HASH(samples + best + j)] = 0;
+	}
+
+	if (pos) fastmemmove(out, out + pos, capacity - pos);
+	return capacity - pos;
+}
+
+/*
+ * Trains a dictionary on count samples stored back to back. The Huffman
+ * table is built from the symbols the samples produce when compressed
+ * against the chosen content, with every symbol kept codable.
+ */
+PUBLIC i32 compress_dict_train(const u8 *samples, const u32 *sizes,
+			       u32 count, u8 *dict, u32 capacity) {
+	CompressDict *d = NULL;
+	CompressCtx *ctx = NULL;
+	u32 *counts = NULL;
+	u8 *scratch = NULL;
+	u32 frequencies[SYMBOL_COUNT] = {0}, content;
+	CodeLength code_lengths[SYMBOL_COUNT] = {0};
+	u64 total = 0, base = 0;
+INIT:
+	if (!samples || !sizes || !dict) ERROR(EFAULT);
+	if (capacity < DICT_HEADER_LEN) ERROR(EINVAL);
+	for (u32 i = 0; i < count; i++) total += sizes[i];
+	if (!total) ERROR(EINVAL);
+
+	content = capacity - DICT_HEADER_LEN;
+	if (content > MAX_DICT_LEN) content = MAX_DICT_LEN;
+	if (!(d = map(sizeof(CompressDict)))) ERROR();
+	if (compress_ctx_init(&ctx) < 0) ERROR();
+	if (!(scratch = map(2 * MAX_COMPRESS_LEN))) ERROR();
+
+	if (total <= content) {
+		fastmemcpy(d->data, samples, total);
+		d->len = total;
+	} else {
+		if (!(counts = map(sizeof(u32) << DICT_HASH_BITS))) ERROR();
+		d->len = compress_dict_select(samples, sizes, count, total,
+					      d->data, content, counts);
+	}
+	compress_dict_prime(d);
+
+	fastmemcpy(ctx->table, d->table, sizeof(ctx->table));
+	fastmemcpy(ctx->window, d->data, d->len);
+	for (u32 i = 0; i < count; base += sizes[i++]) {
+		u32 len = sizes[i] < MAX_COMPRESS_LEN ? sizes[i]
+						      : MAX_COMPRESS_LEN;
+		u32 end = d->len + len;
+		fastmemcpy(ctx->window + d->len, samples + base, len);
+		fastmemset(ctx->window + end, 0, WINDOW_PAD);
+		find_matches(ctx->window, d->len, compress_match_limit(d, end),
+			     end, ctx->match_array, frequencies, scratch,
+			     ctx->table);
+		compress_ctx_reset(ctx, d, ctx->window, d->len, end, 1);
+	}
+
+	for (u32 i = 0; i < SYMBOL_COUNT; i++) frequencies[i]++;
+	compress_calculate_lengths(frequencies, code_lengths, SYMBOL_COUNT,
+				   MAX_CODE_LENGTH);
+
+	content = DICT_MAGIC;
+	fastmemcpy(dict, &content, sizeof(u32));
+	for (u32 i = 0; i < SYMBOL_COUNT; i++)
+		dict[sizeof(u32) + i] = code_lengths[i].length;
+	fastmemcpy(dict + DICT_HEADER_LEN, d->data, d->len);
+	OK(DICT_HEADER_LEN + d->len);
+CLEANUP:
+	if (d) munmap(d, sizeof(CompressDict));
+	compress_ctx_destroy(ctx);
+	if (counts) munmap(counts, sizeof(u32) << DICT_HASH_BITS);
+	if (scratch) munmap(scratch, 2 * MAX_COMPRESS_LEN);
+	RETURN;
+}
@@ -23,36 +23,183 @@
  *
  *******************************************************************************/
 
+#include <libfam/aighthash.h>
 #include <libfam/atomic.h>
 #include <libfam/builtin.h>
 #include <libfam/compress.h>
+#include <libfam/compress_impl.h>
+#include <libfam/debug.h>
 #include <libfam/env.h>
 #include <libfam/format.h>
 #include <libfam/iouring.h>
 #include <libfam/limits.h>
 #include <libfam/linux.h>
+#include <libfam/pool.h>
 #include <libfam/syscall.h>
+#include <libfam/sysext.h>
 #include <libfam/utils.h>
 
 #define MAX_PROCS 128
+#define COMPRESS_INDEX_MAGIC 0x1D3CC377
+#define COMPRESS_LONG_MAGIC 0x1D3CC31E
+#define COMPRESS_DELTA_MAGIC 0x1D3CC3DE
+#define COMPRESS_TRAILER_LEN (2 * sizeof(u64) + sizeof(u32))
+#define COMPRESS_LONG_TRAILER_LEN (COMPRESS_TRAILER_LEN + sizeof(u64))
+#define COMPRESS_DELTA_TRAILER_LEN (COMPRESS_LONG_TRAILER_LEN + 2 * sizeof(u64))
+#define PIPE_SLOTS 4
+#define PIPE_BUF_LEN (MAX_COMPRESS_LEN + 4096)
+#define STREAM_MAX_SLOTS 16
+#define LONG_MAX_REFS 128
+#define LONG_REF_LEN (2 * sizeof(u32) + sizeof(u64))
+#define LONG_HEADER_MAX (sizeof(u32) + LONG_MAX_REFS * LONG_REF_LEN)
+#define LONG_RECORD_MAX (MAX_COMPRESS_LEN + 3 + LONG_HEADER_MAX)
+#define RECORD_CHECK_FLAG 0x80000000U
+#define RECORD_CHECK_LEN (sizeof(u32) + sizeof(u64))
+#define RECORD_MAX (LONG_RECORD_MAX + sizeof(u64))
+#define RANGE_BUF_LEN (RECORD_MAX + 2 * sizeof(u32))
+#define ARCHIVE_MAGIC 0xCA7C0DE5
+#define ARCHIVE_HEADER_LEN (2 * sizeof(u32) + sizeof(u64))
+#define ARCHIVE_ENTRY_LEN (2 * sizeof(u64) + sizeof(u32) + sizeof(u8))
+#define ARCHIVE_PATH_MAX 4096
+#define LONG_WINDOW 64
+#define LONG_MIN_LEN 512
+#define LONG_MIN_PIECE 64
+#define LONG_HASH_BITS 20
+#define LONG_ANCHOR_SHIFT 58
+#define LONG_MAX_DEPTH 4
+#define LONG_DELTA_SRC (1ULL << 63)
+#define DELTA_MIN_LEN 128
+#define GEAR(b) (((u64)(b) + 1) * 0x9E3779B97F4A7C15ULL)
+
+#define SLOT_FREE 0
+#define SLOT_READING 1
+#define SLOT_READY 2
+#define SLOT_DONE 3
+#define SLOT_WRITING 4
+#define SLOT_BUSY 5
+
+/* decompress_stream_source copies a source in behind the longest record */
+STATIC_ASSERT(RECORD_MAX + sizeof(u32) + BLOCK_TABLE_MAX <= PIPE_BUF_LEN,
+	      source_fits);
+
+typedef struct {
+	u8 *in;
+	u8 *out;
+	u64 chunk;
+	i64 len;
+	u8 state;
+} PipeSlot;
+
+/*
+ * Per-worker I/O pipeline: up to PIPE_SLOTS chunks are in flight at once.
+ * Reads are queued ahead of processing, finished chunks are written as soon as
+ * their output offset is known and completions are reaped in batches. With
+ * map set, chunks are processed straight from the mapped input instead.
+ */
+typedef struct {
+	void *state;
+	u64 *next_chunk;
+	u64 chunks;
+	u32 *err;
+	i32 infd;
+	i32 outfd;
+	const u8 *map;
+	/* scratch for process, one per worker */
+	CompressCtx *cctx;
+	i32 (*input)(void *state, u64 chunk, u64 *offset, u64 *len);
+	i64 (*process)(void *state, CompressCtx *cctx, PipeSlot *slot);
+	bool (*output)(void *state, PipeSlot *slot, u64 *offset);
+	/* bumped and woken whenever a waiting output may go ahead, or NULL */
+	u32 *progress;
+} Pipeline;
+
+typedef struct {
+	u8 *in;
+	u8 *out;
+	u64 chunk;
+	i64 len;
+	u32 count;
+	/* bytes of the table the block reuses, copied in behind the record */
+	u32 src_len;
+	u32 state;
+} StreamSlot;
+
+/*
+ * Ring of in-flight blocks for streams, which can only be read and written
+ * in order. The calling thread does all I/O, the other workers process
+ * blocks in between, and the caller helps out whenever it has no I/O to do.
+ */
+typedef struct {
+	void *state;
+	StreamSlot slots[STREAM_MAX_SLOTS];
+	u32 count;
+	u32 procs;
+	u32 ready;
+	u32 done;
+	u32 finished;
+	u32 err;
+	/* the next block to pass stream_turn */
+	u32 turn;
+	/* every worker passes process a CompressCtx of its own */
+	bool compress;
+	i32 (*input)(void *state, StreamSlot *slot);
+	i64 (*process)(void *state, CompressCtx *cctx, StreamSlot *slot);
+	i32 (*output)(void *state, StreamSlot *slot);
+} Stream;
+
+typedef struct {
+	u64 dst;
+	u64 src;
+	u32 len;
+} LongRef;
 
 typedef struct {
 	u64 next_chunk;
-	u64 next_write;
+	u64 resolved;
+	u32 resolve_lock;
+	u32 resolve_seq;
 	u64 chunks;
 	u8 procs;
+	u8 level;
+	bool check;
 	i32 infd;
 	u64 in_offset;
 	i32 outfd;
 	u64 out_offset;
+	u64 out_start;
+	u64 *chunk_offsets;
+	LongRef *refs;
+	u8 *ref_counts;
 	u32 err;
 } CompressState;
 
+/*
+ * Index footer, appended after the last record:
+ * [u32 0][u64 offset]*chunks[u64 size][u64 chunks][u32 magic]
+ * Offsets are relative to the start of the stream and point at the u32 length
+ * of each record. Every block but the last holds MAX_COMPRESS_LEN
+ * uncompressed bytes, so block i starts at i * MAX_COMPRESS_LEN.
+ * With COMPRESS_LONG_MAGIC the trailer starts with [u64 hash] of the whole
+ * uncompressed file, which covers the bytes long-range references copy. With
+ * COMPRESS_DELTA_MAGIC it starts with [u64 hash][u64 ref_size][u64 ref_hash],
+ * the last two describing the reference the delta was made from. Every hash
+ * is aighthash64 with seed 0.
+ */
+typedef struct {
+	u64 size;
+	u64 chunks;
+	u64 offsets;
+	u32 magic;
+	u64 hash;
+	u64 ref_size;
+	u64 ref_hash;
+} CompressIndex;
+
 typedef struct {
 	u64 next_chunk;
-	u64 next_write;
 	u64 chunks;
 	u8 procs;
+	i32 reffd;
 	i32 infd;
 	u64 in_offset;
 	u64 in_len;
@@ -60,130 +207,1256 @@ typedef struct {
 	u64 out_offset;
 	u64 *chunk_offsets;
 	u64 chunk_offset_allocation;
+	u8 *in_map;
+	bool has_index;
+	CompressIndex index;
+	u32 has_long;
 	u32 err;
 } DecompressState;
 
-STATIC void compress_run_proc(u32 id, CompressState *state) {
-	u8 buffers[2][MAX_COMPRESS_LEN + 3 + sizeof(u32)];
-	u64 chunk;
+typedef struct {
+	i32 infd;
+	u64 in_offset;
+	i32 outfd;
+	u64 out_offset;
+	u64 out_start;
+	u64 *offsets;
+	u64 allocation;
+	u64 chunks;
+	u64 size;
+	u8 level;
+	bool check;
+	bool is_last;
+	Stream *stream;
+	/* the table the next block may reuse, passed on in block order */
+	CompressTable table;
+} CompressStream;
 
-	if (IS_VALGRIND()) fastmemset(buffers, 0, sizeof(buffers));
-	while ((chunk = __aadd64(&state->next_chunk, 1)) < state->chunks) {
-		i64 res = pread(state->infd, buffers[0], MAX_COMPRESS_LEN,
-				state->in_offset + chunk * MAX_COMPRESS_LEN);
-		if (res < 0) {
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+typedef struct {
+	i32 infd;
+	u64 in_offset;
+	i32 outfd;
+	u64 out_offset;
+	u64 out_start;
+	bool is_last;
+	bool has_long;
+	/* tables of the last blocks, from decompress_source, 0 long if none */
+	u8 sources[MAX_REUSE_DIST + 1][BLOCK_TABLE_MAX];
+	u32 source_lens[MAX_REUSE_DIST + 1];
+} DecompressStream;
+
+/*
+ * Long-range record, written in place of a block when part of a chunk repeats
+ * data from much earlier in the file:
+ * [u32 LONG_FLAG | n][u32 at, u32 len, u64 src]*n[block of the literals]
+ * Reference i fills out[at, at + len) of the chunk with the uncompressed bytes
+ * at src, which always precede it. With LONG_DELTA_SRC set, src is an offset
+ * into the reference file of a delta instead. The block holds the remaining
+ * bytes in order. LONG_FLAG lies outside BLOCK_FLAGS, so only the fourth
+ * byte of a raw block, which is data, can look like one.
+ */
+STATIC bool compress_is_long(const u8 *in, u64 len) {
+	u32 hdr;
+	if (len < sizeof(u32)) return false;
+	fastmemcpy(&hdr, in, sizeof(u32));
+	return (hdr & (BLOCK_RAW_FLAG | LONG_FLAG)) == LONG_FLAG;
+}
+
+STATIC void compress_long_ref(const u8 *in, u32 i, u32 *at, u32 *len,
+			      u64 *src) {
+	const u8 *ref = in + sizeof(u32) + i * LONG_REF_LEN;
+	fastmemcpy(at, ref, sizeof(u32));
+	fastmemcpy(len, ref + sizeof(u32), sizeof(u32));
+	fastmemcpy(src, ref + 2 * sizeof(u32), sizeof(u64));
+}
+
+/*
+ * Decodes a long-range record into out with its references left as zeroed
+ * holes. The literals are decoded to the front of out and then spread to
+ * their final positions, last segment first.
+ */
+STATIC i64 decompress_long_block(const u8 *in, u32 len, u8 *out, u32 *count) {
+	u32 hdr, n, header, at, rlen, lit_end, out_end;
+	u64 src;
+	i64 res;
+
+	fastmemcpy(&hdr, in, sizeof(u32));
+	n = hdr & ~LONG_FLAG;
+	header = sizeof(u32) + n * LONG_REF_LEN;
+	if (n > LONG_MAX_REFS || len < header) {
+		errno = EPROTO;
+		return -1;
+	}
+	res = decompress_block(in + header, len - header, out,
+			       MAX_COMPRESS_LEN + 3);
+	if (res < 0) return -1;
+
+	lit_end = out_end = res;
+	for (u32 i = 0; i < n; i++) {
+		compress_long_ref(in, i, &at, &rlen, &src);
+		out_end += rlen;
+	}
+	if (out_end > MAX_COMPRESS_LEN) {
+		errno = EPROTO;
+		return -1;
+	}
+	res = out_end;
+
+	for (u32 i = n; i--;) {
+		u32 seg;
+		compress_long_ref(in, i, &at, &rlen, &src);
+		if (at > out_end || rlen > out_end - at ||
+		    out_end - at - rlen > lit_end) {
+			errno = EPROTO;
+			return -1;
+		}
+		seg = out_end - at - rlen;
+		fastmemmove(out + at + rlen, out + lit_end - seg, seg);
+		lit_end -= seg;
+		if (lit_end > at) {
+			errno = EPROTO;
+			return -1;
 		}
-		i32 len =
-		    compress_block(buffers[0], res, buffers[1] + sizeof(u32),
-				   MAX_COMPRESS_LEN + 3);
+		fastmemset(out + at, 0, rlen);
+		out_end = at;
+	}
+	if (lit_end != out_end) {
+		errno = EPROTO;
+		return -1;
+	}
 
-		if (len < 0) {
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+	*count = n;
+	return res;
+}
+
+/*
+ * Record: [u32 len][u64 checksum][block], where len counts every byte after
+ * itself and the checksum is only present with RECORD_CHECK_FLAG set in len.
+ * The checksum is aighthash64 of the decoded chunk, seeded with its index,
+ * with long-range references left as zeroed holes, so a record can be
+ * verified without any earlier output. The filled bytes are covered by the
+ * hash in the index footer instead.
+ */
+STATIC u32 compress_record_head(const u8 *rec) {
+	return (rec[3] & (RECORD_CHECK_FLAG >> 24)) ? RECORD_CHECK_LEN
+						    : sizeof(u32);
+}
+
+/* Writes the header of a record whose block of len bytes is already in place */
+STATIC i64 compress_record(u8 *rec, i32 len, bool check, u64 sum) {
+	u32 word = len;
+
+	if (len < 0) return -1;
+	if (check) {
+		word = (len + sizeof(u64)) | RECORD_CHECK_FLAG;
+		fastmemcpy(rec + sizeof(u32), &sum, sizeof(u64));
+	}
+	fastmemcpy(rec, &word, sizeof(u32));
+	return (word & ~RECORD_CHECK_FLAG) + sizeof(u32);
+}
+
+/*
+ * Returns how many records back the table of the block in rec was sent, or 0
+ * if the block decodes on its own.
+ */
+STATIC u32 decompress_record_source(const u8 *rec, u64 avail) {
+	u32 head;
+
+	if (avail < sizeof(u32)) return 0;
+	head = compress_record_head(rec);
+	if (avail < head || compress_is_long(rec + head, avail - head))
+		return 0;
+	return decompress_block_source(rec + head, avail - head);
+}
+
+/* Reads from map, of size bytes, if there is one and from fd if not */
+STATIC i64 decompress_source_read(i32 fd, const u8 *map, u64 size, u64 offset,
+				  u8 *buf, u64 len) {
+	if (!map) return pread(fd, buf, len, offset);
+	if (offset > size) return 0;
+	len = min(len, size - offset);
+	fastmemcpy(buf, map + offset, len);
+	return len;
+}
+
+/*
+ * Copies the table of the block in the record at offset, which later blocks
+ * reuse, to buf as a block of its own that decompress_block_reuse takes. The
+ * table follows the extra bits of the matches, so only its header word and
+ * the table itself are read.
+ */
+STATIC i32 decompress_source(i32 fd, const u8 *map, u64 size, u64 offset,
+			     u8 buf[BLOCK_TABLE_MAX], u32 *len) {
+	u8 head[RECORD_CHECK_LEN + sizeof(u32)];
+	u32 rec_len, hdr, bit, h;
+	u64 start, end;
+	i64 res;
+
+	res = decompress_source_read(fd, map, size, offset, head, sizeof(head));
+	if (res < 0) return -1;
+	errno = EPROTO;
+	if (res < sizeof(u32)) return -1;
+	fastmemcpy(&rec_len, head, sizeof(u32));
+	h = compress_record_head(head);
+	end = offset + sizeof(u32) + (rec_len & ~RECORD_CHECK_FLAG);
+	if (res < h + sizeof(u32) || end < offset + h + sizeof(u32)) return -1;
+	fastmemcpy(&hdr, head + h, sizeof(u32));
+	if (hdr & (BLOCK_RAW_FLAG | LONG_FLAG)) return -1;
+	bit = hdr & ~BLOCK_FLAGS;
+	start = offset + h + sizeof(u32) + bit / 8;
+	if (start > end) return -1;
+	errno = SUCCESS;
+
+	res = decompress_source_read(fd, map, size, start, buf + sizeof(u32),
+				     min(end - start,
+					 BLOCK_TABLE_MAX - sizeof(u32)));
+	if (res < 0) return -1;
+	hdr = (hdr & BLOCK_FLAGS) | (bit % 8);
+	fastmemcpy(buf, &hdr, sizeof(u32));
+	*len = res + sizeof(u32);
+	return 0;
+}
+
+/*
+ * Decodes the record at rec, of at most avail bytes, and verifies its
+ * checksum. A block that reuses a table needs src, the block holding it.
+ * *block is set to the block so references can be read back.
+ */
+STATIC i64 decompress_record(const u8 *rec, u64 avail, u64 chunk, u8 *out,
+			     const u8 *src, u32 src_len, const u8 **block,
+			     u32 *count) {
+	u32 len, head;
+	u64 sum;
+	i64 res;
+
+	if (avail < sizeof(u32)) {
+		errno = EPROTO;
+		return -1;
+	}
+	fastmemcpy(&len, rec, sizeof(u32));
+	len &= ~RECORD_CHECK_FLAG;
+	head = compress_record_head(rec);
+	if (len > avail - sizeof(u32) || len + sizeof(u32) < head) {
+		errno = EPROTO;
+		return -1;
+	}
+	len -= head - sizeof(u32);
+	*block = rec + head;
+	*count = 0;
+	if (compress_is_long(*block, len))
+		res = decompress_long_block(*block, len, out, count);
+	else if (!decompress_block_source(*block, len))
+		res = decompress_block(*block, len, out, MAX_COMPRESS_LEN + 3);
+	else if (src)
+		res = decompress_block_reuse(src, src_len, *block, len, out,
+					     MAX_COMPRESS_LEN + 3);
+	else {
+		errno = EPROTO;
+		return -1;
+	}
+	if (res < 0 || head == sizeof(u32)) return res;
+
+	fastmemcpy(&sum, rec + sizeof(u32), sizeof(u64));
+	if (aighthash64(out, res, chunk) != sum) {
+		errno = EBADMSG;
+		return -1;
+	}
+	return res;
+}
+
+/*
+ * Fills a reference hole in a chunk that starts at uncompressed position pos.
+ * Source bytes before pos are read back from outfd; the rest are already in
+ * block.
+ */
+STATIC i32 decompress_long_copy(i32 outfd, u64 base, u64 pos, u8 *block,
+				u64 src, u32 at, u32 len) {
+	u64 before = 0;
+
+	/* only decompress_delta has the reference at hand */
+	if (src & LONG_DELTA_SRC) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (src + len > pos + at) {
+		errno = EPROTO;
+		return -1;
+	}
+	if (src < pos) {
+		before = min(len, pos - src);
+		if (pread(outfd, block + at, before, base + src) != before) {
+			if (errno == 0) errno = EIO;
+			return -1;
 		}
+	}
+	fastmemmove(block + at + before, block + (src + before - pos),
+		    len - before);
+	return 0;
+}
 
-		fastmemcpy(buffers[1], &len, sizeof(u32));
-		u64 expected;
-		do {
-			expected = chunk;
-			if (__aload32(&state->err)) return;
-		} while (!__cas64(&state->next_write, &expected, U64_MAX));
+STATIC i32 compress_grow_offsets(u64 **offsets, u64 *allocation, u64 count) {
+	u64 needed = (count * sizeof(u64) + 4095) & ~4095ULL;
+	if (needed <= *allocation) return 0;
+	u64 *tmp = map(needed);
+	if (!tmp) return -1;
+	if (*offsets) {
+		fastmemcpy(tmp, *offsets, *allocation);
+		munmap(*offsets, *allocation);
+	}
+	*allocation = needed;
+	*offsets = tmp;
+	return 0;
+}
 
-		if (pwrite(state->outfd, buffers[1], len + sizeof(u32),
-			   state->out_offset) < 0) {
-			__astore64(&state->next_write, chunk + 1);
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+STATIC bool compress_has_hash(const CompressIndex *index) {
+	return index->magic == COMPRESS_LONG_MAGIC ||
+	       index->magic == COMPRESS_DELTA_MAGIC;
+}
+
+STATIC i32 compress_write_index(i32 fd, u64 offset, const u64 *offsets,
+				const CompressIndex *index) {
+	u8 trailer[COMPRESS_DELTA_TRAILER_LEN], *p = trailer;
+	u32 term = 0;
+
+	if (compress_has_hash(index)) {
+		fastmemcpy(p, &index->hash, sizeof(u64));
+		p += sizeof(u64);
+	}
+	if (index->magic == COMPRESS_DELTA_MAGIC) {
+		fastmemcpy(p, &index->ref_size, sizeof(u64));
+		fastmemcpy(p + sizeof(u64), &index->ref_hash, sizeof(u64));
+		p += 2 * sizeof(u64);
+	}
+	fastmemcpy(p, &index->size, sizeof(u64));
+	fastmemcpy(p + sizeof(u64), &index->chunks, sizeof(u64));
+	fastmemcpy(p + 2 * sizeof(u64), &index->magic, sizeof(u32));
+	p += COMPRESS_TRAILER_LEN;
+
+	if (pwrite(fd, &term, sizeof(u32), offset) < 0) return -1;
+	offset += sizeof(u32);
+	if (pwrite(fd, offsets, index->chunks * sizeof(u64), offset) < 0)
+		return -1;
+	offset += index->chunks * sizeof(u64);
+	if (pwrite(fd, trailer, p - trailer, offset) < 0) return -1;
+	return 0;
+}
+
+/*
+ * Parses the trailer that ends at end, with avail bytes read before end.
+ * Returns its length, or 0 if there is none.
+ */
+STATIC u64 compress_parse_trailer(const u8 *end, u64 avail,
+				  CompressIndex *index) {
+	const u8 *p;
+	u64 len;
+
+	if (avail < COMPRESS_TRAILER_LEN) return 0;
+	fastmemcpy(&index->magic, end - sizeof(u32), sizeof(u32));
+	if (index->magic == COMPRESS_INDEX_MAGIC)
+		len = COMPRESS_TRAILER_LEN;
+	else if (index->magic == COMPRESS_LONG_MAGIC)
+		len = COMPRESS_LONG_TRAILER_LEN;
+	else if (index->magic == COMPRESS_DELTA_MAGIC)
+		len = COMPRESS_DELTA_TRAILER_LEN;
+	else
+		return 0;
+	if (avail < len) return 0;
+
+	p = end - COMPRESS_TRAILER_LEN;
+	fastmemcpy(&index->size, p, sizeof(u64));
+	fastmemcpy(&index->chunks, p + sizeof(u64), sizeof(u64));
+	index->hash = index->ref_size = index->ref_hash = 0;
+	p = end - len;
+	if (compress_has_hash(index)) fastmemcpy(&index->hash, p, sizeof(u64));
+	if (index->magic == COMPRESS_DELTA_MAGIC) {
+		fastmemcpy(&index->ref_size, p + sizeof(u64), sizeof(u64));
+		fastmemcpy(&index->ref_hash, p + 2 * sizeof(u64), sizeof(u64));
+	}
+	return len;
+}
+
+/* Returns 1 if an index footer was found, 0 if not and -1 on error. */
+STATIC i32 compress_read_index(i32 fd, u64 in_offset, u64 in_len,
+			       CompressIndex *index) {
+	u8 trailer[COMPRESS_DELTA_TRAILER_LEN];
+	u32 term = U32_MAX;
+	u64 n, len;
+
+	if (in_len < in_offset + sizeof(u32) + COMPRESS_TRAILER_LEN) return 0;
+	n = min(in_len - in_offset - sizeof(u32), sizeof(trailer));
+	if (pread(fd, trailer, n, in_len - n) < 0) return -1;
+	if (!(len = compress_parse_trailer(trailer + n, n, index))) return 0;
+
+	if (!index->chunks ||
+	    index->chunks >
+		(in_len - in_offset - sizeof(u32) - len) / sizeof(u64) ||
+	    index->size > index->chunks * MAX_COMPRESS_LEN)
+		return 0;
+
+	index->offsets = in_len - len - index->chunks * sizeof(u64);
+	if (pread(fd, &term, sizeof(u32), index->offsets - sizeof(u32)) < 0)
+		return -1;
+	return term == 0;
+}
+
+/* returns 1 if the chunk is ready without a read to submit */
+STATIC i32 pipeline_read(Pipeline *p, IoUring *iou, PipeSlot *slot, u64 id) {
+	u64 offset, len;
+
+#if TEST == 1
+	if (_debug_pread_fail-- == 0) {
+		errno = EIO;
+		return -1;
+	}
+#endif /* TEST */
+
+	if (p->input(p->state, slot->chunk, &offset, &len) < 0) return -1;
+	if (p->map) {
+		slot->in = (u8 *)p->map + offset;
+		slot->len = len;
+		slot->state = SLOT_READY;
+		return 1;
+	}
+	if (iouring_init_pread(iou, p->infd, slot->in, len, offset, id) < 0)
+		return -1;
+	slot->state = SLOT_READING;
+	return 0;
+}
+
+STATIC i32 pipeline_write(Pipeline *p, IoUring *iou, PipeSlot *slot, u64 id,
+			  u64 offset) {
+#if TEST == 1
+	if (_debug_pwrite_fail-- == 0) {
+		errno = EIO;
+		return -1;
+	}
+#endif /* TEST */
+
+	if (iouring_init_pwrite_flags(iou, p->outfd, slot->out, slot->len,
+				      offset, id, 0) < 0)
+		return -1;
+	slot->state = SLOT_WRITING;
+	return 0;
+}
+
+/* Workers waiting on progress give up once they see the error */
+STATIC void pipeline_fail(Pipeline *p, u32 err) {
+	__astore32(p->err, err);
+	if (!p->progress) return;
+	__aadd32(p->progress, 1);
+	futex(p->progress, FUTEX_WAKE_PRIVATE, I32_MAX, NULL);
+}
+
+STATIC void pipeline_run(Pipeline *p) {
+	PipeSlot slots[PIPE_SLOTS] = {0};
+	u64 ids[PIPE_SLOTS], offset;
+	i32 res[PIPE_SLOTS];
+	u32 i, count, queued = 0, inflight = 0, seen = 0;
+	bool claiming = true, waiting, failed;
+	i32 ready;
+	IoUring *iou = NULL;
+	PipeSlot *next;
+	u8 *mem;
+
+	if (!(mem = map(2 * PIPE_SLOTS * PIPE_BUF_LEN))) goto fail;
+	if (iouring_init(&iou, PIPE_SLOTS) < 0) goto fail;
+	for (i = 0; i < PIPE_SLOTS; i++) {
+		slots[i].in = mem + 2 * i * PIPE_BUF_LEN;
+		slots[i].out = slots[i].in + PIPE_BUF_LEN;
+	}
+
+	while (true) {
+		/* read first, so progress made during the pass ends the wait */
+		if (p->progress) seen = __aload32(p->progress);
+		failed = __aload32(p->err) != 0;
+		next = NULL;
+		waiting = false;
+		for (i = 0; i < PIPE_SLOTS; i++) {
+			PipeSlot *slot = &slots[i];
+			if (failed && (slot->state == SLOT_READY ||
+				       slot->state == SLOT_DONE))
+				slot->state = SLOT_FREE;
+			if (slot->state == SLOT_FREE && claiming && !failed) {
+				slot->chunk = __aadd64(p->next_chunk, 1);
+				if (slot->chunk >= p->chunks)
+					claiming = false;
+				else if ((ready = pipeline_read(p, iou, slot,
+							       i)) < 0)
+					goto fail_inflight;
+				else if (!ready)
+					queued++;
+			} else if (slot->state == SLOT_DONE) {
+				if (!p->output(p->state, slot, &offset))
+					waiting = true;
+				else if (pipeline_write(p, iou, slot, i,
+							offset) < 0)
+					goto fail_inflight;
+				else
+					queued++;
+			}
+			if (slot->state == SLOT_READY &&
+			    (!next || slot->chunk < next->chunk))
+				next = slot;
+		}
+
+		if (queued) {
+			if (iouring_submit(iou, queued) < 0) goto fail_inflight;
+			inflight += queued;
+			queued = 0;
 		}
-		__aadd64(&state->out_offset, len + sizeof(u32));
-		__astore64(&state->next_write, chunk + 1);
+
+		if (next) {
+			/* keep the ring busy while the CPU works */
+			next->len = p->process(p->state, p->cctx, next);
+			if (next->len < 0) goto fail_inflight;
+			/* without an output file chunks are only verified */
+			next->state = p->outfd < 0 ? SLOT_FREE : SLOT_DONE;
+		} else if (inflight) {
+			iouring_submit_wait(iou, 0, 1);
+		} else if (waiting) {
+			futex(p->progress, FUTEX_WAIT_PRIVATE, seen, NULL);
+			continue;
+		} else
+			break;
+
+		count = iouring_reap(iou, ids, res, PIPE_SLOTS);
+		for (i = 0; i < count; i++) {
+			PipeSlot *slot = &slots[ids[i]];
+			inflight--;
+			if (res[i] < 0) {
+				pipeline_fail(p, -res[i]);
+				slot->state = SLOT_FREE;
+			} else if (slot->state == SLOT_READING) {
+				slot->len = res[i];
+				slot->state = SLOT_READY;
+			} else {
+				if (res[i] != slot->len)
+					pipeline_fail(p, EIO);
+				slot->state = SLOT_FREE;
+			}
+		}
+		continue;
+	fail_inflight:
+		pipeline_fail(p, errno == 0 ? EIO : errno);
+		claiming = false;
+		inflight += queued;
+		if (queued) iouring_submit(iou, queued);
+		queued = 0;
+		/* buffers must outlive the requests that reference them */
+		while (inflight) {
+			iouring_submit_wait(iou, 0, 1);
+			inflight -= iouring_reap(iou, ids, res, PIPE_SLOTS);
+		}
+		goto cleanup;
 	}
+	goto cleanup;
+fail:
+	pipeline_fail(p, errno == 0 ? ENOMEM : errno);
+cleanup:
+	if (iou) iouring_destroy(iou);
+	if (mem) munmap(mem, 2 * PIPE_SLOTS * PIPE_BUF_LEN);
 }
 
-STATIC void decompress_run_proc(u32 id, DecompressState *state) {
-	u8 buffers[2][MAX_COMPRESS_LEN + 3 + sizeof(u32)];
-	u64 chunk;
+/* also moves the turn along so blocks waiting in stream_turn give up */
+STATIC void stream_fail(Stream *s) {
+	u32 expected = 0;
+	__cas32(&s->err, &expected, errno == 0 ? EIO : errno);
+	__aadd32(&s->turn, 1);
+	futex(&s->turn, FUTEX_WAKE_PRIVATE, I32_MAX, NULL);
+}
+
+/* Takes the lowest ready block, which stream_turn relies on */
+STATIC StreamSlot *stream_claim(Stream *s) {
+	StreamSlot *slot;
+	u32 expected;
+
+	do {
+		slot = NULL;
+		for (u32 i = 0; i < s->count; i++)
+			if (__aload32(&s->slots[i].state) == SLOT_READY &&
+			    (!slot || s->slots[i].chunk < slot->chunk))
+				slot = &s->slots[i];
+		if (!slot) return NULL;
+		expected = SLOT_READY;
+	} while (!__cas32(&slot->state, &expected, SLOT_BUSY));
+	return slot;
+}
+
+/*
+ * Waits until every earlier block has passed stream_turn_end, so part of
+ * process can run in block order. Blocks are claimed lowest first, so all
+ * earlier ones are already being processed. Returns false once the stream
+ * has failed.
+ */
+STATIC bool stream_turn(Stream *s, u64 chunk) {
+	u32 turn;
+
+	while ((turn = __aload32(&s->turn)) != (u32)chunk) {
+		if (__aload32(&s->err)) return false;
+		futex(&s->turn, FUTEX_WAIT_PRIVATE, turn, NULL);
+	}
+	return !__aload32(&s->err);
+}
+
+STATIC void stream_turn_end(Stream *s, u64 chunk) {
+	u32 expected = chunk;
 
-	if (IS_VALGRIND()) fastmemset(buffers, 0, sizeof(buffers));
-	while ((chunk = __aadd64(&state->next_chunk, 1)) < state->chunks) {
-		u32 rlen = state->chunk_offsets[chunk + 1] -
-			   state->chunk_offsets[chunk];
-		if (rlen > MAX_COMPRESS_LEN + 3 + sizeof(u32)) {
-			__astore32(&state->err, errno == 0 ? EPROTO : errno);
+	if (__cas32(&s->turn, &expected, expected + 1))
+		futex(&s->turn, FUTEX_WAKE_PRIVATE, I32_MAX, NULL);
+}
+
+STATIC void stream_process(Stream *s, CompressCtx *cctx, StreamSlot *slot) {
+	if ((slot->len = s->process(s->state, cctx, slot)) < 0) stream_fail(s);
+	__astore32(&slot->state, SLOT_DONE);
+	__aadd32(&s->done, 1);
+	futex(&s->done, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+STATIC void stream_work(Stream *s, CompressCtx *cctx) {
+	StreamSlot *slot;
+	u32 seen;
+
+	while (true) {
+		seen = __aload32(&s->ready);
+		if ((slot = stream_claim(s)))
+			stream_process(s, cctx, slot);
+		else if (__aload32(&s->finished))
 			return;
+		else
+			futex(&s->ready, FUTEX_WAIT_PRIVATE, seen, NULL);
+	}
+}
+
+/*
+ * Block n is read into slot n % count once block n - count has been written,
+ * which bounds memory to count slots however far the writer falls behind.
+ */
+STATIC void stream_io(Stream *s, CompressCtx *cctx) {
+	u64 reads = 0, writes = 0;
+	bool eof = false;
+	StreamSlot *slot;
+	u32 seen;
+	i32 res;
+
+	while (!__aload32(&s->err)) {
+		seen = __aload32(&s->done);
+		slot = &s->slots[writes % s->count];
+		if (writes < reads && __aload32(&slot->state) == SLOT_DONE) {
+			if (s->output(s->state, slot) < 0) {
+				stream_fail(s);
+				break;
+			}
+			__astore32(&slot->state, SLOT_FREE);
+			writes++;
+		} else if (!eof && reads - writes < s->count) {
+			slot = &s->slots[reads % s->count];
+			slot->chunk = reads;
+			if ((res = s->input(s->state, slot)) < 0) {
+				stream_fail(s);
+				break;
+			} else if (!res)
+				eof = true;
+			else {
+				__astore32(&slot->state, SLOT_READY);
+				__aadd32(&s->ready, 1);
+				futex(&s->ready, FUTEX_WAKE_PRIVATE, 1, NULL);
+				reads++;
+			}
+		} else if (eof && writes == reads)
+			break;
+		else if ((slot = stream_claim(s)))
+			stream_process(s, cctx, slot);
+		else
+			futex(&s->done, FUTEX_WAIT_PRIVATE, seen, NULL);
+	}
+
+	__astore32(&s->finished, 1);
+	__aadd32(&s->ready, 1);
+	futex(&s->ready, FUTEX_WAKE_PRIVATE, I32_MAX, NULL);
+}
+
+/* a worker without its context fails every block it takes */
+STATIC void stream_run_proc(u32 id, void *arg) {
+	Stream *s = arg;
+	CompressCtx *cctx = NULL;
+
+	if (s->compress && compress_ctx_init(&cctx) < 0) stream_fail(s);
+	if (id == s->procs - 1)
+		stream_io(s, cctx);
+	else
+		stream_work(s, cctx);
+	compress_ctx_destroy(cctx);
+}
+
+/*
+ * Runs a stream on the global pool with two slots per worker, up to
+ * STREAM_MAX_SLOTS. Without a pool, or from inside a job of the pool, the
+ * caller does everything itself.
+ */
+STATIC i32 stream_run(Stream *s) {
+	ThreadPool *pool = global_pool();
+	u8 *mem;
+
+	s->procs = min(pool_threads(pool) + 1, MAX_PROCS);
+	s->count = min(2 * s->procs, STREAM_MAX_SLOTS);
+	if (!(mem = map(2 * s->count * PIPE_BUF_LEN))) return -1;
+	if (IS_VALGRIND()) fastmemset(mem, 0, 2 * s->count * PIPE_BUF_LEN);
+	for (u32 i = 0; i < s->count; i++) {
+		s->slots[i].in = mem + 2 * i * PIPE_BUF_LEN;
+		s->slots[i].out = s->slots[i].in + PIPE_BUF_LEN;
+	}
+
+	if (s->procs < 2 || pool_run(pool, stream_run_proc, s, s->procs) < 0)
+		stream_run_proc(s->procs - 1, s);
+
+	munmap(mem, 2 * s->count * PIPE_BUF_LEN);
+	if (s->err) {
+		errno = s->err;
+		return -1;
+	}
+	return 0;
+}
+
+STATIC i32 stream_write(i32 fd, const u8 *buf, u64 len, u64 offset) {
+	i64 res;
+
+	while (len) {
+		if ((res = pwrite(fd, buf, len, offset)) < 0) return -1;
+		if (!res) {
+			errno = EIO;
+			return -1;
 		}
-		i32 res = pread(state->infd, buffers[0], rlen,
-				state->chunk_offsets[chunk]);
-		if (res < 0) {
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+		buf += res;
+		offset += res;
+		len -= res;
+	}
+	return 0;
+}
+
+STATIC i32 compress_input(void *ctx, u64 chunk, u64 *offset, u64 *len) {
+	CompressState *state = ctx;
+	*offset = state->in_offset + chunk * MAX_COMPRESS_LEN;
+	*len = MAX_COMPRESS_LEN;
+	return 0;
+}
+
+/*
+ * Removes the chunk's referenced ranges from its input and compresses the
+ * remaining literals behind the reference table.
+ */
+STATIC i32 compress_long_block(CompressState *state, CompressCtx *cctx,
+				PipeSlot *slot, u8 *out) {
+	u32 n = state->ref_counts[slot->chunk], hdr = LONG_FLAG | n;
+	u32 header = sizeof(u32) + n * LONG_REF_LEN, lits = 0, prev = 0;
+	u64 pos = slot->chunk * MAX_COMPRESS_LEN;
+	i32 len;
+
+	fastmemcpy(out, &hdr, sizeof(u32));
+	for (u32 i = 0; i < n; i++) {
+		LongRef *ref = &state->refs[slot->chunk * LONG_MAX_REFS + i];
+		u32 at = ref->dst - pos;
+		u8 *entry = out + sizeof(u32) + i * LONG_REF_LEN;
+
+		if (at + ref->len > slot->len) {
+			errno = EIO;
+			return -1;
 		}
+		fastmemmove(slot->in + lits, slot->in + prev, at - prev);
+		lits += at - prev;
+		prev = at + ref->len;
+		fastmemcpy(entry, &at, sizeof(u32));
+		fastmemcpy(entry + sizeof(u32), &ref->len, sizeof(u32));
+		fastmemcpy(entry + 2 * sizeof(u32), &ref->src, sizeof(u64));
+	}
+	fastmemmove(slot->in + lits, slot->in + prev, slot->len - prev);
+	lits += slot->len - prev;
 
-		res = decompress_block(buffers[0], res, buffers[1],
-				       MAX_COMPRESS_LEN + 3);
-		if (res < 0) {
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+	len = compress_block_scratch(cctx, slot->in, lits, out + header,
+				     MAX_COMPRESS_LEN + 3, state->level);
+	return len < 0 ? -1 : len + header;
+}
+
+/* Hashes the chunk as the decoder first sees it, with its references zeroed */
+STATIC u64 compress_checksum(CompressState *state, PipeSlot *slot) {
+	u32 n = state->ref_counts ? state->ref_counts[slot->chunk] : 0;
+	u64 pos = slot->chunk * MAX_COMPRESS_LEN;
+
+	for (u32 i = 0; i < n; i++) {
+		LongRef *ref = &state->refs[slot->chunk * LONG_MAX_REFS + i];
+		/* out of range references fail in compress_long_block */
+		if (ref->dst - pos + ref->len <= slot->len)
+			fastmemset(slot->in + (ref->dst - pos), 0, ref->len);
+	}
+	return aighthash64(slot->in, slot->len, slot->chunk);
+}
+
+STATIC i64 compress_process(void *ctx, CompressCtx *cctx,
+			    PipeSlot *slot) {
+	CompressState *state = ctx;
+	u8 *out = slot->out + (state->check ? RECORD_CHECK_LEN : sizeof(u32));
+	u64 sum = state->check ? compress_checksum(state, slot) : 0;
+	i64 len;
+
+	if (state->ref_counts && state->ref_counts[slot->chunk])
+		len = compress_long_block(state, cctx, slot, out);
+	else
+		len = compress_block_scratch(cctx, slot->in, slot->len, out,
+					     MAX_COMPRESS_LEN + 3,
+					     state->level);
+	if ((len = compress_record(slot->out, len, state->check, sum)) < 0)
+		return -1;
+	/* holds the record length until compress_resolve sets the offset */
+	__astore64(&state->chunk_offsets[slot->chunk], len);
+	return len;
+}
+
+/*
+ * Whoever holds the lock checks again after releasing it, so a length stored
+ * while it was held, by a worker that then found the lock taken, is never
+ * left for nobody. Waiters are woken once offsets advance.
+ */
+STATIC void compress_resolve(CompressState *state) {
+	bool advanced = false;
+	u32 expected;
+	u64 len, next;
+
+	do {
+		expected = 0;
+		if (!__cas32(&state->resolve_lock, &expected, 1)) break;
+		while (state->resolved < state->chunks &&
+		       (len = __aload64(
+			    &state->chunk_offsets[state->resolved]))) {
+			state->chunk_offsets[state->resolved] =
+			    state->out_offset - state->out_start;
+			state->out_offset += len;
+			__astore64(&state->resolved, state->resolved + 1);
+			advanced = true;
 		}
-		u64 expected;
-		do {
-			expected = chunk;
-			if (__aload32(&state->err)) return;
-		} while (!__cas64(&state->next_write, &expected, U64_MAX));
+		__astore32(&state->resolve_lock, 0);
+		next = __aload64(&state->resolved);
+	} while (next < state->chunks &&
+		 __aload64(&state->chunk_offsets[next]));
 
-		if (pwrite(state->outfd, buffers[1], res,
-			   state->out_offset + MAX_COMPRESS_LEN * chunk) < 0) {
-			__astore64(&state->next_write, chunk + 1);
-			__astore32(&state->err, errno == 0 ? EIO : errno);
-			return;
+	if (advanced) {
+		__aadd32(&state->resolve_seq, 1);
+		futex(&state->resolve_seq, FUTEX_WAKE_PRIVATE, I32_MAX, NULL);
+	}
+}
+
+STATIC bool compress_output(void *ctx, PipeSlot *slot, u64 *offset) {
+	CompressState *state = ctx;
+	if (__aload64(&state->resolved) <= slot->chunk) {
+		compress_resolve(state);
+		if (__aload64(&state->resolved) <= slot->chunk) return false;
+	}
+	*offset = state->out_start + state->chunk_offsets[slot->chunk];
+	return true;
+}
+
+STATIC void compress_run_proc(u32 id, void *arg) {
+	CompressState *state = arg;
+	Pipeline p = {.state = state,
+		      .next_chunk = &state->next_chunk,
+		      .chunks = state->chunks,
+		      .err = &state->err,
+		      .infd = state->infd,
+		      .outfd = state->outfd,
+		      .input = compress_input,
+		      .process = compress_process,
+		      .output = compress_output,
+		      .progress = &state->resolve_seq};
+
+	if (compress_ctx_init(&p.cctx) < 0) {
+		__astore32(p.err, errno == 0 ? ENOMEM : errno);
+		return;
+	}
+	pipeline_run(&p);
+	compress_ctx_destroy(p.cctx);
+}
+
+STATIC i32 decompress_input(void *ctx, u64 chunk, u64 *offset, u64 *len) {
+	DecompressState *state = ctx;
+	*offset = state->chunk_offsets[chunk];
+	*len = state->chunk_offsets[chunk + 1] - *offset;
+	/* the last record is followed by the u32 that ends the records */
+	if (*len > RECORD_MAX + 2 * sizeof(u32) || *offset > state->in_len ||
+	    *len > state->in_len - *offset) {
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+/* Finds the table the record of chunk reuses, sent dist records back */
+STATIC i32 decompress_file_source(DecompressState *state, u64 chunk, u32 dist,
+				  u8 buf[BLOCK_TABLE_MAX], u32 *len) {
+	if (dist > chunk) {
+		errno = EPROTO;
+		return -1;
+	}
+	return decompress_source(state->infd, state->in_map, state->in_len,
+				 state->chunk_offsets[chunk - dist], buf, len);
+}
+
+STATIC i64 decompress_process(void *ctx, CompressCtx *cctx, PipeSlot *slot) {
+	DecompressState *state = ctx;
+	u32 count, src_len = 0, dist, at, len;
+	u8 src[BLOCK_TABLE_MAX];
+	u64 ref;
+	const u8 *block;
+	i64 res;
+
+	dist = decompress_record_source(slot->in, slot->len);
+	if (dist &&
+	    decompress_file_source(state, slot->chunk, dist, src, &src_len) < 0)
+		return -1;
+	res = decompress_record(slot->in, slot->len, slot->chunk, slot->out,
+				dist ? src : NULL, src_len, &block, &count);
+	if (res < 0) return -1;
+	/* only a delta's footer makes reference sources valid */
+	for (u32 i = 0;
+	     i < count && state->index.magic != COMPRESS_DELTA_MAGIC; i++) {
+		compress_long_ref(block, i, &at, &len, &ref);
+		if (ref & LONG_DELTA_SRC) {
+			errno = EPROTO;
+			return -1;
 		}
-		__astore64(&state->next_write, chunk + 1);
 	}
+	/* holes are filled by decompress_long_fill once every chunk is out */
+	if (count) __astore32(&state->has_long, 1);
+	return res;
+}
+
+STATIC bool decompress_output(void *ctx, PipeSlot *slot, u64 *offset) {
+	DecompressState *state = ctx;
+	*offset = state->out_offset + MAX_COMPRESS_LEN * slot->chunk;
+	return true;
+}
+
+STATIC void decompress_run_proc(u32 id, void *arg) {
+	DecompressState *state = arg;
+	Pipeline p = {.state = state,
+		      .next_chunk = &state->next_chunk,
+		      .chunks = state->chunks,
+		      .err = &state->err,
+		      .infd = state->infd,
+		      .outfd = state->outfd,
+		      .map = state->in_map,
+		      .input = decompress_input,
+		      .process = decompress_process,
+		      .output = decompress_output};
+	pipeline_run(&p);
+}
+
+/*
+ * Checks the size bytes decoded at offset of fd against the footer's hash,
+ * once references are filled.
+ */
+STATIC i32 decompress_check_content(i32 fd, u64 offset, u64 size, u64 hash) {
+	u64 skip = offset & 4095, h;
+	u8 *out = NULL;
+
+	if (size) {
+		out = mmap(NULL, size + skip, PROT_READ, MAP_SHARED, fd,
+			   offset - skip);
+		if (out == MAP_FAILED) return -1;
+	}
+	h = aighthash64(out ? out + skip : NULL, size, 0);
+	if (out) munmap(out, size + skip);
+	if (h != hash) {
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Copies every reference of the decompressed file in order. A source never
+ * overlaps a later destination, so each one is complete when it is read.
+ * Delta sources are read from the reference file instead.
+ */
+STATIC i32 decompress_long_fill(DecompressState *state) {
+	u8 header[RECORD_CHECK_LEN + LONG_HEADER_MAX], *buf, *block;
+	u64 base, dst, src, n;
+	u32 count, at, len, piece;
+	i32 ret = -1, fd;
+
+	if (!(buf = map(MAX_COMPRESS_LEN))) return -1;
+	for (u64 c = 0; c < state->chunks; c++) {
+		n = min(state->chunk_offsets[c + 1] - state->chunk_offsets[c],
+			sizeof(header));
+		if (pread(state->infd, header, n, state->chunk_offsets[c]) !=
+		    n)
+			goto cleanup;
+		if (n < sizeof(u32) || n < compress_record_head(header))
+			continue;
+		block = header + compress_record_head(header);
+		n -= block - header;
+		if (!compress_is_long(block, n)) continue;
+		fastmemcpy(&count, block, sizeof(u32));
+		count &= ~LONG_FLAG;
+		if (sizeof(u32) + count * LONG_REF_LEN > n) {
+			errno = EPROTO;
+			goto cleanup;
+		}
+		for (u32 i = 0; i < count; i++) {
+			compress_long_ref(block, i, &at, &len, &src);
+			dst = c * MAX_COMPRESS_LEN + at;
+			fd = state->outfd;
+			base = state->out_offset;
+			if (src & LONG_DELTA_SRC) {
+				fd = state->reffd;
+				base = 0;
+				src &= ~LONG_DELTA_SRC;
+				if (fd < 0) {
+					errno = EINVAL;
+					goto cleanup;
+				}
+			} else if (src + len > dst) {
+				errno = EPROTO;
+				goto cleanup;
+			}
+			for (; len; len -= piece, src += piece, dst += piece) {
+				piece = min(len, MAX_COMPRESS_LEN);
+				if (pread(fd, buf, piece, base + src) !=
+					piece ||
+				    pwrite(state->outfd, buf, piece,
+					   state->out_offset + dst) != piece)
+					goto cleanup;
+			}
+		}
+	}
+	ret = 0;
+cleanup:
+	if (ret < 0 && errno == 0) errno = EIO;
+	munmap(buf, MAX_COMPRESS_LEN);
+	return ret;
+}
+
+/* A delta only decodes, or verifies, against the reference it came from */
+STATIC i32 decompress_check_ref(DecompressState *state,
+				const CompressIndex *index) {
+	struct stat st;
+	u8 *ref = NULL;
+	u64 hash;
+
+	if (state->reffd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (fstat(state->reffd, &st) < 0) return -1;
+	if (st.st_size != index->ref_size) {
+		errno = EBADMSG;
+		return -1;
+	}
+	if (st.st_size && !(ref = fmap(state->reffd, st.st_size, 0)))
+		return -1;
+	hash = aighthash64(ref, st.st_size, 0);
+	if (ref) munmap(ref, st.st_size);
+	if (hash != index->ref_hash) {
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
 }
 
 STATIC i32 compress_setup_offsets(DecompressState *state, u64 st_size) {
 	u64 offset = state->in_offset, i = 0, file_size = 0, chunk_len = 0;
+	CompressIndex index;
+	i32 found;
 
 	state->chunk_offset_allocation = 0;
 
+	found = compress_read_index(state->infd, state->in_offset,
+				    state->in_len, &index);
+	if (found < 0) return -1;
+	if (found) {
+		if (compress_grow_offsets(&state->chunk_offsets,
+					  &state->chunk_offset_allocation,
+					  index.chunks + 1) < 0)
+			return -1;
+		if (pread(state->infd, state->chunk_offsets,
+			  index.chunks * sizeof(u64), index.offsets) < 0)
+			return -1;
+		for (i = 0; i < index.chunks; i++)
+			state->chunk_offsets[i] += state->in_offset;
+		state->chunks = index.chunks;
+		state->chunk_offsets[i] = index.offsets;
+		state->has_index = true;
+		state->index = index;
+		if (index.magic == COMPRESS_DELTA_MAGIC &&
+		    decompress_check_ref(state, &index) < 0)
+			return -1;
+		if (state->outfd >= 0) fallocate(state->outfd, index.size);
+		return 0;
+	}
+
 	while (offset < state->in_len) {
 		if (pread(state->infd, &chunk_len, sizeof(u32), offset) < 0)
 			return -1;
-		if ((i + 1) >= (state->chunk_offset_allocation / sizeof(u64))) {
-			u64 *tmp = smap(4096 + state->chunk_offset_allocation);
-			if (!tmp) return -1;
-			fastmemcpy(tmp, state->chunk_offsets,
-				   state->chunk_offset_allocation);
-			munmap(state->chunk_offsets,
-			       state->chunk_offset_allocation);
-			state->chunk_offset_allocation += 4096;
-			state->chunk_offsets = tmp;
-		}
-		state->chunk_offsets[i++] = offset + sizeof(u32);
-		offset += chunk_len + sizeof(u32);
 		if (chunk_len == 0) break;
+		if (compress_grow_offsets(&state->chunk_offsets,
+					  &state->chunk_offset_allocation,
+					  i + 2) < 0)
+			return -1;
+		state->chunk_offsets[i++] = offset;
+		offset += (chunk_len & ~RECORD_CHECK_FLAG) + sizeof(u32);
 		if (offset < state->in_len) file_size += MAX_COMPRESS_LEN;
 	}
-	state->chunks = i;
-	state->chunk_offsets[i] = state->in_len;
-	fallocate(state->outfd, file_size);
+	if (!state->chunk_offsets &&
+	    compress_grow_offsets(&state->chunk_offsets,
+				  &state->chunk_offset_allocation, 1) < 0)
+		return -1;
+	state->chunks = i;
+	state->chunk_offsets[i] = min(offset, state->in_len);
+	if (state->outfd >= 0) fallocate(state->outfd, file_size);
+
+	return 0;
+}
+
+/*
+ * Trims a match so its source only covers literal bytes. References then
+ * always resolve in one step, which keeps decompress_range from recursing.
+ */
+STATIC u64 compress_long_source(CompressState *state, u64 *s, u64 *d,
+				u64 len) {
+	for (u64 c = *s / MAX_COMPRESS_LEN;
+	     len && c <= (*s + len - 1) / MAX_COMPRESS_LEN; c++) {
+		for (u32 i = 0; i < state->ref_counts[c]; i++) {
+			LongRef *ref = &state->refs[c * LONG_MAX_REFS + i];
+			if (ref->dst >= *s + len) break;
+			if (ref->dst + ref->len <= *s) continue;
+			if (ref->dst > *s) {
+				len = ref->dst - *s;
+				break;
+			}
+			if (ref->dst + ref->len - *s >= len) return 0;
+			len -= ref->dst + ref->len - *s;
+			*d += ref->dst + ref->len - *s;
+			*s = ref->dst + ref->len;
+		}
+	}
+	return len;
+}
+
+/*
+ * Records a match as one reference per chunk it covers. Matches the block
+ * matcher can already find, within a chunk and a u16 distance, are skipped.
+ * The block matcher never sees a delta's reference, so shorter matches into
+ * it are kept. Returns the end of the recorded destination or 0.
+ */
+STATIC u64 compress_long_add(CompressState *state, u64 s, u64 d, u64 len,
+			     bool delta) {
+	u64 c, piece, end;
+
+	if (delta) {
+		if (len < DELTA_MIN_LEN) return 0;
+	} else {
+		if (d - s <= U16_MAX &&
+		    s / MAX_COMPRESS_LEN == d / MAX_COMPRESS_LEN)
+			return 0;
+		len = compress_long_source(state, &s, &d, len);
+		if (len < LONG_MIN_LEN) return 0;
+	}
+
+	for (end = d + len; d < end; d += piece, s += piece) {
+		c = d / MAX_COMPRESS_LEN;
+		piece = min(end - d, (c + 1) * MAX_COMPRESS_LEN - d);
+		if (piece >= LONG_MIN_PIECE &&
+		    state->ref_counts[c] < LONG_MAX_REFS)
+			state->refs[c * LONG_MAX_REFS +
+				    state->ref_counts[c]++] =
+			    (LongRef){.dst = d,
+				      .src = delta ? s | LONG_DELTA_SRC : s,
+				      .len = piece};
+	}
+	return end;
+}
+
+/*
+ * Long-range matcher. A gear hash over the last LONG_WINDOW bytes picks
+ * content-defined anchors, and each anchor is looked up in a table of the
+ * first position its window was seen at. Candidates are extended both ways
+ * and must end before their destination starts. For a delta the reference's
+ * anchors are entered first, below every position of the input, so matches
+ * into the reference win over matches into earlier input.
+ */
+STATIC i32 compress_long_scan(CompressState *state, const u8 *ref,
+			      u64 ref_size, const u8 *data, u64 size) {
+	u64 *table, *entry, h = 0, start = 0, s, d, len, w, end;
+	u64 mask = (1ULL << LONG_HASH_BITS) - 1;
+	const u8 *src;
+	u32 fed = 0;
+	bool delta;
+
+	if (!(table = map(sizeof(u64) << LONG_HASH_BITS))) return -1;
+	for (u64 p = 0; p < ref_size; p++) {
+		h = (h << 1) + GEAR(ref[p]);
+		if (++fed < LONG_WINDOW || (h >> LONG_ANCHOR_SHIFT)) continue;
+		entry = &table[(h >> (LONG_ANCHOR_SHIFT - LONG_HASH_BITS)) &
+			       mask];
+		if (!*entry) *entry = p + 2 - LONG_WINDOW;
+	}
+
+	h = fed = 0;
+	for (u64 p = 0; p < size; p++) {
+		h = (h << 1) + GEAR(data[p]);
+		if (++fed < LONG_WINDOW || (h >> LONG_ANCHOR_SHIFT)) continue;
 
+		w = p + 1 - LONG_WINDOW;
+		entry = &table[(h >> (LONG_ANCHOR_SHIFT - LONG_HASH_BITS)) &
+			       mask];
+		if (!*entry) {
+			*entry = ref_size + w + 1;
+			continue;
+		}
+		s = *entry - 1;
+		d = w;
+		delta = s < ref_size;
+		src = delta ? ref : data;
+		if (!delta) s -= ref_size;
+		end = delta ? ref_size : d;
+		if (s + LONG_WINDOW > end ||
+		    fastmemcmp(src + s, data + d, LONG_WINDOW))
+			continue;
+		while (s && d > start && src[s - 1] == data[d - 1]) s--, d--;
+		len = p + 1 - d;
+		while (d + len < size && s + len < end &&
+		       src[s + len] == data[d + len])
+			len++;
+		if ((len = compress_long_add(state, s, d, len, delta))) {
+			start = len;
+			p = start - 1;
+			h = fed = 0;
+		}
+	}
+	munmap(table, sizeof(u64) << LONG_HASH_BITS);
 	return 0;
 }
 
 PUBLIC i32 compress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
+	return compress_file_level(infd, in_offset, outfd, out_offset,
+				   COMPRESS_LEVEL_DEFAULT);
+}
+
+/* reffd >= 0 seeds the long-range matcher with a delta's reference */
+STATIC i32 compress_file_impl(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+			      u64 out_offset, u8 level, u32 flags) {
 	i32 ret = 0;
 	CompressState *state = NULL;
-	struct stat st, outst;
-	state = smap(sizeof(CompressState));
-	if (!state) return -1;
+	ThreadPool *pool = global_pool();
+	struct stat st, outst, refst = {.st_mode = S_IFREG};
+	CompressIndex index = {.magic = COMPRESS_INDEX_MAGIC};
+	u8 *data, *ref = NULL;
 
-	if (fstat(infd, &st) < 0) return -1;
-	if (fstat(outfd, &outst) < 0) return -1;
+	if (!pool || !(state = map(sizeof(CompressState)))) return -1;
+	if (fstat(infd, &st) < 0 || fstat(outfd, &outst) < 0 ||
+	    (reffd >= 0 && fstat(reffd, &refst) < 0)) {
+		ret = -1;
+		goto cleanup;
+	}
 	if (st.st_size <= in_offset || !S_ISREG(st.st_mode) ||
-	    !S_ISREG(outst.st_mode)) {
+	    !S_ISREG(outst.st_mode) || !S_ISREG(refst.st_mode)) {
 		errno = EINVAL;
 		ret = -1;
 		goto cleanup;
@@ -191,48 +1464,121 @@ PUBLIC i32 compress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
 
 	state->chunks = ((st.st_size - in_offset) + MAX_COMPRESS_LEN - 1) /
 			MAX_COMPRESS_LEN;
-	state->procs = min(get_physical_cores_cpuid(), state->chunks);
+	state->procs = min(pool_threads(pool) + 1, state->chunks);
 	state->procs = min(state->procs, MAX_PROCS);
+	state->level = level;
+	state->check = (flags & COMPRESS_CHECK) != 0;
 	state->infd = infd;
 	state->in_offset = in_offset;
 	state->outfd = outfd;
 	state->out_offset = out_offset;
+	state->out_start = out_offset;
+	state->chunk_offsets = map(state->chunks * sizeof(u64));
+	if (!state->chunk_offsets) {
+		ret = -1;
+		goto cleanup;
+	}
 
-	i32 pids[MAX_PROCS] = {0};
-	u32 i;
-	for (i = 0; i < (state->procs - 1); i++) {
-		pids[i] = fork();
-		if (pids[i] < 0) {
+	if (flags & COMPRESS_LONG) {
+		state->refs = map(state->chunks * LONG_MAX_REFS *
+				  sizeof(LongRef));
+		state->ref_counts = map(state->chunks);
+		data = fmap(infd, st.st_size, 0);
+		if (reffd >= 0 && refst.st_size)
+			ref = fmap(reffd, refst.st_size, 0);
+		if (!state->refs || !state->ref_counts || !data ||
+		    (reffd >= 0 && refst.st_size && !ref) ||
+		    compress_long_scan(state, ref, refst.st_size,
+				       data + in_offset,
+				       st.st_size - in_offset) < 0)
 			ret = -1;
-			goto cleanup;
+		if (ret == 0) {
+			index.magic = COMPRESS_LONG_MAGIC;
+			index.hash = aighthash64(data + in_offset,
+						 st.st_size - in_offset, 0);
 		}
-		if (!pids[i]) {
-			compress_run_proc(i, state);
-			_exit(0);
+		if (ret == 0 && reffd >= 0) {
+			index.magic = COMPRESS_DELTA_MAGIC;
+			index.ref_size = refst.st_size;
+			index.ref_hash = aighthash64(ref, refst.st_size, 0);
 		}
+		if (data) munmap(data, st.st_size);
+		if (ref) munmap(ref, refst.st_size);
+		if (ret < 0) goto cleanup;
 	}
-	compress_run_proc(i, state);
-	for (u32 i = 0; i < state->procs; i++) await(pids[i]);
+
+	if (pool_run(pool, compress_run_proc, state, state->procs) < 0)
+		compress_run_proc(0, state);
 	if (state->err) {
 		errno = state->err;
 		ret = -1;
+	} else {
+		index.size = st.st_size - in_offset;
+		index.chunks = state->chunks;
+		if (compress_write_index(outfd, state->out_offset,
+					 state->chunk_offsets, &index) < 0)
+			ret = -1;
 	}
 cleanup:
-	if (state) munmap(state, sizeof(CompressState));
+	if (state) {
+		if (state->chunk_offsets)
+			munmap(state->chunk_offsets,
+			       state->chunks * sizeof(u64));
+		if (state->refs)
+			munmap(state->refs,
+			       state->chunks * LONG_MAX_REFS * sizeof(LongRef));
+		if (state->ref_counts) munmap(state->ref_counts, state->chunks);
+		munmap(state, sizeof(CompressState));
+	}
 	return ret;
 }
 
-PUBLIC i32 decompress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
-	i32 ret = 0;
-	DecompressState *state = NULL;
-	struct stat st, outst;
+PUBLIC i32 compress_file_flags(i32 infd, u64 in_offset, i32 outfd,
+			       u64 out_offset, u8 level, u32 flags) {
+	return compress_file_impl(-1, infd, in_offset, outfd, out_offset, level,
+				  flags);
+}
 
-	state = smap(sizeof(DecompressState));
-	if (!state) {
-		ret = -1;
-		goto cleanup;
+/*
+ * Compresses infd as a patch against reffd: stretches that also occur in the
+ * reference become references into it, however far away they are.
+ */
+PUBLIC i32 compress_delta(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+			  u64 out_offset, u8 level, u32 flags) {
+	if (reffd < 0) {
+		errno = EBADF;
+		return -1;
 	}
-	if (fstat(infd, &st) < 0 || fstat(outfd, &outst) < 0) {
+	return compress_file_impl(reffd, infd, in_offset, outfd, out_offset,
+				  level, flags | COMPRESS_LONG);
+}
+
+PUBLIC i32 compress_file_level(i32 infd, u64 in_offset, i32 outfd,
+			       u64 out_offset, u8 level) {
+	return compress_file_flags(infd, in_offset, outfd, out_offset, level,
+				   0);
+}
+
+PUBLIC i32 compress_file_long(i32 infd, u64 in_offset, i32 outfd,
+			      u64 out_offset, u8 level) {
+	return compress_file_flags(infd, in_offset, outfd, out_offset, level,
+				   COMPRESS_LONG);
+}
+
+/*
+ * With outfd < 0 every chunk is decoded and verified but nothing written,
+ * except that a long-range file is decoded into memory, since references are
+ * only verified once filled. reffd is the reference of a delta, or -1.
+ */
+STATIC i32 decompress_file_impl(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+				u64 out_offset) {
+	i32 ret = 0, memfd = -1;
+	DecompressState *state = NULL;
+	ThreadPool *pool = global_pool();
+	struct stat st, outst = {.st_mode = S_IFREG};
+
+	if (!pool || !(state = map(sizeof(DecompressState)))) return -1;
+	if (fstat(infd, &st) < 0 || (outfd >= 0 && fstat(outfd, &outst) < 0)) {
 		ret = -1;
 		goto cleanup;
 	}
@@ -243,10 +1589,7 @@ PUBLIC i32 decompress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
 		goto cleanup;
 	}
 
-	state->procs =
-	    min(get_physical_cores_cpuid(),
-		(st.st_size + (MAX_COMPRESS_LEN - 1) / MAX_COMPRESS_LEN));
-	state->procs = min(state->procs, MAX_PROCS);
+	state->reffd = reffd;
 	state->infd = infd;
 	state->in_offset = in_offset;
 	state->in_len = st.st_size;
@@ -257,31 +1600,44 @@ PUBLIC i32 decompress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
 		ret = -1;
 		goto cleanup;
 	}
-
-	i32 pids[MAX_PROCS] = {0};
-
-	u64 i;
-	for (i = 0; i < (state->procs - 1); i++) {
-		pids[i] = fork();
-		if (pids[i] < 0) {
+	if (outfd < 0 && compress_has_hash(&state->index)) {
+		if ((memfd = memfd_create("decompress_verify", 0)) < 0) {
 			ret = -1;
 			goto cleanup;
 		}
-		if (!pids[i]) {
-			decompress_run_proc(i, state);
-			_exit(0);
-		}
+		state->outfd = memfd;
 	}
 
-	decompress_run_proc(i, state);
-	for (u32 i = 0; i < state->procs; i++) await(pids[i]);
+	state->procs = min(pool_threads(pool) + 1, max(state->chunks, 1));
+	state->procs = min(state->procs, MAX_PROCS);
+	/*
+	 * Decode straight from the page cache. The decoder may load up to 7
+	 * bytes past a block, which the index footer keeps inside the file.
+	 */
+	if (state->has_index) {
+		state->in_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+				     infd, 0);
+		if (state->in_map == MAP_FAILED) state->in_map = NULL;
+	}
+	if (pool_run(pool, decompress_run_proc, state, state->procs) < 0)
+		decompress_run_proc(0, state);
+	if (state->in_map) munmap(state->in_map, st.st_size);
 
 	if (state->err) {
 		errno = state->err;
 		ret = -1;
+	} else if (state->outfd >= 0 && state->has_long) {
+		if (decompress_long_fill(state) < 0)
+			ret = -1;
+		else if (compress_has_hash(&state->index) &&
+			 decompress_check_content(
+			     state->outfd, state->out_offset, state->index.size,
+			     state->index.hash) < 0)
+			ret = -1;
 	}
 
 cleanup:
+	if (memfd >= 0) close_raw(memfd);
 	if (state) {
 		if (state->chunk_offsets) {
 			munmap(state->chunk_offsets,
@@ -292,86 +1648,911 @@ cleanup:
 	return ret;
 }
 
+PUBLIC i32 decompress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
+	if (outfd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return decompress_file_impl(-1, infd, in_offset, outfd, out_offset);
+}
+
+PUBLIC i32 decompress_delta(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+			    u64 out_offset) {
+	if (reffd < 0 || outfd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return decompress_file_impl(reffd, infd, in_offset, outfd, out_offset);
+}
+
 PUBLIC i32 compress_stream(i32 infd, u64 in_offset, i32 outfd, u64 out_offset) {
-	i64 res, len, rlen, wlen, to_write;
-	bool is_last = false, wbytes = false;
-	u8 buffers[2][MAX_COMPRESS_LEN + 3 + sizeof(u32)];
-
-	if (IS_VALGRIND()) fastmemset(buffers, 0, sizeof(buffers));
-
-	while (!is_last) {
-		rlen = 0;
-		while (rlen < MAX_COMPRESS_LEN) {
-			res = pread(infd, buffers[0] + rlen,
-				    MAX_COMPRESS_LEN - rlen, in_offset + rlen);
-			if (res < 0) return res;
-			rlen += res;
-			if (res == 0) {
-				is_last = true;
-				break;
-			}
+	return compress_stream_level(infd, in_offset, outfd, out_offset,
+				     COMPRESS_LEVEL_DEFAULT);
+}
+
+STATIC i32 compress_stream_input(void *ctx, StreamSlot *slot) {
+	CompressStream *state = ctx;
+	u64 rlen = 0;
+	i64 res;
+
+	if (state->is_last) return 0;
+	while (rlen < MAX_COMPRESS_LEN) {
+		res = pread(state->infd, slot->in + rlen,
+			    MAX_COMPRESS_LEN - rlen, state->in_offset + rlen);
+		if (res < 0) return -1;
+		if (res == 0) {
+			state->is_last = true;
+			break;
 		}
-		if (rlen == 0 && wbytes) break;
-		wbytes = true;
-		len = compress_block(buffers[0], rlen, buffers[1] + sizeof(u32),
-				     MAX_COMPRESS_LEN + 3);
-		fastmemcpy(buffers[1], &len, sizeof(u32));
-		to_write = len + sizeof(u32);
-		wlen = 0;
-		while (wlen < to_write) {
-			res = pwrite(outfd, buffers[1], to_write, out_offset);
-			if (res < 0) {
-				return res;
-			}
-			wlen += res;
+		rlen += res;
+	}
+	/* empty input still gets one empty block */
+	if (rlen == 0 && state->size) return 0;
+	slot->len = rlen;
+	state->size += rlen;
+	state->in_offset += MAX_COMPRESS_LEN;
+	return 1;
+}
+
+STATIC i64 compress_stream_process(void *ctx, CompressCtx *cctx,
+				   StreamSlot *slot) {
+	CompressStream *state = ctx;
+	u8 *out = slot->out + (state->check ? RECORD_CHECK_LEN : sizeof(u32));
+	u64 sum = 0;
+	i32 len;
+
+	if (state->check) sum = aighthash64(slot->in, slot->len, slot->chunk);
+	/* blocks are matched at once but coded in order, passing on tables */
+	if (compress_block_begin(cctx, slot->in, slot->len, out,
+				 MAX_COMPRESS_LEN + 3, state->level) < 0 ||
+	    !stream_turn(state->stream, slot->chunk))
+		return -1;
+	len = compress_block_end(cctx, &state->table);
+	stream_turn_end(state->stream, slot->chunk);
+	return compress_record(slot->out, len, state->check, sum);
+}
+
+STATIC i32 compress_stream_output(void *ctx, StreamSlot *slot) {
+	CompressStream *state = ctx;
+
+	if (compress_grow_offsets(&state->offsets, &state->allocation,
+				  state->chunks + 1) < 0)
+		return -1;
+	state->offsets[state->chunks++] = state->out_offset - state->out_start;
+	if (stream_write(state->outfd, slot->out, slot->len,
+			 state->out_offset) < 0)
+		return -1;
+	state->out_offset += slot->len;
+	return 0;
+}
+
+PUBLIC i32 compress_stream_level(i32 infd, u64 in_offset, i32 outfd,
+				 u64 out_offset, u8 level) {
+	return compress_stream_flags(infd, in_offset, outfd, out_offset, level,
+				     0);
+}
+
+/* Long-range matching needs the whole input up front, so streams lack it */
+PUBLIC i32 compress_stream_flags(i32 infd, u64 in_offset, i32 outfd,
+				 u64 out_offset, u8 level, u32 flags) {
+	CompressStream state = {.infd = infd,
+				.in_offset = in_offset,
+				.outfd = outfd,
+				.out_offset = out_offset,
+				.out_start = out_offset,
+				.level = level,
+				.check = (flags & COMPRESS_CHECK) != 0};
+	Stream *s;
+	i32 ret;
+
+	if (flags & COMPRESS_LONG) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!(s = map(sizeof(Stream)))) return -1;
+	s->state = &state;
+	state.stream = s;
+	s->input = compress_stream_input;
+	s->compress = true;
+	s->process = compress_stream_process;
+	s->output = compress_stream_output;
+	ret = stream_run(s);
+	if (!ret)
+		ret = compress_write_index(
+		    outfd, state.out_offset, state.offsets,
+		    &(CompressIndex){.size = state.size,
+				     .chunks = state.chunks,
+				     .magic = COMPRESS_INDEX_MAGIC});
+	if (state.offsets) munmap(state.offsets, state.allocation);
+	munmap(s, sizeof(Stream));
+	return ret;
+}
+
+/*
+ * Copies the table a block reuses in behind its record, since the record
+ * holding it may be gone from its slot by the time the block is decoded, and
+ * keeps the table of this block for later ones.
+ */
+STATIC i32 decompress_stream_source(DecompressStream *state,
+				    StreamSlot *slot) {
+	u32 dist = decompress_record_source(slot->in, slot->len), i;
+
+	slot->src_len = 0;
+	if (dist) {
+		if (dist > slot->chunk) {
+			errno = EPROTO;
+			return -1;
 		}
-		out_offset += to_write;
-		in_offset += MAX_COMPRESS_LEN;
+		i = (slot->chunk - dist) % (MAX_REUSE_DIST + 1);
+		if (!(slot->src_len = state->source_lens[i])) {
+			errno = EPROTO;
+			return -1;
+		}
+		fastmemcpy(slot->in + slot->len, state->sources[i],
+			   slot->src_len);
+	}
+	/* blocks without a table of their own are no source */
+	i = slot->chunk % (MAX_REUSE_DIST + 1);
+	if (dist || decompress_source(-1, slot->in, slot->len, 0,
+				      state->sources[i],
+				      &state->source_lens[i]) < 0)
+		state->source_lens[i] = 0;
+	return 1;
+}
+
+STATIC i32 decompress_stream_input(void *ctx, StreamSlot *slot) {
+	DecompressStream *state = ctx;
+	u32 chunk_len = 0;
+	u64 rlen = 0;
+	i64 res;
+
+	if (state->is_last) return 0;
+	res = pread(state->infd, slot->in, sizeof(u32), state->in_offset);
+	if (res < 0) return -1;
+	if (res < sizeof(u32)) return 0;
+	fastmemcpy(&chunk_len, slot->in, sizeof(u32));
+	chunk_len &= ~RECORD_CHECK_FLAG;
+	if (chunk_len > RECORD_MAX) {
+		errno = EPROTO;
+		return -1;
+	}
+	state->in_offset += sizeof(u32);
+	while (rlen < chunk_len) {
+		res = pread(state->infd, slot->in + sizeof(u32) + rlen,
+			    chunk_len - rlen, state->in_offset);
+		if (res < 0) return -1;
+		if (res == 0) break;
+		rlen += res;
 	}
+	state->in_offset += chunk_len;
+	/* the index footer starts with an empty record */
+	if (!rlen) {
+		state->is_last = true;
+		return 0;
+	}
+	slot->len = rlen + sizeof(u32);
+	return decompress_stream_source(state, slot);
+}
+
+STATIC i64 decompress_stream_process(void *ctx, CompressCtx *cctx,
+				     StreamSlot *slot) {
+	const u8 *block, *src = slot->src_len ? slot->in + slot->len : NULL;
+
+	return decompress_record(slot->in, slot->len, slot->chunk, slot->out,
+				 src, slot->src_len, &block, &slot->count);
+}
+
+/* references are copied here, once everything before the block is out */
+STATIC i32 decompress_stream_output(void *ctx, StreamSlot *slot) {
+	DecompressStream *state = ctx;
+	u64 pos = state->out_offset - state->out_start, src;
+	const u8 *block = slot->in + compress_record_head(slot->in);
+	u32 at, len;
 
+	/* verifying only, which cannot fill references without the output */
+	if (state->outfd < 0) {
+		if (slot->count) {
+			errno = EINVAL;
+			return -1;
+		}
+		state->out_offset += slot->len;
+		return 0;
+	}
+	if (slot->count) state->has_long = true;
+	for (u32 i = 0; i < slot->count; i++) {
+		compress_long_ref(block, i, &at, &len, &src);
+		if (decompress_long_copy(state->outfd, state->out_start, pos,
+					 slot->out, src, at, len) < 0)
+			return -1;
+	}
+	if (stream_write(state->outfd, slot->out, slot->len,
+			 state->out_offset) < 0)
+		return -1;
+	state->out_offset += slot->len;
 	return 0;
 }
 
+/*
+ * Reads the rest of the input after the last record and parses the index
+ * footer at its end, which also works on pipes. Returns 1 if one was found,
+ * 0 if not and -1 on error.
+ */
+STATIC i32 decompress_stream_index(DecompressStream *state,
+				   CompressIndex *index) {
+	u8 buf[4096 + COMPRESS_DELTA_TRAILER_LEN];
+	u64 kept = 0, tail = COMPRESS_DELTA_TRAILER_LEN;
+	i64 res;
+
+	/* only the longest trailer is kept of what was read */
+	while ((res = pread(state->infd, buf + kept, sizeof(buf) - kept,
+			    state->in_offset)) > 0) {
+		state->in_offset += res;
+		kept += res;
+		if (kept > tail) {
+			fastmemmove(buf, buf + kept - tail, tail);
+			kept = tail;
+		}
+	}
+	if (res < 0) return -1;
+	return compress_parse_trailer(buf + kept, kept, index) != 0;
+}
+
+STATIC i32 decompress_stream_impl(i32 infd, u64 in_offset, i32 outfd,
+				  u64 out_offset) {
+	DecompressStream state = {.infd = infd,
+				  .in_offset = in_offset,
+				  .outfd = outfd,
+				  .out_offset = out_offset,
+				  .out_start = out_offset};
+	CompressIndex index;
+	Stream *s;
+	i32 ret, found;
+
+	if (!(s = map(sizeof(Stream)))) return -1;
+	s->state = &state;
+	s->input = decompress_stream_input;
+	s->process = decompress_stream_process;
+	s->output = decompress_stream_output;
+	ret = stream_run(s);
+	munmap(s, sizeof(Stream));
+	if (!ret && state.has_long) {
+		found = decompress_stream_index(&state, &index);
+		if (found < 0)
+			ret = -1;
+		else if (found && compress_has_hash(&index))
+			ret = decompress_check_content(
+			    outfd, out_offset, state.out_offset - out_offset,
+			    index.hash);
+	}
+	return ret;
+}
+
 PUBLIC i32 decompress_stream(i32 infd, u64 in_offset, i32 outfd,
 			     u64 out_offset) {
-	u8 buffers[2][MAX_COMPRESS_LEN + 3 + sizeof(u32)];
-	u64 rlen = 0;
-	i64 res;
-	u32 chunk_len = 0;
+	if (outfd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return decompress_stream_impl(infd, in_offset, outfd, out_offset);
+}
 
-	if (IS_VALGRIND()) fastmemset(buffers, 0, sizeof(buffers));
+/*
+ * Decodes every block and checks the checksums of those that have one,
+ * without writing anything. Regular files are verified on every core, and
+ * long-range files are also checked against the hash in their footer. Pipes
+ * cannot fill references, so long-range records there fail with EINVAL.
+ */
+PUBLIC i32 decompress_verify(i32 infd, u64 in_offset) {
+	struct stat st;
 
-	while (true) {
-		res = pread(infd, &chunk_len, sizeof(u32), in_offset);
-		if (res < 0) return res;
-		if (res < sizeof(u32)) break;
-		in_offset += sizeof(u32);
-		rlen = 0;
-		while (rlen < chunk_len) {
-			res = pread(infd, buffers[0] + rlen, chunk_len - rlen,
-				    in_offset);
-			if (res < 0) return res;
-			if (res == 0) break;
-			rlen += res;
-		}
-		in_offset += chunk_len;
-		if (!rlen) break;
-
-		res = decompress_block(buffers[0], rlen, buffers[1],
-				       MAX_COMPRESS_LEN + 3);
-		if (res < 0) return res;
-		i64 out_offset_update = res;
-		while (res) {
-			i64 wres = pwrite(outfd, buffers[1], res, out_offset);
-			if (wres < 0) {
-				return wres;
+	if (fstat(infd, &st) < 0) return -1;
+	if (!S_ISREG(st.st_mode))
+		return decompress_stream_impl(infd, in_offset, -1, 0);
+	return decompress_file_impl(-1, infd, in_offset, -1, 0);
+}
+
+/* Verifies a delta, which needs the reference it was made from */
+PUBLIC i32 decompress_verify_delta(i32 reffd, i32 infd, u64 in_offset) {
+	if (reffd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return decompress_file_impl(reffd, infd, in_offset, -1, 0);
+}
+
+/*
+ * Finds the table of the block in chunk, through the index or else the
+ * offsets of the last records read.
+ */
+STATIC i32 decompress_range_source(i32 infd, u64 in_offset,
+				   const CompressIndex *index,
+				   const u64 *recent, u64 chunk,
+				   u8 buf[BLOCK_TABLE_MAX], u32 *len) {
+	u64 offset;
+
+	if (index) {
+		if (pread(infd, &offset, sizeof(u64),
+			  index->offsets + chunk * sizeof(u64)) < 0)
+			return -1;
+		offset += in_offset;
+	} else
+		offset = recent[chunk % (MAX_REUSE_DIST + 1)];
+	return decompress_source(infd, NULL, 0, offset, buf, len);
+}
+
+/*
+ * References inside the requested range are resolved by reading their
+ * sources, which the compressor keeps free of references. depth only guards
+ * against malformed input. Each level uses its own pair of buffers from
+ * scratch, which holds LONG_MAX_DEPTH + 1 pairs.
+ */
+STATIC i64 decompress_range_depth(i32 infd, u64 in_offset, u64 uoff, u64 len,
+				  u8 *out, u8 (*scratch)[RANGE_BUF_LEN],
+				  u32 depth) {
+	u8 (*buffers)[RANGE_BUF_LEN];
+	u64 chunk = uoff / MAX_COMPRESS_LEN, skip = uoff % MAX_COMPRESS_LEN;
+	u64 offset = in_offset, copied = 0, n, pos = uoff - skip, src;
+	u32 chunk_len = 0, count = 0, at, rlen, dist, source_len = 0;
+	u8 source[BLOCK_TABLE_MAX];
+	u64 recent[MAX_REUSE_DIST + 1];
+	const u8 *block;
+	CompressIndex index;
+	i32 found;
+	i64 res, dlen;
+
+	if (!out && len) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (depth > LONG_MAX_DEPTH) {
+		errno = ELOOP;
+		return -1;
+	}
+	buffers = scratch + 2 * depth;
+	if ((res = fsize(infd)) < 0) return -1;
+	found = compress_read_index(infd, in_offset, res, &index);
+	if (found < 0) return -1;
+
+	if (found) {
+		if (uoff >= index.size) return 0;
+		len = min(len, index.size - uoff);
+		if (pread(infd, &offset, sizeof(u64),
+			  index.offsets + chunk * sizeof(u64)) < 0)
+			return -1;
+		offset += in_offset;
+	} else {
+		for (u64 c = 0; c < chunk; c++) {
+			recent[c % (MAX_REUSE_DIST + 1)] = offset;
+			res = pread(infd, &chunk_len, sizeof(u32), offset);
+			if (res < 0) return -1;
+			if (res < sizeof(u32) || !chunk_len) return 0;
+			chunk_len &= ~RECORD_CHECK_FLAG;
+			offset += chunk_len + sizeof(u32);
+		}
+	}
+
+	res = pread(infd, &chunk_len, sizeof(u32), offset);
+	if (res < 0) return -1;
+	if (res < sizeof(u32)) chunk_len = 0;
+
+	/* Each read also fetches the length of the following record. */
+	while (copied < len && chunk_len) {
+		fastmemcpy(buffers[0], &chunk_len, sizeof(u32));
+		chunk_len &= ~RECORD_CHECK_FLAG;
+		if (chunk_len > RECORD_MAX) {
+			errno = EPROTO;
+			return -1;
+		}
+		chunk = pos / MAX_COMPRESS_LEN;
+		recent[chunk % (MAX_REUSE_DIST + 1)] = offset;
+		offset += sizeof(u32);
+		res = pread(infd, buffers[0] + sizeof(u32),
+			    chunk_len + sizeof(u32), offset);
+		if (res < 0) return -1;
+		if (res < chunk_len) {
+			errno = EPROTO;
+			return -1;
+		}
+		offset += chunk_len;
+
+		dist = decompress_record_source(buffers[0],
+						chunk_len + sizeof(u32));
+		if (dist > chunk) {
+			errno = EPROTO;
+			return -1;
+		}
+		if (dist && decompress_range_source(infd, in_offset,
+						    found ? &index : NULL,
+						    recent, chunk - dist,
+						    source, &source_len) < 0)
+			return -1;
+		dlen = decompress_record(buffers[0], chunk_len + sizeof(u32),
+					 chunk, buffers[1],
+					 dist ? source : NULL, source_len,
+					 &block, &count);
+		if (dlen < 0) return -1;
+		if (dlen <= skip) break;
+
+		n = min(dlen - skip, len - copied);
+		while (count--) {
+			u64 lo, hi;
+			compress_long_ref(block, count, &at, &rlen, &src);
+			lo = max(at, skip);
+			hi = min(at + rlen, skip + n);
+			if (lo >= hi) continue;
+			if (src & LONG_DELTA_SRC) {
+				errno = EINVAL;
+				return -1;
 			}
-			res -= wres;
+			if (src + rlen > pos + at) {
+				errno = EPROTO;
+				return -1;
+			}
+			dlen = decompress_range_depth(infd, in_offset,
+						      src + lo - at, hi - lo,
+						      buffers[1] + lo, scratch,
+						      depth + 1);
+			if (dlen < 0) return -1;
+			if (dlen != hi - lo) {
+				errno = EPROTO;
+				return -1;
+			}
+		}
+		count = 0;
+
+		fastmemcpy(out + copied, buffers[1] + skip, n);
+		copied += n;
+		skip = 0;
+		pos += MAX_COMPRESS_LEN;
+
+		if (res == chunk_len + sizeof(u32))
+			fastmemcpy(&chunk_len,
+				   buffers[0] + sizeof(u32) + chunk_len,
+				   sizeof(u32));
+		else
+			chunk_len = 0;
+	}
+
+	return copied;
+}
+
+PUBLIC i64 decompress_range(i32 infd, u64 in_offset, u64 uoff, u64 len,
+			    u8 *out) {
+	u64 scratch_len = 2 * (LONG_MAX_DEPTH + 1) * RANGE_BUF_LEN;
+	u8 (*scratch)[RANGE_BUF_LEN] = map(scratch_len);
+	i64 res;
+
+	if (!scratch) return -1;
+	res = decompress_range_depth(infd, in_offset, uoff, len, out, scratch,
+				     0);
+	munmap(scratch, scratch_len);
+	return res;
+}
+
+/*
+ * Archive of many files:
+ * [u32 magic][u32 count][u64 dir_len][entry]*count[stream]
+ * entry: [u64 size][u64 mtime][u32 mode][u8 name_len][name]
+ * The stream holds the contents of every member back to back, so small files
+ * share blocks. Members start where the previous one ends, and the stream's
+ * index lets a single member be read without decoding the others.
+ */
+struct Archive {
+	i32 fd;
+	u64 data;
+	u32 count;
+	ArchiveEntry entries[];
+};
+
+typedef struct {
+	CompressStream base;
+	const u8 **paths;
+	const ArchiveEntry *entries;
+	u32 count;
+	u32 index;
+	u64 pos;
+	i32 fd;
+} ArchivePack;
+
+typedef struct {
+	DecompressStream base;
+	const Archive *archive;
+	const u8 *dir;
+	u32 index;
+	u64 pos;
+	i32 fd;
+} ArchiveUnpack;
+
+/* Member names are relative and never step outside the current directory */
+STATIC bool archive_name_ok(const u8 *name, u64 len) {
+	u64 start = 0;
+
+	if (!len || len > ARCHIVE_NAME_MAX || name[0] == '/') return false;
+	for (u64 i = 0; i <= len; i++) {
+		if (i < len && !name[i]) return false;
+		if (i < len && name[i] != '/') continue;
+		if (i - start == 2 && !fastmemcmp(name + start, "..", 2))
+			return false;
+		start = i + 1;
+	}
+	return true;
+}
+
+STATIC i32 archive_stat(const u8 *path, ArchiveEntry *entry) {
+	struct stat st;
+	u64 len;
+	i32 fd;
+
+	if ((fd = open(path, O_RDONLY, 0)) < 0) return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (!S_ISREG(st.st_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+	while (*path == '/') path++;
+	if ((len = strlen(path)) > ARCHIVE_NAME_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (!archive_name_ok(path, len)) {
+		errno = EINVAL;
+		return -1;
+	}
+	fastmemcpy(entry->name, path, len + 1);
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	entry->mode = st.st_mode & 07777;
+	return 0;
+}
+
+/* Fills the slot from as many members as it takes, opening them in turn */
+STATIC i32 archive_pack_input(void *ctx, StreamSlot *slot) {
+	ArchivePack *state = ctx;
+	const ArchiveEntry *entry;
+	u64 rlen = 0, n;
+	i64 res;
+
+	while (rlen < MAX_COMPRESS_LEN && state->index < state->count) {
+		entry = &state->entries[state->index];
+		if (state->pos == entry->size) {
+			if (state->fd >= 0) close(state->fd);
+			state->fd = -1;
+			state->index++;
+			state->pos = 0;
+			continue;
+		}
+		if (state->fd < 0 &&
+		    (state->fd = open(state->paths[state->index], O_RDONLY,
+				      0)) < 0)
+			return -1;
+		n = min(MAX_COMPRESS_LEN - rlen, entry->size - state->pos);
+		res = pread(state->fd, slot->in + rlen, n, state->pos);
+		if (res < 0) return -1;
+		/* the member shrank since it was listed */
+		if (res == 0) {
+			errno = EIO;
+			return -1;
+		}
+		rlen += res;
+		state->pos += res;
+	}
+	/* an archive of empty files still gets one empty block */
+	if (rlen == 0 && slot->chunk) return 0;
+	slot->len = rlen;
+	state->base.size += rlen;
+	return 1;
+}
+
+/*
+ * Packs the files at paths into an archive at out_offset. Blocks are
+ * compressed on every core while the calling thread reads the members.
+ */
+PUBLIC i32 compress_archive(const u8 **paths, u32 count, i32 outfd,
+			    u64 out_offset, u8 level, u32 flags) {
+	ArchivePack state = {.paths = paths, .count = count, .fd = -1};
+	u64 dir_len = 0, name_len;
+	u32 magic = ARCHIVE_MAGIC;
+	ArchiveEntry *entries;
+	u8 *dir = NULL, *p;
+	Stream *s = NULL;
+	i32 ret = -1;
+
+	if (!count || (flags & COMPRESS_LONG)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!(entries = map(count * sizeof(ArchiveEntry)))) return -1;
+	state.entries = entries;
+	for (u32 i = 0; i < count; i++) {
+		if (archive_stat(paths[i], &entries[i]) < 0) goto cleanup;
+		dir_len += ARCHIVE_ENTRY_LEN + strlen(entries[i].name);
+	}
+
+	if (!(dir = map(ARCHIVE_HEADER_LEN + dir_len))) goto cleanup;
+	fastmemcpy(dir, &magic, sizeof(u32));
+	fastmemcpy(dir + sizeof(u32), &count, sizeof(u32));
+	fastmemcpy(dir + 2 * sizeof(u32), &dir_len, sizeof(u64));
+	p = dir + ARCHIVE_HEADER_LEN;
+	for (u32 i = 0; i < count; i++) {
+		name_len = strlen(entries[i].name);
+		fastmemcpy(p, &entries[i].size, sizeof(u64));
+		fastmemcpy(p + sizeof(u64), &entries[i].mtime, sizeof(u64));
+		fastmemcpy(p + 2 * sizeof(u64), &entries[i].mode, sizeof(u32));
+		p[ARCHIVE_ENTRY_LEN - 1] = name_len;
+		fastmemcpy(p + ARCHIVE_ENTRY_LEN, entries[i].name, name_len);
+		p += ARCHIVE_ENTRY_LEN + name_len;
+	}
+	if (stream_write(outfd, dir, ARCHIVE_HEADER_LEN + dir_len,
+			 out_offset) < 0)
+		goto cleanup;
+
+	state.base.outfd = outfd;
+	state.base.out_offset = out_offset + ARCHIVE_HEADER_LEN + dir_len;
+	state.base.out_start = state.base.out_offset;
+	state.base.level = level;
+	state.base.check = (flags & COMPRESS_CHECK) != 0;
+	if (!(s = map(sizeof(Stream)))) goto cleanup;
+	s->state = &state;
+	state.base.stream = s;
+	s->input = archive_pack_input;
+	s->compress = true;
+	s->process = compress_stream_process;
+	s->output = compress_stream_output;
+	if (stream_run(s) < 0) goto cleanup;
+	ret = compress_write_index(
+	    outfd, state.base.out_offset, state.base.offsets,
+	    &(CompressIndex){.size = state.base.size,
+			     .chunks = state.base.chunks,
+			     .magic = COMPRESS_INDEX_MAGIC});
+cleanup:
+	if (state.fd >= 0) close(state.fd);
+	if (state.base.offsets)
+		munmap(state.base.offsets, state.base.allocation);
+	if (s) munmap(s, sizeof(Stream));
+	if (dir) munmap(dir, ARCHIVE_HEADER_LEN + dir_len);
+	munmap(entries, count * sizeof(ArchiveEntry));
+	return ret;
+}
+
+/* Reads the directory only; member data is left untouched */
+PUBLIC i32 archive_open(Archive **archive, i32 fd, u64 offset) {
+	u8 header[ARCHIVE_HEADER_LEN], *dir = NULL, *p;
+	u64 dir_len, pos = 0, name_len;
+	u32 magic, count;
+	ArchiveEntry *entry;
+	Archive *a = NULL;
+	i64 size;
+
+	if ((size = fsize(fd)) < 0) return -1;
+	if (pread(fd, header, ARCHIVE_HEADER_LEN, offset) !=
+	    ARCHIVE_HEADER_LEN)
+		goto invalid;
+	fastmemcpy(&magic, header, sizeof(u32));
+	fastmemcpy(&count, header + sizeof(u32), sizeof(u32));
+	fastmemcpy(&dir_len, header + 2 * sizeof(u32), sizeof(u64));
+	if (magic != ARCHIVE_MAGIC || !count ||
+	    dir_len > size - offset - ARCHIVE_HEADER_LEN ||
+	    dir_len < count * ARCHIVE_ENTRY_LEN)
+		goto invalid;
+
+	if (!(a = map(sizeof(Archive) + count * sizeof(ArchiveEntry))))
+		return -1;
+	a->fd = fd;
+	a->data = offset + ARCHIVE_HEADER_LEN + dir_len;
+	a->count = count;
+	if (!(dir = map(dir_len))) goto fail;
+	if (pread(fd, dir, dir_len, offset + ARCHIVE_HEADER_LEN) != dir_len)
+		goto invalid;
+
+	p = dir;
+	for (u32 i = 0; i < count; i++) {
+		entry = &a->entries[i];
+		if (p + ARCHIVE_ENTRY_LEN > dir + dir_len) goto invalid;
+		fastmemcpy(&entry->size, p, sizeof(u64));
+		fastmemcpy(&entry->mtime, p + sizeof(u64), sizeof(u64));
+		fastmemcpy(&entry->mode, p + 2 * sizeof(u64), sizeof(u32));
+		name_len = p[ARCHIVE_ENTRY_LEN - 1];
+		p += ARCHIVE_ENTRY_LEN;
+		if (p + name_len > dir + dir_len ||
+		    !archive_name_ok(p, name_len) ||
+		    entry->size > U64_MAX - pos)
+			goto invalid;
+		fastmemcpy(entry->name, p, name_len);
+		entry->offset = pos;
+		pos += entry->size;
+		p += name_len;
+	}
+	munmap(dir, dir_len);
+	*archive = a;
+	return 0;
+invalid:
+	errno = EPROTO;
+fail:
+	if (dir) munmap(dir, dir_len);
+	if (a) munmap(a, sizeof(Archive) + count * sizeof(ArchiveEntry));
+	return -1;
+}
+
+PUBLIC void archive_close(Archive *archive) {
+	if (archive)
+		munmap(archive,
+		       sizeof(Archive) + archive->count * sizeof(ArchiveEntry));
+}
+
+PUBLIC u32 archive_count(const Archive *archive) { return archive->count; }
+
+PUBLIC const ArchiveEntry *archive_entry(const Archive *archive, u32 index) {
+	if (index >= archive->count) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return &archive->entries[index];
+}
+
+/* Only the blocks overlapping the requested range are read and decoded */
+PUBLIC i64 archive_read(const Archive *archive, u32 index, u64 offset,
+			u64 len, u8 *out) {
+	const ArchiveEntry *entry;
+
+	if (!(entry = archive_entry(archive, index))) return -1;
+	if (offset >= entry->size) return 0;
+	len = min(len, entry->size - offset);
+	return decompress_range(archive->fd, archive->data,
+				entry->offset + offset, len, out);
+}
+
+/*
+ * Copies in pieces that end on block boundaries so no block is read twice.
+ * outfd is written from offset 0 on but never truncated, so an existing file
+ * must be truncated first, as archive_create_member does.
+ */
+PUBLIC i32 archive_extract(const Archive *archive, u32 index, i32 outfd) {
+	const ArchiveEntry *entry;
+	u64 pos = 0, n;
+	i32 ret = 0;
+	u8 *buf;
+	i64 res;
+
+	if (!(entry = archive_entry(archive, index))) return -1;
+	if (!(buf = map(MAX_COMPRESS_LEN))) return -1;
+	while (pos < entry->size) {
+		n = MAX_COMPRESS_LEN - (entry->offset + pos) % MAX_COMPRESS_LEN;
+		n = min(n, entry->size - pos);
+		if ((res = archive_read(archive, index, pos, n, buf)) < 0 ||
+		    res != n || stream_write(outfd, buf, n, pos) < 0) {
+			if (res >= 0 && res != n) errno = EPROTO;
+			ret = -1;
+			break;
 		}
+		pos += n;
+	}
+	munmap(buf, MAX_COMPRESS_LEN);
+	return ret;
+}
 
-		out_offset += out_offset_update;
+PUBLIC i32 archive_verify(const Archive *archive) {
+	return decompress_verify(archive->fd, archive->data);
+}
+
+/*
+ * Creates or truncates the member's file below dir, or the current directory
+ * if dir is NULL, along with any missing directories.
+ */
+PUBLIC i32 archive_create_member(const u8 *dir, const ArchiveEntry *entry) {
+	u8 path[ARCHIVE_PATH_MAX];
+	u64 dir_len, name_len = strlen(entry->name);
+
+	if (!dir) dir = ".";
+	dir_len = strlen(dir);
+
+	if (dir_len + name_len + 2 > sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
 	}
+	fastmemcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	fastmemcpy(path + dir_len + 1, entry->name, name_len + 1);
+	for (u8 *p = path + 1; *p; p++) {
+		if (*p != '/') continue;
+		*p = '\0';
+		if (mkdirat(AT_FDCWD, (const char *)path, 0755) < 0 &&
+		    errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	return open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+}
+
+STATIC i32 archive_finish(const ArchiveEntry *entry, i32 fd) {
+	struct timeval ts[2] = {0};
+	i32 ret = 0;
+
+	ts[0].tv_sec = ts[1].tv_sec = entry->mtime;
+	if (fchmod(fd, entry->mode ? entry->mode : 0600) < 0 ||
+	    utimesat(fd, NULL, ts, 0) < 0)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+/* Closes completed members and opens the next one that still needs data */
+STATIC i32 archive_unpack_next(ArchiveUnpack *state) {
+	const ArchiveEntry *entry;
 
+	while (state->index < state->archive->count) {
+		entry = &state->archive->entries[state->index];
+		if (state->fd < 0 &&
+		    (state->fd = archive_create_member(state->dir, entry)) < 0)
+			return -1;
+		if (state->pos < entry->size) break;
+		if (archive_finish(entry, state->fd) < 0) {
+			state->fd = -1;
+			return -1;
+		}
+		state->fd = -1;
+		state->index++;
+		state->pos = 0;
+	}
 	return 0;
 }
 
+/* Splits each decoded block across the members it covers */
+STATIC i32 archive_unpack_output(void *ctx, StreamSlot *slot) {
+	ArchiveUnpack *state = ctx;
+	const ArchiveEntry *entry;
+	u64 done = 0, n;
+
+	/* archives never hold long-range records */
+	if (slot->count) {
+		errno = EPROTO;
+		return -1;
+	}
+	while (true) {
+		if (archive_unpack_next(state) < 0) return -1;
+		if (done == slot->len) return 0;
+		if (state->index == state->archive->count) {
+			errno = EPROTO;
+			return -1;
+		}
+		entry = &state->archive->entries[state->index];
+		n = min(slot->len - done, entry->size - state->pos);
+		if (stream_write(state->fd, slot->out + done, n, state->pos) <
+		    0)
+			return -1;
+		done += n;
+		state->pos += n;
+	}
+}
+
+/*
+ * Extracts every member below dir, or the current directory if dir is NULL.
+ * Blocks are decoded on every core while the calling thread writes them out.
+ */
+PUBLIC i32 archive_extract_all(const Archive *archive, const u8 *dir) {
+	ArchiveUnpack state = {.base = {.infd = archive->fd,
+					.in_offset = archive->data},
+			       .archive = archive,
+			       .dir = dir ? dir : (const u8 *)".",
+			       .fd = -1};
+	Stream *s;
+	i32 ret;
+
+	if (!(s = map(sizeof(Stream)))) return -1;
+	s->state = &state;
+	s->input = decompress_stream_input;
+	s->process = decompress_stream_process;
+	s->output = archive_unpack_output;
+	ret = stream_run(s);
+	if (!ret) ret = archive_unpack_next(&state);
+	if (!ret && state.index != archive->count) {
+		errno = EPROTO;
+		ret = -1;
+	}
+	if (state.fd >= 0) close(state.fd);
+	munmap(s, sizeof(Stream));
+	return ret;
+}
@@ -26,8 +26,11 @@
 #include <libfam/bible.h>
 #include <libfam/builtin.h>
 #include <libfam/compress.h>
+#include <libfam/compress_impl.h>
 #include <libfam/env.h>
 #include <libfam/limits.h>
+#include <libfam/linux.h>
+#include <libfam/pool.h>
 #include <libfam/storm.h>
 #include <libfam/test.h>
 
@@ -75,13 +78,8 @@ Test(compressfile_fails) {
 	i32 infd = file(path);
 	i32 outfd = file(outpath);
 
-	_debug_fork_fail = true;
-	i32 res = compress_file(infd, 0, outfd, 0);
-	if (get_physical_cores_cpuid() == 1) res = -1;	// simulate for 1 core
-	ASSERT_EQ(res, -1, "compress_file fail");
 	ASSERT_EQ(decompress_file(infd, 0, outfd, 0), -1,
 		  "decompress_file fail");
-	_debug_fork_fail = false;
 
 	_debug_pwrite_fail = 0;
 	ASSERT_EQ(decompress_file(infd, 0, outfd, 0), -1,
@@ -135,7 +133,8 @@ Test(decompressfile_fails) {
 	infd = file(outpath);
 	outfd = file(outpath2);
 
-	for (u32 i = 0; i < 100; i++) {
+	/* trailer, terminator, offset table, then the first block read */
+	for (u32 i = 0; i < 4; i++) {
 		_debug_pread_fail = i;
 		ASSERT_EQ(decompress_file(infd, 0, outfd, 0), -1,
 			  "decomp file fail1");
@@ -222,6 +221,53 @@ Test(compressfile1) {
 	ASSERT_BYTES(0);
 }
 
+Test(decompress_file_index_bounds) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *inpath = "/tmp/decompress_bounds.in";
+	const u8 *outpath = "/tmp/decompress_bounds.cz";
+	const u8 *outpath2 = "/tmp/decompress_bounds.out";
+	u64 size = 3 * MAX_COMPRESS_LEN, at, saved, bad = 1ULL << 40;
+	u8 *verify;
+	unlink(inpath);
+	unlink(outpath);
+	unlink(outpath2);
+
+	i32 fd = file(path);
+	u8 *in = fmap(fd, size, 0);
+	i32 infd = file(inpath);
+	ASSERT_EQ(pwrite(infd, in, size, 0), size, "pwrite");
+	i32 outfd = file(outpath);
+	ASSERT(!compress_file(infd, 0, outfd, 0), "compress_file");
+	close(infd);
+
+	/*
+	 * Decoding reads the mapped input, so offsets must stay inside it.
+	 * Corrupt the second of [u64 offset]*3[u64 size][u64 chunks][u32 magic]
+	 */
+	at = fsize(outfd) - sizeof(u32) - 4 * sizeof(u64);
+	ASSERT_EQ(pread(outfd, &saved, sizeof(u64), at), sizeof(u64), "read");
+	infd = file(outpath2);
+	ASSERT_EQ(pwrite(outfd, &bad, sizeof(u64), at), sizeof(u64),
+		  "corrupt");
+	ASSERT_EQ(decompress_file(outfd, 0, infd, 0), -1, "bounds");
+	ASSERT_EQ(errno, EPROTO, "EPROTO");
+	ASSERT_EQ(pwrite(outfd, &saved, sizeof(u64), at), sizeof(u64),
+		  "restore");
+	ASSERT(!decompress_file(outfd, 0, infd, 0), "decompress_file");
+	ASSERT_EQ(fsize(infd), size, "fsize");
+	verify = fmap(infd, size, 0);
+	ASSERT(!memcmp(verify, in, size), "equal");
+
+	munmap(verify, size);
+	munmap(in, size);
+	close(fd);
+	close(infd);
+	close(outfd);
+	unlink(inpath);
+	unlink(outpath);
+	unlink(outpath2);
+}
+
 Test(compress_raw) {
 	u8 in[1024] = {'a', 'b', 'c'}, out[1024] = {0}, verify[1024] = {0};
 	ASSERT_EQ(compress_block(in, 3, out, 6), 6, "compress3");
@@ -238,6 +284,110 @@ Test(compress_raw) {
 	ASSERT_EQ(verify[0], 'a', "a");
 }
 
+Test(compress_incompressible) {
+	const u8 *path = "./resources/akjv5.txt";
+	u64 size, state = 0x9E3779B97F4A7C15ULL;
+	u8 *rnd, *mid, *out, *verify, *text;
+	CompressCtx *ctx;
+	i32 fd, res;
+
+	rnd = map(MAX_COMPRESS_LEN);
+	mid = map(MAX_COMPRESS_LEN);
+	out = map(MAX_COMPRESS_LEN + 3);
+	verify = map(MAX_COMPRESS_LEN);
+	ASSERT(rnd && mid && out && verify, "map");
+	for (u32 i = 0; i < MAX_COMPRESS_LEN; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		rnd[i] = state >> 24;
+		/* about 7.64 bits per byte */
+		mid[i] = (state >> 40) % 200;
+	}
+
+	for (u8 level = 1; level <= COMPRESS_LEVEL_MAX; level += 4) {
+		res = compress_block_level(rnd, MAX_COMPRESS_LEN, out,
+					   MAX_COMPRESS_LEN + 3, level);
+		ASSERT_EQ(res, MAX_COMPRESS_LEN + 3, "stored");
+		ASSERT_EQ(decompress_block(out, res, verify, MAX_COMPRESS_LEN),
+			  MAX_COMPRESS_LEN, "decompress");
+		ASSERT(!memcmp(rnd, verify, MAX_COMPRESS_LEN), "verify");
+	}
+
+	ASSERT(!compress_ctx_init(&ctx), "ctx");
+	res = compress_block_ctx(ctx, mid, MAX_COMPRESS_LEN, out,
+				 MAX_COMPRESS_LEN + 3, 1);
+	ASSERT(res < MAX_COMPRESS_LEN, "compressed");
+
+	/* a run of raw blocks switches to store mode */
+	for (u32 i = 0; i < 4; i++)
+		ASSERT_EQ(compress_block_ctx(ctx, rnd, MAX_COMPRESS_LEN, out,
+					     MAX_COMPRESS_LEN + 3, 1),
+			  MAX_COMPRESS_LEN + 3, "raw run");
+	res = compress_block_ctx(ctx, mid, MAX_COMPRESS_LEN, out,
+				 MAX_COMPRESS_LEN + 3, 1);
+	ASSERT_EQ(res, MAX_COMPRESS_LEN + 3, "store mode");
+	ASSERT_EQ(decompress_block(out, res, verify, MAX_COMPRESS_LEN),
+		  MAX_COMPRESS_LEN, "decompress stored");
+	ASSERT(!memcmp(mid, verify, MAX_COMPRESS_LEN), "verify stored");
+
+	/* and compressible data switches back */
+	fd = file(path);
+	size = fsize(fd);
+	ASSERT(size >= MAX_COMPRESS_LEN, "size");
+	text = fmap(fd, size, 0);
+	res = compress_block_ctx(ctx, text, MAX_COMPRESS_LEN, out,
+				 MAX_COMPRESS_LEN + 3, 1);
+	ASSERT(res < MAX_COMPRESS_LEN / 2, "text");
+	res = compress_block_ctx(ctx, mid, MAX_COMPRESS_LEN, out,
+				 MAX_COMPRESS_LEN + 3, 1);
+	ASSERT(res < MAX_COMPRESS_LEN, "left store mode");
+	ASSERT_EQ(decompress_block(out, res, verify, MAX_COMPRESS_LEN),
+		  MAX_COMPRESS_LEN, "decompress mid");
+	ASSERT(!memcmp(mid, verify, MAX_COMPRESS_LEN), "verify mid");
+
+	munmap(text, size);
+	close(fd);
+	compress_ctx_destroy(ctx);
+	munmap(rnd, MAX_COMPRESS_LEN);
+	munmap(mid, MAX_COMPRESS_LEN);
+	munmap(out, MAX_COMPRESS_LEN + 3);
+	munmap(verify, MAX_COMPRESS_LEN);
+}
+
+Test(compress_short_dist) {
+	u8 in[8192], out[8192 + 3], verify[8192 + 64];
+	u64 state = 0x2545F4914F6CDD1DULL;
+	u32 len = 0, dist = 1, run;
+	i32 res;
+
+	/* fresh bytes repeated at a distance, so matches can only be close */
+	while (len < sizeof(in)) {
+		run = min(dist + 3 + (u32)(state % 300), sizeof(in) - len);
+		for (u32 i = 0; i < run; i++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			in[len + i] = i < dist ? (u8)state : in[len + i - dist];
+		}
+		len += run;
+		dist = dist % 40 + 1;
+	}
+
+	for (u8 level = 1; level <= COMPRESS_LEVEL_MAX; level += 8) {
+		res = compress_block_level(in, sizeof(in), out, sizeof(out),
+					   level);
+		ASSERT(res > 0 && res < sizeof(in) / 2, "compress");
+		ASSERT_EQ(decompress_block(out, res, verify, sizeof(verify)),
+			  sizeof(in), "decompress");
+		ASSERT(!memcmp(in, verify, sizeof(in)), "verify");
+		/* without slack the last matches take the careful path */
+		ASSERT_EQ(decompress_block(out, res, verify, sizeof(in)),
+			  sizeof(in), "decompress exact");
+		ASSERT(!memcmp(in, verify, sizeof(in)), "verify exact");
+	}
+}
+
 Test(compress_stream) {
 	const u8 *path1 = "./resources/akjv5.txt";
 	const u8 *path_out1 = "/tmp/compress_stream1.out";
@@ -259,6 +409,1145 @@ Test(compress_stream) {
 	close(fd2);
 }
 
+extern ThreadPool *__global_pool__;
+
+Test(compress_stream_parallel) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outs[] = {"/tmp/compress_stream_par1.cz",
+			    "/tmp/compress_stream_par2.cz",
+			    "/tmp/compress_stream_par3.out"};
+	ThreadPool *pool = NULL, *global = __global_pool__;
+	i32 infd = file(path), fds[3];
+	u64 size = fsize(infd), lens[2];
+	u8 *in = fmap(infd, size, 0), *a, *b;
+
+	for (u32 i = 0; i < 3; i++) {
+		unlink(outs[i]);
+		fds[i] = file(outs[i]);
+	}
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+
+	/* the same records whether or not workers help */
+	__global_pool__ = pool;
+	ASSERT(!compress_stream(infd, 0, fds[0], 0), "parallel");
+	__global_pool__ = global;
+	ASSERT(!compress_stream(infd, 0, fds[1], 0), "sequential");
+	for (u32 i = 0; i < 2; i++) lens[i] = fsize(fds[i]);
+	ASSERT_EQ(lens[0], lens[1], "same size");
+	a = fmap(fds[0], lens[0], 0);
+	b = fmap(fds[1], lens[1], 0);
+	ASSERT(!memcmp(a, b, lens[0]), "same bytes");
+	munmap(a, lens[0]);
+	munmap(b, lens[1]);
+
+	__global_pool__ = pool;
+	ASSERT(!decompress_stream(fds[0], 0, fds[2], 0), "decompress_stream");
+	ASSERT_EQ(fsize(fds[2]), size, "size");
+	a = fmap(fds[2], size, 0);
+	ASSERT(!memcmp(a, in, size), "round trip");
+	munmap(a, size);
+
+	_debug_pwrite_fail = 5;
+	ASSERT_EQ(compress_stream(infd, 0, fds[2], 0), -1, "write fail");
+	_debug_pwrite_fail = 5;
+	ASSERT_EQ(decompress_stream(fds[0], 0, fds[2], 0), -1, "write fail");
+	_debug_pwrite_fail = I64_MAX;
+	_debug_compress_fail = true;
+	ASSERT_EQ(compress_stream(infd, 0, fds[2], 0), -1, "compress fail");
+	ASSERT_EQ(decompress_stream(fds[0], 0, fds[2], 0), -1,
+		  "decompress fail");
+	_debug_compress_fail = false;
+	__global_pool__ = global;
+
+	pool_destroy(pool);
+	for (u32 i = 0; i < 3; i++) {
+		close(fds[i]);
+		unlink(outs[i]);
+	}
+	munmap(in, size);
+	close(infd);
+}
+
+Test(compress_file_parallel) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outs[] = {"/tmp/compress_file_par1.cz",
+			    "/tmp/compress_file_par2.cz"};
+	ThreadPool *pool = NULL, *global = __global_pool__;
+	i32 infd = file(path), fds[2];
+	u64 lens[2];
+	u8 *a, *b;
+
+	for (u32 i = 0; i < 2; i++) {
+		unlink(outs[i]);
+		fds[i] = file(outs[i]);
+	}
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+
+	/* workers sleep until the chunks before theirs have offsets */
+	__global_pool__ = pool;
+	ASSERT(!compress_file(infd, 0, fds[0], 0), "parallel");
+	__global_pool__ = global;
+	ASSERT(!compress_file(infd, 0, fds[1], 0), "sequential");
+	for (u32 i = 0; i < 2; i++) lens[i] = fsize(fds[i]);
+	ASSERT_EQ(lens[0], lens[1], "same size");
+	a = fmap(fds[0], lens[0], 0);
+	b = fmap(fds[1], lens[1], 0);
+	ASSERT(!memcmp(a, b, lens[0]), "same bytes");
+	munmap(a, lens[0]);
+	munmap(b, lens[1]);
+
+	/* and are woken when a failure means those offsets never come */
+	__global_pool__ = pool;
+	_debug_pwrite_fail = 5;
+	ASSERT_EQ(compress_file(infd, 0, fds[1], 0), -1, "write fail");
+	_debug_pwrite_fail = I64_MAX;
+	_debug_compress_fail = true;
+	ASSERT_EQ(compress_file(infd, 0, fds[1], 0), -1, "compress fail");
+	_debug_compress_fail = false;
+	__global_pool__ = global;
+
+	pool_destroy(pool);
+	for (u32 i = 0; i < 2; i++) {
+		close(fds[i]);
+		unlink(outs[i]);
+	}
+	close(infd);
+}
+
+Test(compress_stream_reuse) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outs[] = {
+	    "/tmp/compress_stream_reuse.in",  "/tmp/compress_stream_reuse1.cz",
+	    "/tmp/compress_stream_reuse2.cz", "/tmp/compress_stream_reuse3.cz",
+	    "/tmp/compress_stream_reuse4.cz", "/tmp/compress_stream_reuse.out"};
+	ThreadPool *pool = NULL, *global = __global_pool__;
+	u64 blocks = 8, size = blocks * MAX_COMPRESS_LEN, lens[2], records;
+	i32 infd = file(path), fds[6];
+	u8 *first = fmap(infd, MAX_COMPRESS_LEN, 0), *in, *a, *b;
+	u8 buf[100];
+	u32 len;
+
+	/* the same statistics in every block */
+	in = map(size);
+	ASSERT(in, "map");
+	for (u64 i = 0; i < blocks; i++)
+		fastmemcpy(in + i * MAX_COMPRESS_LEN, first, MAX_COMPRESS_LEN);
+	for (u32 i = 0; i < 6; i++) {
+		unlink(outs[i]);
+		fds[i] = file(outs[i]);
+	}
+	ASSERT_EQ(pwrite(fds[0], in, size, 0), size, "pwrite");
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+
+	__global_pool__ = pool;
+	ASSERT(!compress_stream(fds[0], 0, fds[1], 0), "parallel");
+	ASSERT(!compress_file(fds[0], 0, fds[3], 0), "compress_file");
+	__global_pool__ = global;
+	ASSERT(!compress_stream(fds[0], 0, fds[2], 0), "sequential");
+	for (u32 i = 0; i < 2; i++) lens[i] = fsize(fds[i + 1]);
+	ASSERT_EQ(lens[0], lens[1], "same size");
+	ASSERT(lens[0] < fsize(fds[3]), "smaller than compress_file");
+	a = fmap(fds[1], lens[0], 0);
+	b = fmap(fds[2], lens[1], 0);
+	ASSERT(!memcmp(a, b, lens[0]), "same bytes");
+	fastmemcpy(&len, a, sizeof(u32));
+	ASSERT_EQ(decompress_block_source(a + 2 * sizeof(u32) + len,
+					  lens[0] - 2 * sizeof(u32) - len),
+		  1, "second block reuses the first table");
+
+	/* the records alone, without the index footer */
+	records = lens[0] - sizeof(u32) - blocks * sizeof(u64) -
+		  (2 * sizeof(u64) + sizeof(u32));
+	ASSERT_EQ(pwrite(fds[4], a, records, 0), records, "pwrite");
+	munmap(a, lens[0]);
+	munmap(b, lens[1]);
+
+	__global_pool__ = pool;
+	ASSERT(!decompress_stream(fds[1], 0, fds[5], 0), "decompress_stream");
+	ASSERT_EQ(fsize(fds[5]), size, "stream size");
+	a = fmap(fds[5], size, 0);
+	ASSERT(!memcmp(a, in, size), "stream round trip");
+	munmap(a, size);
+	for (u32 i = 1; i < 5; i += 3) {
+		ASSERT(!decompress_file(fds[i], 0, fds[5], 0),
+		       "decompress_file");
+		a = fmap(fds[5], size, 0);
+		ASSERT(!memcmp(a, in, size), "file round trip");
+		munmap(a, size);
+		ASSERT_EQ(decompress_range(fds[i], 0, 5 * MAX_COMPRESS_LEN - 50,
+					   sizeof(buf), buf),
+			  sizeof(buf), "range");
+		ASSERT(!memcmp(buf, in + 5 * MAX_COMPRESS_LEN - 50,
+			       sizeof(buf)),
+		       "range verify");
+	}
+	__global_pool__ = global;
+
+	pool_destroy(pool);
+	for (u32 i = 0; i < 6; i++) {
+		close(fds[i]);
+		unlink(outs[i]);
+	}
+	munmap(in, size);
+	munmap(first, MAX_COMPRESS_LEN);
+	close(infd);
+}
+
+typedef struct {
+	i32 fds[4];
+	i32 res[3];
+} PoolJob;
+
+static void compress_pool_job(u32 id, void *arg) {
+	PoolJob *job = arg;
+	if (id) return;
+	job->res[0] = compress_file(job->fds[0], 0, job->fds[1], 0);
+	job->res[1] = decompress_file(job->fds[1], 0, job->fds[2], 0);
+	job->res[2] = compress_stream(job->fds[0], 0, job->fds[3], 0);
+}
+
+Test(compress_in_pool_job) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	const u8 *outs[] = {"/tmp/compress_job.cz", "/tmp/compress_job.out",
+			    "/tmp/compress_job2.cz"};
+	ThreadPool *pool = NULL, *global = __global_pool__;
+	PoolJob job = {.fds = {file(path)}, .res = {-1, -1, -1}};
+	u64 size = fsize(job.fds[0]);
+	u8 *a, *b;
+
+	for (u32 i = 0; i < 3; i++) {
+		unlink(outs[i]);
+		job.fds[i + 1] = file(outs[i]);
+	}
+	ASSERT(!pool_init(&pool, 3), "pool_init");
+
+	/* the library runs on the same pool the job came from */
+	__global_pool__ = pool;
+	ASSERT(!pool_run(pool, compress_pool_job, &job, 2), "pool_run");
+	__global_pool__ = global;
+	ASSERT(!job.res[0], "compress_file");
+	ASSERT(!job.res[1], "decompress_file");
+	ASSERT(!job.res[2], "compress_stream");
+	ASSERT_EQ(fsize(job.fds[2]), size, "size");
+	a = fmap(job.fds[0], size, 0);
+	b = fmap(job.fds[2], size, 0);
+	ASSERT(!memcmp(a, b, size), "round trip");
+	munmap(a, size);
+	munmap(b, size);
+	ASSERT(fsize(job.fds[3]) > 0, "stream");
+
+	pool_destroy(pool);
+	for (u32 i = 0; i < 4; i++) close(job.fds[i]);
+	for (u32 i = 0; i < 3; i++) unlink(outs[i]);
+}
+
+Test(compress_levels) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	i32 fd = file(path);
+	u32 size = fsize(fd);
+	u8 *in = fmap(fd, size, 0);
+	u8 out[100000] = {0}, verify[100000] = {0};
+	i32 level1 = 0, res;
+
+	for (u8 level = COMPRESS_LEVEL_MIN; level <= COMPRESS_LEVEL_MAX;
+	     level++) {
+		res = compress_block_level(in, size, out, sizeof(out), level);
+		ASSERT(res > 0, "compress level");
+		if (level == COMPRESS_LEVEL_MIN) level1 = res;
+		ASSERT(res <= level1 + 64, "level ratio");
+		fastmemset(verify, 0, sizeof(verify));
+		ASSERT_EQ(decompress_block(out, res, verify, sizeof(verify)),
+			  size, "decompress level");
+		ASSERT(!memcmp(in, verify, size), "verify level");
+	}
+	ASSERT(res < level1, "level 9 smaller than level 1");
+
+	ASSERT_EQ(compress_block(in, size, out, sizeof(out)), level1,
+		  "default level");
+
+	ASSERT_EQ(compress_block_level(in, size, out, sizeof(out), 0), -1,
+		  "level 0");
+	ASSERT_EQ(compress_block_level(in, size, out, sizeof(out),
+				       COMPRESS_LEVEL_MAX + 1),
+		  -1, "level 10");
+
+	munmap(in, size);
+	close(fd);
+}
+
+Test(compress_ctx) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	i32 fd = file(path);
+	u32 size = fsize(fd);
+	u8 *in = fmap(fd, size, 0);
+	u8 out[100000] = {0}, out2[100000] = {0}, verify[100000] = {0};
+	u32 sizes[] = {size, 100, 4096, size, 1000, 40000, 0, size};
+	CompressCtx *cctx = NULL;
+	DecompressCtx *dctx = NULL;
+	i32 res;
+
+	ASSERT(!compress_ctx_init(&cctx), "compress_ctx_init");
+	ASSERT(!decompress_ctx_init(&dctx), "decompress_ctx_init");
+
+	for (u8 level = 1; level <= 9; level += 4) {
+		for (u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			u32 len = sizes[i];
+			res = compress_block_ctx(cctx, in, len, out,
+						 sizeof(out), level);
+			ASSERT(res > 0, "compress_block_ctx");
+			ASSERT_EQ(compress_block_level(in, len, out2,
+						       sizeof(out2), level),
+				  res, "same size");
+			ASSERT(!memcmp(out, out2, res), "same bytes");
+			ASSERT_EQ(decompress_block_ctx(dctx, out, res, verify,
+						       sizeof(verify)),
+				  len, "decompress_block_ctx");
+			ASSERT(!memcmp(in, verify, len), "verify ctx");
+		}
+	}
+
+	ASSERT_EQ(compress_block_ctx(NULL, in, size, out, sizeof(out), 1), -1,
+		  "null ctx");
+	ASSERT_EQ(compress_block_ctx(cctx, in, size, out, sizeof(out), 0), -1,
+		  "bad level");
+	ASSERT_EQ(decompress_block_ctx(NULL, out, res, verify, sizeof(verify)),
+		  -1, "null dctx");
+	ASSERT_EQ(decompress_block_ctx(dctx, out, 2, verify, sizeof(verify)),
+		  -1, "short");
+	ASSERT_EQ(compress_ctx_init(NULL), -1, "null init");
+	ASSERT_EQ(decompress_ctx_init(NULL), -1, "null init");
+
+	compress_ctx_destroy(cctx);
+	decompress_ctx_destroy(dctx);
+
+	_debug_alloc_failure = true;
+	ASSERT_EQ(compress_ctx_init(&cctx), -1, "alloc fail");
+	ASSERT_EQ(decompress_ctx_init(&dctx), -1, "alloc fail");
+	_debug_alloc_failure = false;
+
+	munmap(in, size);
+	close(fd);
+}
+
+Test(compress_dict) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	i32 fd = file(path);
+	u32 size = fsize(fd);
+	u8 *in = fmap(fd, size, 0);
+	u8 out[100000] = {0}, out2[100000] = {0}, verify[100000] = {0};
+	u8 dict[16384];
+	u32 sizes[256], count = 0, plain = 0, primed = 0, half = size / 2;
+	CompressCtx *cctx = NULL;
+	DecompressCtx *dctx = NULL;
+	CompressDict *cdict = NULL;
+	i32 dlen, res;
+
+	while ((count + 1) * 200 <= half && count < 256) sizes[count++] = 200;
+	dlen = compress_dict_train(in, sizes, count, dict, sizeof(dict));
+	ASSERT(dlen > 0 && dlen <= (i32)sizeof(dict), "train");
+	ASSERT(!compress_dict_init(&cdict, dict, dlen), "dict init");
+	ASSERT(!compress_ctx_init(&cctx), "compress_ctx_init");
+	ASSERT(!decompress_ctx_init(&dctx), "decompress_ctx_init");
+
+	/* small messages from the untrained half */
+	for (u32 off = half; off + 300 <= size; off += 1500) {
+		res = compress_block_dict(cctx, cdict, in + off, 300, out,
+					  sizeof(out));
+		ASSERT(res > 0, "compress_block_dict");
+		ASSERT_EQ(decompress_block_dict(dctx, cdict, out, res, verify,
+						sizeof(verify)),
+			  300, "decompress_block_dict");
+		ASSERT(!memcmp(in + off, verify, 300), "verify dict");
+		primed += res;
+		plain += compress_block(in + off, 300, out2, sizeof(out2));
+	}
+	ASSERT(primed < plain, "dictionary helps");
+
+	/* large inputs send their own table but still reach the dictionary */
+	res = compress_block_dict(cctx, cdict, in + half, half, out,
+				  sizeof(out));
+	ASSERT(res > 0, "large dict block");
+	ASSERT_EQ(decompress_block_dict(dctx, cdict, out, res, verify,
+					sizeof(verify)),
+		  half, "large dict decompress");
+	ASSERT(!memcmp(in + half, verify, half), "verify large");
+
+	/* a dictionary table block cannot be read without the dictionary */
+	res = compress_block_dict(cctx, cdict, in + half, 300, out,
+				  sizeof(out));
+	ASSERT_EQ(decompress_block_ctx(dctx, out, res, verify, sizeof(verify)),
+		  -1, "needs dict");
+
+	/* the context drops the dictionary state for plain blocks */
+	res = compress_block_ctx(cctx, in, 4096, out, sizeof(out), 1);
+	ASSERT_EQ(compress_block(in, 4096, out2, sizeof(out2)), res,
+		  "plain after dict");
+	ASSERT(!memcmp(out, out2, res), "plain bytes after dict");
+
+	/* everything fits: the samples become the content */
+	sizes[0] = 1000;
+	dlen = compress_dict_train(in, sizes, 1, dict, sizeof(dict));
+	ASSERT_EQ(dlen, MAX_DICT_SIZE - MAX_DICT_LEN + 1000, "small train");
+
+	ASSERT_EQ(compress_dict_train(NULL, sizes, 1, dict, sizeof(dict)), -1,
+		  "null samples");
+	ASSERT_EQ(compress_dict_train(in, sizes, 1, dict, 100), -1,
+		  "small capacity");
+	ASSERT_EQ(compress_dict_train(in, sizes, 0, dict, sizeof(dict)), -1,
+		  "no samples");
+	ASSERT_EQ(compress_dict_init(NULL, dict, dlen), -1, "null dict");
+	ASSERT_EQ(compress_dict_init(&cdict, dict, 100), -1, "short dict");
+	dict[0]++;
+	ASSERT_EQ(compress_dict_init(&cdict, dict, dlen), -1, "bad magic");
+	dict[0]--;
+	dict[4] = 0;
+	ASSERT_EQ(compress_dict_init(&cdict, dict, dlen), -1, "bad length");
+	ASSERT_EQ(compress_block_dict(cctx, NULL, in, 100, out, sizeof(out)),
+		  -1, "null dict");
+	ASSERT_EQ(decompress_block_dict(dctx, NULL, out, res, verify,
+					sizeof(verify)),
+		  -1, "null dict");
+
+	compress_dict_destroy(cdict);
+	compress_ctx_destroy(cctx);
+	decompress_ctx_destroy(dctx);
+
+	_debug_alloc_failure = true;
+	ASSERT_EQ(compress_dict_train(in, sizes, 1, dict, sizeof(dict)), -1,
+		  "alloc fail");
+	_debug_alloc_failure = false;
+
+	munmap(in, size);
+	close(fd);
+}
+
+Test(compress_reuse) {
+	const u8 *path = "./resources/akjv5.txt";
+	u32 blocks = 24, chunk = 8192, reused = 0, at = 0, plain = 0, dist;
+	u8 out[24 * 9000], tmp[9000], verify[8192];
+	u32 offsets[24], lens[24];
+	CompressCtx *cctx = NULL;
+	DecompressCtx *dctx = NULL;
+	i32 res;
+
+	i32 fd = file(path);
+	u8 *in = fmap(fd, blocks * chunk, 0);
+	ASSERT(!compress_ctx_init(&cctx), "compress_ctx_init");
+	ASSERT(!decompress_ctx_init(&dctx), "decompress_ctx_init");
+
+	for (u32 i = 0; i < blocks; i++) {
+		res = compress_block_reuse(cctx, in + i * chunk, chunk,
+					   out + at, sizeof(tmp), 1);
+		ASSERT(res > 0, "compress_block_reuse");
+		offsets[i] = at;
+		lens[i] = res;
+		at += res;
+		plain += compress_block(in + i * chunk, chunk, tmp,
+					sizeof(tmp));
+		if (!(dist = decompress_block_source(out + offsets[i], res)))
+			continue;
+		ASSERT(dist <= i, "dist");
+		ASSERT(!decompress_block_source(out + offsets[i - dist],
+						lens[i - dist]),
+		       "source has a table");
+		ASSERT_EQ(decompress_block(out + offsets[i], res, tmp,
+					   sizeof(tmp)),
+			  -1, "needs table");
+		reused++;
+	}
+	ASSERT(reused > blocks / 2, "reused");
+	ASSERT(at < plain, "smaller");
+
+	for (u32 i = 0; i < blocks; i++) {
+		ASSERT_EQ(decompress_block_ctx(dctx, out + offsets[i], lens[i],
+					       verify, sizeof(verify)),
+			  chunk, "sequential");
+		ASSERT(!memcmp(verify, in + i * chunk, chunk), "verify seq");
+	}
+	for (u32 i = blocks; i--;) {
+		dist = decompress_block_source(out + offsets[i], lens[i]);
+		if (!dist) continue;
+		res = decompress_block_reuse(out + offsets[i - dist],
+					     lens[i - dist], out + offsets[i],
+					     lens[i], verify, sizeof(verify));
+		ASSERT_EQ(res, chunk, "random");
+		ASSERT(!memcmp(verify, in + i * chunk, chunk), "verify random");
+		ASSERT_EQ(decompress_block_reuse(out + offsets[i], lens[i],
+						 out + offsets[i], lens[i],
+						 verify, sizeof(verify)),
+			  -1, "source reuses");
+	}
+
+	/* a fresh context has no table to reuse */
+	for (u32 i = 1; i < blocks; i++) {
+		if (!decompress_block_source(out + offsets[i], lens[i]))
+			continue;
+		decompress_ctx_destroy(dctx);
+		ASSERT(!decompress_ctx_init(&dctx), "decompress_ctx_init");
+		ASSERT_EQ(decompress_block_ctx(dctx, out + offsets[i], lens[i],
+					       verify, sizeof(verify)),
+			  -1, "fresh ctx");
+		break;
+	}
+
+	compress_ctx_destroy(cctx);
+	decompress_ctx_destroy(dctx);
+	munmap(in, blocks * chunk);
+	close(fd);
+}
+
+Test(compress_streams) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	i32 fd = file(path);
+	u32 size = fsize(fd);
+	u8 *in = fmap(fd, size, 0);
+	u8 out[100000] = {0}, verify[100000] = {0};
+	u32 sizes[] = {1000, 1500, 2001, 2002, 2003, 2004, 5000, size};
+	i32 res;
+
+	for (u32 i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		res = compress_block(in, sizes[i], out, sizeof(out));
+		ASSERT(res > 0, "compress");
+		if (sizes[i] == 1000)
+			ASSERT(!(out[3] & 0x80), "single stream block");
+		if (sizes[i] >= 2000)
+			ASSERT(out[3] & 0x80, "multi-stream block");
+		ASSERT_EQ(decompress_block(out, res, verify, sizeof(verify)),
+			  sizes[i], "decompress");
+		ASSERT(!memcmp(in, verify, sizes[i]), "verify");
+	}
+
+	/* truncated and corrupt jump tables are rejected */
+	ASSERT_EQ(decompress_block(out, 64, verify, sizeof(verify)), -1,
+		  "truncated");
+	ASSERT_EQ(decompress_block(out, res, verify, size - 1), -1,
+		  "capacity");
+	for (u32 i = 4; i < (u32)res; i += 37) {
+		out[i] ^= 0x5A;
+		decompress_block(out, res, verify, sizeof(verify));
+		out[i] ^= 0x5A;
+	}
+	ASSERT_EQ(decompress_block(out, res, verify, sizeof(verify)), size,
+		  "decompress after corruption");
+
+	munmap(in, size);
+	close(fd);
+}
+
+Test(compress_file_levels) {
+	const u8 *path = "./resources/test_wikipedia.txt";
+	const u8 *outpath = "/tmp/compress_levels.cz";
+	const u8 *outpath2 = "/tmp/compress_levels.out";
+	unlink(outpath);
+	unlink(outpath2);
+
+	i32 infd = file(path);
+	i32 outfd = file(outpath);
+	ASSERT(!compress_file_level(infd, 0, outfd, 0, 9), "compress_file");
+	close(outfd);
+
+	outfd = file(outpath2);
+	ASSERT(!compress_stream_level(infd, 0, outfd, 0, 6),
+	       "compress_stream");
+	close(outfd);
+	close(infd);
+
+	infd = file(outpath);
+	outfd = file(outpath2);
+	ASSERT(!decompress_file(infd, 0, outfd, 0), "decompress_file");
+	close(infd);
+
+	i32 fd = file(path);
+	ASSERT_EQ(fsize(fd), fsize(outfd), "fsize");
+	void *ptr1 = fmap(fd, fsize(fd), 0);
+	void *ptr2 = fmap(outfd, fsize(outfd), 0);
+	ASSERT(!memcmp(ptr1, ptr2, fsize(fd)), "equal");
+	munmap(ptr1, fsize(fd));
+	munmap(ptr2, fsize(outfd));
+	close(fd);
+	close(outfd);
+	unlink(outpath);
+	unlink(outpath2);
+}
+
+Test(decompress_range) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outpath = "/tmp/decompress_range.cz";
+	const u8 *outpath2 = "/tmp/decompress_range2.cz";
+	u64 offsets[] = {0, 1, 12345, MAX_COMPRESS_LEN - 7, MAX_COMPRESS_LEN,
+			 3 * MAX_COMPRESS_LEN + 99};
+	u64 lens[] = {1, 100, MAX_COMPRESS_LEN + 3000, 2 * MAX_COMPRESS_LEN};
+	u8 *buf;
+	unlink(outpath);
+	unlink(outpath2);
+
+	i32 infd = file(path);
+	u64 size = fsize(infd);
+	u8 *in = fmap(infd, size, 0);
+	i32 outfd = file(outpath);
+	ASSERT(!compress_file(infd, 0, outfd, 100), "compress_file");
+	close(outfd);
+	outfd = file(outpath2);
+	ASSERT(!compress_stream(infd, 0, outfd, 0), "compress_stream");
+	close(outfd);
+	close(infd);
+
+	buf = map(2 * MAX_COMPRESS_LEN);
+	ASSERT(buf, "map");
+	i32 fd = file(outpath);
+	i32 fd2 = file(outpath2);
+	for (u32 i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		for (u32 j = 0; j < sizeof(lens) / sizeof(lens[0]); j++) {
+			ASSERT_EQ(decompress_range(fd, 100, offsets[i], lens[j],
+						   buf),
+				  lens[j], "range len");
+			ASSERT(!memcmp(buf, in + offsets[i], lens[j]), "range");
+			ASSERT_EQ(decompress_range(fd2, 0, offsets[i], lens[j],
+						   buf),
+				  lens[j], "stream range len");
+			ASSERT(!memcmp(buf, in + offsets[i], lens[j]),
+			       "stream range");
+		}
+	}
+
+	ASSERT_EQ(decompress_range(fd, 100, size - 10, 100, buf), 10, "tail");
+	ASSERT(!memcmp(buf, in + size - 10, 10), "tail data");
+	ASSERT_EQ(decompress_range(fd, 100, size, 100, buf), 0, "eof");
+	ASSERT_EQ(decompress_range(fd, 100, 0, 100, NULL), -1, "null");
+
+	_debug_pread_fail = 0;
+	ASSERT_EQ(decompress_range(fd, 100, 0, 100, buf), -1, "pread fail");
+	_debug_pread_fail = I64_MAX;
+
+	munmap(buf, 2 * MAX_COMPRESS_LEN);
+	munmap(in, size);
+	close(fd);
+	close(fd2);
+	unlink(outpath);
+	unlink(outpath2);
+}
+
+Test(compress_file_long) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outpath = "/tmp/compress_long.cz";
+	const u8 *outpath2 = "/tmp/compress_long.out";
+	const u8 *outpath3 = "/tmp/compress_long2.out";
+	const u8 *path2 = "/tmp/compress_long.in";
+	u64 offsets[] = {0, 5 * MAX_COMPRESS_LEN + 17, 30 * MAX_COMPRESS_LEN,
+			 60 * MAX_COMPRESS_LEN - 5};
+	u64 size, plain, packed;
+	u8 *in, *out, *buf;
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(outpath3);
+	unlink(path2);
+
+	i32 infd = file(path);
+	size = fsize(infd);
+	in = fmap(infd, size, 0);
+	i32 outfd = file(outpath);
+	ASSERT(!compress_file(infd, 0, outfd, 0), "compress_file");
+	plain = fsize(outfd);
+	close(outfd);
+	unlink(outpath);
+	outfd = file(outpath);
+	ASSERT(!compress_file_long(infd, 0, outfd, 0, 1), "compress_file_long");
+	packed = fsize(outfd);
+	close(outfd);
+	close(infd);
+	/* the corpus is five copies of the same text */
+	ASSERT(packed * 3 < plain, "long range matches");
+
+	infd = file(outpath);
+	outfd = file(outpath2);
+	ASSERT(!decompress_file(infd, 0, outfd, 0), "decompress_file");
+	ASSERT_EQ(fsize(outfd), size, "size");
+	out = fmap(outfd, size, 0);
+	ASSERT(!memcmp(in, out, size), "equal");
+	munmap(out, size);
+	close(outfd);
+
+	outfd = file(outpath3);
+	ASSERT(!decompress_stream(infd, 0, outfd, 0), "decompress_stream");
+	ASSERT_EQ(fsize(outfd), size, "stream size");
+	out = fmap(outfd, size, 0);
+	ASSERT(!memcmp(in, out, size), "stream equal");
+	munmap(out, size);
+	close(outfd);
+
+	buf = map(2 * MAX_COMPRESS_LEN);
+	ASSERT(buf, "map");
+	for (u32 i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		ASSERT_EQ(decompress_range(infd, 0, offsets[i],
+					   2 * MAX_COMPRESS_LEN, buf),
+			  2 * MAX_COMPRESS_LEN, "range len");
+		ASSERT(!memcmp(buf, in + offsets[i], 2 * MAX_COMPRESS_LEN),
+		       "range");
+	}
+	munmap(buf, 2 * MAX_COMPRESS_LEN);
+
+	munmap(in, size);
+	close(infd);
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(outpath3);
+
+	/*
+	 * Random data with short references followed by long literal runs:
+	 * the decoder shifts each run down over the reference it replaced,
+	 * so the copy overlaps by far more than the distance.
+	 */
+	__attribute__((aligned(32))) u8 key[32] = {7};
+	StormContext ctx;
+	size = 4 * MAX_COMPRESS_LEN;
+	in = map(size);
+	ASSERT(in, "map");
+	storm_init(&ctx, key);
+	storm_xcrypt(&ctx, in, size);
+	for (u32 i = 1; i < 4; i++)
+		fastmemcpy(in + i * MAX_COMPRESS_LEN + 999 * i,
+			   in + 4096 * i, 4096);
+	infd = file(path2);
+	ASSERT_EQ(pwrite(infd, in, size, 0), size, "pwrite");
+	outfd = file(outpath);
+	ASSERT(!compress_file_long(infd, 0, outfd, 0, 1), "compress_file_long");
+	packed = fsize(outfd);
+	close(outfd);
+	close(infd);
+	ASSERT(packed + 3 * 4096 < size + 3 * 512, "short references");
+
+	infd = file(outpath);
+	outfd = file(outpath2);
+	ASSERT(!decompress_file(infd, 0, outfd, 0), "decompress_file");
+	ASSERT_EQ(fsize(outfd), size, "size");
+	out = fmap(outfd, size, 0);
+	ASSERT(!memcmp(in, out, size), "shift equal");
+	munmap(out, size);
+	close(outfd);
+	close(infd);
+
+	munmap(in, size);
+	unlink(path2);
+	unlink(outpath);
+	unlink(outpath2);
+}
+
+Test(compress_checksum) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outpath = "/tmp/compress_checksum.cz";
+	const u8 *outpath2 = "/tmp/compress_checksum.out";
+	const u8 *outpath3 = "/tmp/compress_checksum2.cz";
+	u64 size, offset = 3 * MAX_COMPRESS_LEN - 9, pos, src;
+	u8 *in, *out, *buf, byte;
+	u32 word, head;
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(outpath3);
+
+	i32 infd = file(path);
+	size = fsize(infd);
+	in = fmap(infd, size, 0);
+	i32 outfd = file(outpath);
+	ASSERT(!compress_file_flags(infd, 0, outfd, 0, 1,
+				    COMPRESS_LONG | COMPRESS_CHECK),
+	       "compress_file_flags");
+	close(outfd);
+	outfd = file(outpath3);
+	ASSERT(!compress_stream_flags(infd, 0, outfd, 0, 1, COMPRESS_CHECK),
+	       "compress_stream_flags");
+	ASSERT(compress_stream_flags(infd, 0, outfd, 0, 1, COMPRESS_LONG),
+	       "stream long");
+	ASSERT_EQ(errno, EINVAL, "EINVAL");
+	ASSERT(!decompress_verify(outfd, 0), "verify stream output");
+	close(outfd);
+	close(infd);
+
+	infd = file(outpath);
+	ASSERT(!decompress_verify(infd, 0), "verify");
+	outfd = file(outpath2);
+	ASSERT(!decompress_file(infd, 0, outfd, 0), "decompress_file");
+	ASSERT_EQ(fsize(outfd), size, "size");
+	out = fmap(outfd, size, 0);
+	ASSERT(!memcmp(in, out, size), "equal");
+	munmap(out, size);
+	close(outfd);
+	unlink(outpath2);
+
+	outfd = file(outpath2);
+	ASSERT(!decompress_stream(infd, 0, outfd, 0), "decompress_stream");
+	ASSERT_EQ(fsize(outfd), size, "stream size");
+	out = fmap(outfd, size, 0);
+	ASSERT(!memcmp(in, out, size), "stream equal");
+	munmap(out, size);
+	close(outfd);
+	unlink(outpath2);
+
+	buf = map(MAX_COMPRESS_LEN);
+	ASSERT(buf, "map");
+	ASSERT_EQ(decompress_range(infd, 0, offset, MAX_COMPRESS_LEN, buf),
+		  MAX_COMPRESS_LEN, "range len");
+	ASSERT(!memcmp(buf, in + offset, MAX_COMPRESS_LEN), "range");
+
+	/*
+	 * A reference that copies the wrong bytes leaves every block checksum
+	 * intact, since those hash references as holes. The footer's hash of
+	 * the whole file catches it.
+	 */
+	for (pos = 0;; pos += (word & ~0x80000000U) + sizeof(u32)) {
+		ASSERT_EQ(pread(infd, &word, sizeof(u32), pos), sizeof(u32),
+			  "record");
+		ASSERT(word, "long record");
+		ASSERT_EQ(pread(infd, &head, sizeof(u32), pos + 12),
+			  sizeof(u32), "block head");
+		if ((head & LONG_FLAG) && (head & ~LONG_FLAG) <= 128) break;
+	}
+	pos += 12 + 2 * sizeof(u32) + sizeof(u32);
+	ASSERT_EQ(pread(infd, &src, sizeof(u64), pos), sizeof(u64), "src");
+	src ^= 1;
+	ASSERT_EQ(pwrite(infd, &src, sizeof(u64), pos), sizeof(u64), "move");
+	errno = 0;
+	ASSERT(decompress_verify(infd, 0), "verify moved");
+	ASSERT_EQ(errno, EBADMSG, "moved EBADMSG");
+	outfd = file(outpath2);
+	errno = 0;
+	ASSERT(decompress_file(infd, 0, outfd, 0), "decompress moved");
+	ASSERT_EQ(errno, EBADMSG, "moved file EBADMSG");
+	close(outfd);
+	unlink(outpath2);
+	outfd = file(outpath2);
+	errno = 0;
+	ASSERT(decompress_stream(infd, 0, outfd, 0), "stream moved");
+	ASSERT_EQ(errno, EBADMSG, "moved stream EBADMSG");
+	close(outfd);
+	unlink(outpath2);
+	src ^= 1;
+	ASSERT_EQ(pwrite(infd, &src, sizeof(u64), pos), sizeof(u64), "restore");
+	ASSERT(!decompress_verify(infd, 0), "verify restored");
+
+	/* the checksum of the first record follows its length */
+	ASSERT_EQ(pread(infd, &byte, 1, sizeof(u32)), 1, "pread");
+	byte ^= 1;
+	ASSERT_EQ(pwrite(infd, &byte, 1, sizeof(u32)), 1, "pwrite");
+	errno = 0;
+	ASSERT(decompress_verify(infd, 0), "verify corrupt");
+	ASSERT_EQ(errno, EBADMSG, "EBADMSG");
+	outfd = file(outpath2);
+	errno = 0;
+	ASSERT(decompress_file(infd, 0, outfd, 0), "decompress corrupt");
+	ASSERT_EQ(errno, EBADMSG, "file EBADMSG");
+	close(outfd);
+	unlink(outpath2);
+	outfd = file(outpath2);
+	errno = 0;
+	ASSERT(decompress_stream(infd, 0, outfd, 0), "stream corrupt");
+	ASSERT_EQ(errno, EBADMSG, "stream EBADMSG");
+	close(outfd);
+	errno = 0;
+	ASSERT(decompress_range(infd, 0, 0, 16, buf) < 0, "range corrupt");
+	ASSERT_EQ(errno, EBADMSG, "range EBADMSG");
+	ASSERT_EQ(decompress_range(infd, 0, offset, MAX_COMPRESS_LEN, buf),
+		  MAX_COMPRESS_LEN, "other blocks still decode");
+
+	munmap(buf, MAX_COMPRESS_LEN);
+	munmap(in, size);
+	close(infd);
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(outpath3);
+}
+
+Test(decompress_range_noindex) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outpath = "/tmp/decompress_range_noindex.cz";
+	const u8 *outpath2 = "/tmp/decompress_range_noindex.out";
+	u8 block[MAX_COMPRESS_LEN + 3 + sizeof(u32)];
+	u64 offset = 0, blocks = 3;
+	u8 *buf;
+	unlink(outpath);
+	unlink(outpath2);
+
+	/* records without a footer, as written by older versions */
+	i32 infd = file(path);
+	u8 *in = fmap(infd, blocks * MAX_COMPRESS_LEN, 0);
+	i32 outfd = file(outpath);
+	for (u64 i = 0; i < blocks; i++) {
+		i32 len = compress_block(in + i * MAX_COMPRESS_LEN,
+					 MAX_COMPRESS_LEN, block + sizeof(u32),
+					 MAX_COMPRESS_LEN + 3);
+		ASSERT(len > 0, "compress_block");
+		fastmemcpy(block, &len, sizeof(u32));
+		ASSERT_EQ(pwrite(outfd, block, len + sizeof(u32), offset),
+			  len + sizeof(u32), "pwrite");
+		offset += len + sizeof(u32);
+	}
+	close(outfd);
+	close(infd);
+
+	buf = map(MAX_COMPRESS_LEN);
+	ASSERT(buf, "map");
+	i32 fd = file(outpath);
+	ASSERT_EQ(decompress_range(fd, 0, 2 * MAX_COMPRESS_LEN - 50, 100, buf),
+		  100, "range");
+	ASSERT(!memcmp(buf, in + 2 * MAX_COMPRESS_LEN - 50, 100), "verify");
+	ASSERT_EQ(decompress_range(fd, 0, blocks * MAX_COMPRESS_LEN - 1, 100,
+				   buf),
+		  1, "tail");
+	ASSERT_EQ(decompress_range(fd, 0, 5 * MAX_COMPRESS_LEN, 100, buf), 0,
+		  "past end");
+
+	outfd = file(outpath2);
+	ASSERT(!decompress_file(fd, 0, outfd, 0), "decompress_file");
+	ASSERT_EQ(fsize(outfd), blocks * MAX_COMPRESS_LEN, "fsize");
+	u8 *verify = fmap(outfd, blocks * MAX_COMPRESS_LEN, 0);
+	ASSERT(!memcmp(verify, in, blocks * MAX_COMPRESS_LEN), "equal");
+
+	for (u32 i = 0; i < blocks; i++) {
+		_debug_pread_fail = i;
+		ASSERT_EQ(decompress_file(fd, 0, outfd, 0), -1, "walk fail");
+		_debug_pread_fail = I64_MAX;
+	}
+
+	munmap(verify, blocks * MAX_COMPRESS_LEN);
+	munmap(buf, MAX_COMPRESS_LEN);
+	munmap(in, blocks * MAX_COMPRESS_LEN);
+	close(fd);
+	close(outfd);
+	unlink(outpath);
+	unlink(outpath2);
+}
+
+Test(compress_delta) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *refpath = "/tmp/compress_delta.ref";
+	const u8 *newpath = "/tmp/compress_delta.new";
+	const u8 *outpath = "/tmp/compress_delta.cz";
+	const u8 *outpath2 = "/tmp/compress_delta.out";
+	const u8 *fullpath = "/tmp/compress_delta_full.cz";
+	u64 ref_size = 3 * MAX_COMPRESS_LEN * 4, size = 0, pos;
+	u8 *in, *data, *out, buf[64];
+	i32 infd, reffd, newfd, outfd, fd;
+	unlink(refpath);
+	unlink(newpath);
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(fullpath);
+
+	infd = file(path);
+	in = fmap(infd, fsize(infd), 0);
+	data = map(2 * ref_size);
+	ASSERT(data, "map");
+
+	/* an update: inserted, changed and deleted bytes plus a new tail */
+	for (pos = 0; pos < ref_size; pos += 100000) {
+		u64 n = min(100000, ref_size - pos);
+		fastmemcpy(data + size, in + pos, n);
+		data[size + n / 2] ^= 0x20;
+		size += n;
+		if (pos % 300000 == 0) {
+			fastmemcpy(data + size, "inserted text", 13);
+			size += 13;
+		} else if (pos % 300000 == 100000)
+			pos += 777;
+	}
+	fastmemcpy(data + size, in + 2 * ref_size, 20000);
+	size += 20000;
+
+	reffd = file(refpath);
+	ASSERT_EQ(pwrite(reffd, in, ref_size, 0), ref_size, "write ref");
+	newfd = file(newpath);
+	ASSERT_EQ(pwrite(newfd, data, size, 0), size, "write new");
+
+	outfd = file(outpath);
+	ASSERT_EQ(compress_delta(-1, newfd, 0, outfd, 0, 1, 0), -1, "no ref");
+	ASSERT_EQ(errno, EBADF, "EBADF");
+	ASSERT(!compress_delta(reffd, newfd, 0, outfd, 0, 1, COMPRESS_CHECK),
+	       "compress_delta");
+	fd = file(fullpath);
+	ASSERT(!compress_file_flags(newfd, 0, fd, 0, 1, COMPRESS_LONG),
+	       "compress_file_flags");
+	/* only the edits and the new tail cost anything */
+	ASSERT(fsize(outfd) * 20 < fsize(fd), "patch size");
+	close(fd);
+
+	/* the copied bytes are only verified against the reference */
+	errno = 0;
+	ASSERT_EQ(decompress_verify(outfd, 0), -1, "verify without reference");
+	ASSERT_EQ(errno, EINVAL, "verify EINVAL");
+	ASSERT(!decompress_verify_delta(reffd, outfd, 0), "verify");
+	fd = file(outpath2);
+	ASSERT(!decompress_delta(reffd, outfd, 0, fd, 0), "decompress_delta");
+	ASSERT_EQ(fsize(fd), size, "size");
+	out = fmap(fd, size, 0);
+	ASSERT(!memcmp(out, data, size), "equal");
+	munmap(out, size);
+	close(fd);
+	unlink(outpath2);
+
+	/* the reference is needed to rebuild the file */
+	fd = file(outpath2);
+	errno = 0;
+	ASSERT_EQ(decompress_file(outfd, 0, fd, 0), -1, "no reference");
+	ASSERT_EQ(errno, EINVAL, "file EINVAL");
+	ASSERT_EQ(fsize(fd), 0, "nothing written");
+	errno = 0;
+	ASSERT_EQ(decompress_range(outfd, 0, MAX_COMPRESS_LEN, sizeof(buf),
+				   buf),
+		  -1, "range");
+	ASSERT_EQ(errno, EINVAL, "range EINVAL");
+
+	/* and it must be the one the delta was made from */
+	errno = 0;
+	ASSERT_EQ(decompress_delta(newfd, outfd, 0, fd, 0), -1, "wrong size");
+	ASSERT_EQ(errno, EBADMSG, "size EBADMSG");
+	buf[0] = in[ref_size / 2] ^ 1;
+	ASSERT_EQ(pwrite(reffd, buf, 1, ref_size / 2), 1, "edit ref");
+	errno = 0;
+	ASSERT_EQ(decompress_delta(reffd, outfd, 0, fd, 0), -1, "wrong ref");
+	ASSERT_EQ(errno, EBADMSG, "ref EBADMSG");
+	ASSERT_EQ(fsize(fd), 0, "nothing written against it");
+	errno = 0;
+	ASSERT_EQ(decompress_verify_delta(reffd, outfd, 0), -1, "verify ref");
+	ASSERT_EQ(errno, EBADMSG, "verify EBADMSG");
+	close(fd);
+
+	munmap(data, 2 * ref_size);
+	munmap(in, fsize(infd));
+	close(outfd);
+	close(newfd);
+	close(reffd);
+	close(infd);
+	unlink(refpath);
+	unlink(newpath);
+	unlink(outpath);
+	unlink(outpath2);
+	unlink(fullpath);
+}
+
+#define ARCHIVE_MEMBERS 40
+
+Test(compress_archive) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *outpath = "/tmp/compress_archive.cza";
+	const u8 *outdir = "/tmp/compress_archive.d";
+	u8 names[ARCHIVE_MEMBERS][64], extracted[128];
+	const u8 *paths[ARCHIVE_MEMBERS];
+	u64 sizes[ARCHIVE_MEMBERS], offsets[ARCHIVE_MEMBERS], size, n;
+	const ArchiveEntry *entry;
+	Archive *a;
+	struct stat st;
+	u8 *in, *buf;
+	i32 infd, fd;
+
+	infd = file(path);
+	size = fsize(infd);
+	in = fmap(infd, size, 0);
+	buf = map(size);
+	ASSERT(buf, "map");
+
+	/* small members share blocks, the last spans several, one is empty */
+	for (u32 i = 0; i < ARCHIVE_MEMBERS; i++) {
+		strcpy(names[i], "/tmp/compress_archive_00");
+		names[i][22] = '0' + i / 10;
+		names[i][23] = '0' + i % 10;
+		paths[i] = names[i];
+		sizes[i] = i == ARCHIVE_MEMBERS - 1 ? 3 * MAX_COMPRESS_LEN + 17
+						    : (i * 7919) % 9000;
+		offsets[i] = (i * 104729) % (size - sizes[i]);
+		unlink(paths[i]);
+		fd = file(paths[i]);
+		ASSERT_EQ(pwrite(fd, in + offsets[i], sizes[i], 0), sizes[i],
+			  "pwrite");
+		ASSERT(!fchmod(fd, i % 2 ? 0640 : 0600), "fchmod");
+		close(fd);
+	}
+
+	unlink(outpath);
+	fd = file(outpath);
+	ASSERT_EQ(compress_archive(paths, ARCHIVE_MEMBERS, fd, 0, 1,
+				   COMPRESS_LONG),
+		  -1, "long");
+	ASSERT_EQ(errno, EINVAL, "EINVAL");
+	ASSERT(!compress_archive(paths, ARCHIVE_MEMBERS, fd, 0, 1,
+				 COMPRESS_CHECK),
+	       "compress_archive");
+	close(fd);
+
+	fd = file(outpath);
+	ASSERT(!archive_open(&a, fd, 0), "archive_open");
+	ASSERT_EQ(archive_count(a), ARCHIVE_MEMBERS, "count");
+	ASSERT(!archive_entry(a, ARCHIVE_MEMBERS), "entry bounds");
+	for (u32 i = 0; i < ARCHIVE_MEMBERS; i++) {
+		entry = archive_entry(a, i);
+		ASSERT(!strcmp(entry->name, paths[i] + 1), "name");
+		ASSERT_EQ(entry->size, sizes[i], "size");
+		ASSERT_EQ(entry->mode, i % 2 ? 0640 : 0600, "mode");
+		n = sizes[i] / 2;
+		ASSERT_EQ(archive_read(a, i, n, size, buf), sizes[i] - n,
+			  "archive_read");
+		ASSERT(!memcmp(buf, in + offsets[i] + n, sizes[i] - n),
+		       "read equal");
+	}
+	ASSERT(!archive_verify(a), "archive_verify");
+
+	unlink("/tmp/compress_archive.out");
+	i32 outfd = file("/tmp/compress_archive.out");
+	ASSERT(!archive_extract(a, ARCHIVE_MEMBERS - 1, outfd),
+	       "archive_extract");
+	ASSERT_EQ(pread(outfd, buf, size, 0), sizes[ARCHIVE_MEMBERS - 1],
+		  "extract size");
+	ASSERT(!memcmp(buf, in + offsets[ARCHIVE_MEMBERS - 1],
+		       sizes[ARCHIVE_MEMBERS - 1]),
+	       "extract equal");
+	close(outfd);
+	unlink("/tmp/compress_archive.out");
+
+	/* a lone member gets its directories and replaces a longer file */
+	entry = archive_entry(a, 1);
+	outfd = archive_create_member(outdir, entry);
+	ASSERT(outfd >= 0, "archive_create_member");
+	ASSERT_EQ(pwrite(outfd, in, sizes[1] + 100, 0), sizes[1] + 100,
+		  "stale");
+	close(outfd);
+	outfd = archive_create_member(outdir, entry);
+	ASSERT(!archive_extract(a, 1, outfd), "archive_extract member");
+	ASSERT(!fstat(outfd, &st), "fstat");
+	ASSERT_EQ(st.st_size, sizes[1], "truncated");
+	close(outfd);
+
+	ASSERT(!archive_extract_all(a, outdir), "archive_extract_all");
+	for (u32 i = 0; i < ARCHIVE_MEMBERS; i++) {
+		strcpy(extracted, outdir);
+		strcat(extracted, paths[i]);
+		outfd = file(extracted);
+		ASSERT(!fstat(outfd, &st), "fstat");
+		ASSERT_EQ(st.st_size, sizes[i], "extracted size");
+		ASSERT_EQ(st.st_mode & 07777, i % 2 ? 0640 : 0600, "mode");
+		ASSERT_EQ(pread(outfd, buf, size, 0), sizes[i], "pread");
+		ASSERT(!memcmp(buf, in + offsets[i], sizes[i]), "equal");
+		close(outfd);
+		unlink(extracted);
+		unlink(paths[i]);
+	}
+	archive_close(a);
+	close(fd);
+
+	/* a non-archive and a name that leaves the directory are refused */
+	ASSERT_EQ(archive_open(&a, infd, 0), -1, "not an archive");
+	ASSERT_EQ(errno, EPROTO, "EPROTO");
+	fd = file(outpath);
+	paths[0] = "/tmp/../tmp/compress_archive.cza";
+	ASSERT_EQ(compress_archive(paths, 1, fd, 0, 1, 0), -1, "dotdot");
+	ASSERT_EQ(errno, EINVAL, "dotdot EINVAL");
+	close(fd);
+
+	unlinkat(AT_FDCWD, "/tmp/compress_archive.d/tmp", AT_REMOVEDIR);
+	unlinkat(AT_FDCWD, outdir, AT_REMOVEDIR);
+	unlink(outpath);
+	munmap(buf, size);
+	munmap(in, size);
+	close(infd);
+}
+
 i32 compress_read_raw(const u8 *in, u32 len, u8 *out, u32 capacity);
 i32 compress_read_block(const u8 *in, u32 len, u8 *out, u32 capacity);
 
@@ -419,3 +1708,85 @@ Test(bible_dat) {
 	munmap(bible, BIBLE_UNCOMPRESSED_SIZE);
 }
 
+
+#define RUNS_BLOCKS 32
+#define RUNS_ITERATIONS 50
+
+/*
+ * Decoder throughput on input dominated by short-distance matches: text
+ * padded to fixed-width columns, zero fills and short repeating patterns.
+ */
+Bench(compress_runs) {
+	const u8 *path = "./resources/akjv5.txt";
+	const u8 *patterns = "-=+*#.:";
+	u64 size, pos = 0, at = 0, line = 0, packed = 0, len = 0;
+	u32 lens[RUNS_BLOCKS];
+	u8 *text, *in, *out, *verify, fbuf[MAX_F64_STRING_LEN] = {0};
+	i64 timer;
+	i32 fd;
+
+	fd = file(path);
+	size = fsize(fd);
+	text = fmap(fd, size, 0);
+	in = map(RUNS_BLOCKS * MAX_COMPRESS_LEN);
+	out = map(RUNS_BLOCKS * compress_bound(MAX_COMPRESS_LEN));
+	verify = map(MAX_COMPRESS_LEN + 32);
+	ASSERT(text && in && out && verify, "map");
+
+	while (len < RUNS_BLOCKS * MAX_COMPRESS_LEN) {
+		u64 n = 0, run = 64 + line % 512, period = line % 7 + 1;
+		const u8 *row = text + pos;
+		while (pos + n < size && text[pos + n] != '\n') n++;
+		n = min(n, RUNS_BLOCKS * MAX_COMPRESS_LEN - len);
+		fastmemcpy(in + len, row, n);
+		len += n;
+		pos = pos + n + 1 < size ? pos + n + 1 : 0;
+		/* pad to a 96 column table row */
+		while (len % 96 && len < RUNS_BLOCKS * MAX_COMPRESS_LEN)
+			in[len++] = ' ';
+		/* then a fill: zeros, a rule or part of the row repeated */
+		for (u64 i = 0; i < run && len < RUNS_BLOCKS * MAX_COMPRESS_LEN;
+		     i++)
+			in[len++] = line % 4 == 0   ? 0
+				    : line % 4 == 1 ? patterns[line % 7]
+						    : row[i % period];
+		line++;
+	}
+
+	for (u32 i = 0; i < RUNS_BLOCKS; i++) {
+		i32 res = compress_block(in + i * MAX_COMPRESS_LEN,
+					 MAX_COMPRESS_LEN, out + at,
+					 compress_bound(MAX_COMPRESS_LEN));
+		ASSERT(res > 0, "compress_block");
+		lens[i] = res;
+		at += res;
+	}
+
+	timer = micros();
+	for (u32 iter = 0; iter < RUNS_ITERATIONS; iter++) {
+		at = 0;
+		for (u32 i = 0; i < RUNS_BLOCKS; i++) {
+			packed += decompress_block(out + at, lens[i], verify,
+						   MAX_COMPRESS_LEN + 32);
+			at += lens[i];
+		}
+	}
+	timer = micros() - timer;
+	ASSERT_EQ(packed, (u64)RUNS_ITERATIONS * len, "decompressed");
+	ASSERT(!memcmp(verify, in + len - MAX_COMPRESS_LEN, MAX_COMPRESS_LEN),
+	       "verify");
+
+	f64_to_string(fbuf, (f64)len / (f64)at, 2, false);
+	pwrite(2, "ratio=", 6, 0);
+	pwrite(2, fbuf, strlen(fbuf), 0);
+	f64_to_string(fbuf, (f64)packed / (f64)timer, 1, false);
+	pwrite(2, ",mbps=", 6, 0);
+	pwrite(2, fbuf, strlen(fbuf), 0);
+	pwrite(2, "\n", 1, 0);
+
+	munmap(text, size);
+	close(fd);
+	munmap(in, RUNS_BLOCKS * MAX_COMPRESS_LEN);
+	munmap(out, RUNS_BLOCKS * compress_bound(MAX_COMPRESS_LEN));
+	munmap(verify, MAX_COMPRESS_LEN + 32);
+}
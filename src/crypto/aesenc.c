@@ -24,11 +24,12 @@
  *******************************************************************************/
 
 #include <libfam/aesenc.h>
+#include <libfam/cpu.h>
 #include <libfam/string.h>
 #include <libfam/types.h>
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
+#ifdef __x86_64__
 #define USE_AVX2
 #elif defined(__ARM_FEATURE_CRYPTO)
 #define USE_NEON
@@ -46,7 +47,7 @@
 
 typedef u8 state_t[4][4];
 
-#if !defined(USE_AVX2) && !defined(USE_NEON)
+#ifndef USE_NEON
 static const u8 sbox[256] = {
     0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
     0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
@@ -136,8 +137,7 @@ STATIC void aesenc_mix_columns(state_t *state) {
 	}
 }
 
-STATIC __attribute__((unused)) void aesenc128(u8 state[16],
-					      const u8 *RoundKey) {
+STATIC void aesenc128(u8 state[16], const u8 *RoundKey) {
 	state_t *s = (void *)state;
 	aesenc_sub_bytes(s);
 	aesenc_shift_rows(s);
@@ -145,11 +145,31 @@ STATIC __attribute__((unused)) void aesenc128(u8 state[16],
 	aesenc_add_round_key(0, s, RoundKey);
 }
 
-#endif /* !USE_AVX2 && !USE_NEON */
+STATIC void aesenc256_scalar(void *data, const void *key) {
+	aesenc128(data, key);
+	aesenc128((u8 *)data + 16, (const u8 *)key + 16);
+}
+
+#endif /* !USE_NEON */
+
+#ifdef USE_AVX2
+STATIC CPU_TARGET_AES void aesenc256_aesni(void *data, const void *key) {
+	__m128i d_lo = _mm_loadu_si128((const __m128i *)data);
+	__m128i d_hi = _mm_loadu_si128((const __m128i *)data + 1);
+	__m128i k_lo = _mm_loadu_si128((const __m128i *)key);
+	__m128i k_hi = _mm_loadu_si128((const __m128i *)key + 1);
+
+	_mm_storeu_si128((__m128i *)data, _mm_aesenc_si128(d_lo, k_lo));
+	_mm_storeu_si128((__m128i *)data + 1, _mm_aesenc_si128(d_hi, k_hi));
+}
+#endif /* USE_AVX2 */
 
 void aesenc256(void *data, const void *key) {
 #ifdef USE_AVX2
-	AESENC256(data, data, key);
+	if (cpu_features() & CPU_AES)
+		aesenc256_aesni(data, key);
+	else
+		aesenc256_scalar(data, key);
 #elif defined(USE_NEON)
 	uint8x16_t d_lo = *(const uint8x16_t *)data;
 	uint8x16_t d_hi = *(const uint8x16_t *)((const u8 *)data + 16);
@@ -168,8 +188,7 @@ void aesenc256(void *data, const void *key) {
 	*(uint8x16_t *)data = out_lo;
 	*(uint8x16_t *)((u8 *)data + 16) = out_hi;
 #else
-	aesenc128(data, key);
-	aesenc128((u8 *)data + 16, (u8 *)key + 16);
+	aesenc256_scalar(data, key);
 #endif
 }
 
@@ -25,11 +25,12 @@
 
 #include <libfam/aesenc.h>
 #include <libfam/aighthash.h>
+#include <libfam/cpu.h>
 #include <libfam/string.h>
 #include <libfam/utils.h>
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
+#ifdef __x86_64__
 #define USE_AVX2
 #elif defined(__ARM_FEATURE_CRYPTO)
 #define USE_NEON
@@ -53,67 +54,59 @@ static const u8* AIGHT_DOMAIN = (void*)AIGHT_NUMS;
 #define AIGHT_P1 0xc2b2ae35u
 #define AIGHT_P2 0x85ebca6bu
 
-PUBLIC u64 aighthash64(const void* data, u64 len, u64 seed) {
-	const u8* p = (const u8*)data;
-	u64 h = seed ^ AIGHT64_INIT, tail = 0;
+STATIC u64 aighthash_finish(u64 h, const u8* p, u64 len) {
+	u64 tail = 0;
 
-#ifdef USE_AVX2
-	__m256i key = _mm256_load_si256((const __m256i*)AIGHT_DOMAIN);
-#elif defined(USE_NEON)
-	uint8x16_t key_lo = vld1q_u8(AIGHT_DOMAIN);
-	uint8x16_t key_hi = vld1q_u8(AIGHT_DOMAIN + 16);
-#else
-	const u8* key = AIGHT_DOMAIN;
-#endif
-
-	while (len >= 256) {
-		for (int i = 0; i < 8; i++) {
-#ifdef USE_AVX2
-			__m256i x =
-			    _mm256_loadu_si256((const __m256i*)(p + i * 32));
-			AESENC256(&x, &x, &key);
+	while (len--) tail ^= (u64)*p++ << (8 * (len & 7));
 
-			__attribute__((aligned(32))) u64 parts[4];
-			_mm256_store_si256((__m256i*)parts, x);
-			h ^= parts[0] ^ parts[1] ^ parts[2] ^ parts[3];
-#elif defined(USE_NEON)
-			uint8x16_t lo = vld1q_u8(p + i * 32);
-			uint8x16_t hi = vld1q_u8(p + i * 32 + 16);
+	h ^= tail;
+	h *= AIGHT_P2;
+	h ^= h >> 29;
+	h *= AIGHT_P1;
+	h ^= h >> 33;
 
-			lo = veorq_u8(lo, key_lo);
-			lo = vaeseq_u8(lo, vdupq_n_u8(0));
-			lo = vaesmcq_u8(lo);
+	return h;
+}
 
-			hi = veorq_u8(hi, key_hi);
-			hi = vaeseq_u8(hi, vdupq_n_u8(0));
-			hi = vaesmcq_u8(hi);
+#ifdef USE_AVX2
+#define AIGHT_BLOCK_AVX2(h, p, key, aesenc)                                 \
+	do {                                                                \
+		__m256i _x__ = _mm256_loadu_si256((const __m256i*)(p));     \
+		__attribute__((aligned(32))) u64 _parts__[4];               \
+		aesenc(&_x__, &_x__, &key);                                 \
+		_mm256_store_si256((__m256i*)_parts__, _x__);               \
+		h ^= _parts__[0] ^ _parts__[1] ^ _parts__[2] ^ _parts__[3]; \
+	} while (0);
+
+#define AIGHT_HASH_AVX2(h, p, len, aesenc)                                   \
+	do {                                                                 \
+		__m256i _key__ =                                             \
+		    _mm256_load_si256((const __m256i*)AIGHT_DOMAIN);         \
+		for (; len >= 256; p += 256, len -= 256)                     \
+			for (int _i__ = 0; _i__ < 8; _i__++)                 \
+				AIGHT_BLOCK_AVX2(h, p + _i__ * 32, _key__,   \
+						 aesenc);                    \
+		for (; len >= 32; p += 32, len -= 32)                        \
+			AIGHT_BLOCK_AVX2(h, p, _key__, aesenc);              \
+	} while (0);
+
+STATIC CPU_TARGET_VAES u64 aighthash64_vaes(const u8* p, u64 len, u64 h) {
+	AIGHT_HASH_AVX2(h, p, len, AESENC256_VAES);
+	return aighthash_finish(h, p, len);
+}
 
-			__attribute__((aligned(16))) u64 parts[4];
-			vst1q_u64(parts + 0, vreinterpretq_u64_u8(lo));
-			vst1q_u64(parts + 2, vreinterpretq_u64_u8(hi));
+STATIC CPU_TARGET_AVX2 u64 aighthash64_avx2(const u8* p, u64 len, u64 h) {
+	AIGHT_HASH_AVX2(h, p, len, AESENC256_AESNI);
+	return aighthash_finish(h, p, len);
+}
+#endif /* USE_AVX2 */
 
-			h ^= parts[0] ^ parts[1] ^ parts[2] ^ parts[3];
-#else
-			u8 x[32];
-			fastmemcpy(x, p + i * 32, 32);
-			aesenc256(x, key);
-			h ^= *(u64*)x ^ *(u64*)(x + 8) ^ *(u64*)(x + 16) ^
-			     *(u64*)(x + 24);
-#endif
-		}
-		p += 256;
-		len -= 256;
-	}
+#ifdef USE_NEON
+STATIC u64 aighthash64_neon(const u8* p, u64 len, u64 h) {
+	uint8x16_t key_lo = vld1q_u8(AIGHT_DOMAIN);
+	uint8x16_t key_hi = vld1q_u8(AIGHT_DOMAIN + 16);
 
 	while (len >= 32) {
-#ifdef USE_AVX2
-		__m256i x = _mm256_loadu_si256((const __m256i*)p);
-		AESENC256(&x, &x, &key);
-
-		__attribute__((aligned(32))) u64 parts[4];
-		_mm256_store_si256((__m256i*)parts, x);
-		h ^= parts[0] ^ parts[1] ^ parts[2] ^ parts[3];
-#elif defined(USE_NEON)
 		uint8x16_t lo = vld1q_u8(p);
 		uint8x16_t hi = vld1q_u8(p + 16);
 
@@ -130,24 +123,58 @@ PUBLIC u64 aighthash64(const void* data, u64 len, u64 seed) {
 		vst1q_u64(parts + 2, vreinterpretq_u64_u8(hi));
 
 		h ^= parts[0] ^ parts[1] ^ parts[2] ^ parts[3];
+		p += 32;
+		len -= 32;
+	}
+	return aighthash_finish(h, p, len);
+}
 #else
+STATIC u64 aighthash64_scalar(const u8* p, u64 len, u64 h) {
+	const u8* key = AIGHT_DOMAIN;
+
+	while (len >= 32) {
 		u8 x[32];
 		fastmemcpy(x, p, 32);
 		aesenc256(x, key);
 		h ^= *(u64*)x ^ *(u64*)(x + 8) ^ *(u64*)(x + 16) ^
 		     *(u64*)(x + 24);
-#endif
 		p += 32;
 		len -= 32;
 	}
+	return aighthash_finish(h, p, len);
+}
+#endif /* !USE_NEON */
 
-	while (len--) tail ^= (u64)*p++ << (8 * (len & 7));
-
-	h ^= tail;
-	h *= AIGHT_P2;
-	h ^= h >> 29;
-	h *= AIGHT_P1;
-	h ^= h >> 33;
+#ifdef USE_AVX2
+typedef u64 (*AightKernel)(const u8* p, u64 len, u64 h);
+
+static AightKernel aighthash_kernel = NULL;
+
+/* Picks the kernel for this CPU on first use */
+STATIC AightKernel aighthash_select(void) {
+	AightKernel k = __atomic_load_n(&aighthash_kernel, __ATOMIC_RELAXED);
+	if (__builtin_expect(!k, 0)) {
+		u32 features = cpu_features();
+		if (features & CPU_VAES)
+			k = aighthash64_vaes;
+		else if ((features & (CPU_AVX2 | CPU_AES)) ==
+			 (CPU_AVX2 | CPU_AES))
+			k = aighthash64_avx2;
+		else
+			k = aighthash64_scalar;
+		__atomic_store_n(&aighthash_kernel, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+#endif /* USE_AVX2 */
 
-	return h;
+PUBLIC u64 aighthash64(const void* data, u64 len, u64 seed) {
+	u64 h = seed ^ AIGHT64_INIT;
+#ifdef USE_AVX2
+	return aighthash_select()(data, len, h);
+#elif defined(USE_NEON)
+	return aighthash64_neon(data, len, h);
+#else
+	return aighthash64_scalar(data, len, h);
+#endif
 }
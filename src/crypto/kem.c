@@ -23,44 +23,79 @@
  *
  *******************************************************************************/
 
+#include <libfam/cpu.h>
 #include <libfam/kem.h>
+#include <libfam/kem_impl.h>
+#include <libfam/utils.h>
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
+#ifdef __x86_64__
 #define USE_AVX2
-#endif /* __AVX2__ */
+#endif /* __x86_64__ */
 #endif /* NO_VECTOR */
 
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
 i32 pqcrystals_kyber512_ref_keypair(u8 *pk, u8 *sk, Rng *rng);
 i32 pqcrystals_kyber512_ref_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng);
+i32 pqcrystals_kyber512_ref_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_kyber512_ref_enc_expanded(u8 *ct, u8 *ss, const u8 *epk,
+					 Rng *rng);
 i32 pqcrystals_kyber512_ref_dec(u8 *ss, const u8 *ct, const u8 *sk);
 i32 pqcrystals_kyber512_avx2_keypair(u8 *pk, u8 *sk, Rng *rng);
 i32 pqcrystals_kyber512_avx2_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng);
+i32 pqcrystals_kyber512_avx2_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_kyber512_avx2_enc_expanded(u8 *ct, u8 *ss, const u8 *epk,
+					  Rng *rng);
 i32 pqcrystals_kyber512_avx2_dec(u8 *ss, const u8 *ct, const u8 *sk);
 
+STATIC_ASSERT(KEM_PUBKEY_EXPANDED_SIZE == KYBER_PUBLICKEYEXPANDEDBYTES,
+	      kem_pubkey_expanded_size);
+
 void keypair(KemPubKey *pk, KemSecKey *sk, Rng *rng) {
 #ifdef USE_AVX2
-	pqcrystals_kyber512_avx2_keypair(pk->data, sk->data, rng);
-#else
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_kyber512_avx2_keypair(pk->data, sk->data, rng);
+		return;
+	}
+#endif /* USE_AVX2 */
 	pqcrystals_kyber512_ref_keypair(pk->data, sk->data, rng);
-#endif
 }
 void enc(KemCipherText *ct, KemSharedSecret *ss, const KemPubKey *pk,
 	 Rng *rng) {
 #ifdef USE_AVX2
-	pqcrystals_kyber512_avx2_enc(ct->data, ss->data, pk->data, rng);
-#else
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_kyber512_avx2_enc(ct->data, ss->data, pk->data, rng);
+		return;
+	}
+#endif /* USE_AVX2 */
 	pqcrystals_kyber512_ref_enc(ct->data, ss->data, pk->data, rng);
-#endif
+}
+void kem_pk_expand(KemPubKeyExpanded *epk, const KemPubKey *pk) {
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_kyber512_avx2_pk_expand(epk->data, pk->data);
+		return;
+	}
+#endif /* USE_AVX2 */
+	pqcrystals_kyber512_ref_pk_expand(epk->data, pk->data);
+}
+void enc_expanded(KemCipherText *ct, KemSharedSecret *ss,
+		  const KemPubKeyExpanded *epk, Rng *rng) {
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_kyber512_avx2_enc_expanded(ct->data, ss->data,
+						      epk->data, rng);
+		return;
+	}
+#endif /* USE_AVX2 */
+	pqcrystals_kyber512_ref_enc_expanded(ct->data, ss->data, epk->data,
+					     rng);
 }
 void dec(KemSharedSecret *ss, const KemCipherText *ct, const KemSecKey *sk) {
 #ifdef USE_AVX2
-	pqcrystals_kyber512_avx2_dec(ss->data, ct->data, sk->data);
-#else
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_kyber512_avx2_dec(ss->data, ct->data, sk->data);
+		return;
+	}
+#endif /* USE_AVX2 */
 	pqcrystals_kyber512_ref_dec(ss->data, ct->data, sk->data);
-#endif
 }
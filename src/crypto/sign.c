@@ -0,0 +1,130 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#include <libfam/aighthash.h>
+#include <libfam/atomic.h>
+#include <libfam/pool.h>
+#include <libfam/sign.h>
+#include <libfam/string.h>
+#include <libfam/syscall.h>
+#include <libfam/sysext.h>
+#include <libfam/utils.h>
+
+/* Signatures a worker takes at a time */
+#define VERIFY_BATCH_CHUNK 64
+
+typedef struct {
+	const u8 (*msgs)[32];
+	const PublicKey *pks;
+	const Signature *sigs;
+	i32 *results;
+	const u64 *order;
+	u32 n;
+	u32 next;
+	u32 failed;
+} VerifyBatch;
+
+STATIC void verify_batch_sift(u64 *a, u64 root, u64 n) {
+	u64 v = a[root], child;
+
+	while ((child = 2 * root + 1) < n) {
+		if (child + 1 < n && a[child + 1] > a[child]) child++;
+		if (a[child] <= v) break;
+		a[root] = a[child];
+		root = child;
+	}
+	a[root] = v;
+}
+
+STATIC void verify_batch_sort(u64 *a, u64 n) {
+	for (u64 i = n / 2; i-- > 0;) verify_batch_sift(a, i, n);
+	for (u64 i = n; i-- > 1;) {
+		u64 t = a[0];
+		a[0] = a[i];
+		a[i] = t;
+		verify_batch_sift(a, 0, i);
+	}
+}
+
+/* Consecutive signatures under the same key share one expansion */
+STATIC void verify_batch_range(VerifyBatch *vb, u32 start, u32 end) {
+	PublicKeyExpanded epk;
+	const PublicKey *last = NULL;
+
+	for (u32 i = start; i < end; i++) {
+		u32 j = vb->order ? (u32)vb->order[i] : i;
+		const PublicKey *pk = &vb->pks[j];
+
+		if (!last || fastmemcmp(last, pk, sizeof(PublicKey))) {
+			pk_expand(pk, &epk);
+			last = pk;
+		}
+		vb->results[j] =
+		    verify_expanded(vb->msgs[j], &epk, &vb->sigs[j]);
+		if (vb->results[j]) __aadd32(&vb->failed, 1);
+	}
+}
+
+STATIC void verify_batch_worker(u32 id, void *arg) {
+	VerifyBatch *vb = arg;
+	u32 start;
+
+	(void)id;
+	while ((start = __aadd32(&vb->next, VERIFY_BATCH_CHUNK)) < vb->n)
+		verify_batch_range(vb, start,
+				   min(start + VERIFY_BATCH_CHUNK, vb->n));
+}
+
+PUBLIC i32 verify_batch(const u8 msgs[][32], const PublicKey *pks,
+			const Signature *sigs, u32 n, i32 *results) {
+	VerifyBatch vb = {msgs, pks, sigs, results, NULL, n, 0, 0};
+	ThreadPool *pool;
+	u64 *order;
+
+	if (!n) return 0;
+
+	/*
+	 * Sort by key hash (high half) then index (low half) so signatures
+	 * under the same key end up next to each other. Without the scratch
+	 * space the batch is verified in the order given.
+	 */
+	order = map(n * sizeof(u64));
+	if (order) {
+		for (u32 i = 0; i < n; i++)
+			order[i] = (aighthash64(&pks[i], sizeof(PublicKey), 0) &
+				    0xFFFFFFFF00000000ULL) |
+				   i;
+		verify_batch_sort(order, n);
+		vb.order = order;
+	}
+
+	pool = n > VERIFY_BATCH_CHUNK ? global_pool() : NULL;
+	if (!pool || pool_run(pool, verify_batch_worker, &vb,
+			      pool_threads(pool) + 1))
+		verify_batch_worker(0, &vb);
+
+	if (order) munmap(order, n * sizeof(u64));
+	return vb.failed ? -1 : 0;
+}
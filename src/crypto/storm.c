@@ -24,12 +24,14 @@
  *******************************************************************************/
 
 #include <libfam/aesenc.h>
+#include <libfam/cpu.h>
+#include <libfam/errno.h>
 #include <libfam/storm.h>
 #include <libfam/string.h>
 #include <libfam/utils.h>
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
+#ifdef __x86_64__
 #define USE_AVX2
 #elif defined(__ARM_FEATURE_CRYPTO)
 #define USE_NEON
@@ -63,8 +65,137 @@ typedef struct {
 	__attribute__((aligned(32))) u8 counter[32];
 } StormContextImpl;
 
+/* XORs the first len (< 32) bytes of a keystream block into buf */
+STATIC void storm_xor_tail(u8 *buf, const void *keystream, u64 len) {
+	const u8 *k = keystream;
+	for (u64 i = 0; i < len; i++) buf[i] ^= k[i];
+}
+
+/*
+ * Bulk CTR for backends without a pipelined kernel. A short tail consumes a
+ * whole counter block, exactly as a zero-padded storm_xcrypt_buffer would.
+ */
+STATIC void storm_xcrypt_blocks(StormContext *ctx, u8 *buf, u64 len,
+				void (*xcrypt_buffer)(StormContext *, u8 *)) {
+	__attribute__((aligned(32))) u8 block[32];
+	while (len >= 32) {
+		fastmemcpy(block, buf, 32);
+		xcrypt_buffer(ctx, block);
+		fastmemcpy(buf, block, 32);
+		buf += 32;
+		len -= 32;
+	}
+	if (len) {
+		fastmemset(block, 0, 32);
+		xcrypt_buffer(ctx, block);
+		storm_xor_tail(buf, block, len);
+	}
+}
+
+/* Multi-lane storm_next_block for backends without an interleaved kernel */
+STATIC void storm_next_block_lanes(StormContext *lane, u8 *const *blocks,
+				   u32 lanes, u64 len,
+				   void (*next_block)(StormContext *, u8 *)) {
+	for (u64 off = 0; off < len; off += 32)
+		for (u32 i = 0; i < lanes; i++)
+			next_block(&lane[i], blocks[i] + off);
+}
+
+/*
+ * Returns the first chain at or after next that has steps left, copying the
+ * zero-step chains it skips straight to out.
+ */
+STATIC u32 storm_chain_next(u8 *out, const u8 *in, const u32 *steps, u32 n,
+			    u32 next) {
+	for (; next < n && !steps[next]; next++)
+		if (out != in) fastmemmove(out + next * 32, in + next * 32, 32);
+	return next;
+}
+
+/* storm_chain for backends without a multi-buffer kernel */
+STATIC void storm_chain_blocks(const StormContext *ctx, u8 *out, const u8 *in,
+			       const u32 *steps, u32 n,
+			       void (*next_block)(StormContext *, u8 *)) {
+	__attribute__((aligned(32))) u8 block[32];
+	StormContext tmp;
+
+	for (u32 i = 0; i < n; i++) {
+		fastmemcpy(block, in + i * 32, 32);
+		for (u32 j = 0; j < steps[i]; j++) {
+			tmp = *ctx;
+			next_block(&tmp, block);
+		}
+		fastmemcpy(out + i * 32, block, 32);
+	}
+}
+
+/* What the AEAD kernels do with each block */
+#define STORM_AEAD_AD 0
+#define STORM_AEAD_SEAL 1
+#define STORM_AEAD_OPEN 2
+
+/*
+ * Applies up to 32 bytes of keystream to p, unless it is associated data,
+ * and writes the zero-padded ciphertext block the authenticator absorbs.
+ */
+STATIC void storm_aead_block(u8 *p, u64 n, const void *keystream, u8 c[32],
+			     i32 mode) {
+	const u8 *k = keystream;
+	fastmemset(c, 0, 32);
+	for (u64 i = 0; i < n; i++) {
+		u8 d = p[i];
+		if (mode != STORM_AEAD_AD) p[i] = d ^ k[i];
+		c[i] = mode == STORM_AEAD_SEAL ? p[i] : d;
+	}
+}
+
+/*
+ * Single-pass AEAD for backends without a pipelined kernel. Each counter
+ * block advances the state chain as storm_xcrypt does; the new state masks
+ * the ciphertext block, which then takes four rounds under the mac keys and
+ * is XORed into acc.
+ */
+STATIC void storm_aead_blocks(StormContext *ctx, const StormContext *mac,
+			      u8 *buf, u64 len, u8 acc[32], i32 mode) {
+	StormContextImpl *st = (StormContextImpl *)ctx;
+	const StormContextImpl *mt = (const StormContextImpl *)mac;
+	__attribute__((aligned(32))) u8 x[32], c[32];
+	u64 *counter = (u64 *)st->counter;
+
+	while (len) {
+		u64 n = len < 32 ? len : 32;
+		for (int i = 0; i < 32; i++)
+			x[i] = st->state[i] ^ st->counter[i];
+		aesenc256(x, st->key0);
+		for (int i = 0; i < 16; i++) {
+			st->state[i] = x[i + 16];
+			st->state[i + 16] = x[i] ^ x[i + 16];
+		}
+		if (mode != STORM_AEAD_AD) {
+			aesenc256(x, st->key1);
+			for (int i = 0; i < 32; i++) x[i] ^= st->state[i];
+			aesenc256(x, st->key2);
+			aesenc256(x, st->key3);
+		}
+		storm_aead_block(buf, n, x, c, mode);
+		for (int i = 0; i < 32; i++) c[i] ^= st->state[i];
+		aesenc256(c, mt->key0);
+		aesenc256(c, mt->key1);
+		aesenc256(c, mt->key2);
+		aesenc256(c, mt->key3);
+		for (int i = 0; i < 32; i++) acc[i] ^= c[i];
+		++counter[0];
+		++counter[1];
+		++counter[2];
+		++counter[3];
+		buf += n;
+		len -= n;
+	}
+}
+
 #ifdef USE_AVX2
-STATIC void storm_init_avx2(StormContext *ctx, const u8 key[32]) {
+STATIC CPU_TARGET_AVX2 void storm_init_avx2(StormContext *ctx,
+					    const u8 key[32]) {
 	static const __attribute__((aligned(32))) u8 ZERO256[32] = {0};
 	StormContextImpl *st = (StormContextImpl *)ctx;
 	__m256i key256 = _mm256_load_si256((const __m256i *)key);
@@ -81,33 +212,388 @@ STATIC void storm_init_avx2(StormContext *ctx, const u8 key[32]) {
 	*(__m256i *)st->key3 = _mm256_xor_si256(key256, domain_key);
 	*(__m256i *)st->counter = _mm256_load_si256((const __m256i *)ZERO256);
 }
-STATIC void storm_next_block_avx2(StormContext *ctx, u8 buf[32]) {
-	StormContextImpl *st = (StormContextImpl *)ctx;
-	__m256i p = _mm256_load_si256((const __m256i *)buf);
-	__m256i x = _mm256_xor_si256(*(const __m256i *)st->state, p);
-	AESENC256(&x, &x, st->key0);
-	__m128i lo = _mm256_castsi256_si128(x);
-	__m128i hi = _mm256_extracti128_si256(x, 1);
-	lo = _mm_xor_si128(lo, hi);
-	*(__m256i *)st->state = _mm256_set_m128i(lo, hi);
-	AESENC256(&x, &x, st->key1);
-	x = _mm256_xor_si256(*(__m256i *)st->state, x);
-	AESENC256(&x, &x, st->key2);
-	AESENC256(&x, &x, st->key3);
-	_mm256_store_si256((__m256i *)buf, x);
-}
-
-STATIC void storm_xcrypt_buffer_avx2(StormContext *ctx, u8 buf[32]) {
-	StormContextImpl *st = (StormContextImpl *)ctx;
-	__m256i ctr = *(__m256i *)st->counter;
-	storm_next_block(ctx, (u8 *)&ctr);
-	_mm256_store_si256(
-	    (__m256i *)buf,
-	    _mm256_xor_si256(_mm256_load_si256((__m256i *)buf), ctr));
-	*(__m256i *)st->counter =
-	    _mm256_add_epi64(*(__m256i *)st->counter, _mm256_set1_epi64x(1));
+
+/* The AES-NI and VAES kernels differ only in how the rounds are issued */
+#define STORM_NEXT_BLOCK_AVX2(ctx, buf, aesenc)                              \
+	do {                                                                 \
+		StormContextImpl *_st__ = (StormContextImpl *)(ctx);         \
+		__m256i _p__ = _mm256_load_si256((const __m256i *)(buf));    \
+		__m256i _x__ =                                               \
+		    _mm256_xor_si256(*(const __m256i *)_st__->state, _p__);  \
+		aesenc(&_x__, &_x__, _st__->key0);                           \
+		__m128i _lo__ = _mm256_castsi256_si128(_x__);                \
+		__m128i _hi__ = _mm256_extracti128_si256(_x__, 1);           \
+		_lo__ = _mm_xor_si128(_lo__, _hi__);                         \
+		*(__m256i *)_st__->state = _mm256_set_m128i(_lo__, _hi__);   \
+		aesenc(&_x__, &_x__, _st__->key1);                           \
+		_x__ = _mm256_xor_si256(*(__m256i *)_st__->state, _x__);     \
+		aesenc(&_x__, &_x__, _st__->key2);                           \
+		aesenc(&_x__, &_x__, _st__->key3);                           \
+		_mm256_store_si256((__m256i *)(buf), _x__);                  \
+	} while (0);
+
+#define STORM_XCRYPT_BUFFER_AVX2(ctx, buf, next_block)                        \
+	do {                                                                  \
+		StormContextImpl *_st__ = (StormContextImpl *)(ctx);          \
+		__m256i _ctr__ = *(__m256i *)_st__->counter;                  \
+		next_block(ctx, (u8 *)&_ctr__);                               \
+		_mm256_store_si256(                                           \
+		    (__m256i *)(buf),                                         \
+		    _mm256_xor_si256(_mm256_load_si256((__m256i *)(buf)),     \
+				     _ctr__));                                \
+		*(__m256i *)_st__->counter = _mm256_add_epi64(                \
+		    *(__m256i *)_st__->counter, _mm256_set1_epi64x(1));       \
+	} while (0);
+
+/* Value forms of the AESENC256 macros, so the bulk kernels stay in registers */
+#define STORM_AESENC_VAES(x, k) _mm256_aesenc_epi128(x, k)
+#define STORM_AESENC_AESNI(x, k)                              \
+	_mm256_set_m128i(                                     \
+	    _mm_aesenc_si128(_mm256_extracti128_si256(x, 1),  \
+			     _mm256_extracti128_si256(k, 1)), \
+	    _mm_aesenc_si128(_mm256_castsi256_si128(x),       \
+			     _mm256_castsi256_si128(k)))
+
+/*
+ * Only the first round of each block feeds the state of the next one. The
+ * state chain is walked for STORM_LANES counter blocks, then the remaining
+ * rounds of those blocks are issued together so the AES units stay busy.
+ */
+#define STORM_LANES 4
+#define STORM_XCRYPT_AVX2(ctx, buf, len, aesenc)                               \
+	do {                                                                   \
+		StormContextImpl *_st__ = (StormContextImpl *)(ctx);           \
+		__m256i _s__ = _mm256_load_si256((__m256i *)_st__->state);     \
+		__m256i _ctr__ = _mm256_load_si256((__m256i *)_st__->counter); \
+		__m256i _k0__ = _mm256_load_si256((__m256i *)_st__->key0);     \
+		__m256i _k1__ = _mm256_load_si256((__m256i *)_st__->key1);     \
+		__m256i _k2__ = _mm256_load_si256((__m256i *)_st__->key2);     \
+		__m256i _k3__ = _mm256_load_si256((__m256i *)_st__->key3);     \
+		__m256i _one__ = _mm256_set1_epi64x(1);                        \
+		__m256i _zero__ = _mm256_setzero_si256();                      \
+		__m256i _x__[STORM_LANES];                                     \
+		u8 *_p__ = (buf);                                              \
+		u64 _n__ = (len);                                              \
+		while (_n__) {                                                 \
+			u32 _blocks__ = _n__ >= STORM_LANES * 32               \
+					    ? STORM_LANES                      \
+					    : (u32)((_n__ + 31) >> 5);         \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++) {         \
+				__m256i _y__ = aesenc(                         \
+				    _mm256_xor_si256(_s__, _ctr__), _k0__);    \
+				_s__ = _mm256_xor_si256(                       \
+				    _mm256_permute2x128_si256(_y__, _y__, 1),  \
+				    _mm256_blend_epi32(_zero__, _y__, 0xF0));  \
+				_x__[_i__] = _mm256_xor_si256(                 \
+				    _s__, aesenc(_y__, _k1__));                \
+				_ctr__ = _mm256_add_epi64(_ctr__, _one__);     \
+			}                                                      \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_x__[_i__] = aesenc(_x__[_i__], _k2__);        \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_x__[_i__] = aesenc(_x__[_i__], _k3__);        \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++) {         \
+				if (_n__ < 32) {                               \
+					storm_xor_tail(_p__, &_x__[_i__],      \
+						       _n__);                  \
+					_n__ = 0;                              \
+					break;                                 \
+				}                                              \
+				_mm256_storeu_si256(                           \
+				    (__m256i *)_p__,                           \
+				    _mm256_xor_si256(                          \
+					_mm256_loadu_si256((__m256i *)_p__),   \
+					_x__[_i__]));                          \
+				_p__ += 32;                                    \
+				_n__ -= 32;                                    \
+			}                                                      \
+		}                                                              \
+		_mm256_store_si256((__m256i *)_st__->state, _s__);             \
+		_mm256_store_si256((__m256i *)_st__->counter, _ctr__);         \
+	} while (0);
+
+STATIC CPU_TARGET_AVX2 void storm_next_block_avx2(StormContext *ctx,
+						  u8 buf[32]) {
+	STORM_NEXT_BLOCK_AVX2(ctx, buf, AESENC256_AESNI);
 }
-#elif defined(USE_NEON)
+
+STATIC CPU_TARGET_AVX2 void storm_xcrypt_buffer_avx2(StormContext *ctx,
+						     u8 buf[32]) {
+	STORM_XCRYPT_BUFFER_AVX2(ctx, buf, storm_next_block_avx2);
+}
+
+STATIC CPU_TARGET_VAES void storm_next_block_vaes(StormContext *ctx,
+						  u8 buf[32]) {
+	STORM_NEXT_BLOCK_AVX2(ctx, buf, AESENC256_VAES);
+}
+
+STATIC CPU_TARGET_VAES void storm_xcrypt_buffer_vaes(StormContext *ctx,
+						     u8 buf[32]) {
+	STORM_XCRYPT_BUFFER_AVX2(ctx, buf, storm_next_block_vaes);
+}
+
+STATIC CPU_TARGET_AVX2 void storm_xcrypt_avx2(StormContext *ctx, u8 *buf,
+					      u64 len) {
+	STORM_XCRYPT_AVX2(ctx, buf, len, STORM_AESENC_AESNI);
+}
+
+STATIC CPU_TARGET_VAES void storm_xcrypt_vaes(StormContext *ctx, u8 *buf,
+					      u64 len) {
+	STORM_XCRYPT_AVX2(ctx, buf, len, STORM_AESENC_VAES);
+}
+
+/*
+ * Advances independent contexts in lock-step. The lanes share no state, so
+ * their chains overlap and each round is issued for every lane in turn.
+ * States stay in registers; the per-lane keys are read from L1.
+ */
+#define STORM_NEXT_BLOCK_LANES_AVX2(lane, blocks, lanes, len, aesenc)         \
+	do {                                                                  \
+		StormContextImpl *_st__[lanes];                               \
+		__m256i _s__[lanes], _x__[lanes];                             \
+		__m256i _zero__ = _mm256_setzero_si256();                     \
+		for (u32 _i__ = 0; _i__ < (lanes); _i__++) {                  \
+			_st__[_i__] = (StormContextImpl *)&(lane)[_i__];      \
+			_s__[_i__] =                                          \
+			    _mm256_load_si256((__m256i *)_st__[_i__]->state); \
+		}                                                             \
+		for (u64 _off__ = 0; _off__ < (len); _off__ += 32) {          \
+			for (u32 _i__ = 0; _i__ < (lanes); _i__++) {          \
+				__m256i _p__ = _mm256_loadu_si256(            \
+				    (__m256i *)((blocks)[_i__] + _off__));    \
+				__m256i _y__ = aesenc(                        \
+				    _mm256_xor_si256(_s__[_i__], _p__),       \
+				    *(__m256i *)_st__[_i__]->key0);           \
+				_s__[_i__] = _mm256_xor_si256(                \
+				    _mm256_permute2x128_si256(_y__, _y__,     \
+							      1),             \
+				    _mm256_blend_epi32(_zero__, _y__, 0xF0)); \
+				_x__[_i__] = _mm256_xor_si256(                \
+				    _s__[_i__],                               \
+				    aesenc(_y__,                              \
+					   *(__m256i *)_st__[_i__]->key1));   \
+			}                                                     \
+			for (u32 _i__ = 0; _i__ < (lanes); _i__++)            \
+				_x__[_i__] = aesenc(                          \
+				    _x__[_i__],                               \
+				    *(__m256i *)_st__[_i__]->key2);           \
+			for (u32 _i__ = 0; _i__ < (lanes); _i__++)            \
+				_mm256_storeu_si256(                          \
+				    (__m256i *)((blocks)[_i__] + _off__),     \
+				    aesenc(_x__[_i__],                        \
+					   *(__m256i *)_st__[_i__]->key3));   \
+		}                                                             \
+		for (u32 _i__ = 0; _i__ < (lanes); _i__++)                    \
+			_mm256_store_si256((__m256i *)_st__[_i__]->state,     \
+					   _s__[_i__]);                       \
+	} while (0);
+
+STATIC CPU_TARGET_AVX2 void storm_next_block_4x_avx2(StormContext4x *ctx,
+						     u8 *const blocks[4],
+						     u64 len) {
+	STORM_NEXT_BLOCK_LANES_AVX2(ctx->lane, blocks, 4, len,
+				    STORM_AESENC_AESNI);
+}
+
+STATIC CPU_TARGET_VAES void storm_next_block_4x_vaes(StormContext4x *ctx,
+						     u8 *const blocks[4],
+						     u64 len) {
+	STORM_NEXT_BLOCK_LANES_AVX2(ctx->lane, blocks, 4, len,
+				    STORM_AESENC_VAES);
+}
+
+/*
+ * storm_aead_blocks with the storm_xcrypt pipeline: the state chain is walked
+ * for STORM_LANES blocks, then their keystream rounds and, once the
+ * ciphertext is known, their authenticator rounds are issued together.
+ */
+#define STORM_AEAD_AVX2(ctx, mac, buf, len, acc, mode, aesenc)                 \
+	do {                                                                   \
+		StormContextImpl *_st__ = (StormContextImpl *)(ctx);           \
+		const StormContextImpl *_mt__ =                                \
+		    (const StormContextImpl *)(mac);                           \
+		__m256i _s__ = _mm256_load_si256((__m256i *)_st__->state);     \
+		__m256i _ctr__ = _mm256_load_si256((__m256i *)_st__->counter); \
+		__m256i _acc__ = _mm256_loadu_si256((__m256i *)(acc));         \
+		__m256i _one__ = _mm256_set1_epi64x(1);                        \
+		__m256i _zero__ = _mm256_setzero_si256();                      \
+		__m256i _x__[STORM_LANES], _m__[STORM_LANES];                  \
+		__attribute__((aligned(32))) u8 _c__[32];                      \
+		u8 *_p__ = (buf);                                              \
+		u64 _n__ = (len);                                              \
+		while (_n__) {                                                 \
+			u32 _blocks__ = _n__ >= STORM_LANES * 32               \
+					    ? STORM_LANES                      \
+					    : (u32)((_n__ + 31) >> 5);         \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++) {         \
+				__m256i _y__ = aesenc(                         \
+				    _mm256_xor_si256(_s__, _ctr__),            \
+				    *(__m256i *)_st__->key0);                  \
+				_s__ = _mm256_xor_si256(                       \
+				    _mm256_permute2x128_si256(_y__, _y__, 1),  \
+				    _mm256_blend_epi32(_zero__, _y__, 0xF0));  \
+				_m__[_i__] = _s__;                             \
+				if ((mode) != STORM_AEAD_AD)                   \
+					_x__[_i__] = _mm256_xor_si256(         \
+					    _s__,                              \
+					    aesenc(_y__,                       \
+						   *(__m256i *)_st__->key1));  \
+				_ctr__ = _mm256_add_epi64(_ctr__, _one__);     \
+			}                                                      \
+			if ((mode) != STORM_AEAD_AD) {                         \
+				for (u32 _i__ = 0; _i__ < _blocks__; _i__++)   \
+					_x__[_i__] = aesenc(                   \
+					    _x__[_i__],                        \
+					    *(__m256i *)_st__->key2);          \
+				for (u32 _i__ = 0; _i__ < _blocks__; _i__++)   \
+					_x__[_i__] = aesenc(                   \
+					    _x__[_i__],                        \
+					    *(__m256i *)_st__->key3);          \
+			}                                                      \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++) {         \
+				__m256i _d__;                                  \
+				if (_n__ < 32) {                               \
+					storm_aead_block(_p__, _n__,           \
+							 &_x__[_i__], _c__,    \
+							 mode);                \
+					_d__ = _mm256_load_si256(              \
+					    (__m256i *)_c__);                  \
+					_n__ = 0;                              \
+				} else {                                       \
+					_d__ = _mm256_loadu_si256(             \
+					    (__m256i *)_p__);                  \
+					if ((mode) != STORM_AEAD_AD) {         \
+						__m256i _o__ =                 \
+						    _mm256_xor_si256(          \
+							_d__, _x__[_i__]);     \
+						_mm256_storeu_si256(           \
+						    (__m256i *)_p__, _o__);    \
+						if ((mode) == STORM_AEAD_SEAL) \
+							_d__ = _o__;           \
+					}                                      \
+					_p__ += 32;                            \
+					_n__ -= 32;                            \
+				}                                              \
+				_m__[_i__] =                                   \
+				    _mm256_xor_si256(_d__, _m__[_i__]);        \
+			}                                                      \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_m__[_i__] = aesenc(_m__[_i__],                \
+						    *(__m256i *)_mt__->key0);  \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_m__[_i__] = aesenc(_m__[_i__],                \
+						    *(__m256i *)_mt__->key1);  \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_m__[_i__] = aesenc(_m__[_i__],                \
+						    *(__m256i *)_mt__->key2);  \
+			for (u32 _i__ = 0; _i__ < _blocks__; _i__++)           \
+				_acc__ = _mm256_xor_si256(                     \
+				    _acc__, aesenc(_m__[_i__],                 \
+						   *(__m256i *)_mt__->key3));  \
+		}                                                              \
+		_mm256_store_si256((__m256i *)_st__->state, _s__);             \
+		_mm256_store_si256((__m256i *)_st__->counter, _ctr__);         \
+		_mm256_storeu_si256((__m256i *)(acc), _acc__);                 \
+	} while (0);
+
+/*
+ * Multi-buffer storm_chain. Every step restarts from the same context, so the
+ * initial state and keys stay in registers and a step is a pure function of
+ * the block. STORM_CHAIN_LANES chains run in lock-step, and a lane that
+ * finishes is refilled with the next pending chain.
+ */
+#define STORM_CHAIN_LANES 6
+#define STORM_CHAIN_AVX2(ctx, out, in, steps, n, aesenc)                       \
+	do {                                                                   \
+		const StormContextImpl *_st__ =                                \
+		    (const StormContextImpl *)(ctx);                           \
+		__m256i _s0__ = _mm256_load_si256((__m256i *)_st__->state);    \
+		__m256i _k0__ = _mm256_load_si256((__m256i *)_st__->key0);     \
+		__m256i _k1__ = _mm256_load_si256((__m256i *)_st__->key1);     \
+		__m256i _k2__ = _mm256_load_si256((__m256i *)_st__->key2);     \
+		__m256i _k3__ = _mm256_load_si256((__m256i *)_st__->key3);     \
+		__m256i _zero__ = _mm256_setzero_si256();                      \
+		__m256i _x__[STORM_CHAIN_LANES], _t__[STORM_CHAIN_LANES];      \
+		u32 _left__[STORM_CHAIN_LANES], _idx__[STORM_CHAIN_LANES];     \
+		u32 _next__ = 0, _live__ = 0;                                  \
+		for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++) {         \
+			_next__ =                                              \
+			    storm_chain_next(out, in, steps, n, _next__);      \
+			_left__[_i__] = 0;                                     \
+			_x__[_i__] = _zero__;                                  \
+			if (_next__ < n) {                                     \
+				_x__[_i__] = _mm256_loadu_si256(               \
+				    (__m256i *)((in) + _next__ * 32));         \
+				_left__[_i__] = (steps)[_next__];              \
+				_idx__[_i__] = _next__++;                      \
+				_live__++;                                     \
+			}                                                      \
+		}                                                              \
+		while (_live__) {                                              \
+			for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++)   \
+				_t__[_i__] = aesenc(                           \
+				    _mm256_xor_si256(_s0__, _x__[_i__]),       \
+				    _k0__);                                    \
+			for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++)   \
+				_t__[_i__] = _mm256_xor_si256(                 \
+				    _mm256_xor_si256(                          \
+					_mm256_permute2x128_si256(             \
+					    _t__[_i__], _t__[_i__], 1),        \
+					_mm256_blend_epi32(                    \
+					    _zero__, _t__[_i__], 0xF0)),       \
+				    aesenc(_t__[_i__], _k1__));                \
+			for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++)   \
+				_t__[_i__] = aesenc(_t__[_i__], _k2__);        \
+			for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++)   \
+				_t__[_i__] = aesenc(_t__[_i__], _k3__);        \
+			for (u32 _i__ = 0; _i__ < STORM_CHAIN_LANES; _i__++) { \
+				if (!_left__[_i__]) continue;                  \
+				_x__[_i__] = _t__[_i__];                       \
+				if (--_left__[_i__]) continue;                 \
+				_mm256_storeu_si256(                           \
+				    (__m256i *)((out) + _idx__[_i__] * 32),    \
+				    _x__[_i__]);                               \
+				_live__--;                                     \
+				_next__ = storm_chain_next(out, in, steps, n,  \
+							   _next__);           \
+				if (_next__ < n) {                             \
+					_x__[_i__] = _mm256_loadu_si256(       \
+					    (__m256i *)((in) + _next__ * 32)); \
+					_left__[_i__] = (steps)[_next__];      \
+					_idx__[_i__] = _next__++;              \
+					_live__++;                             \
+				}                                              \
+			}                                                      \
+		}                                                              \
+	} while (0);
+
+STATIC CPU_TARGET_AVX2 void storm_chain_avx2(const StormContext *ctx,
+					     u8 *out, const u8 *in,
+					     const u32 *steps, u32 n) {
+	STORM_CHAIN_AVX2(ctx, out, in, steps, n, STORM_AESENC_AESNI);
+}
+
+STATIC CPU_TARGET_VAES void storm_chain_vaes(const StormContext *ctx,
+					     u8 *out, const u8 *in,
+					     const u32 *steps, u32 n) {
+	STORM_CHAIN_AVX2(ctx, out, in, steps, n, STORM_AESENC_VAES);
+}
+
+STATIC CPU_TARGET_AVX2 void storm_aead_avx2(StormContext *ctx,
+					    const StormContext *mac, u8 *buf,
+					    u64 len, u8 acc[32], i32 mode) {
+	STORM_AEAD_AVX2(ctx, mac, buf, len, acc, mode, STORM_AESENC_AESNI);
+}
+
+STATIC CPU_TARGET_VAES void storm_aead_vaes(StormContext *ctx,
+					    const StormContext *mac, u8 *buf,
+					    u64 len, u8 acc[32], i32 mode) {
+	STORM_AEAD_AVX2(ctx, mac, buf, len, acc, mode, STORM_AESENC_VAES);
+}
+
+#endif /* USE_AVX2 */
+
+#ifdef USE_NEON
 STATIC void storm_init_neon(StormContext *ctx, const u8 key[32]) {
 	static const __attribute__((aligned(32))) u8 ZERO256[32] = {0};
 	StormContextImpl *st = (StormContextImpl *)ctx;
@@ -274,6 +760,27 @@ STATIC void storm_xcrypt_buffer_neon(StormContext *ctx, u8 buf[32]) {
 	*(uint8x16_t *)((u8 *)st->counter + 16) =
 	    vreinterpretq_u8_u64(vaddq_u64(hi64, inc));
 }
+
+STATIC void storm_xcrypt_neon(StormContext *ctx, u8 *buf, u64 len) {
+	storm_xcrypt_blocks(ctx, buf, len, storm_xcrypt_buffer_neon);
+}
+
+STATIC void storm_next_block_4x_neon(StormContext4x *ctx, u8 *const blocks[4],
+				     u64 len) {
+	storm_next_block_lanes(ctx->lane, blocks, 4, len,
+			       storm_next_block_neon);
+}
+
+STATIC void storm_aead_neon(StormContext *ctx, const StormContext *mac,
+			    u8 *buf, u64 len, u8 acc[32], i32 mode) {
+	storm_aead_blocks(ctx, mac, buf, len, acc, mode);
+}
+
+STATIC void storm_chain_neon(const StormContext *ctx, u8 *out, const u8 *in,
+			     const u32 *steps, u32 n) {
+	storm_chain_blocks(ctx, out, in, steps, n, storm_next_block_neon);
+}
+
 #else
 STATIC void storm_init_scalar(StormContext *ctx, const u8 key[32]) {
 	static const __attribute__((aligned(32))) u8 ZERO256[32] = {0};
@@ -312,7 +819,7 @@ STATIC void storm_xcrypt_buffer_scalar(StormContext *ctx, u8 buf[32]) {
 	u8 block[32];
 	fastmemcpy(block, st->counter, 32);
 
-	storm_next_block(ctx, block);
+	storm_next_block_scalar(ctx, block);
 
 	for (int i = 0; i < 32; i++) {
 		buf[i] ^= block[i];
@@ -324,11 +831,83 @@ STATIC void storm_xcrypt_buffer_scalar(StormContext *ctx, u8 buf[32]) {
 	++counter[2];
 	++counter[3];
 }
-#endif /* !USE_AVX2 && !USE_NEON */
+
+STATIC void storm_xcrypt_scalar(StormContext *ctx, u8 *buf, u64 len) {
+	storm_xcrypt_blocks(ctx, buf, len, storm_xcrypt_buffer_scalar);
+}
+
+STATIC void storm_next_block_4x_scalar(StormContext4x *ctx,
+				       u8 *const blocks[4], u64 len) {
+	storm_next_block_lanes(ctx->lane, blocks, 4, len,
+			       storm_next_block_scalar);
+}
+
+STATIC void storm_aead_scalar(StormContext *ctx, const StormContext *mac,
+			      u8 *buf, u64 len, u8 acc[32], i32 mode) {
+	storm_aead_blocks(ctx, mac, buf, len, acc, mode);
+}
+
+STATIC void storm_chain_scalar(const StormContext *ctx, u8 *out, const u8 *in,
+			       const u32 *steps, u32 n) {
+	storm_chain_blocks(ctx, out, in, steps, n, storm_next_block_scalar);
+}
+
+#endif /* !USE_NEON */
+
+#ifdef USE_AVX2
+typedef struct {
+	void (*init)(StormContext *ctx, const u8 key[32]);
+	void (*next_block)(StormContext *ctx, u8 buf[32]);
+	void (*xcrypt_buffer)(StormContext *ctx, u8 buf[32]);
+	void (*xcrypt)(StormContext *ctx, u8 *buf, u64 len);
+	void (*next_block_4x)(StormContext4x *ctx, u8 *const blocks[4],
+			      u64 len);
+	void (*aead)(StormContext *ctx, const StormContext *mac, u8 *buf,
+		     u64 len, u8 acc[32], i32 mode);
+	void (*chain)(const StormContext *ctx, u8 *out, const u8 *in,
+		      const u32 *steps, u32 n);
+} StormKernels;
+
+static const StormKernels STORM_VAES = {
+    storm_init_avx2,	      storm_next_block_vaes,
+    storm_xcrypt_buffer_vaes, storm_xcrypt_vaes,
+    storm_next_block_4x_vaes, storm_aead_vaes,
+    storm_chain_vaes};
+static const StormKernels STORM_AVX2 = {
+    storm_init_avx2,	      storm_next_block_avx2,
+    storm_xcrypt_buffer_avx2, storm_xcrypt_avx2,
+    storm_next_block_4x_avx2, storm_aead_avx2,
+    storm_chain_avx2};
+static const StormKernels STORM_SCALAR = {
+    storm_init_scalar,		storm_next_block_scalar,
+    storm_xcrypt_buffer_scalar, storm_xcrypt_scalar,
+    storm_next_block_4x_scalar, storm_aead_scalar,
+    storm_chain_scalar};
+
+static const StormKernels *storm_kernels = NULL;
+
+/* Picks the kernels for this CPU on first use */
+STATIC const StormKernels *storm_select(void) {
+	const StormKernels *k =
+	    __atomic_load_n(&storm_kernels, __ATOMIC_RELAXED);
+	if (__builtin_expect(!k, 0)) {
+		u32 features = cpu_features();
+		if (features & CPU_VAES)
+			k = &STORM_VAES;
+		else if ((features & (CPU_AVX2 | CPU_AES)) ==
+			 (CPU_AVX2 | CPU_AES))
+			k = &STORM_AVX2;
+		else
+			k = &STORM_SCALAR;
+		__atomic_store_n(&storm_kernels, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+#endif /* USE_AVX2 */
 
 PUBLIC void storm_init(StormContext *ctx, const u8 key[32]) {
 #ifdef USE_AVX2
-	storm_init_avx2(ctx, key);
+	storm_select()->init(ctx, key);
 #elif defined(USE_NEON)
 	storm_init_neon(ctx, key);
 #else
@@ -338,7 +917,7 @@ PUBLIC void storm_init(StormContext *ctx, const u8 key[32]) {
 
 PUBLIC void storm_next_block(StormContext *ctx, u8 block[32]) {
 #ifdef USE_AVX2
-	storm_next_block_avx2(ctx, block);
+	storm_select()->next_block(ctx, block);
 #elif defined(USE_NEON)
 	storm_next_block_neon(ctx, block);
 #else
@@ -348,7 +927,7 @@ PUBLIC void storm_next_block(StormContext *ctx, u8 block[32]) {
 
 PUBLIC void storm_xcrypt_buffer(StormContext *ctx, u8 buf[32]) {
 #ifdef USE_AVX2
-	storm_xcrypt_buffer_avx2(ctx, buf);
+	storm_select()->xcrypt_buffer(ctx, buf);
 #elif defined(USE_NEON)
 	storm_xcrypt_buffer_neon(ctx, buf);
 #else
@@ -356,3 +935,117 @@ PUBLIC void storm_xcrypt_buffer(StormContext *ctx, u8 buf[32]) {
 #endif /* !USE_AVX2 */
 }
 
+PUBLIC void storm_xcrypt(StormContext *ctx, void *buf, u64 len) {
+#ifdef USE_AVX2
+	storm_select()->xcrypt(ctx, buf, len);
+#elif defined(USE_NEON)
+	storm_xcrypt_neon(ctx, buf, len);
+#else
+	storm_xcrypt_scalar(ctx, buf, len);
+#endif /* !USE_AVX2 */
+}
+
+PUBLIC void storm_init_4x(StormContext4x *ctx, const u8 keys[4][32]) {
+	for (u32 i = 0; i < 4; i++) storm_init(&ctx->lane[i], keys[i]);
+}
+
+PUBLIC void storm_next_block_4x(StormContext4x *ctx, u8 *const blocks[4],
+				u64 len) {
+#ifdef USE_AVX2
+	storm_select()->next_block_4x(ctx, blocks, len);
+#elif defined(USE_NEON)
+	storm_next_block_4x_neon(ctx, blocks, len);
+#else
+	storm_next_block_4x_scalar(ctx, blocks, len);
+#endif /* !USE_AVX2 */
+}
+
+PUBLIC void storm_chain(const StormContext *ctx, void *out, const void *in,
+			const u32 *steps, u32 n) {
+#ifdef USE_AVX2
+	storm_select()->chain(ctx, out, in, steps, n);
+#elif defined(USE_NEON)
+	storm_chain_neon(ctx, out, in, steps, n);
+#else
+	storm_chain_scalar(ctx, out, in, steps, n);
+#endif /* !USE_AVX2 */
+}
+
+STATIC void storm_aead_kernel(StormContext *ctx, const StormContext *mac,
+			      u8 *buf, u64 len, u8 acc[32], i32 mode) {
+#ifdef USE_AVX2
+	storm_select()->aead(ctx, mac, buf, len, acc, mode);
+#elif defined(USE_NEON)
+	storm_aead_neon(ctx, mac, buf, len, acc, mode);
+#else
+	storm_aead_scalar(ctx, mac, buf, len, acc, mode);
+#endif /* !USE_AVX2 */
+}
+
+/*
+ * The key context absorbs the nonce; its next two blocks key the cipher and
+ * the authenticator for this message.
+ */
+STATIC void storm_aead_init(StormContext *ctx, StormContext *mac,
+			    const u8 key[32],
+			    const u8 nonce[STORM_AEAD_NONCE_SIZE]) {
+	__attribute__((aligned(32))) u8 k[32], mk[32] = {0};
+
+	fastmemcpy(k, key, 32);
+	storm_init(ctx, k);
+	fastmemset(k, 0, 32);
+	fastmemcpy(k, nonce, STORM_AEAD_NONCE_SIZE);
+	storm_next_block(ctx, k);
+	storm_next_block(ctx, mk);
+	storm_init(ctx, k);
+	storm_init(mac, mk);
+	secure_zero32(k);
+	secure_zero32(mk);
+}
+
+/* The lengths are bound into the tag so no block can move between parts */
+STATIC void storm_aead_finish(StormContext *ctx, u8 acc[32], u64 ad_len,
+			      u64 len, u8 tag[STORM_AEAD_TAG_SIZE]) {
+	((u64 *)acc)[0] ^= ad_len;
+	((u64 *)acc)[1] ^= len;
+	storm_next_block(ctx, acc);
+	fastmemcpy(tag, acc, STORM_AEAD_TAG_SIZE);
+	secure_zero32(acc);
+}
+
+PUBLIC void storm_aead_seal(const u8 key[32],
+			    const u8 nonce[STORM_AEAD_NONCE_SIZE],
+			    const void *ad, u64 ad_len, void *buf, u64 len,
+			    u8 tag[STORM_AEAD_TAG_SIZE]) {
+	__attribute__((aligned(32))) u8 acc[32] = {0};
+	StormContext ctx, mac;
+
+	storm_aead_init(&ctx, &mac, key, nonce);
+	storm_aead_kernel(&ctx, &mac, (u8 *)ad, ad_len, acc, STORM_AEAD_AD);
+	storm_aead_kernel(&ctx, &mac, buf, len, acc, STORM_AEAD_SEAL);
+	storm_aead_finish(&ctx, acc, ad_len, len, tag);
+}
+
+PUBLIC i32 storm_aead_open(const u8 key[32],
+			   const u8 nonce[STORM_AEAD_NONCE_SIZE],
+			   const void *ad, u64 ad_len, void *buf, u64 len,
+			   const u8 tag[STORM_AEAD_TAG_SIZE]) {
+	__attribute__((aligned(32))) u8 acc[32] = {0};
+	u8 expected[STORM_AEAD_TAG_SIZE], diff = 0;
+	StormContext ctx, mac;
+
+	storm_aead_init(&ctx, &mac, key, nonce);
+	storm_aead_kernel(&ctx, &mac, (u8 *)ad, ad_len, acc, STORM_AEAD_AD);
+	storm_aead_kernel(&ctx, &mac, buf, len, acc, STORM_AEAD_OPEN);
+	storm_aead_finish(&ctx, acc, ad_len, len, expected);
+
+	for (u32 i = 0; i < STORM_AEAD_TAG_SIZE; i++)
+		diff |= expected[i] ^ tag[i];
+	if (diff) {
+		/* never hand out plaintext that failed authentication */
+		fastmemset(buf, 0, len);
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
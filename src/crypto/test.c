@@ -25,7 +25,9 @@
 
 #include <libfam/aesenc.h>
 #include <libfam/aighthash.h>
+#include <libfam/cpu.h>
 #include <libfam/env.h>
+#include <libfam/errno.h>
 #include <libfam/kem.h>
 #include <libfam/limits.h>
 #include <libfam/rng.h>
@@ -34,6 +36,7 @@
 #include <libfam/storm_vectors.h>
 #include <libfam/test_base.h>
 #include <libfam/wots.h>
+#include <libfam/xmss.h>
 
 Test(aesenc) {
 	__attribute__((aligned(32))) u8 data[32] = {
@@ -161,6 +164,167 @@ Test(storm_cipher) {
 	ASSERT(!memcmp(buffer5, "x", 1), "eq5");
 }
 
+Test(storm_xcrypt) {
+	__attribute__((aligned(32))) const u8 SEED[32] = {4, 4, 4};
+	__attribute__((aligned(32))) u8 block[32];
+	u8 data[512 + 1], expected[512];
+	StormContext ctx1, ctx2;
+
+	for (u32 i = 0; i < sizeof(data); i++) data[i] = i * 7;
+	for (u32 len = 0; len <= 512; len += len < 70 ? 1 : 29) {
+		storm_init(&ctx1, SEED);
+		storm_init(&ctx2, SEED);
+		fastmemcpy(expected, data + 1, len);
+		for (u32 off = 0; off < len; off += 32) {
+			u32 n = len - off < 32 ? len - off : 32;
+			fastmemset(block, 0, 32);
+			fastmemcpy(block, expected + off, n);
+			storm_xcrypt_buffer(&ctx1, block);
+			fastmemcpy(expected + off, block, n);
+		}
+
+		/* Odd offset so the bulk path sees an unaligned buffer */
+		storm_xcrypt(&ctx2, data + 1, len);
+		ASSERT(!memcmp(data + 1, expected, len), "bulk");
+		ASSERT(!memcmp(&ctx1, &ctx2, sizeof(ctx1)), "ctx");
+
+		storm_init(&ctx2, SEED);
+		storm_xcrypt(&ctx2, data + 1, len);
+		for (u32 i = 0; i < len; i++)
+			ASSERT_EQ(data[i + 1], (u8)((i + 1) * 7), "roundtrip");
+	}
+
+	/* Splitting a message on block boundaries gives the same keystream */
+	storm_init(&ctx1, SEED);
+	storm_init(&ctx2, SEED);
+	fastmemcpy(expected, data, 512);
+	storm_xcrypt(&ctx1, expected, 512);
+	storm_xcrypt(&ctx2, data, 96);
+	storm_xcrypt(&ctx2, data + 96, 32);
+	storm_xcrypt(&ctx2, data + 128, 384);
+	ASSERT(!memcmp(data, expected, 512), "split");
+}
+
+Test(storm_lanes) {
+	__attribute__((aligned(32))) u8 keys[4][32] = {{0}};
+	__attribute__((aligned(32))) u8 bufs[4][160], expected[4][160];
+	u8 *blocks[4];
+	StormContext4x ctx4;
+	StormContext ctx;
+
+	for (u32 i = 0; i < 4; i++) {
+		keys[i][0] = i;
+		keys[i][31] = i * 3;
+		for (u32 j = 0; j < 160; j++) bufs[i][j] = i * 160 + j;
+		blocks[i] = bufs[i];
+	}
+	fastmemcpy(expected, bufs, sizeof(bufs));
+	for (u32 i = 0; i < 4; i++) {
+		storm_init(&ctx, keys[i]);
+		for (u32 j = 0; j < 160; j += 32)
+			storm_next_block(&ctx, expected[i] + j);
+	}
+
+	storm_init_4x(&ctx4, (const u8(*)[32])keys);
+	storm_next_block_4x(&ctx4, blocks, 64);
+	storm_next_block_4x(&ctx4, blocks, 0);
+	for (u32 i = 0; i < 4; i++) blocks[i] += 64;
+	storm_next_block_4x(&ctx4, blocks, 96);
+	for (u32 i = 0; i < 4; i++)
+		ASSERT(!memcmp(bufs[i], expected[i], 160), "4x");
+
+	/* The lanes are ordinary contexts and carry on as such */
+	storm_init(&ctx, keys[2]);
+	for (u32 j = 0; j < 160; j++) bufs[0][j] = 2 * 160 + j;
+	for (u32 j = 0; j < 160; j += 32) storm_next_block(&ctx, bufs[0] + j);
+	fastmemset(bufs[0], 0, 32);
+	fastmemset(bufs[1], 0, 32);
+	storm_next_block(&ctx, bufs[0]);
+	storm_next_block(&ctx4.lane[2], bufs[1]);
+	ASSERT(!memcmp(bufs[0], bufs[1], 32), "lane");
+}
+
+Test(storm_chain) {
+	__attribute__((aligned(32))) const u8 key[32] = {8, 6, 7, 5, 3, 0, 9};
+	__attribute__((aligned(32))) u8 block[32];
+	u8 in[13 * 32 + 1], out[13 * 32], expected[13 * 32];
+	u32 steps[13] = {0, 255, 1, 7, 0, 64, 200, 3, 3, 0, 1, 90, 17};
+	StormContext ctx, tmp;
+
+	storm_init(&ctx, key);
+	for (u32 i = 0; i < sizeof(in); i++) in[i] = i * 11;
+	for (u32 i = 0; i < 13; i++) {
+		fastmemcpy(block, in + 1 + i * 32, 32);
+		for (u32 j = 0; j < steps[i]; j++) {
+			storm_init(&tmp, key);
+			storm_next_block(&tmp, block);
+		}
+		fastmemcpy(expected + i * 32, block, 32);
+	}
+
+	/* Odd offset so the kernels see unaligned blocks */
+	storm_chain(&ctx, out, in + 1, steps, 13);
+	ASSERT(!memcmp(out, expected, sizeof(out)), "chain");
+	storm_chain(&ctx, in + 1, in + 1, steps, 13);
+	ASSERT(!memcmp(in + 1, expected, sizeof(out)), "in place");
+	storm_chain(&ctx, out, in, steps, 0);
+	ASSERT(!memcmp(out, expected, sizeof(out)), "empty");
+}
+
+Test(storm_aead) {
+	__attribute__((aligned(32))) const u8 key[32] = {3, 1, 4, 1, 5};
+	const u8 nonce[STORM_AEAD_NONCE_SIZE] = {9, 2, 6};
+	u8 tag[STORM_AEAD_TAG_SIZE], bad_tag[STORM_AEAD_TAG_SIZE];
+	u8 data[600 + 1], copy[600], ad[40];
+	u32 ad_lens[] = {0, 5, 40};
+
+	for (u32 i = 0; i < sizeof(ad); i++) ad[i] = i ^ 0x55;
+	for (u32 a = 0; a < 3; a++) {
+		for (u32 len = 0; len <= 600; len += len < 70 ? 1 : 53) {
+			for (u32 i = 0; i < len; i++) data[i + 1] = i * 3;
+			fastmemcpy(copy, data + 1, len);
+
+			/* Odd offset: the bulk path sees an unaligned buffer */
+			storm_aead_seal(key, nonce, ad, ad_lens[a], data + 1,
+					len, tag);
+			if (len >= 16)
+				ASSERT(memcmp(data + 1, copy, len), "sealed");
+			ASSERT(!storm_aead_open(key, nonce, ad, ad_lens[a],
+						data + 1, len, tag),
+			       "open");
+			ASSERT(!memcmp(data + 1, copy, len), "roundtrip");
+		}
+	}
+
+	/* Any change to the ciphertext, ad, tag or nonce is rejected */
+	for (u32 i = 0; i < 4; i++) {
+		u8 other[STORM_AEAD_NONCE_SIZE] = {9, 2, 6};
+		u8 ad2[40];
+		fastmemcpy(ad2, ad, sizeof(ad));
+		for (u32 j = 0; j < 100; j++) data[j] = j;
+		storm_aead_seal(key, nonce, ad, sizeof(ad), data, 100, tag);
+		fastmemcpy(bad_tag, tag, sizeof(tag));
+		if (i == 0) data[99] ^= 1;
+		if (i == 1) ad2[0] ^= 0x80;
+		if (i == 2) bad_tag[31] ^= 4;
+		if (i == 3) other[15] = 1;
+		errno = 0;
+		ASSERT_EQ(storm_aead_open(key, other, ad2, sizeof(ad2), data,
+					  100, bad_tag),
+			  -1, "forgery");
+		ASSERT_EQ(errno, EBADMSG, "errno");
+		for (u32 j = 0; j < 100; j++) ASSERT(!data[j], "wiped");
+	}
+
+	/* ad and message lengths are both bound into the tag */
+	storm_aead_seal(key, nonce, ad, 32, data, 32, tag);
+	ASSERT_EQ(storm_aead_open(key, nonce, ad, 0, data, 32, tag), -1,
+		  "ad len");
+	storm_aead_seal(key, nonce, NULL, 0, data, 31, tag);
+	ASSERT_EQ(storm_aead_open(key, nonce, NULL, 0, data, 32, tag), -1,
+		  "len");
+}
+
 Test(rng) {
 	u64 x = 0, y = 0;
 	__attribute__((aligned(32))) u8 z[64] = {0};
@@ -288,6 +452,176 @@ Bench(storm_perf) {
 	pwrite(2, "ps\n", 3, 0);
 }
 
+#define XCRYPT_BYTES (64ULL * 1024 * 1024)
+#define XCRYPT_ITERATIONS 16
+
+/*
+ * Bulk CTR throughput: storm_xcrypt over a 64 MiB buffer, against the same
+ * buffer encrypted 32 bytes at a time with storm_xcrypt_buffer.
+ */
+Bench(storm_xcrypt) {
+	__attribute__((aligned(32))) static const u8 SEED[32] = {7};
+	u8 fbuf[MAX_F64_STRING_LEN] = {0};
+	StormContext ctx;
+	i64 bulk, single;
+	u8 *buf;
+
+	buf = map(XCRYPT_BYTES);
+	ASSERT(buf, "map");
+	fastmemset(buf, 0x5a, XCRYPT_BYTES);
+
+	storm_init(&ctx, SEED);
+	bulk = micros();
+	for (u32 i = 0; i < XCRYPT_ITERATIONS; i++)
+		storm_xcrypt(&ctx, buf, XCRYPT_BYTES);
+	bulk = micros() - bulk;
+
+	storm_init(&ctx, SEED);
+	single = micros();
+	for (u32 i = 0; i < XCRYPT_ITERATIONS; i++)
+		for (u64 off = 0; off < XCRYPT_BYTES; off += 32)
+			storm_xcrypt_buffer(&ctx, buf + off);
+	single = micros() - single;
+
+	/* Both passes used the same keystream, so the buffer is restored */
+	for (u64 i = 0; i < XCRYPT_BYTES; i++) ASSERT_EQ(buf[i], 0x5a, "buf");
+
+	f64_to_string(fbuf,
+		      (f64)(XCRYPT_BYTES * XCRYPT_ITERATIONS) / (f64)bulk /
+			  1000.0,
+		      3, false);
+	pwrite(2, "xcrypt_gbps=", 12, 0);
+	pwrite(2, fbuf, strlen(fbuf), 0);
+	f64_to_string(fbuf,
+		      (f64)(XCRYPT_BYTES * XCRYPT_ITERATIONS) / (f64)single /
+			  1000.0,
+		      3, false);
+	pwrite(2, ",xcrypt_buffer_gbps=", 20, 0);
+	pwrite(2, fbuf, strlen(fbuf), 0);
+	pwrite(2, "\n", 1, 0);
+	munmap(buf, XCRYPT_BYTES);
+}
+
+#define LANES_BYTES 512
+#define LANES_ITERATIONS 200000
+
+/*
+ * XOF-style sampling: four streams of 512 bytes, the size of a Dilithium
+ * uniform poly, with separate contexts and with the 4x kernel.
+ */
+Bench(storm_lanes) {
+	__attribute__((aligned(32))) static u8 keys[4][32] = {{1}, {2}, {3},
+							       {4}};
+	__attribute__((aligned(32))) static u8 bufs[4][LANES_BYTES];
+	u8 *blocks[4] = {bufs[0], bufs[1], bufs[2], bufs[3]};
+	StormContext4x ctx4;
+	StormContext ctx[4];
+	i64 single, four;
+
+	single = micros();
+	for (u32 iter = 0; iter < LANES_ITERATIONS; iter++) {
+		for (u32 i = 0; i < 4; i++) storm_init(&ctx[i], keys[i]);
+		for (u32 j = 0; j < LANES_BYTES; j += 32)
+			for (u32 i = 0; i < 4; i++)
+				storm_next_block(&ctx[i], bufs[i] + j);
+	}
+	single = micros() - single;
+
+	four = micros();
+	for (u32 iter = 0; iter < LANES_ITERATIONS; iter++) {
+		storm_init_4x(&ctx4, (const u8(*)[32])keys);
+		storm_next_block_4x(&ctx4, blocks, LANES_BYTES);
+	}
+	four = micros() - four;
+
+	pwrite(2, "single_us=", 10, 0);
+	write_num(2, single);
+	pwrite(2, ",4x_us=", 7, 0);
+	write_num(2, four);
+	pwrite(2, "\n", 1, 0);
+}
+
+#define AEAD_BYTES (256ULL * 1024 * 1024)
+
+/* Encrypt, then authenticate the ciphertext with a second Storm context */
+static void storm_two_pass(const u8 key[32], const u8 *nonce, const u8 *ad,
+			   u64 ad_len, u8 *buf, u64 len, u8 tag[32]) {
+	__attribute__((aligned(32))) u8 k[32], mk[32] = {0}, block[32];
+	StormContext ctx, mac;
+
+	fastmemcpy(k, key, 32);
+	storm_init(&ctx, k);
+	fastmemset(k, 0, 32);
+	fastmemcpy(k, nonce, STORM_AEAD_NONCE_SIZE);
+	storm_next_block(&ctx, k);
+	storm_next_block(&ctx, mk);
+	storm_init(&ctx, k);
+	storm_init(&mac, mk);
+
+	storm_xcrypt(&ctx, buf, len);
+	for (u64 off = 0; off < ad_len; off += 32) {
+		u64 n = ad_len - off < 32 ? ad_len - off : 32;
+		fastmemset(block, 0, 32);
+		fastmemcpy(block, ad + off, n);
+		storm_next_block(&mac, block);
+	}
+	for (u64 off = 0; off < len; off += 32) {
+		u64 n = len - off < 32 ? len - off : 32;
+		fastmemset(block, 0, 32);
+		fastmemcpy(block, buf + off, n);
+		storm_next_block(&mac, block);
+	}
+	fastmemset(block, 0, 32);
+	((u64 *)block)[0] = ad_len;
+	((u64 *)block)[1] = len;
+	storm_next_block(&mac, block);
+	fastmemcpy(tag, block, 32);
+}
+
+/* storm_aead_seal against storm_xcrypt followed by a separate MAC pass */
+Bench(storm_aead) {
+	__attribute__((aligned(32))) static const u8 key[32] = {7};
+	const u8 nonce[STORM_AEAD_NONCE_SIZE] = {1};
+	const u8 ad[16] = {2};
+	u64 sizes[] = {64, 1024, 1024 * 1024};
+	u8 fbuf[MAX_F64_STRING_LEN] = {0};
+	u8 tag[STORM_AEAD_TAG_SIZE];
+	u8 *buf;
+
+	buf = map(sizes[2]);
+	ASSERT(buf, "map");
+	fastmemset(buf, 0x5a, sizes[2]);
+
+	for (u32 i = 0; i < 3; i++) {
+		u64 iterations = AEAD_BYTES / sizes[i];
+		i64 single, two;
+
+		single = micros();
+		for (u64 j = 0; j < iterations; j++)
+			storm_aead_seal(key, nonce, ad, sizeof(ad), buf,
+					sizes[i], tag);
+		single = micros() - single;
+
+		two = micros();
+		for (u64 j = 0; j < iterations; j++)
+			storm_two_pass(key, nonce, ad, sizeof(ad), buf,
+				       sizes[i], tag);
+		two = micros() - two;
+
+		write_num(2, sizes[i]);
+		f64_to_string(fbuf, (f64)AEAD_BYTES / (f64)single / 1000.0,
+			      3, false);
+		pwrite(2, "B: aead_gbps=", 13, 0);
+		pwrite(2, fbuf, strlen(fbuf), 0);
+		f64_to_string(fbuf, (f64)AEAD_BYTES / (f64)two / 1000.0, 3,
+			      false);
+		pwrite(2, ",two_pass_gbps=", 15, 0);
+		pwrite(2, fbuf, strlen(fbuf), 0);
+		pwrite(2, "\n", 1, 0);
+	}
+	munmap(buf, sizes[2]);
+}
+
 Bench(storm_preimage) {
 	StormContext ctx1;
 	StormContext ctx2;
@@ -345,10 +679,113 @@ Test(wots) {
 		msg[i]--;
 	}
 	ASSERT(!wots_verify(&pk, &sig, msg), "verify");
+
+	/* Pins the chain outputs of the original one-chain-at-a-time code */
+	ASSERT_EQ(aighthash64(pk.data, sizeof(pk.data), 0),
+		  13559956080962321956ULL, "pk");
+	ASSERT_EQ(aighthash64(sig.data, sizeof(sig.data), 0),
+		  4248220968939018395ULL, "sig");
+}
+
+Test(xmss) {
+	__attribute__((aligned(32))) u8 seed[32] = {6, 5, 4};
+	u8 msg[32] = {1, 2, 3};
+	XmssPubKey pk;
+	XmssSecKey sk;
+	XmssSig sig;
+
+	ASSERT_EQ(xmss_keyfrom(seed, 1, &pk, &sk), -1, "height 1");
+	ASSERT_EQ(errno, EINVAL, "einval");
+	ASSERT_EQ(xmss_keyfrom(seed, 21, &pk, &sk), -1, "height 21");
+
+	/* Every leaf of small even and odd trees, so each BDS step is used */
+	for (u8 height = 2; height <= 7; height++) {
+		ASSERT(!xmss_keyfrom(seed, height, &pk, &sk), "keyfrom");
+		for (u64 i = 0; i < (1ULL << height); i++) {
+			ASSERT_EQ(xmss_remaining(&sk), (1ULL << height) - i,
+				  "remaining");
+			msg[31] = i;
+			ASSERT(!xmss_sign(&sk, msg, &sig), "sign");
+			ASSERT_EQ(sig.index, i, "index");
+			ASSERT(!xmss_verify(&pk, msg, &sig), "verify");
+			msg[0]++;
+			ASSERT(xmss_verify(&pk, msg, &sig), "!verify msg");
+			msg[0]--;
+			sig.auth[height - 1][5] ^= 1;
+			ASSERT(xmss_verify(&pk, msg, &sig), "!verify auth");
+			sig.auth[height - 1][5] ^= 1;
+			sig.index ^= 1;
+			ASSERT(xmss_verify(&pk, msg, &sig), "!verify index");
+		}
+		errno = 0;
+		ASSERT_EQ(xmss_sign(&sk, msg, &sig), -1, "exhausted");
+		ASSERT_EQ(errno, ENOSPC, "enospc");
+		ASSERT_EQ(xmss_remaining(&sk), 0, "none left");
+	}
+
+	/* Deterministic keys, and the split keygen covers deep trees */
+	{
+		XmssPubKey pk2;
+		ASSERT(!xmss_keyfrom(seed, 10, &pk, &sk), "keyfrom 10");
+		ASSERT(!xmss_keyfrom(seed, 10, &pk2, &sk), "keyfrom 10 again");
+		ASSERT(!memcmp(&pk, &pk2, sizeof(pk)), "deterministic");
+		for (u32 i = 0; i < 40; i++) {
+			ASSERT(!xmss_sign(&sk, msg, &sig), "sign 10");
+			ASSERT(!xmss_verify(&pk, msg, &sig), "verify 10");
+		}
+	}
 }
 
 #define WOTS_COUNT 1000
 
+#define XMSS_SIGNS 1024
+
+/* BDS keeps signing flat in the leaf index: max is reported next to mean */
+Bench(xmss) {
+	__attribute__((aligned(32))) u8 seed[32] = {0};
+	__attribute__((aligned(32))) u8 msg[32] = {0};
+	u8 heights[] = {10, 16, 20};
+	XmssPubKey pk;
+	XmssSecKey sk;
+	XmssSig sig;
+	Rng rng;
+
+	rng_init(&rng);
+	for (u32 i = 0; i < sizeof(heights); i++) {
+		u64 sign_sum = 0, sign_max = 0, verify_sum = 0, cycles;
+		i64 keygen;
+
+		rng_gen(&rng, seed, 32);
+		keygen = micros();
+		ASSERT(!xmss_keyfrom(seed, heights[i], &pk, &sk), "keyfrom");
+		keygen = micros() - keygen;
+
+		for (u32 j = 0; j < XMSS_SIGNS; j++) {
+			rng_gen(&rng, msg, 32);
+			cycles = cycle_counter();
+			ASSERT(!xmss_sign(&sk, msg, &sig), "sign");
+			cycles = cycle_counter() - cycles;
+			sign_sum += cycles;
+			sign_max = max(sign_max, cycles);
+			cycles = cycle_counter();
+			ASSERT(!xmss_verify(&pk, msg, &sig), "verify");
+			verify_sum += cycle_counter() - cycles;
+		}
+
+		pwrite(2, "height=", 7, 0);
+		write_num(2, heights[i]);
+		pwrite(2, ",keygen_us=", 11, 0);
+		write_num(2, keygen);
+		pwrite(2, ",sign=", 6, 0);
+		write_num(2, sign_sum / XMSS_SIGNS);
+		pwrite(2, ",sign_max=", 10, 0);
+		write_num(2, sign_max);
+		pwrite(2, ",verify=", 8, 0);
+		write_num(2, verify_sum / XMSS_SIGNS);
+		pwrite(2, "\n", 1, 0);
+	}
+}
+
 Bench(wotsp) {
 	__attribute__((aligned(32))) u8 key[32] = {0};
 	__attribute__((aligned(32))) u8 msg[32] = {0};
@@ -537,6 +974,32 @@ Test(kem_iter) {
 	}
 }
 
+Test(kem_expanded) {
+	__attribute__((aligned(32))) u8 seed[32] = {2, 7, 1, 8, 2, 8};
+	KemSecKey sk;
+	KemPubKey pk;
+	KemPubKeyExpanded epk;
+	KemCipherText ct1, ct2;
+	KemSharedSecret ss1, ss2, ss3;
+	Rng rng1, rng2;
+
+	rng_test_seed(&rng1, seed);
+	keypair(&pk, &sk, &rng1);
+	kem_pk_expand(&epk, &pk);
+
+	for (u32 i = 0; i < 100; i++) {
+		seed[31] = i;
+		rng_test_seed(&rng1, seed);
+		rng_test_seed(&rng2, seed);
+		enc(&ct1, &ss1, &pk, &rng1);
+		enc_expanded(&ct2, &ss2, &epk, &rng2);
+		ASSERT(!fastmemcmp(&ct1, &ct2, sizeof(ct1)), "ct");
+		ASSERT(!fastmemcmp(&ss1, &ss2, sizeof(ss1)), "ss");
+		dec(&ss3, &ct2, &sk);
+		ASSERT(!fastmemcmp(&ss2, &ss3, sizeof(ss2)), "dec");
+	}
+}
+
 #define KEM_COUNT 10000
 
 Bench(kempf) {
@@ -575,6 +1038,39 @@ Bench(kempf) {
 	pwrite(2, "\n", 1, 0);
 }
 
+Bench(kem_expanded) {
+	KemSecKey sk;
+	KemPubKey pk;
+	KemPubKeyExpanded epk;
+	KemCipherText ct;
+	KemSharedSecret ss;
+	Rng rng;
+	u64 expand_sum = 0, enc_sum = 0, enc_expanded_sum = 0;
+
+	rng_init(&rng);
+	keypair(&pk, &sk, &rng);
+
+	for (u32 i = 0; i < KEM_COUNT; i++) {
+		u64 start = cycle_counter();
+		kem_pk_expand(&epk, &pk);
+		expand_sum += cycle_counter() - start;
+		start = cycle_counter();
+		enc(&ct, &ss, &pk, &rng);
+		enc_sum += cycle_counter() - start;
+		start = cycle_counter();
+		enc_expanded(&ct, &ss, &epk, &rng);
+		enc_expanded_sum += cycle_counter() - start;
+	}
+
+	pwrite(2, "expand=", 7, 0);
+	write_num(2, expand_sum / KEM_COUNT);
+	pwrite(2, ",enc=", 5, 0);
+	write_num(2, enc_sum / KEM_COUNT);
+	pwrite(2, ",enc_expanded=", 14, 0);
+	write_num(2, enc_expanded_sum / KEM_COUNT);
+	pwrite(2, "\n", 1, 0);
+}
+
 Test(kem_vector) {
 	__attribute__((aligned(32))) u8 seed[32] = {1, 2, 3};
 	KemSecKey sk;
@@ -879,6 +1375,41 @@ Test(dilithium) {
 	ASSERT_EQ(res, -1, "bad sig");
 }
 
+Test(dilithium_expanded) {
+	__attribute__((aligned(32))) u8 seed[32] = {9, 2, 6, 5};
+	__attribute__((aligned(32))) u8 msg[32] = {3, 5, 8, 9};
+	PublicKey pk;
+	SecretKey sk;
+	PublicKeyExpanded epk;
+	SecretKeyExpanded esk;
+	Signature sig1, sig2;
+	Rng rng1, rng2;
+
+	keyfrom(seed, &sk, &pk);
+	sk_expand(&sk, &esk);
+	pk_expand(&pk, &epk);
+
+	for (u32 i = 0; i < 100; i++) {
+		seed[31] = i;
+		msg[31] = i;
+		rng_test_seed(&rng1, seed);
+		rng_test_seed(&rng2, seed);
+		sign(msg, &sk, &sig1, &rng1);
+		sign_expanded(msg, &esk, &sig2, &rng2);
+		ASSERT(!fastmemcmp(sig1.data, sig2.data,
+				   DILITHIUM_SIGNATURE_SIZE),
+		       "sig");
+		ASSERT(!verify_expanded(msg, &epk, &sig2), "verify_expanded");
+		ASSERT(!verify(msg, &pk, &sig2), "verify");
+	}
+
+	msg[4]++;
+	ASSERT_EQ(verify_expanded(msg, &epk, &sig2), -1, "bad msg");
+	msg[4]--;
+	sig2.data[100] ^= 1;
+	ASSERT_EQ(verify_expanded(msg, &epk, &sig2), -1, "bad sig");
+}
+
 #define DILITHIUM_TESTS 1000
 Bench(dilithium) {
 	Rng rng;
@@ -915,6 +1446,110 @@ Bench(dilithium) {
 	pwrite(2, "\n", 1, 0);
 }
 
+Bench(dilithium_expanded) {
+	Rng rng;
+	PublicKey pk;
+	SecretKey sk;
+	PublicKeyExpanded epk;
+	SecretKeyExpanded esk;
+	Signature sig;
+	__attribute__((aligned(32))) u8 m[32];
+	__attribute__((aligned(32))) u8 seed[32];
+	u64 sign_sum = 0, sign_expanded_sum = 0;
+	u64 verify_sum = 0, verify_expanded_sum = 0;
+
+	rng_init(&rng);
+	rng_gen(&rng, seed, 32);
+	keyfrom(seed, &sk, &pk);
+	sk_expand(&sk, &esk);
+	pk_expand(&pk, &epk);
+
+	for (u32 i = 0; i < DILITHIUM_TESTS; i++) {
+		rng_gen(&rng, m, 32);
+
+		u64 timer = cycle_counter();
+		sign(m, &sk, &sig, &rng);
+		sign_sum += cycle_counter() - timer;
+		timer = cycle_counter();
+		i32 res = verify(m, &pk, &sig);
+		verify_sum += cycle_counter() - timer;
+		ASSERT(!res, "verify");
+
+		timer = cycle_counter();
+		sign_expanded(m, &esk, &sig, &rng);
+		sign_expanded_sum += cycle_counter() - timer;
+		timer = cycle_counter();
+		res = verify_expanded(m, &epk, &sig);
+		verify_expanded_sum += cycle_counter() - timer;
+		ASSERT(!res, "verify_expanded");
+	}
+
+	pwrite(2, "sign=", 5, 0);
+	write_num(2, sign_sum / DILITHIUM_TESTS);
+	pwrite(2, ",sign_expanded=", 15, 0);
+	write_num(2, sign_expanded_sum / DILITHIUM_TESTS);
+	pwrite(2, ",verify=", 8, 0);
+	write_num(2, verify_sum / DILITHIUM_TESTS);
+	pwrite(2, ",verify_expanded=", 17, 0);
+	write_num(2, verify_expanded_sum / DILITHIUM_TESTS);
+	pwrite(2, "\n", 1, 0);
+}
+
+#define BATCH_BENCH_KEYS 16
+#define BATCH_BENCH_SIGS 4096
+
+Bench(verify_batch) {
+	__attribute__((aligned(32))) u8 seed[32];
+	PublicKey pks[BATCH_BENCH_KEYS], *batch_pks;
+	SecretKey sks[BATCH_BENCH_KEYS];
+	Signature *sigs;
+	u8(*msgs)[32];
+	i32 *results;
+	u64 loop_sum, batch_sum, timer;
+	Rng rng;
+
+	batch_pks = map(BATCH_BENCH_SIGS * sizeof(PublicKey));
+	sigs = map(BATCH_BENCH_SIGS * sizeof(Signature));
+	msgs = map(BATCH_BENCH_SIGS * 32);
+	results = map(BATCH_BENCH_SIGS * sizeof(i32));
+	ASSERT(batch_pks && sigs && msgs && results, "map");
+
+	rng_init(&rng);
+	for (u32 i = 0; i < BATCH_BENCH_KEYS; i++) {
+		rng_gen(&rng, seed, 32);
+		keyfrom(seed, &sks[i], &pks[i]);
+	}
+	for (u32 i = 0; i < BATCH_BENCH_SIGS; i++) {
+		u32 k = i % BATCH_BENCH_KEYS;
+		rng_gen(&rng, msgs[i], 32);
+		batch_pks[i] = pks[k];
+		sign(msgs[i], &sks[k], &sigs[i], &rng);
+	}
+
+	timer = cycle_counter();
+	for (u32 i = 0; i < BATCH_BENCH_SIGS; i++)
+		results[i] = verify(msgs[i], &batch_pks[i], &sigs[i]);
+	loop_sum = cycle_counter() - timer;
+	for (u32 i = 0; i < BATCH_BENCH_SIGS; i++)
+		ASSERT(!results[i], "verify");
+
+	timer = cycle_counter();
+	ASSERT(!verify_batch(msgs, batch_pks, sigs, BATCH_BENCH_SIGS, results),
+	       "verify_batch");
+	batch_sum = cycle_counter() - timer;
+
+	pwrite(2, "verify=", 7, 0);
+	write_num(2, loop_sum / BATCH_BENCH_SIGS);
+	pwrite(2, ",verify_batch=", 14, 0);
+	write_num(2, batch_sum / BATCH_BENCH_SIGS);
+	pwrite(2, "\n", 1, 0);
+
+	munmap(batch_pks, BATCH_BENCH_SIGS * sizeof(PublicKey));
+	munmap(sigs, BATCH_BENCH_SIGS * sizeof(Signature));
+	munmap(msgs, BATCH_BENCH_SIGS * 32);
+	munmap(results, BATCH_BENCH_SIGS * sizeof(i32));
+}
+
 Test(dilithium_loop) {
 	Rng rng;
 	PublicKey pk;
@@ -935,6 +1570,58 @@ Test(dilithium_loop) {
 	}
 }
 
+#define BATCH_KEYS 4
+#define BATCH_SIGS 300
+
+Test(verify_batch) {
+	__attribute__((aligned(32))) u8 seed[32] = {1, 4, 1, 4, 2};
+	PublicKey pks[BATCH_KEYS], *batch_pks;
+	SecretKey sks[BATCH_KEYS];
+	Signature *sigs;
+	u8(*msgs)[32];
+	i32 results[BATCH_SIGS];
+	Rng rng;
+
+	batch_pks = map(BATCH_SIGS * sizeof(PublicKey));
+	sigs = map(BATCH_SIGS * sizeof(Signature));
+	msgs = map(BATCH_SIGS * 32);
+	ASSERT(batch_pks && sigs && msgs, "map");
+
+	rng_test_seed(&rng, seed);
+	for (u32 i = 0; i < BATCH_KEYS; i++) {
+		seed[31] = i;
+		keyfrom(seed, &sks[i], &pks[i]);
+	}
+	for (u32 i = 0; i < BATCH_SIGS; i++) {
+		u32 k = (i * 7) % BATCH_KEYS;
+		rng_gen(&rng, msgs[i], 32);
+		batch_pks[i] = pks[k];
+		sign(msgs[i], &sks[k], &sigs[i], &rng);
+	}
+
+	ASSERT(!verify_batch(msgs, batch_pks, sigs, 0, results), "empty");
+	ASSERT(!verify_batch(msgs, batch_pks, sigs, 10, results), "small");
+	ASSERT(!verify_batch(msgs, batch_pks, sigs, BATCH_SIGS, results),
+	       "batch");
+	for (u32 i = 0; i < BATCH_SIGS; i++) ASSERT(!results[i], "result");
+
+	msgs[7][0]++;
+	sigs[150].data[100] ^= 1;
+	batch_pks[299] = pks[(299 * 7 + 1) % BATCH_KEYS];
+	ASSERT_EQ(verify_batch(msgs, batch_pks, sigs, BATCH_SIGS, results), -1,
+		  "bad batch");
+	for (u32 i = 0; i < BATCH_SIGS; i++) {
+		i32 expected = verify(msgs[i], &batch_pks[i], &sigs[i]);
+		ASSERT_EQ(results[i], expected, "matches verify");
+		ASSERT_EQ(results[i], (i == 7 || i == 150 || i == 299) ? -1 : 0,
+			  "bad result");
+	}
+
+	munmap(batch_pks, BATCH_SIGS * sizeof(PublicKey));
+	munmap(sigs, BATCH_SIGS * sizeof(Signature));
+	munmap(msgs, BATCH_SIGS * 32);
+}
+
 Test(dilithium_vector) {
 	__attribute__((aligned(32))) u8 seed[32] = {1, 2, 3, 4};
 	__attribute__((aligned(32))) u8 msg[32] = {5, 4, 2, 1};
@@ -1450,3 +2137,284 @@ Test(dilithium_vector) {
 	(void)expected_sig;
 }
 
+
+#if defined(__x86_64__) && !defined(NO_VECTOR)
+void aesenc256_scalar(void *data, const void *key);
+void aesenc256_aesni(void *data, const void *key);
+void storm_init_scalar(StormContext *ctx, const u8 key[32]);
+void storm_init_avx2(StormContext *ctx, const u8 key[32]);
+void storm_next_block_scalar(StormContext *ctx, u8 buf[32]);
+void storm_next_block_avx2(StormContext *ctx, u8 buf[32]);
+void storm_next_block_vaes(StormContext *ctx, u8 buf[32]);
+void storm_xcrypt_buffer_scalar(StormContext *ctx, u8 buf[32]);
+void storm_xcrypt_buffer_avx2(StormContext *ctx, u8 buf[32]);
+void storm_xcrypt_buffer_vaes(StormContext *ctx, u8 buf[32]);
+void storm_xcrypt_scalar(StormContext *ctx, u8 *buf, u64 len);
+void storm_xcrypt_avx2(StormContext *ctx, u8 *buf, u64 len);
+void storm_xcrypt_vaes(StormContext *ctx, u8 *buf, u64 len);
+void storm_next_block_4x_scalar(StormContext4x *ctx, u8 *const blocks[4],
+				u64 len);
+void storm_next_block_4x_avx2(StormContext4x *ctx, u8 *const blocks[4],
+			      u64 len);
+void storm_next_block_4x_vaes(StormContext4x *ctx, u8 *const blocks[4],
+			      u64 len);
+void storm_aead_scalar(StormContext *ctx, const StormContext *mac, u8 *buf,
+		       u64 len, u8 acc[32], i32 mode);
+void storm_aead_avx2(StormContext *ctx, const StormContext *mac, u8 *buf,
+		     u64 len, u8 acc[32], i32 mode);
+void storm_aead_vaes(StormContext *ctx, const StormContext *mac, u8 *buf,
+		     u64 len, u8 acc[32], i32 mode);
+void storm_chain_scalar(const StormContext *ctx, u8 *out, const u8 *in,
+			const u32 *steps, u32 n);
+void storm_chain_avx2(const StormContext *ctx, u8 *out, const u8 *in,
+		      const u32 *steps, u32 n);
+void storm_chain_vaes(const StormContext *ctx, u8 *out, const u8 *in,
+		      const u32 *steps, u32 n);
+u64 aighthash64_scalar(const u8 *p, u64 len, u64 h);
+u64 aighthash64_avx2(const u8 *p, u64 len, u64 h);
+u64 aighthash64_vaes(const u8 *p, u64 len, u64 h);
+i32 pqcrystals_kyber512_ref_keypair(u8 *pk, u8 *sk, Rng *rng);
+i32 pqcrystals_kyber512_ref_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng);
+i32 pqcrystals_kyber512_ref_dec(u8 *ss, const u8 *ct, const u8 *sk);
+i32 pqcrystals_kyber512_avx2_keypair(u8 *pk, u8 *sk, Rng *rng);
+i32 pqcrystals_kyber512_avx2_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng);
+i32 pqcrystals_kyber512_avx2_dec(u8 *ss, const u8 *ct, const u8 *sk);
+i32 pqcrystals_kyber512_ref_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_kyber512_ref_enc_expanded(u8 *ct, u8 *ss, const u8 *epk,
+					 Rng *rng);
+i32 pqcrystals_kyber512_avx2_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_kyber512_avx2_enc_expanded(u8 *ct, u8 *ss, const u8 *epk,
+					  Rng *rng);
+
+Test(aesenc_backends) {
+	__attribute__((aligned(32))) u8 key[32] = {7, 1, 9, 200, 31};
+	__attribute__((aligned(32))) u8 a[32], b[32];
+
+	if (!(cpu_features() & CPU_AES)) return;
+	for (u32 i = 0; i < 32; i++) a[i] = b[i] = i * 13;
+	for (u32 i = 0; i < 64; i++) {
+		aesenc256_scalar(a, key);
+		aesenc256_aesni(b, key);
+		ASSERT(!memcmp(a, b, 32), "aesni");
+	}
+}
+
+Test(storm_backends) {
+	__attribute__((aligned(32))) const u8 key[32] = {9, 8, 7, 6};
+	__attribute__((aligned(32))) u8 a[32], b[32], c[32];
+	u8 bulk_a[333], bulk_b[333], bulk_c[333];
+	u8 *pa[4], *pb[4], *pc[4];
+	StormContext4x la, lb, lc;
+	StormContext ca, cb, cc;
+	u32 features = cpu_features();
+
+	if (!(features & CPU_AVX2)) return;
+	storm_init_scalar(&ca, key);
+	storm_init_avx2(&cb, key);
+	storm_init_avx2(&cc, key);
+	ASSERT(!memcmp(&ca, &cb, sizeof(ca)), "init");
+
+	for (u32 i = 0; i < 128; i++) {
+		for (u32 j = 0; j < 32; j++) a[j] = b[j] = c[j] = i + j;
+		if (i & 1) {
+			storm_xcrypt_buffer_scalar(&ca, a);
+			storm_xcrypt_buffer_avx2(&cb, b);
+			if (features & CPU_VAES)
+				storm_xcrypt_buffer_vaes(&cc, c);
+		} else {
+			storm_next_block_scalar(&ca, a);
+			storm_next_block_avx2(&cb, b);
+			if (features & CPU_VAES) storm_next_block_vaes(&cc, c);
+		}
+		ASSERT(!memcmp(a, b, 32), "avx2");
+		if (features & CPU_VAES) ASSERT(!memcmp(a, c, 32), "vaes");
+	}
+
+	for (u32 i = 0; i < sizeof(bulk_a); i++)
+		bulk_a[i] = bulk_b[i] = bulk_c[i] = i;
+	storm_xcrypt_scalar(&ca, bulk_a, sizeof(bulk_a));
+	storm_xcrypt_avx2(&cb, bulk_b, sizeof(bulk_b));
+	ASSERT(!memcmp(bulk_a, bulk_b, sizeof(bulk_a)), "bulk avx2");
+	ASSERT(!memcmp(&ca, &cb, sizeof(ca)), "bulk avx2 ctx");
+	if (features & CPU_VAES) {
+		storm_xcrypt_vaes(&cc, bulk_c, sizeof(bulk_c));
+		ASSERT(!memcmp(bulk_a, bulk_c, sizeof(bulk_a)), "bulk vaes");
+	}
+
+	for (u32 i = 0; i < 4; i++) {
+		storm_init_scalar(&la.lane[i], key);
+		storm_init_avx2(&lb.lane[i], key);
+		storm_init_avx2(&lc.lane[i], key);
+		/* distinct lanes from one key: advance each lane i times */
+		for (u32 j = 0; j < i; j++) {
+			fastmemset(a, 0, 32);
+			storm_next_block_scalar(&la.lane[i], a);
+			fastmemset(a, 0, 32);
+			storm_next_block_avx2(&lb.lane[i], a);
+			fastmemset(a, 0, 32);
+			storm_next_block_avx2(&lc.lane[i], a);
+		}
+		pa[i] = bulk_a + i * 64;
+		pb[i] = bulk_b + i * 64;
+		pc[i] = bulk_c + i * 64;
+	}
+	fastmemcpy(bulk_b, bulk_a, 256);
+	fastmemcpy(bulk_c, bulk_a, 256);
+	storm_next_block_4x_scalar(&la, pa, 64);
+	storm_next_block_4x_avx2(&lb, pb, 64);
+	ASSERT(!memcmp(bulk_a, bulk_b, 256), "4x avx2");
+	if (features & CPU_VAES) {
+		storm_next_block_4x_vaes(&lc, pc, 64);
+		ASSERT(!memcmp(bulk_a, bulk_c, 256), "4x vaes");
+	}
+
+	/* AEAD: 77 bytes of ad (mode 0), then seal (1) and open (2) */
+	for (u32 mode = 1; mode <= 2; mode++) {
+		__attribute__((aligned(32))) u8 acc[3][32] = {0};
+		StormContext mac;
+		storm_init_scalar(&ca, key);
+		storm_init_avx2(&cb, key);
+		storm_init_avx2(&cc, key);
+		storm_init_scalar(&mac, a);
+		if (mode == 1)
+			for (u32 i = 0; i < sizeof(bulk_a); i++)
+				bulk_a[i] = bulk_b[i] = bulk_c[i] = i;
+		storm_aead_scalar(&ca, &mac, (u8 *)STORM_NUMS, 77, acc[0], 0);
+		storm_aead_scalar(&ca, &mac, bulk_a, sizeof(bulk_a), acc[0],
+				  mode);
+		storm_aead_avx2(&cb, &mac, (u8 *)STORM_NUMS, 77, acc[1], 0);
+		storm_aead_avx2(&cb, &mac, bulk_b, sizeof(bulk_b), acc[1],
+				mode);
+		ASSERT(!memcmp(bulk_a, bulk_b, sizeof(bulk_a)), "aead avx2");
+		ASSERT(!memcmp(acc[0], acc[1], 32), "aead avx2 acc");
+		ASSERT(!memcmp(&ca, &cb, sizeof(ca)), "aead avx2 ctx");
+		if (features & CPU_VAES) {
+			storm_aead_vaes(&cc, &mac, (u8 *)STORM_NUMS, 77,
+					acc[2], 0);
+			storm_aead_vaes(&cc, &mac, bulk_c, sizeof(bulk_c),
+					acc[2], mode);
+			ASSERT(!memcmp(bulk_a, bulk_c, sizeof(bulk_a)),
+			       "aead vaes");
+			ASSERT(!memcmp(acc[0], acc[2], 32), "aead vaes acc");
+		}
+	}
+	for (u32 i = 0; i < sizeof(bulk_a); i++)
+		ASSERT_EQ(bulk_a[i], (u8)i, "aead open");
+
+	/* storm_chain: ten chains of mixed length from 320 bytes of bulk */
+	{
+		u32 steps[10] = {5, 0, 40, 1, 2, 9, 0, 33, 12, 7};
+		storm_init_scalar(&ca, key);
+		storm_chain_scalar(&ca, bulk_b, bulk_a, steps, 10);
+		storm_chain_avx2(&ca, bulk_c, bulk_a, steps, 10);
+		ASSERT(!memcmp(bulk_b, bulk_c, 320), "chain avx2");
+		if (features & CPU_VAES) {
+			storm_chain_vaes(&ca, bulk_c, bulk_a, steps, 10);
+			ASSERT(!memcmp(bulk_b, bulk_c, 320), "chain vaes");
+		}
+	}
+}
+
+Test(aighthash_backends) {
+	__attribute__((aligned(32))) u8 buf[1024];
+	u32 features = cpu_features();
+
+	if (!(features & CPU_AVX2)) return;
+	for (u32 i = 0; i < sizeof(buf); i++) buf[i] = i * 31 + 7;
+	for (u32 len = 0; len <= sizeof(buf); len += 17) {
+		u64 h = aighthash64_scalar(buf, len, len);
+		ASSERT_EQ(h, aighthash64_avx2(buf, len, len), "avx2");
+		if (features & CPU_VAES)
+			ASSERT_EQ(h, aighthash64_vaes(buf, len, len), "vaes");
+	}
+}
+
+Test(kem_backends) {
+	__attribute__((aligned(32))) u8 seed[32] = {3, 1, 4, 1, 5};
+	KemPubKey pk1, pk2;
+	KemPubKeyExpanded epk1, epk2;
+	KemSecKey sk1, sk2;
+	KemCipherText ct1, ct2;
+	KemSharedSecret ss1, ss2, ss3;
+	Rng rng1, rng2;
+
+	if (!(cpu_features() & CPU_AVX2)) return;
+	rng_test_seed(&rng1, seed);
+	rng_test_seed(&rng2, seed);
+	pqcrystals_kyber512_ref_keypair(pk1.data, sk1.data, &rng1);
+	pqcrystals_kyber512_avx2_keypair(pk2.data, sk2.data, &rng2);
+	ASSERT(!memcmp(&pk1, &pk2, sizeof(pk1)), "pk");
+	ASSERT(!memcmp(&sk1, &sk2, sizeof(sk1)), "sk");
+
+	pqcrystals_kyber512_ref_enc(ct1.data, ss1.data, pk1.data, &rng1);
+	pqcrystals_kyber512_avx2_enc(ct2.data, ss2.data, pk2.data, &rng2);
+	ASSERT(!memcmp(&ct1, &ct2, sizeof(ct1)), "ct");
+	ASSERT(!memcmp(&ss1, &ss2, sizeof(ss1)), "ss");
+
+	pqcrystals_kyber512_ref_dec(ss3.data, ct2.data, sk1.data);
+	ASSERT(!memcmp(&ss1, &ss3, sizeof(ss1)), "ref dec");
+	pqcrystals_kyber512_avx2_dec(ss3.data, ct1.data, sk2.data);
+	ASSERT(!memcmp(&ss1, &ss3, sizeof(ss1)), "avx2 dec");
+
+	pqcrystals_kyber512_ref_pk_expand(epk1.data, pk1.data);
+	pqcrystals_kyber512_avx2_pk_expand(epk2.data, pk2.data);
+	pqcrystals_kyber512_ref_enc_expanded(ct1.data, ss1.data, epk1.data,
+					     &rng1);
+	pqcrystals_kyber512_avx2_enc_expanded(ct2.data, ss2.data, epk2.data,
+					      &rng2);
+	ASSERT(!memcmp(&ct1, &ct2, sizeof(ct1)), "expanded ct");
+	ASSERT(!memcmp(&ss1, &ss2, sizeof(ss1)), "expanded ss");
+}
+
+Test(dilithium_backends) {
+	__attribute__((aligned(32))) u8 seed[32] = {2, 7, 1, 8};
+	__attribute__((aligned(32))) u8 msg[32] = {1, 6, 1, 8};
+	PublicKey pk1, pk2;
+	SecretKey sk1, sk2;
+	PublicKeyExpanded epk1, epk2;
+	SecretKeyExpanded esk1, esk2;
+	Signature sig1, sig2;
+	u64 len1, len2;
+	Rng rng1, rng2;
+
+	if (!(cpu_features() & CPU_AVX2)) return;
+	rng_test_seed(&rng1, seed);
+	rng_test_seed(&rng2, seed);
+	pqcrystals_dilithium2_ref_keypair(pk1.data, sk1.data, seed);
+	pqcrystals_dilithium2_avx2_keypair(pk2.data, sk2.data, seed);
+	ASSERT(!memcmp(&pk1, &pk2, sizeof(pk1)), "pk");
+	ASSERT(!memcmp(&sk1, &sk2, sizeof(sk1)), "sk");
+
+	pqcrystals_dilithium2_ref_signature(sig1.data, &len1, msg, 32, NULL, 0,
+					    sk1.data, &rng1);
+	pqcrystals_dilithium2_avx2_signature(sig2.data, &len2, msg, 32, NULL,
+					     0, sk2.data, &rng2);
+	ASSERT_EQ(len1, len2, "siglen");
+	ASSERT(!memcmp(sig1.data, sig2.data, DILITHIUM_SIGNATURE_SIZE), "sig");
+
+	ASSERT(!pqcrystals_dilithium2_ref_verify(sig2.data, len2, msg, 32, NULL,
+						 0, pk1.data),
+	       "ref verify");
+	ASSERT(!pqcrystals_dilithium2_avx2_verify(sig1.data, len1, msg, 32,
+						  NULL, 0, pk2.data),
+	       "avx2 verify");
+
+	pqcrystals_dilithium2_ref_sk_expand(esk1.data, sk1.data);
+	pqcrystals_dilithium2_avx2_sk_expand(esk2.data, sk2.data);
+	pqcrystals_dilithium2_ref_signature_expanded(
+	    sig1.data, &len1, msg, 32, NULL, 0, esk1.data, &rng1);
+	pqcrystals_dilithium2_avx2_signature_expanded(
+	    sig2.data, &len2, msg, 32, NULL, 0, esk2.data, &rng2);
+	ASSERT(!memcmp(sig1.data, sig2.data, DILITHIUM_SIGNATURE_SIZE),
+	       "expanded sig");
+
+	pqcrystals_dilithium2_ref_pk_expand(epk1.data, pk1.data);
+	pqcrystals_dilithium2_avx2_pk_expand(epk2.data, pk2.data);
+	ASSERT(!pqcrystals_dilithium2_ref_verify_expanded(
+		   sig2.data, len2, msg, 32, NULL, 0, epk1.data),
+	       "ref verify_expanded");
+	ASSERT(!pqcrystals_dilithium2_avx2_verify_expanded(
+		   sig1.data, len1, msg, 32, NULL, 0, epk2.data),
+	       "avx2 verify_expanded");
+}
+#endif /* __x86_64__ && !NO_VECTOR */
@@ -36,80 +36,67 @@
 __attribute__((aligned(32))) static const u8 DOMAIN_CHAIN[32] = {
     0x01, 'W', 'O', 'T', 'S', '+', 'c', 'h', 'a', 'i', 'n'};
 
-static void wots_chain(StormContext *ctx, u8 out[32], const u8 in[32],
-		       u32 steps) {
-	fastmemcpy(out, in, 32);
+/*
+ * Every chain step is storm_next_block from the DOMAIN_CHAIN context, so the
+ * chain lengths are all the work there is; storm_chain runs them together.
+ */
+static void wots_chains(u8 *out, const u8 *in, const u32 steps[WOTS_LEN]) {
+	StormContext ctx;
+	storm_init(&ctx, DOMAIN_CHAIN);
+	storm_chain(&ctx, out, in, steps, WOTS_LEN);
+}
+
+/* Base-256 message digits followed by the two checksum digits */
+static void wots_digits(const u8 message[32], u32 digits[WOTS_LEN]) {
+	u16 checksum = 0;
 
-	for (u32 i = 0; i < steps; ++i) {
-		storm_init(ctx, DOMAIN_CHAIN);
-		storm_next_block(ctx, out);
+	for (u32 i = 0; i < WOTS_LEN1; ++i) {
+		digits[i] = message[i] ^ message[i + WOTS_LEN1];
+		checksum += (WOTS_W - 1) - digits[i];
 	}
+	for (u32 i = 0; i < WOTS_LEN2; ++i)
+		digits[WOTS_LEN1 + i] = (checksum >> (8 * i)) & 0xFF;
 }
 
-void wots_keyfrom(const u8 seed[32], WotsPubKey *pk, WotsSecKey *sk) {
+void wots_seckeyfrom(const u8 seed[32], WotsSecKey *sk) {
 	StormContext ctx;
 	storm_init(&ctx, seed);
 	fastmemset(sk->data, 0, WOTS_SECKEY_SIZE);
 
 	for (u32 i = 0; i < WOTS_LEN; ++i)
 		storm_next_block(&ctx, sk->data + i * WOTS_N);
-
-	for (u32 i = 0; i < WOTS_LEN; ++i) {
-		const u8 *base = sk->data + i * WOTS_N;
-		wots_chain(&ctx, pk->data + i * WOTS_N, base, WOTS_W - 1);
-	}
 	secure_zero(&ctx, sizeof(ctx));
 }
 
+void wots_keyfrom(const u8 seed[32], WotsPubKey *pk, WotsSecKey *sk) {
+	u32 steps[WOTS_LEN];
+
+	wots_seckeyfrom(seed, sk);
+	for (u32 i = 0; i < WOTS_LEN; ++i) steps[i] = WOTS_W - 1;
+	wots_chains(pk->data, sk->data, steps);
+}
+
 void wots_sign(const WotsSecKey *sk, const u8 message[32], WotsSig *sig) {
-	StormContext ctx;
-	u16 checksum = 0;
+	u32 steps[WOTS_LEN];
 
-	for (u32 i = 0; i < WOTS_LEN1; ++i) {
-		u8 digit = message[i] ^ message[i + WOTS_LEN1];
-		checksum += (WOTS_W - 1) - digit;
-		u32 steps = digit;
-		wots_chain(&ctx, sig->data + i * WOTS_N, sk->data + i * WOTS_N,
-			   steps);
-	}
+	wots_digits(message, steps);
+	wots_chains(sig->data, sk->data, steps);
+}
 
-	for (u32 i = 0; i < WOTS_LEN2; ++i) {
-		u8 digit = (checksum >> (8 * i)) & 0xFF;
-		u32 steps = digit;
-		u32 chain_idx = WOTS_LEN1 + i;
-		wots_chain(&ctx, sig->data + chain_idx * WOTS_N,
-			   sk->data + chain_idx * WOTS_N, steps);
-	}
+void wots_pk_from_sig(const WotsSig *sig, const u8 message[32],
+		      WotsPubKey *pk) {
+	u32 steps[WOTS_LEN];
 
-	secure_zero(&ctx, sizeof(ctx));
+	wots_digits(message, steps);
+	for (u32 i = 0; i < WOTS_LEN; ++i) steps[i] = (WOTS_W - 1) - steps[i];
+	wots_chains(pk->data, sig->data, steps);
 }
 
 i32 wots_verify(const WotsPubKey *pk, const WotsSig *sig,
 		const u8 message[32]) {
-	StormContext ctx;
-	u16 checksum = 0;
-	__attribute__((aligned(32))) u8 tmp[32];
-	i32 ret = 0;
-
-	for (u32 i = 0; i < WOTS_LEN1; ++i) {
-		u8 digit = message[i] ^ message[i + WOTS_LEN1];
-		checksum += (WOTS_W - 1) - digit;
-		u32 steps = (WOTS_W - 1) - digit;
-		const u8 *revealed = sig->data + i * WOTS_N;
-		wots_chain(&ctx, tmp, revealed, steps);
-		if (fastmemcmp(tmp, pk->data + i * WOTS_N, WOTS_N) != 0)
-			ret = -1;
-	}
-
-	for (u32 i = 0; i < WOTS_LEN2; ++i) {
-		u8 expected_digit = (checksum >> (8 * i)) & 0xFF;
-		u32 steps = (WOTS_W - 1) - expected_digit;
-		u32 chain_idx = WOTS_LEN1 + i;
-		const u8 *revealed = sig->data + chain_idx * WOTS_N;
-		wots_chain(&ctx, tmp, revealed, steps);
-		if (fastmemcmp(tmp, pk->data + chain_idx * WOTS_N, WOTS_N) != 0)
-			ret = -1;
-	}
+	WotsPubKey tmp;
 
-	return ret;
+	wots_pk_from_sig(sig, message, &tmp);
+	if (fastmemcmp(tmp.data, pk->data, WOTS_PUBKEY_SIZE) != 0) return -1;
+	return 0;
 }
@@ -0,0 +1,427 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#include <libfam/atomic.h>
+#include <libfam/errno.h>
+#include <libfam/pool.h>
+#include <libfam/storm.h>
+#include <libfam/string.h>
+#include <libfam/utils.h>
+#include <libfam/xmss.h>
+
+#define XMSS_N 32
+/* Levels at the top of the tree kept whole; height - K must be even */
+#define XMSS_BDS_K(height) (2 + ((height) & 1))
+/* 2^K - K - 1 nodes for K = 3 */
+#define XMSS_RETAIN_MAX 4
+/* Key generation hands out at most 2^XMSS_SPLIT subtrees */
+#define XMSS_SPLIT 8
+
+__attribute__((aligned(32))) static const u8 DOMAIN_WOTS[32] = {
+    0x02, 'X', 'M', 'S', 'S', 'w', 'o', 't', 's'};
+__attribute__((aligned(32))) static const u8 DOMAIN_LEAF[32] = {
+    0x03, 'X', 'M', 'S', 'S', 'l', 'e', 'a', 'f'};
+__attribute__((aligned(32))) static const u8 DOMAIN_NODE[32] = {
+    0x04, 'X', 'M', 'S', 'S', 'n', 'o', 'd', 'e'};
+__attribute__((aligned(32))) static const u8 DOMAIN_MSG[32] = {
+    0x05, 'X', 'M', 'S', 'S', 'm', 's', 'g'};
+
+/* One instance of the BDS treehash, computing a future auth path node */
+typedef struct {
+	u8 node[XMSS_N];
+	u64 next;
+	u8 h;
+	u8 completed;
+	u8 usage;
+} XmssTreehash;
+
+typedef struct {
+	__attribute__((aligned(32))) u8 sk_seed[XMSS_N];
+	u8 pub_seed[XMSS_N];
+	u8 root[XMSS_N];
+	u64 index;
+	u32 height;
+	u32 offset;
+	u8 levels[XMSS_MAX_HEIGHT + 1];
+	u8 stack[XMSS_MAX_HEIGHT + 1][XMSS_N];
+	u8 auth[XMSS_MAX_HEIGHT][XMSS_N];
+	u8 keep[XMSS_MAX_HEIGHT][XMSS_N];
+	u8 retain[XMSS_RETAIN_MAX][XMSS_N];
+	XmssTreehash treehash[XMSS_MAX_HEIGHT];
+} XmssSecKeyImpl;
+
+STATIC_ASSERT(sizeof(XmssSecKeyImpl) <= XMSS_SECKEY_SIZE, xmss_seckey_fits);
+
+typedef struct {
+	XmssSecKeyImpl *sk;
+	u8 (*roots)[XMSS_N];
+	u32 split;
+	u32 count;
+	u32 next;
+} XmssKeygen;
+
+/* A Storm context keyed by seed ^ domain */
+STATIC void xmss_ctx(StormContext *ctx, const u8 seed[32],
+		     const u8 domain[32]) {
+	__attribute__((aligned(32))) u8 key[32];
+	for (u32 i = 0; i < 32; i++) key[i] = seed[i] ^ domain[i];
+	storm_init(ctx, key);
+	secure_zero32(key);
+}
+
+/* Absorbs a tree position so that no two hashes share an input */
+STATIC void xmss_address(StormContext *ctx, u64 level, u64 index,
+			 u8 block[32]) {
+	fastmemset(block, 0, 32);
+	fastmemcpy(block, &level, sizeof(level));
+	fastmemcpy(block + 8, &index, sizeof(index));
+	storm_next_block(ctx, block);
+}
+
+/* Node (level, index) from its two children; out may alias either one */
+STATIC void xmss_node(const u8 pub_seed[32], u32 level, u64 index,
+		      const u8 left[32], const u8 right[32], u8 out[32]) {
+	__attribute__((aligned(32))) u8 block[32];
+	StormContext ctx;
+
+	xmss_ctx(&ctx, pub_seed, DOMAIN_NODE);
+	xmss_address(&ctx, level, index, block);
+	fastmemcpy(block, left, 32);
+	storm_next_block(&ctx, block);
+	fastmemcpy(block, right, 32);
+	storm_next_block(&ctx, block);
+	fastmemcpy(out, block, 32);
+}
+
+STATIC void xmss_leaf_from_pk(const u8 pub_seed[32], u64 index,
+			      const WotsPubKey *pk, u8 out[32]) {
+	__attribute__((aligned(32))) u8 block[32];
+	StormContext ctx;
+
+	xmss_ctx(&ctx, pub_seed, DOMAIN_LEAF);
+	xmss_address(&ctx, 0, index, block);
+	for (u32 i = 0; i < WOTS_CHAINS; i++) {
+		fastmemcpy(block, pk->data + i * WOTS_HASH_BYTES, 32);
+		storm_next_block(&ctx, block);
+	}
+	fastmemcpy(out, block, 32);
+}
+
+STATIC void xmss_wots_seed(const u8 sk_seed[32], u64 index, u8 seed[32]) {
+	StormContext ctx;
+
+	xmss_ctx(&ctx, sk_seed, DOMAIN_WOTS);
+	xmss_address(&ctx, 0, index, seed);
+	secure_zero(&ctx, sizeof(ctx));
+}
+
+STATIC void xmss_leaf(const XmssSecKeyImpl *sk, u64 index, u8 out[32]) {
+	__attribute__((aligned(32))) u8 seed[32];
+	WotsPubKey pk;
+	WotsSecKey wsk;
+
+	xmss_wots_seed(sk->sk_seed, index, seed);
+	wots_keyfrom(seed, &pk, &wsk);
+	xmss_leaf_from_pk(sk->pub_seed, index, &pk, out);
+	secure_zero32(seed);
+	secure_zero(&wsk, sizeof(wsk));
+}
+
+/* The message is signed bound to the key and to the leaf that signs it */
+STATIC void xmss_digest(const u8 pub_seed[32], const u8 root[32], u64 index,
+			const u8 message[32], u8 out[32]) {
+	StormContext ctx;
+
+	xmss_ctx(&ctx, pub_seed, DOMAIN_MSG);
+	xmss_address(&ctx, 0, index, out);
+	fastmemcpy(out, root, 32);
+	storm_next_block(&ctx, out);
+	fastmemcpy(out, message, 32);
+	storm_next_block(&ctx, out);
+}
+
+/*
+ * Stores the nodes the traversal starts from: the first auth path (index 1
+ * on every level), the first treehash results (index 3) and, on the top K
+ * levels, every right node after those.
+ */
+STATIC void xmss_keep_node(XmssSecKeyImpl *sk, u32 h, u64 index,
+			   const u8 node[32]) {
+	u32 height = sk->height, k = XMSS_BDS_K(height);
+
+	if (h == height)
+		fastmemcpy(sk->root, node, XMSS_N);
+	else if (index == 1)
+		fastmemcpy(sk->auth[h], node, XMSS_N);
+	else if (index == 3 && h < height - k)
+		fastmemcpy(sk->treehash[h].node, node, XMSS_N);
+	else if (h >= height - k && index >= 3 && (index & 1))
+		fastmemcpy(sk->retain[(1 << (height - 1 - h)) + h - height +
+				      ((index - 3) >> 1)],
+			   node, XMSS_N);
+}
+
+/*
+ * Root of the subtree whose 2^levels bottom nodes, on level base, start at
+ * index first. The bottom nodes are leaves when nodes is NULL.
+ */
+STATIC void xmss_subtree(XmssSecKeyImpl *sk, u32 base, u64 first, u32 levels,
+			 const u8 (*nodes)[XMSS_N], u8 out[32]) {
+	u8 stack[XMSS_MAX_HEIGHT + 1][XMSS_N];
+	u32 stack_levels[XMSS_MAX_HEIGHT + 1];
+	u32 top = 0;
+
+	for (u64 i = 0; i < (1ULL << levels); i++) {
+		u64 index = first + i;
+		if (nodes)
+			fastmemcpy(stack[top], nodes[i], XMSS_N);
+		else
+			xmss_leaf(sk, index, stack[top]);
+		stack_levels[top] = base;
+		xmss_keep_node(sk, base, index, stack[top++]);
+		while (top > 1 &&
+		       stack_levels[top - 1] == stack_levels[top - 2]) {
+			u32 h = stack_levels[top - 1] + 1;
+			u64 parent = index >> (h - base);
+			xmss_node(sk->pub_seed, h, parent, stack[top - 2],
+				  stack[top - 1], stack[top - 2]);
+			stack_levels[top - 2] = h;
+			xmss_keep_node(sk, h, parent, stack[--top - 1]);
+		}
+	}
+	fastmemcpy(out, stack[0], XMSS_N);
+}
+
+STATIC void xmss_keygen_worker(u32 id, void *arg) {
+	XmssKeygen *kg = arg;
+	u32 j;
+
+	(void)id;
+	while ((j = __aadd32(&kg->next, 1)) < kg->count)
+		xmss_subtree(kg->sk, 0, (u64)j << kg->split, kg->split, NULL,
+			     kg->roots[j]);
+}
+
+STATIC void xmss_treehash_update(XmssSecKeyImpl *sk, XmssTreehash *th) {
+	u8 node[XMSS_N];
+	u32 h = 0;
+
+	xmss_leaf(sk, th->next, node);
+	while (th->usage && sk->levels[sk->offset - 1] == h) {
+		xmss_node(sk->pub_seed, h + 1, th->next >> (h + 1),
+			  sk->stack[sk->offset - 1], node, node);
+		h++;
+		th->usage--;
+		sk->offset--;
+	}
+	if (h == th->h) {
+		fastmemcpy(th->node, node, XMSS_N);
+		th->completed = 1;
+	} else {
+		fastmemcpy(sk->stack[sk->offset], node, XMSS_N);
+		sk->levels[sk->offset++] = h;
+		th->usage++;
+		th->next++;
+	}
+}
+
+/* Lowest level this instance still has to merge at */
+STATIC u32 xmss_treehash_low(const XmssSecKeyImpl *sk,
+			     const XmssTreehash *th) {
+	u32 low = th->h;
+
+	if (th->completed) return sk->height;
+	for (u32 i = 0; i < th->usage; i++)
+		low = min(low, sk->levels[sk->offset - i - 1]);
+	return low;
+}
+
+/* Spends up to updates leaf computations on the most urgent treehash */
+STATIC void xmss_bds_update(XmssSecKeyImpl *sk, u32 updates) {
+	u32 instances = sk->height - XMSS_BDS_K(sk->height);
+
+	for (u32 j = 0; j < updates; j++) {
+		u32 level = instances, low = sk->height;
+		for (u32 i = 0; i < instances; i++) {
+			u32 l = xmss_treehash_low(sk, &sk->treehash[i]);
+			if (l < low) {
+				low = l;
+				level = i;
+			}
+		}
+		if (level == instances) break;
+		xmss_treehash_update(sk, &sk->treehash[level]);
+	}
+}
+
+/* Turns the auth path of leaf s into the auth path of leaf s + 1 */
+STATIC void xmss_bds_round(XmssSecKeyImpl *sk, u64 s) {
+	u32 height = sk->height, k = XMSS_BDS_K(height), tau = height;
+	u8 left[XMSS_N], right[XMSS_N];
+
+	for (u32 i = 0; i < height; i++) {
+		if (!((s >> i) & 1)) {
+			tau = i;
+			break;
+		}
+	}
+	if (tau > 0) {
+		fastmemcpy(left, sk->auth[tau - 1], XMSS_N);
+		fastmemcpy(right, sk->keep[tau - 1], XMSS_N);
+	}
+	if (!((s >> (tau + 1)) & 1) && tau < height - 1)
+		fastmemcpy(sk->keep[tau], sk->auth[tau], XMSS_N);
+	if (tau == 0) {
+		xmss_leaf(sk, s, sk->auth[0]);
+		return;
+	}
+
+	xmss_node(sk->pub_seed, tau, s >> tau, left, right, sk->auth[tau]);
+	for (u32 i = 0; i < tau; i++) {
+		if (i < height - k)
+			fastmemcpy(sk->auth[i], sk->treehash[i].node, XMSS_N);
+		else
+			fastmemcpy(sk->auth[i],
+				   sk->retain[(1 << (height - 1 - i)) + i -
+					      height + (((s >> i) - 1) >> 1)],
+				   XMSS_N);
+	}
+	for (u32 i = 0; i < tau && i < height - k; i++) {
+		u64 start = s + 1 + 3 * (1ULL << i);
+		if (start < (1ULL << height)) {
+			sk->treehash[i].h = i;
+			sk->treehash[i].next = start;
+			sk->treehash[i].completed = 0;
+			sk->treehash[i].usage = 0;
+		}
+	}
+}
+
+PUBLIC i32 xmss_keyfrom(const u8 seed[32], u8 height, XmssPubKey *pk,
+			XmssSecKey *sk) {
+	XmssSecKeyImpl *st = (XmssSecKeyImpl *)sk;
+	__attribute__((aligned(32))) u8 key[32];
+	u8 roots[1 << XMSS_SPLIT][XMSS_N];
+	ThreadPool *pool;
+	StormContext ctx;
+	XmssKeygen kg;
+	u32 split;
+
+	if (height < XMSS_MIN_HEIGHT || height > XMSS_MAX_HEIGHT) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fastmemset(sk, 0, sizeof(XmssSecKey));
+	st->height = height;
+	fastmemcpy(key, seed, 32);
+	storm_init(&ctx, key);
+	storm_next_block(&ctx, st->sk_seed);
+	storm_next_block(&ctx, st->pub_seed);
+	secure_zero32(key);
+	secure_zero(&ctx, sizeof(ctx));
+
+	/* Subtrees below the split level are built in parallel */
+	split = height > XMSS_SPLIT ? height - XMSS_SPLIT : 0;
+	kg.sk = st;
+	kg.roots = roots;
+	kg.split = split;
+	kg.count = 1U << (height - split);
+	kg.next = 0;
+	pool = global_pool();
+	if (!pool ||
+	    pool_run(pool, xmss_keygen_worker, &kg, pool_threads(pool) + 1))
+		xmss_keygen_worker(0, &kg);
+	xmss_subtree(st, split, 0, height - split, (const u8(*)[XMSS_N])roots,
+		     st->root);
+
+	for (u32 h = 0; h + XMSS_BDS_K(height) < height; h++) {
+		st->treehash[h].h = h;
+		st->treehash[h].completed = 1;
+	}
+
+	fastmemcpy(pk->root, st->root, XMSS_N);
+	fastmemcpy(pk->seed, st->pub_seed, XMSS_N);
+	pk->height = height;
+	return 0;
+}
+
+PUBLIC i32 xmss_sign(XmssSecKey *sk, const u8 message[32], XmssSig *sig) {
+	XmssSecKeyImpl *st = (XmssSecKeyImpl *)sk;
+	__attribute__((aligned(32))) u8 seed[32], digest[32];
+	u64 s = st->index;
+	WotsSecKey wsk;
+
+	if (s >> st->height) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	fastmemset(sig, 0, sizeof(XmssSig));
+	sig->index = s;
+	xmss_digest(st->pub_seed, st->root, s, message, digest);
+	xmss_wots_seed(st->sk_seed, s, seed);
+	wots_seckeyfrom(seed, &wsk);
+	wots_sign(&wsk, digest, &sig->wots);
+	fastmemcpy(sig->auth, st->auth, st->height * XMSS_N);
+	secure_zero32(seed);
+	secure_zero(&wsk, sizeof(wsk));
+
+	st->index++;
+	if (st->index < (1ULL << st->height)) {
+		xmss_bds_round(st, s);
+		xmss_bds_update(st, (st->height - XMSS_BDS_K(st->height)) / 2);
+	}
+	return 0;
+}
+
+PUBLIC i32 xmss_verify(const XmssPubKey *pk, const u8 message[32],
+		       const XmssSig *sig) {
+	__attribute__((aligned(32))) u8 digest[32], node[32];
+	u64 s = sig->index;
+	WotsPubKey wpk;
+
+	if (pk->height < XMSS_MIN_HEIGHT || pk->height > XMSS_MAX_HEIGHT ||
+	    s >> pk->height)
+		return -1;
+
+	xmss_digest(pk->seed, pk->root, s, message, digest);
+	wots_pk_from_sig(&sig->wots, digest, &wpk);
+	xmss_leaf_from_pk(pk->seed, s, &wpk, node);
+	for (u32 h = 0; h < pk->height; h++) {
+		if ((s >> h) & 1)
+			xmss_node(pk->seed, h + 1, s >> (h + 1), sig->auth[h],
+				  node, node);
+		else
+			xmss_node(pk->seed, h + 1, s >> (h + 1), node,
+				  sig->auth[h], node);
+	}
+	return fastmemcmp(node, pk->root, XMSS_N) ? -1 : 0;
+}
+
+PUBLIC u64 xmss_remaining(const XmssSecKey *sk) {
+	const XmssSecKeyImpl *st = (const XmssSecKeyImpl *)sk;
+	return (1ULL << st->height) - st->index;
+}
@@ -190,9 +190,11 @@ static unsigned int rej_uniform(i32 *a, unsigned int len, const u8 *buf,
 
 void poly_uniform_4x(poly *a0, poly *a1, poly *a2, poly *a3, const u8 seed[32],
 		     u16 nonce0, u16 nonce1, u16 nonce2, u16 nonce3) {
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	StormContext4x ctx;
 	unsigned int ctr0, ctr1, ctr2, ctr3;
 	ALIGNED_UINT8(512) buf[4] = {0};
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
 	__m256i f;
 
 	f = _mm256_loadu_si256((__m256i *)seed);
@@ -210,17 +212,12 @@ void poly_uniform_4x(poly *a0, poly *a1, poly *a2, poly *a3, const u8 seed[32],
 	buf[3].coeffs[SEEDBYTES + 0] = nonce3;
 	buf[3].coeffs[SEEDBYTES + 1] = nonce3 >> 8;
 
-	storm_init_nonce(&ctx0, nonce0);
-	storm_init_nonce(&ctx1, nonce1);
-	storm_init_nonce(&ctx2, nonce2);
-	storm_init_nonce(&ctx3, nonce3);
+	storm_init_nonce(&ctx.lane[0], nonce0);
+	storm_init_nonce(&ctx.lane[1], nonce1);
+	storm_init_nonce(&ctx.lane[2], nonce2);
+	storm_init_nonce(&ctx.lane[3], nonce3);
 
-	for (u32 i = 0; i < 512; i += 32) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i);
-	}
+	storm_next_block_4x(&ctx, blocks, 512);
 
 	ctr0 = rej_uniform_avx(a0->coeffs, buf[0].coeffs);
 	ctr1 = rej_uniform_avx(a1->coeffs, buf[1].coeffs);
@@ -228,10 +225,7 @@ void poly_uniform_4x(poly *a0, poly *a1, poly *a2, poly *a3, const u8 seed[32],
 	ctr3 = rej_uniform_avx(a3->coeffs, buf[3].coeffs);
 
 	while (ctr0 < N || ctr1 < N || ctr2 < N || ctr3 < N) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs);
+		storm_next_block_4x(&ctx, blocks, 32);
 
 		ctr0 +=
 		    rej_uniform(a0->coeffs + ctr0, N - ctr0, buf[0].coeffs, 32);
@@ -270,9 +264,11 @@ static unsigned int rej_eta(i32 *a, unsigned int len, const u8 *buf,
 void poly_uniform_eta_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 			 const u8 seed[64], u16 nonce0, u16 nonce1, u16 nonce2,
 			 u16 nonce3) {
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	StormContext4x ctx;
 	unsigned int ctr0, ctr1, ctr2, ctr3;
 	ALIGNED_UINT8(128) buf[4] = {0};
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
 
 	__m256i f;
 
@@ -296,17 +292,12 @@ void poly_uniform_eta_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 	buf[3].coeffs[64] = nonce3;
 	buf[3].coeffs[65] = nonce3 >> 8;
 
-	storm_init_nonce(&ctx0, nonce0);
-	storm_init_nonce(&ctx1, nonce1);
-	storm_init_nonce(&ctx2, nonce2);
-	storm_init_nonce(&ctx3, nonce3);
+	storm_init_nonce(&ctx.lane[0], nonce0);
+	storm_init_nonce(&ctx.lane[1], nonce1);
+	storm_init_nonce(&ctx.lane[2], nonce2);
+	storm_init_nonce(&ctx.lane[3], nonce3);
 
-	for (u32 i = 0; i < 128; i += 32) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i);
-	}
+	storm_next_block_4x(&ctx, blocks, 128);
 
 	ctr0 = rej_eta_avx(a0->coeffs, buf[0].coeffs);
 	ctr1 = rej_eta_avx(a1->coeffs, buf[1].coeffs);
@@ -314,10 +305,7 @@ void poly_uniform_eta_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 	ctr3 = rej_eta_avx(a3->coeffs, buf[3].coeffs);
 
 	while (ctr0 < N || ctr1 < N || ctr2 < N || ctr3 < N) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs);
+		storm_next_block_4x(&ctx, blocks, 32);
 
 		ctr0 += rej_eta(a0->coeffs + ctr0, N - ctr0, buf[0].coeffs, 32);
 		ctr1 += rej_eta(a1->coeffs + ctr1, N - ctr1, buf[1].coeffs, 32);
@@ -329,9 +317,11 @@ void poly_uniform_eta_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 void poly_uniform_gamma1_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 			    const u8 seed[64], u16 nonce0, u16 nonce1,
 			    u16 nonce2, u16 nonce3) {
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	StormContext4x ctx;
 	ALIGNED_UINT8(704)
 	buf[4] = {0};
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
 	__m256i f;
 
 	f = _mm256_loadu_si256((__m256i *)&seed[0]);
@@ -354,16 +344,11 @@ void poly_uniform_gamma1_4x(poly *a0, poly *a1, poly *a2, poly *a3,
 	buf[3].coeffs[64] = nonce3;
 	buf[3].coeffs[65] = nonce3 >> 8;
 
-	storm_init_nonce(&ctx0, nonce0);
-	storm_init_nonce(&ctx1, nonce1);
-	storm_init_nonce(&ctx2, nonce2);
-	storm_init_nonce(&ctx3, nonce3);
-	for (u32 i = 0; i < 704; i += 32) {
-		storm_next_block(&ctx0, buf[0].coeffs + i);
-		storm_next_block(&ctx1, buf[1].coeffs + i);
-		storm_next_block(&ctx2, buf[2].coeffs + i);
-		storm_next_block(&ctx3, buf[3].coeffs + i);
-	}
+	storm_init_nonce(&ctx.lane[0], nonce0);
+	storm_init_nonce(&ctx.lane[1], nonce1);
+	storm_init_nonce(&ctx.lane[2], nonce2);
+	storm_init_nonce(&ctx.lane[3], nonce3);
+	storm_next_block_4x(&ctx, blocks, 704);
 
 	polyz_unpack(a0, buf[0].coeffs);
 	polyz_unpack(a1, buf[1].coeffs);
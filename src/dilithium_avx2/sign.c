@@ -41,6 +41,12 @@
 #include <libfam/sign_impl.h>
 #include <libfam/storm.h>
 #include <libfam/string.h>
+#include <libfam/utils.h>
+
+STATIC_ASSERT(sizeof(expanded_sk) == CRYPTO_SECRETKEYEXPANDEDBYTES,
+	      expanded_sk_size);
+STATIC_ASSERT(sizeof(expanded_pk) == CRYPTO_PUBLICKEYEXPANDEDBYTES,
+	      expanded_pk_size);
 
 static inline void polyvec_matrix_expand_row(polyvecl **row, polyvecl buf[2],
 					     const u8 rho[SEEDBYTES],
@@ -150,37 +156,48 @@ int crypto_sign_keypair(u8 *pk, u8 *sk, const u8 seed[32]) {
 	return 0;
 }
 
-int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
-				   const u8 *pre, u64 prelen,
-				   const u8 rnd[RNDBYTES], const u8 *sk) {
+int crypto_sign_sk_expand(u8 *esk, const u8 *sk) {
+	expanded_sk *e = (expanded_sk *)esk;
+	u8 rho[SEEDBYTES];
+
+	unpack_sk(rho, e->tr, e->key, &e->t0, &e->s1, &e->s2, sk);
+
+	/* Expand matrix and transform vectors */
+	polyvec_matrix_expand(e->mat, rho);
+	polyvecl_ntt(&e->s1);
+	polyveck_ntt(&e->s2);
+	polyveck_ntt(&e->t0);
+	return 0;
+}
+
+int crypto_sign_signature_expanded_internal(u8 *sig, u64 *siglen, const u8 *m,
+					    u64 mlen, const u8 *pre, u64 prelen,
+					    const u8 rnd[RNDBYTES],
+					    const u8 *esk) {
+	const expanded_sk *e = (const expanded_sk *)esk;
 	StormContext ctx;
 	unsigned int i, n, pos;
-	__attribute__((
-	    aligned(32))) u8 seedbuf[2 * SEEDBYTES + TRBYTES + 2 * CRHBYTES];
-	u8 *rho, *tr, *key, *mu, *rhoprime;
+	__attribute__((aligned(32))) u8 seedbuf[2 * CRHBYTES];
+	u8 *mu, *rhoprime;
 	u8 hintbuf[N];
 	u8 *hint = sig + CTILDEBYTES + L * POLYZ_PACKEDBYTES;
 	u64 nonce = 0;
-	polyvecl mat[K], s1, z;
-	polyveck t0, s2, w1;
+	polyvecl z;
+	polyveck w1;
 	poly c, tmp;
 	union {
 		polyvecl y;
 		polyveck w0;
 	} tmpv;
 
-	rho = seedbuf;
-	tr = rho + SEEDBYTES;
-	key = tr + TRBYTES;
-	mu = key + SEEDBYTES;
+	mu = seedbuf;
 	rhoprime = mu + CRHBYTES;
-	unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
 
 	/* Compute mu = CRH(tr, pre, msg) */
 
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 buffer[TRBYTES + 32];
-	fastmemcpy(buffer, tr, TRBYTES);
+	fastmemcpy(buffer, e->tr, TRBYTES);
 	fastmemcpy(buffer + TRBYTES, m, 32);
 	storm_next_block(&ctx, buffer);
 	storm_next_block(&ctx, buffer + 32);
@@ -191,7 +208,7 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 rho_prime_buffer[128];
-	fastmemcpy(rho_prime_buffer, key, 32);
+	fastmemcpy(rho_prime_buffer, e->key, 32);
 	fastmemcpy(rho_prime_buffer + 32, rnd, 32);
 	fastmemcpy(rho_prime_buffer + 64, mu, 64);
 	storm_next_block(&ctx, rho_prime_buffer);
@@ -202,12 +219,6 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 	storm_next_block(&ctx, rhoprime);
 	storm_next_block(&ctx, rhoprime + 32);
 
-	/* Expand matrix and transform vectors */
-	polyvec_matrix_expand(mat, rho);
-	polyvecl_ntt(&s1);
-	polyveck_ntt(&s2);
-	polyveck_ntt(&t0);
-
 rej:
 	/* Sample intermediate vector y */
 	poly_uniform_gamma1_4x(&z.vec[0], &z.vec[1], &z.vec[2], &z.vec[3],
@@ -218,7 +229,7 @@ rej:
 	/* Matrix-vector product */
 	tmpv.y = z;
 	polyvecl_ntt(&tmpv.y);
-	polyvec_matrix_pointwise_montgomery(&w1, mat, &tmpv.y);
+	polyvec_matrix_pointwise_montgomery(&w1, e->mat, &tmpv.y);
 	polyveck_invntt_tomont(&w1);
 
 	/* Decompose w and call the random oracle */
@@ -241,7 +252,7 @@ rej:
 
 	/* Compute z, reject if it reveals secret */
 	for (i = 0; i < L; i++) {
-		poly_pointwise_montgomery(&tmp, &c, &s1.vec[i]);
+		poly_pointwise_montgomery(&tmp, &c, &e->s1.vec[i]);
 		poly_invntt_tomont(&tmp);
 		poly_add(&z.vec[i], &z.vec[i], &tmp);
 		poly_reduce(&z.vec[i]);
@@ -255,14 +266,14 @@ rej:
 	for (i = 0; i < K; i++) {
 		/* Check that subtracting cs2 does not change high bits of w and
 		 * low bits do not reveal secret information */
-		poly_pointwise_montgomery(&tmp, &c, &s2.vec[i]);
+		poly_pointwise_montgomery(&tmp, &c, &e->s2.vec[i]);
 		poly_invntt_tomont(&tmp);
 		poly_sub(&tmpv.w0.vec[i], &tmpv.w0.vec[i], &tmp);
 		poly_reduce(&tmpv.w0.vec[i]);
 		if (poly_chknorm(&tmpv.w0.vec[i], GAMMA2 - BETA)) goto rej;
 
 		/* Compute hints */
-		poly_pointwise_montgomery(&tmp, &c, &t0.vec[i]);
+		poly_pointwise_montgomery(&tmp, &c, &e->t0.vec[i]);
 		poly_invntt_tomont(&tmp);
 		poly_reduce(&tmp);
 		if (poly_chknorm(&tmp, GAMMA2)) goto rej;
@@ -285,6 +296,16 @@ rej:
 	return 0;
 }
 
+int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
+				   const u8 *pre, u64 prelen,
+				   const u8 rnd[RNDBYTES], const u8 *sk) {
+	expanded_sk esk;
+
+	crypto_sign_sk_expand((u8 *)&esk, sk);
+	return crypto_sign_signature_expanded_internal(
+	    sig, siglen, m, mlen, pre, prelen, rnd, (const u8 *)&esk);
+}
+
 int crypto_sign_signature(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 			  const u8 *ctx, u64 ctxlen, const u8 *sk, Rng *rng) {
 	u8 pre[257];
@@ -303,39 +324,73 @@ int crypto_sign_signature(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 	return 0;
 }
 
-int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
-				u64 mlen, const u8 *pre, u64 prelen,
-				const u8 *pk) {
+int crypto_sign_signature_expanded(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
+				   const u8 *ctx, u64 ctxlen, const u8 *esk,
+				   Rng *rng) {
+	u8 pre[257];
+	__attribute__((aligned(32))) u8 rnd[RNDBYTES] = {0};
+
+	if (ctxlen > 255) return -1;
+
+	pre[0] = 0;
+	pre[1] = ctxlen;
+	fastmemcpy(&pre[2], ctx, ctxlen);
+	rng_gen(rng, rnd, RNDBYTES);
+
+	crypto_sign_signature_expanded_internal(sig, siglen, m, mlen, pre,
+						2 + ctxlen, rnd, esk);
+	return 0;
+}
+
+int crypto_sign_pk_expand(u8 *epk, const u8 *pk) {
+	expanded_pk *e = (expanded_pk *)epk;
+	StormContext ctx;
+	unsigned int i;
+
+	/* Compute H(rho, t1) */
+	storm_init(&ctx, HASH_DOMAIN);
+	__attribute__((aligned(32))) u8 pk_copy[CRYPTO_PUBLICKEYBYTES];
+	fastmemcpy(pk_copy, pk, CRYPTO_PUBLICKEYBYTES);
+	for (u32 i = 0; i < CRYPTO_PUBLICKEYBYTES; i += 32)
+		storm_next_block(&ctx, pk_copy + i);
+	fastmemset(e->tr, 0, TRBYTES);
+	storm_next_block(&ctx, e->tr);
+	storm_next_block(&ctx, e->tr + 32);
+
+	/* Expand matrix and transform 2^d t1 */
+	polyvec_matrix_expand(e->mat, pk);
+	for (i = 0; i < K; i++) {
+		polyt1_unpack(&e->t1.vec[i],
+			      pk + SEEDBYTES + i * POLYT1_PACKEDBYTES);
+		poly_shiftl(&e->t1.vec[i]);
+		poly_ntt(&e->t1.vec[i]);
+	}
+	return 0;
+}
+
+int crypto_sign_verify_expanded_internal(const u8 *sig, u64 siglen,
+					 const u8 *m, u64 mlen, const u8 *pre,
+					 u64 prelen, const u8 *epk) {
+	const expanded_pk *e = (const expanded_pk *)epk;
 	StormContext ctx;
 	unsigned int i, j, pos = 0;
 	/* polyw1_pack writes additional 14 bytes */
 	ALIGNED_UINT8(K * POLYW1_PACKEDBYTES + 14) buf;
 	__attribute__((aligned(32))) u8 mu[CRHBYTES] = {0};
 	const u8 *hint = sig + CTILDEBYTES + L * POLYZ_PACKEDBYTES;
-	polyvecl rowbuf[2];
-	polyvecl *row = rowbuf;
 	polyvecl z;
 	poly c, w1, h;
 
 	if (siglen != CRYPTO_BYTES) return -1;
 
 	/* Compute CRH(H(rho, t1), pre, msg) */
-	storm_init(&ctx, HASH_DOMAIN);
-	__attribute__((aligned(32))) u8 pk_copy[CRYPTO_PUBLICKEYBYTES];
-	fastmemcpy(pk_copy, pk, CRYPTO_PUBLICKEYBYTES);
-	for (u32 i = 0; i < CRYPTO_PUBLICKEYBYTES; i += 32)
-		storm_next_block(&ctx, pk_copy + i);
-	storm_next_block(&ctx, mu);
-	storm_next_block(&ctx, mu + 32);
-
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 buffer[TRBYTES + 32];
-	fastmemcpy(buffer, mu, TRBYTES);
+	fastmemcpy(buffer, e->tr, TRBYTES);
 	fastmemcpy(buffer + TRBYTES, m, 32);
 	storm_next_block(&ctx, buffer);
 	storm_next_block(&ctx, buffer + 32);
 	storm_next_block(&ctx, buffer + 64);
-	fastmemset(mu, 0, 64);
 	storm_next_block(&ctx, mu);
 	storm_next_block(&ctx, mu + 32);
 
@@ -351,16 +406,9 @@ int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
 	}
 
 	for (i = 0; i < K; i++) {
-		/* Expand matrix row */
-		polyvec_matrix_expand_row(&row, rowbuf, pk, i);
-
 		/* Compute i-th row of Az - c2^Dt1 */
-		polyvecl_pointwise_acc_montgomery(&w1, row, &z);
-
-		polyt1_unpack(&h, pk + SEEDBYTES + i * POLYT1_PACKEDBYTES);
-		poly_shiftl(&h);
-		poly_ntt(&h);
-		poly_pointwise_montgomery(&h, &c, &h);
+		polyvecl_pointwise_acc_montgomery(&w1, &e->mat[i], &z);
+		poly_pointwise_montgomery(&h, &c, &e->t1.vec[i]);
 
 		poly_sub(&w1, &w1, &h);
 		poly_reduce(&w1);
@@ -405,6 +453,18 @@ int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
 	return 0;
 }
 
+int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
+				u64 mlen, const u8 *pre, u64 prelen,
+				const u8 *pk) {
+	expanded_pk epk;
+
+	if (siglen != CRYPTO_BYTES) return -1;
+
+	crypto_sign_pk_expand((u8 *)&epk, pk);
+	return crypto_sign_verify_expanded_internal(sig, siglen, m, mlen, pre,
+						    prelen, (const u8 *)&epk);
+}
+
 int crypto_sign_verify(const u8 *sig, u64 siglen, const u8 *m, u64 mlen,
 		       const u8 *ctx, u64 ctxlen, const u8 *pk) {
 	u8 pre[257];
@@ -418,4 +478,18 @@ int crypto_sign_verify(const u8 *sig, u64 siglen, const u8 *m, u64 mlen,
 					   2 + ctxlen, pk);
 }
 
+int crypto_sign_verify_expanded(const u8 *sig, u64 siglen, const u8 *m,
+				u64 mlen, const u8 *ctx, u64 ctxlen,
+				const u8 *epk) {
+	u8 pre[257];
+
+	if (ctxlen > 255) return -1;
+
+	pre[0] = 0;
+	pre[1] = ctxlen;
+	fastmemcpy(&pre[2], ctx, ctxlen);
+	return crypto_sign_verify_expanded_internal(sig, siglen, m, mlen, pre,
+						    2 + ctxlen, epk);
+}
+
 #endif /* USE_AVX2 */
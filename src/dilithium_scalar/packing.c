@@ -23,14 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifndef USE_AVX2
-
 #include <dilithium_scalar/packing.h>
 #include <dilithium_scalar/params.h>
 #include <dilithium_scalar/poly.h>
@@ -233,5 +225,3 @@ int unpack_sig(u8 c[CTILDEBYTES], polyvecl *z, polyveck *h,
 
 	return 0;
 }
-
-#endif /* !USE_AVX2 */
@@ -23,14 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifndef USE_AVX2
-
 #include <dilithium_scalar/params.h>
 #include <dilithium_scalar/reduce.h>
 
@@ -99,5 +91,3 @@ i32 freeze(i32 a) {
 	a = caddq(a);
 	return a;
 }
-
-#endif /* !USE_AVX2 */
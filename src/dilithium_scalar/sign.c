@@ -23,14 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifndef USE_AVX2
-
 #include <dilithium_scalar/packing.h>
 #include <dilithium_scalar/params.h>
 #include <dilithium_scalar/poly.h>
@@ -39,6 +31,12 @@
 #include <libfam/sign_impl.h>
 #include <libfam/storm.h>
 #include <libfam/string.h>
+#include <libfam/utils.h>
+
+STATIC_ASSERT(sizeof(expanded_sk) == CRYPTO_SECRETKEYEXPANDEDBYTES,
+	      expanded_sk_size);
+STATIC_ASSERT(sizeof(expanded_pk) == CRYPTO_PUBLICKEYEXPANDEDBYTES,
+	      expanded_pk_size);
 
 /*************************************************
  * Name:        crypto_sign_keypair
@@ -117,9 +115,36 @@ int crypto_sign_keypair(u8 *pk, u8 *sk, const u8 seed[32]) {
 }
 
 /*************************************************
- * Name:        crypto_sign_signature_internal
+ * Name:        crypto_sign_sk_expand
  *
- * Description: Computes signature. Internal API.
+ * Description: Unpacks a secret key and precomputes A, s1, s2 and t0 in
+ *              NTT form for repeated signing.
+ *
+ * Arguments:   - u8 *esk: pointer to output expanded secret key (of
+ *                         length CRYPTO_SECRETKEYEXPANDEDBYTES)
+ *              - u8 *sk:  pointer to bit-packed secret key
+ *
+ * Returns 0 (success)
+ **************************************************/
+int crypto_sign_sk_expand(u8 *esk, const u8 *sk) {
+	expanded_sk *e = (expanded_sk *)esk;
+	u8 rho[SEEDBYTES];
+
+	unpack_sk(rho, e->tr, e->key, &e->t0, &e->s1, &e->s2, sk);
+
+	/* Expand matrix and transform vectors */
+	polyvec_matrix_expand(e->mat, rho);
+	polyvecl_ntt(&e->s1);
+	polyveck_ntt(&e->s2);
+	polyveck_ntt(&e->t0);
+	return 0;
+}
+
+/*************************************************
+ * Name:        crypto_sign_signature_expanded_internal
+ *
+ * Description: Computes signature from an expanded secret key. Internal
+ *              API.
  *
  * Arguments:   - u8 *sig:   pointer to output signature (of length
  *CRYPTO_BYTES)
@@ -129,30 +154,27 @@ int crypto_sign_keypair(u8 *pk, u8 *sk, const u8 seed[32]) {
  *              - u8 *pre:   pointer to prefix string
  *              - u64 prelen:  length of prefix string
  *              - u8 *rnd:   pointer to random seed
- *              - u8 *sk:    pointer to bit-packed secret key
+ *              - u8 *esk:   pointer to expanded secret key
  *
  * Returns 0 (success)
  **************************************************/
-int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
-				   const u8 *pre, u64 prelen,
-				   const u8 rnd[RNDBYTES], const u8 *sk) {
+int crypto_sign_signature_expanded_internal(u8 *sig, u64 *siglen, const u8 *m,
+					    u64 mlen, const u8 *pre, u64 prelen,
+					    const u8 rnd[RNDBYTES],
+					    const u8 *esk) {
+	const expanded_sk *e = (const expanded_sk *)esk;
 	StormContext ctx;
 	unsigned int n;
-	__attribute__((
-	    aligned(32))) u8 seedbuf[2 * SEEDBYTES + TRBYTES + 2 * CRHBYTES];
-	u8 *rho, *tr, *key, *mu, *rhoprime;
+	__attribute__((aligned(32))) u8 seedbuf[2 * CRHBYTES];
+	u8 *mu, *rhoprime;
 	u16 nonce = 0;
-	polyvecl mat[K], s1, y, z;
-	polyveck t0, s2, w1, w0, h;
+	polyvecl y, z;
+	polyveck w1, w0, h;
 	poly cp;
 	// keccak_state state;
 
-	rho = seedbuf;
-	tr = rho + SEEDBYTES;
-	key = tr + TRBYTES;
-	mu = key + SEEDBYTES;
+	mu = seedbuf;
 	rhoprime = mu + CRHBYTES;
-	unpack_sk(rho, tr, key, &t0, &s1, &s2, sk);
 
 	/* Compute mu = CRH(tr, pre, msg) */
 	/*
@@ -166,7 +188,7 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 buffer[TRBYTES + 32];
-	fastmemcpy(buffer, tr, TRBYTES);
+	fastmemcpy(buffer, e->tr, TRBYTES);
 	fastmemcpy(buffer + TRBYTES, m, 32);
 	storm_next_block(&ctx, buffer);
 	storm_next_block(&ctx, buffer + 32);
@@ -178,7 +200,7 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 	/* Compute rhoprime = CRH(key, rnd, mu) */
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 rho_prime_buffer[128];
-	fastmemcpy(rho_prime_buffer, key, 32);
+	fastmemcpy(rho_prime_buffer, e->key, 32);
 	fastmemcpy(rho_prime_buffer + 32, rnd, 32);
 	fastmemcpy(rho_prime_buffer + 64, mu, 64);
 	storm_next_block(&ctx, rho_prime_buffer);
@@ -198,12 +220,6 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 	shake256_squeeze(rhoprime, CRHBYTES, &state);
 	*/
 
-	/* Expand matrix and transform vectors */
-	polyvec_matrix_expand(mat, rho);
-	polyvecl_ntt(&s1);
-	polyveck_ntt(&s2);
-	polyveck_ntt(&t0);
-
 rej:
 	/* Sample intermediate vector y */
 	polyvecl_uniform_gamma1(&y, rhoprime, nonce++);
@@ -211,7 +227,7 @@ rej:
 	/* Matrix-vector multiplication */
 	z = y;
 	polyvecl_ntt(&z);
-	polyvec_matrix_pointwise_montgomery(&w1, mat, &z);
+	polyvec_matrix_pointwise_montgomery(&w1, e->mat, &z);
 	polyveck_reduce(&w1);
 	polyveck_invntt_tomont(&w1);
 
@@ -242,7 +258,7 @@ rej:
 	poly_ntt(&cp);
 
 	/* Compute z, reject if it reveals secret */
-	polyvecl_pointwise_poly_montgomery(&z, &cp, &s1);
+	polyvecl_pointwise_poly_montgomery(&z, &cp, &e->s1);
 	polyvecl_invntt_tomont(&z);
 	polyvecl_add(&z, &z, &y);
 	polyvecl_reduce(&z);
@@ -250,14 +266,14 @@ rej:
 
 	/* Check that subtracting cs2 does not change high bits of w and low
 	 * bits do not reveal secret information */
-	polyveck_pointwise_poly_montgomery(&h, &cp, &s2);
+	polyveck_pointwise_poly_montgomery(&h, &cp, &e->s2);
 	polyveck_invntt_tomont(&h);
 	polyveck_sub(&w0, &w0, &h);
 	polyveck_reduce(&w0);
 	if (polyveck_chknorm(&w0, GAMMA2 - BETA)) goto rej;
 
 	/* Compute hints for w1 */
-	polyveck_pointwise_poly_montgomery(&h, &cp, &t0);
+	polyveck_pointwise_poly_montgomery(&h, &cp, &e->t0);
 	polyveck_invntt_tomont(&h);
 	polyveck_reduce(&h);
 	if (polyveck_chknorm(&h, GAMMA2)) goto rej;
@@ -272,6 +288,33 @@ rej:
 	return 0;
 }
 
+/*************************************************
+ * Name:        crypto_sign_signature_internal
+ *
+ * Description: Computes signature. Internal API.
+ *
+ * Arguments:   - u8 *sig:   pointer to output signature (of length
+ *CRYPTO_BYTES)
+ *              - u64 *siglen: pointer to output length of signature
+ *              - u8 *m:     pointer to message to be signed
+ *              - u64 mlen:    length of message
+ *              - u8 *pre:   pointer to prefix string
+ *              - u64 prelen:  length of prefix string
+ *              - u8 *rnd:   pointer to random seed
+ *              - u8 *sk:    pointer to bit-packed secret key
+ *
+ * Returns 0 (success)
+ **************************************************/
+int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
+				   const u8 *pre, u64 prelen,
+				   const u8 rnd[RNDBYTES], const u8 *sk) {
+	expanded_sk esk;
+
+	crypto_sign_sk_expand((u8 *)&esk, sk);
+	return crypto_sign_signature_expanded_internal(
+	    sig, siglen, m, mlen, pre, prelen, rnd, (const u8 *)&esk);
+}
+
 /*************************************************
  * Name:        crypto_sign_signature
  *
@@ -308,6 +351,42 @@ int crypto_sign_signature(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 	return 0;
 }
 
+/*************************************************
+ * Name:        crypto_sign_signature_expanded
+ *
+ * Description: Computes signature from an expanded secret key.
+ *
+ * Arguments:   - u8 *sig:   pointer to output signature (of length
+ *CRYPTO_BYTES)
+ *              - u64 *siglen: pointer to output length of signature
+ *              - u8 *m:     pointer to message to be signed
+ *              - u64 mlen:    length of message
+ *              - u8 *ctx:   pointer to contex string
+ *              - u64 ctxlen:  length of contex string
+ *              - u8 *esk:   pointer to expanded secret key
+ *
+ * Returns 0 (success) or -1 (context string too long)
+ **************************************************/
+int crypto_sign_signature_expanded(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
+				   const u8 *ctx, u64 ctxlen, const u8 *esk,
+				   Rng *rng) {
+	u64 i;
+	u8 pre[257];
+	__attribute__((aligned(32))) u8 rnd[RNDBYTES] = {0};
+
+	if (ctxlen > 255) return -1;
+
+	pre[0] = 0;
+	pre[1] = ctxlen;
+	for (i = 0; i < ctxlen; i++) pre[2 + i] = ctx[i];
+
+	rng_gen(rng, rnd, RNDBYTES);
+
+	crypto_sign_signature_expanded_internal(sig, siglen, m, mlen, pre,
+						2 + ctxlen, rnd, esk);
+	return 0;
+}
+
 /*************************************************
  * Name:        crypto_sign
  *
@@ -340,9 +419,46 @@ int crypto_sign(u8 *sm, u64 *smlen, const u8 *m, u64 mlen, const u8 *ctx,
 }
 
 /*************************************************
- * Name:        crypto_sign_verify_internal
+ * Name:        crypto_sign_pk_expand
  *
- * Description: Verifies signature. Internal API.
+ * Description: Unpacks a public key and precomputes A, 2^d t1 in NTT
+ *              form and H(rho, t1) for repeated verification.
+ *
+ * Arguments:   - u8 *epk: pointer to output expanded public key (of
+ *                         length CRYPTO_PUBLICKEYEXPANDEDBYTES)
+ *              - u8 *pk:  pointer to bit-packed public key
+ *
+ * Returns 0 (success)
+ **************************************************/
+int crypto_sign_pk_expand(u8 *epk, const u8 *pk) {
+	expanded_pk *e = (expanded_pk *)epk;
+	StormContext ctx;
+	u8 rho[SEEDBYTES];
+
+	unpack_pk(rho, &e->t1, pk);
+
+	/* Compute H(rho, t1) */
+	storm_init(&ctx, HASH_DOMAIN);
+	__attribute__((aligned(32))) u8 pk_copy[CRYPTO_PUBLICKEYBYTES];
+	fastmemcpy(pk_copy, pk, CRYPTO_PUBLICKEYBYTES);
+	for (u32 i = 0; i < CRYPTO_PUBLICKEYBYTES; i += 32)
+		storm_next_block(&ctx, pk_copy + i);
+	fastmemset(e->tr, 0, TRBYTES);
+	storm_next_block(&ctx, e->tr);
+	storm_next_block(&ctx, e->tr + 32);
+
+	/* Expand matrix and transform 2^d t1 */
+	polyvec_matrix_expand(e->mat, rho);
+	polyveck_shiftl(&e->t1);
+	polyveck_ntt(&e->t1);
+	return 0;
+}
+
+/*************************************************
+ * Name:        crypto_sign_verify_expanded_internal
+ *
+ * Description: Verifies signature against an expanded public key.
+ *              Internal API.
  *
  * Arguments:   - u8 *m: pointer to input signature
  *              - u64 siglen: length of signature
@@ -350,72 +466,48 @@ int crypto_sign(u8 *sm, u64 *smlen, const u8 *m, u64 mlen, const u8 *ctx,
  *              - u64 mlen: length of message
  *              - const u8 *pre: pointer to prefix string
  *              - u64 prelen: length of prefix string
- *              - const u8 *pk: pointer to bit-packed public key
+ *              - const u8 *epk: pointer to expanded public key
  *
  * Returns 0 if signature could be verified correctly and -1 otherwise
  **************************************************/
-int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
-				u64 mlen, const u8 *pre, u64 prelen,
-				const u8 *pk) {
+int crypto_sign_verify_expanded_internal(const u8 *sig, u64 siglen,
+					 const u8 *m, u64 mlen, const u8 *pre,
+					 u64 prelen, const u8 *epk) {
+	const expanded_pk *e = (const expanded_pk *)epk;
 	StormContext ctx;
 	unsigned int i;
 	__attribute__((aligned(32))) u8 buf[K * POLYW1_PACKEDBYTES];
-	u8 rho[SEEDBYTES];
 	__attribute__((aligned(32))) u8 mu[CRHBYTES] = {0};
 	u8 c[CTILDEBYTES];
 	u8 c2[CTILDEBYTES];
 	poly cp;
-	polyvecl mat[K], z;
+	polyvecl z;
 	polyveck t1, w1, h;
-	// keccak_state state;
 
 	if (siglen != CRYPTO_BYTES) return -1;
 
-	unpack_pk(rho, &t1, pk);
 	if (unpack_sig(c, &z, &h, sig)) return -1;
 	if (polyvecl_chknorm(&z, GAMMA1 - BETA)) return -1;
 
 	/* Compute CRH(H(rho, t1), pre, msg) */
-	// shake256(mu, TRBYTES, pk, CRYPTO_PUBLICKEYBYTES);
-	storm_init(&ctx, HASH_DOMAIN);
-	__attribute__((aligned(32))) u8 pk_copy[CRYPTO_PUBLICKEYBYTES];
-	fastmemcpy(pk_copy, pk, CRYPTO_PUBLICKEYBYTES);
-	for (u32 i = 0; i < CRYPTO_PUBLICKEYBYTES; i += 32)
-		storm_next_block(&ctx, pk_copy + i);
-	storm_next_block(&ctx, mu);
-	storm_next_block(&ctx, mu + 32);
-
-	/*
-	shake256_init(&state);
-	shake256_absorb(&state, mu, TRBYTES);
-	// shake256_absorb(&state, pre, prelen);
-	shake256_absorb(&state, m, mlen);
-	shake256_finalize(&state);
-	shake256_squeeze(mu, CRHBYTES, &state);
-	*/
-
 	storm_init(&ctx, HASH_DOMAIN);
 	__attribute__((aligned(32))) u8 buffer[TRBYTES + 32];
-	fastmemcpy(buffer, mu, TRBYTES);
+	fastmemcpy(buffer, e->tr, TRBYTES);
 	fastmemcpy(buffer + TRBYTES, m, 32);
 	storm_next_block(&ctx, buffer);
 	storm_next_block(&ctx, buffer + 32);
 	storm_next_block(&ctx, buffer + 64);
-	fastmemset(mu, 0, 64);
 	storm_next_block(&ctx, mu);
 	storm_next_block(&ctx, mu + 32);
 
 	/* Matrix-vector multiplication; compute Az - c2^dt1 */
 	poly_challenge(&cp, c);
-	polyvec_matrix_expand(mat, rho);
 
 	polyvecl_ntt(&z);
-	polyvec_matrix_pointwise_montgomery(&w1, mat, &z);
+	polyvec_matrix_pointwise_montgomery(&w1, e->mat, &z);
 
 	poly_ntt(&cp);
-	polyveck_shiftl(&t1);
-	polyveck_ntt(&t1);
-	polyveck_pointwise_poly_montgomery(&t1, &cp, &t1);
+	polyveck_pointwise_poly_montgomery(&t1, &cp, &e->t1);
 
 	polyveck_sub(&w1, &w1, &t1);
 	polyveck_reduce(&w1);
@@ -437,19 +529,39 @@ int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
 	fastmemset(c2, 0, 32);
 	storm_next_block(&ctx, c2);
 
-	/*
-	shake256_init(&state);
-	shake256_absorb(&state, mu, CRHBYTES);
-	shake256_absorb(&state, buf, K * POLYW1_PACKEDBYTES);
-	shake256_finalize(&state);
-	shake256_squeeze(c2, CTILDEBYTES, &state);
-	*/
 	for (i = 0; i < CTILDEBYTES; ++i)
 		if (c[i] != c2[i]) return -1;
 
 	return 0;
 }
 
+/*************************************************
+ * Name:        crypto_sign_verify_internal
+ *
+ * Description: Verifies signature. Internal API.
+ *
+ * Arguments:   - u8 *m: pointer to input signature
+ *              - u64 siglen: length of signature
+ *              - const u8 *m: pointer to message
+ *              - u64 mlen: length of message
+ *              - const u8 *pre: pointer to prefix string
+ *              - u64 prelen: length of prefix string
+ *              - const u8 *pk: pointer to bit-packed public key
+ *
+ * Returns 0 if signature could be verified correctly and -1 otherwise
+ **************************************************/
+int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
+				u64 mlen, const u8 *pre, u64 prelen,
+				const u8 *pk) {
+	expanded_pk epk;
+
+	if (siglen != CRYPTO_BYTES) return -1;
+
+	crypto_sign_pk_expand((u8 *)&epk, pk);
+	return crypto_sign_verify_expanded_internal(sig, siglen, m, mlen, pre,
+						    prelen, (const u8 *)&epk);
+}
+
 /*************************************************
  * Name:        crypto_sign_verify
  *
@@ -480,6 +592,37 @@ int crypto_sign_verify(const u8 *sig, u64 siglen, const u8 *m, u64 mlen,
 					   2 + ctxlen, pk);
 }
 
+/*************************************************
+ * Name:        crypto_sign_verify_expanded
+ *
+ * Description: Verifies signature against an expanded public key.
+ *
+ * Arguments:   - u8 *m: pointer to input signature
+ *              - u64 siglen: length of signature
+ *              - const u8 *m: pointer to message
+ *              - u64 mlen: length of message
+ *              - const u8 *ctx: pointer to context string
+ *              - u64 ctxlen: length of context string
+ *              - const u8 *epk: pointer to expanded public key
+ *
+ * Returns 0 if signature could be verified correctly and -1 otherwise
+ **************************************************/
+int crypto_sign_verify_expanded(const u8 *sig, u64 siglen, const u8 *m,
+				u64 mlen, const u8 *ctx, u64 ctxlen,
+				const u8 *epk) {
+	u64 i;
+	u8 pre[257];
+
+	if (ctxlen > 255) return -1;
+
+	pre[0] = 0;
+	pre[1] = ctxlen;
+	for (i = 0; i < ctxlen; i++) pre[2 + i] = ctx[i];
+
+	return crypto_sign_verify_expanded_internal(sig, siglen, m, mlen, pre,
+						    2 + ctxlen, epk);
+}
+
 /*************************************************
  * Name:        crypto_sign_open
  *
@@ -519,5 +662,3 @@ badsig:
 
 	return -1;
 }
-
-#endif /* !USE_AVX2 */
@@ -31,6 +31,21 @@
 #include <dilithium_avx2/polyvec.h>
 #include <libfam/rng.h>
 
+typedef struct {
+	polyvecl mat[K];
+	polyvecl s1;
+	polyveck s2;
+	polyveck t0;
+	__attribute__((aligned(32))) u8 tr[TRBYTES];
+	u8 key[SEEDBYTES];
+} expanded_sk;
+
+typedef struct {
+	polyvecl mat[K];
+	polyveck t1;
+	__attribute__((aligned(32))) u8 tr[TRBYTES];
+} expanded_pk;
+
 #define crypto_sign_keypair DILITHIUM_NAMESPACE(keypair)
 int crypto_sign_keypair(u8 *pk, u8 *sk, const u8 seed[32]);
 
@@ -43,6 +58,21 @@ int crypto_sign_signature_internal(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 int crypto_sign_signature(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
 			  const u8 *ctx, u64 ctxlen, const u8 *sk, Rng *rng);
 
+#define crypto_sign_sk_expand DILITHIUM_NAMESPACE(sk_expand)
+int crypto_sign_sk_expand(u8 *esk, const u8 *sk);
+
+#define crypto_sign_signature_expanded_internal \
+	DILITHIUM_NAMESPACE(signature_expanded_internal)
+int crypto_sign_signature_expanded_internal(u8 *sig, u64 *siglen, const u8 *m,
+					    u64 mlen, const u8 *pre, u64 prelen,
+					    const u8 rnd[RNDBYTES],
+					    const u8 *esk);
+
+#define crypto_sign_signature_expanded DILITHIUM_NAMESPACE(signature_expanded)
+int crypto_sign_signature_expanded(u8 *sig, u64 *siglen, const u8 *m, u64 mlen,
+				   const u8 *ctx, u64 ctxlen, const u8 *esk,
+				   Rng *rng);
+
 #define crypto_sign DILITHIUM_NAMESPACETOP
 int crypto_sign(u8 *sm, u64 *smlen, const u8 *m, u64 mlen, const u8 *ctx,
 		u64 ctxlen, const u8 *sk, Rng *rng);
@@ -56,6 +86,20 @@ int crypto_sign_verify_internal(const u8 *sig, u64 siglen, const u8 *m,
 int crypto_sign_verify(const u8 *sig, u64 siglen, const u8 *m, u64 mlen,
 		       const u8 *ctx, u64 ctxlen, const u8 *pk);
 
+#define crypto_sign_pk_expand DILITHIUM_NAMESPACE(pk_expand)
+int crypto_sign_pk_expand(u8 *epk, const u8 *pk);
+
+#define crypto_sign_verify_expanded_internal \
+	DILITHIUM_NAMESPACE(verify_expanded_internal)
+int crypto_sign_verify_expanded_internal(const u8 *sig, u64 siglen,
+					 const u8 *m, u64 mlen, const u8 *pre,
+					 u64 prelen, const u8 *epk);
+
+#define crypto_sign_verify_expanded DILITHIUM_NAMESPACE(verify_expanded)
+int crypto_sign_verify_expanded(const u8 *sig, u64 siglen, const u8 *m,
+				u64 mlen, const u8 *ctx, u64 ctxlen,
+				const u8 *epk);
+
 #define crypto_sign_open DILITHIUM_NAMESPACE(open)
 int crypto_sign_open(u8 *m, u64 *mlen, const u8 *sm, u64 smlen, const u8 *ctx,
 		     u64 ctxlen, const u8 *pk);
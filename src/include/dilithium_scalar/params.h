@@ -64,4 +64,9 @@
 #define CRYPTO_BYTES \
 	(CTILDEBYTES + L * POLYZ_PACKEDBYTES + POLYVECH_PACKEDBYTES)
 
+/* A, s1, s2 and t0 in NTT form with tr and key; A and 2^d t1 with tr */
+#define CRYPTO_SECRETKEYEXPANDEDBYTES \
+	((K * L + L + 2 * K) * N * 4 + TRBYTES + SEEDBYTES)
+#define CRYPTO_PUBLICKEYEXPANDEDBYTES ((K * L + K) * N * 4 + TRBYTES)
+
 #endif
@@ -46,6 +46,16 @@ int crypto_kem_enc_derand(u8 *ct, u8 *ss, const u8 *pk, const u8 *coins);
 #define crypto_kem_enc KYBER_NAMESPACE(enc)
 int crypto_kem_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng);
 
+#define crypto_kem_pk_expand KYBER_NAMESPACE(pk_expand)
+int crypto_kem_pk_expand(u8 *epk, const u8 *pk);
+
+#define crypto_kem_enc_expanded_derand KYBER_NAMESPACE(enc_expanded_derand)
+int crypto_kem_enc_expanded_derand(u8 *ct, u8 *ss, const u8 *epk,
+				   const u8 *coins);
+
+#define crypto_kem_enc_expanded KYBER_NAMESPACE(enc_expanded)
+int crypto_kem_enc_expanded(u8 *ct, u8 *ss, const u8 *epk, Rng *rng);
+
 #define crypto_kem_dec KYBER_NAMESPACE(dec)
 int crypto_kem_dec(u8 *ss, const u8 *ct, const u8 *sk);
 
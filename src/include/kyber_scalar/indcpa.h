@@ -43,6 +43,16 @@ void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
 		const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
 		const u8 coins[KYBER_SYMBYTES]);
 
+#define indcpa_pk_expand KYBER_NAMESPACE(indcpa_pk_expand)
+void indcpa_pk_expand(u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+		      const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES]);
+
+#define indcpa_enc_expanded KYBER_NAMESPACE(indcpa_enc_expanded)
+void indcpa_enc_expanded(u8 c[KYBER_INDCPA_BYTES],
+			 const u8 m[KYBER_INDCPA_MSGBYTES],
+			 const u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+			 const u8 coins[KYBER_SYMBYTES]);
+
 #define indcpa_dec KYBER_NAMESPACE(indcpa_dec)
 void indcpa_dec(u8 m[KYBER_INDCPA_MSGBYTES], const u8 c[KYBER_INDCPA_BYTES],
 		const u8 sk[KYBER_INDCPA_SECRETKEYBYTES]);
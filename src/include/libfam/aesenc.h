@@ -26,12 +26,15 @@
 #ifndef _AESENC_H
 #define _AESENC_H
 
-#ifdef __VAES__
-#define AESENC256(result, data, key) \
-	*(__m256i *)result =         \
+/*
+ * One AES round on each 128-bit lane of a 256-bit value. Only usable inside
+ * CPU_TARGET_VAES and CPU_TARGET_AVX2 functions respectively.
+ */
+#define AESENC256_VAES(result, data, key) \
+	*(__m256i *)result =              \
 	    _mm256_aesenc_epi128(*(__m256i *)data, *(__m256i *)key);
-#else
-#define AESENC256(result, data, key)                                           \
+
+#define AESENC256_AESNI(result, data, key)                                     \
 	do {                                                                   \
 		__m128i data_lo = _mm256_castsi256_si128(*(__m256i *)data);    \
 		__m128i data_hi =                                              \
@@ -45,7 +48,6 @@
 		fastmemcpy(result, &data_lo, 16);                              \
 		fastmemcpy((u8 *)result + 16, &data_hi, 16);                   \
 	} while (0);
-#endif /* !__VAES__ */
 
 void aesenc256(void *data, const void *key);
 
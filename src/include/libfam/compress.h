@@ -29,13 +29,89 @@
 #include <libfam/types.h>
 
 #define MAX_COMPRESS_LEN (1 << 18)
+#define COMPRESS_LEVEL_MIN 1
+#define COMPRESS_LEVEL_MAX 9
+#define COMPRESS_LEVEL_DEFAULT 1
+#define MAX_DICT_LEN (1 << 16)
+#define MAX_DICT_SIZE (MAX_DICT_LEN + 389)
+#define COMPRESS_LONG 0x1
+#define COMPRESS_CHECK 0x2
+#define ARCHIVE_NAME_MAX 255
+
+typedef struct CompressCtx CompressCtx;
+typedef struct DecompressCtx DecompressCtx;
+typedef struct CompressDict CompressDict;
+typedef struct Archive Archive;
+
+typedef struct {
+	u64 offset;
+	u64 size;
+	u64 mtime;
+	u32 mode;
+	u8 name[ARCHIVE_NAME_MAX + 1];
+} ArchiveEntry;
 
 u64 compress_bound(u64 source_len);
 i32 compress_block(const u8 *in, u32 len, u8 *out, u32 capacity);
+i32 compress_block_level(const u8 *in, u32 len, u8 *out, u32 capacity,
+			 u8 level);
 i32 decompress_block(const u8 *in, u32 len, u8 *out, u32 capacity);
 i32 compress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset);
+i32 compress_file_level(i32 infd, u64 in_offset, i32 outfd, u64 out_offset,
+			u8 level);
+i32 compress_file_long(i32 infd, u64 in_offset, i32 outfd, u64 out_offset,
+		       u8 level);
+i32 compress_file_flags(i32 infd, u64 in_offset, i32 outfd, u64 out_offset,
+			u8 level, u32 flags);
 i32 decompress_file(i32 infd, u64 in_offset, i32 outfd, u64 out_offset);
+i32 compress_delta(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+		   u64 out_offset, u8 level, u32 flags);
+i32 decompress_delta(i32 reffd, i32 infd, u64 in_offset, i32 outfd,
+		     u64 out_offset);
 i32 compress_stream(i32 infd, u64 in_offset, i32 outfd, u64 out_offset);
+i32 compress_stream_level(i32 infd, u64 in_offset, i32 outfd, u64 out_offset,
+			  u8 level);
+i32 compress_stream_flags(i32 infd, u64 in_offset, i32 outfd, u64 out_offset,
+			  u8 level, u32 flags);
 i32 decompress_stream(i32 infd, u64 in_offset, i32 outfd, u64 out_offset);
+i32 decompress_verify(i32 infd, u64 in_offset);
+i32 decompress_verify_delta(i32 reffd, i32 infd, u64 in_offset);
+i64 decompress_range(i32 infd, u64 in_offset, u64 uoff, u64 len, u8 *out);
+
+i32 compress_ctx_init(CompressCtx **ctx);
+void compress_ctx_destroy(CompressCtx *ctx);
+i32 compress_block_ctx(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+		       u32 capacity, u8 level);
+i32 decompress_ctx_init(DecompressCtx **ctx);
+void decompress_ctx_destroy(DecompressCtx *ctx);
+i32 decompress_block_ctx(DecompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			 u32 capacity);
+i32 compress_block_reuse(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			 u32 capacity, u8 level);
+u32 decompress_block_source(const u8 *in, u32 len);
+i32 decompress_block_reuse(const u8 *src, u32 src_len, const u8 *in, u32 len,
+			   u8 *out, u32 capacity);
+
+i32 compress_dict_train(const u8 *samples, const u32 *sizes, u32 count,
+			u8 *dict, u32 capacity);
+i32 compress_dict_init(CompressDict **dict, const u8 *data, u32 len);
+void compress_dict_destroy(CompressDict *dict);
+i32 compress_block_dict(CompressCtx *ctx, const CompressDict *dict,
+			const u8 *in, u32 len, u8 *out, u32 capacity);
+i32 decompress_block_dict(DecompressCtx *ctx, const CompressDict *dict,
+			  const u8 *in, u32 len, u8 *out, u32 capacity);
+
+i32 compress_archive(const u8 **paths, u32 count, i32 outfd, u64 out_offset,
+		     u8 level, u32 flags);
+i32 archive_open(Archive **archive, i32 fd, u64 offset);
+void archive_close(Archive *archive);
+u32 archive_count(const Archive *archive);
+const ArchiveEntry *archive_entry(const Archive *archive, u32 index);
+i64 archive_read(const Archive *archive, u32 index, u64 offset, u64 len,
+		 u8 *out);
+i32 archive_extract(const Archive *archive, u32 index, i32 outfd);
+i32 archive_create_member(const u8 *dir, const ArchiveEntry *entry);
+i32 archive_extract_all(const Archive *archive, const u8 *dir);
+i32 archive_verify(const Archive *archive);
 
 #endif /* _COMPRESS_H */
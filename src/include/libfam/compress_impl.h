@@ -0,0 +1,79 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#ifndef _COMPRESS_IMPL_H
+#define _COMPRESS_IMPL_H
+
+#include <libfam/compress.h>
+#include <libfam/types.h>
+#include <libfam/utils.h>
+
+/*
+ * Record headers are little-endian u32 words. A raw block has bit 23 set and
+ * its length in the low 23 bits, with data from the fourth byte on. Any other
+ * block holds a bit count below 1 << 23 with BLOCK_FLAGS in the high byte,
+ * and a long-range record holds its reference count with LONG_FLAG set.
+ */
+#define BLOCK_RAW_FLAG 0x00800000U
+#define BLOCK_STREAMS_FLAG 0x80000000U
+#define BLOCK_DICT_TABLE_FLAG 0x40000000U
+#define BLOCK_REUSE_FLAG 0x10000000U
+#define BLOCK_REUSE_SHIFT 24
+#define MAX_REUSE_DIST 15
+#define BLOCK_REUSE_MASK (MAX_REUSE_DIST << BLOCK_REUSE_SHIFT)
+#define BLOCK_FLAGS                                                      \
+	(BLOCK_STREAMS_FLAG | BLOCK_DICT_TABLE_FLAG | BLOCK_REUSE_FLAG | \
+	 BLOCK_REUSE_MASK)
+#define LONG_FLAG 0x20000000U
+#define BLOCK_TABLE_SYMBOLS 385
+/*
+ * A table starts (hdr & ~BLOCK_FLAGS) bits after the header word, behind the
+ * extra bits of the matches. The word and the table, with the bits moved up
+ * to the first byte, always fit in BLOCK_TABLE_MAX bytes.
+ */
+#define BLOCK_TABLE_MAX 512
+
+STATIC_ASSERT((LONG_FLAG & BLOCK_FLAGS) == 0, long_flag_overlap);
+STATIC_ASSERT(((LONG_FLAG | BLOCK_FLAGS) & BLOCK_RAW_FLAG) == 0,
+	      raw_flag_overlap);
+
+/*
+ * The Huffman table blocks pass on to later ones through compress_block_end:
+ * code lengths of the table sent last and its size in bits, and age as in
+ * CompressCtx, 0 before any table is sent.
+ */
+typedef struct {
+	u8 lengths[BLOCK_TABLE_SYMBOLS];
+	u8 age;
+	u32 bits;
+} CompressTable;
+
+i32 compress_block_scratch(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			   u32 capacity, u8 level);
+i32 compress_block_begin(CompressCtx *ctx, const u8 *in, u32 len, u8 *out,
+			 u32 capacity, u8 level);
+i32 compress_block_end(CompressCtx *ctx, CompressTable *table);
+
+#endif /* _COMPRESS_IMPL_H */
@@ -0,0 +1,43 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <libfam/types.h>
+
+/* AVX2 with the rest of the Haswell set: BMI1/2, FMA, LZCNT and MOVBE */
+#define CPU_AVX2 0x1
+#define CPU_AES 0x2
+/* Only reported together with CPU_AVX2 and CPU_AES */
+#define CPU_VAES 0x4
+
+#define CPU_TARGET_AES __attribute__((target("aes")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,aes")))
+#define CPU_TARGET_VAES __attribute__((target("avx2,aes,vaes")))
+
+u32 cpu_features(void);
+
+#endif /* _CPU_H */
@@ -36,12 +36,16 @@ i32 iouring_init_pread(IoUring *iou, i32 fd, void *buf, u64 len, u64 foffset,
 		       u64 id);
 i32 iouring_init_pwrite(IoUring *iou, i32 fd, const void *buf, u64 len,
 			u64 foffset, u64 id);
+i32 iouring_init_pwrite_flags(IoUring *iou, i32 fd, const void *buf, u64 len,
+			      u64 foffset, u64 id, u8 flags);
 i32 iouring_init_fsync(IoUring *iou, i32 fd, u64 id);
 i32 iouring_init_openat(IoUring *iou, i32 dirfd, const char *path,
 			struct open_how *how, u64 id);
 i32 iouring_init_close(IoUring *iou, i32 fd, u64 id);
 i32 iouring_init_fallocate(IoUring *iou, i32 fd, u64 new_size, u64 id);
 i32 iouring_submit(IoUring *iou, u32 count);
+i32 iouring_submit_wait(IoUring *iou, u32 count, u32 min);
+u32 iouring_reap(IoUring *iou, u64 *ids, i32 *res, u32 max);
 i32 iouring_spin(IoUring *iou, u64 *id);
 i32 iouring_wait(IoUring *iou, u64 *id);
 void iouring_destroy(IoUring *iou);
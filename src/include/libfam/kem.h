@@ -33,6 +33,7 @@
 #define KEM_PUBKEY_SIZE 800
 #define KEM_SS_SIZE 32
 #define KEM_CT_SIZE 768
+#define KEM_PUBKEY_EXPANDED_SIZE 3104
 
 typedef struct {
 	__attribute__((aligned(32))) u8 data[KEM_SECKEY_SIZE];
@@ -42,6 +43,16 @@ typedef struct {
 	__attribute__((aligned(32))) u8 data[KEM_PUBKEY_SIZE];
 } KemPubKey;
 
+/*
+ * A public key with the matrix A expanded, the key unpacked and the key
+ * hash precomputed, for repeated encapsulation to the same peer. The
+ * layout belongs to the kernel picked at runtime, so it is only valid
+ * in the process that expanded it.
+ */
+typedef struct {
+	__attribute__((aligned(32))) u8 data[KEM_PUBKEY_EXPANDED_SIZE];
+} KemPubKeyExpanded;
+
 typedef struct {
 	__attribute__((aligned(32))) u8 data[KEM_CT_SIZE];
 } KemCipherText;
@@ -52,6 +63,9 @@ typedef struct {
 
 void keypair(KemPubKey *pk, KemSecKey *sk, Rng *rng);
 void enc(KemCipherText *ct, KemSharedSecret *ss, const KemPubKey *pk, Rng *rng);
+void kem_pk_expand(KemPubKeyExpanded *epk, const KemPubKey *pk);
+void enc_expanded(KemCipherText *ct, KemSharedSecret *ss,
+		  const KemPubKeyExpanded *epk, Rng *rng);
 void dec(KemSharedSecret *ss, const KemCipherText *ct, const KemSecKey *sk);
 
 #endif /* _KEM_H */
@@ -78,4 +78,9 @@ __attribute__((aligned(32))) static const u8 GEN_MAT_DOMAIN[32] = {1, 2, 3, 99,
 	 2 * KYBER_SYMBYTES)
 #define KYBER_CIPHERTEXTBYTES (KYBER_INDCPA_BYTES)
 
+/* A^T and the unpacked public polyvec, followed by H(pk) */
+#define KYBER_INDCPA_EXPANDEDBYTES ((KYBER_K + 1) * KYBER_K * KYBER_N * 2)
+#define KYBER_PUBLICKEYEXPANDEDBYTES \
+	(KYBER_INDCPA_EXPANDEDBYTES + KYBER_SYMBYTES)
+
 #endif /* _KEM_IMPL_H */
@@ -389,6 +389,13 @@ struct timezone {
 #define CLONE_NEWNET 0x40000000		/* New network namespace */
 #define CLONE_IO 0x80000000		/* Clone I/O context */
 
+/* Futex operations */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_PRIVATE_FLAG 128
+#define FUTEX_WAIT_PRIVATE (FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIVATE (FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+
 #define CLOCK_REALTIME 0
 #define CLOCK_MONOTONIC 1
 #define CLOCK_PROCESS_CPUTIME_ID 2
@@ -401,6 +408,7 @@ struct timezone {
 #define CLOCK_BOOTTIME_ALARM 9
 
 #define AT_FDCWD -100
+#define AT_REMOVEDIR 0x200
 
 /* Open constants */
 #define O_CREAT 0100
@@ -408,6 +416,7 @@ struct timezone {
 #define O_RDONLY 00000000
 #define O_RDWR 02
 #define O_EXCL 00000200
+#define O_TRUNC 00001000
 #define O_SYNC 04000000
 #ifdef __aarch64__
 #define O_DIRECT 0200000
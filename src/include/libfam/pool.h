@@ -0,0 +1,45 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <libfam/types.h>
+
+#define MAX_POOL_THREADS 127
+
+typedef struct ThreadPool ThreadPool;
+
+i32 pool_init(ThreadPool **pool, u32 threads);
+i32 pool_run(ThreadPool *pool, void (*fn)(u32 id, void *arg), void *arg,
+	     u32 n);
+u32 pool_threads(ThreadPool *pool);
+void pool_destroy(ThreadPool *pool);
+ThreadPool *global_pool(void);
+
+/* The errno slot of the calling pool worker, or NULL on any other thread. */
+i32 *pool_errno(void);
+
+#endif /* _POOL_H */
@@ -27,21 +27,21 @@
 #define _SIGN_H
 
 #ifndef NO_VECTOR
-#ifdef __AVX2__
+#ifdef __x86_64__
 #define USE_AVX2
-#endif /* __AVX2__ */
+#endif /* __x86_64__ */
 #endif /* NO_VECTOR */
 
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
+#include <libfam/cpu.h>
 #include <libfam/format.h>
+#include <libfam/rng.h>
 #include <libfam/types.h>
 
 #define DILITHIUM_SECRETKEY_SIZE 2560
 #define DILITHIUM_PUBLICKEY_SIZE 1312
 #define DILITHIUM_SIGNATURE_SIZE 2420
+#define DILITHIUM_SECRETKEY_EXPANDED_SIZE 28768
+#define DILITHIUM_PUBLICKEY_EXPANDED_SIZE 20544
 
 i32 pqcrystals_dilithium2_ref_keypair(u8 *pk, u8 *sk, const u8 seed[32]);
 i32 pqcrystals_dilithium2_ref_signature(u8 *sig, u64 *siglen, const u8 *m,
@@ -50,6 +50,16 @@ i32 pqcrystals_dilithium2_ref_signature(u8 *sig, u64 *siglen, const u8 *m,
 i32 pqcrystals_dilithium2_ref_verify(const u8 *sig, u64 siglen, const u8 *m,
 				     u64 mlen, const u8 *ctx, u64 ctxlen,
 				     const u8 *pk);
+i32 pqcrystals_dilithium2_ref_sk_expand(u8 *esk, const u8 *sk);
+i32 pqcrystals_dilithium2_ref_signature_expanded(u8 *sig, u64 *siglen,
+						 const u8 *m, u64 mlen,
+						 const u8 *ctx, u64 ctxlen,
+						 const u8 *esk, Rng *rng);
+i32 pqcrystals_dilithium2_ref_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_dilithium2_ref_verify_expanded(const u8 *sig, u64 siglen,
+					      const u8 *m, u64 mlen,
+					      const u8 *ctx, u64 ctxlen,
+					      const u8 *epk);
 
 i32 pqcrystals_dilithium2_avx2_keypair(u8 *pk, u8 *sk, const u8 seed[32]);
 i32 pqcrystals_dilithium2_avx2_signature(u8 *sig, u64 *siglen, const u8 *m,
@@ -58,6 +68,16 @@ i32 pqcrystals_dilithium2_avx2_signature(u8 *sig, u64 *siglen, const u8 *m,
 i32 pqcrystals_dilithium2_avx2_verify(const u8 *sig, u64 siglen, const u8 *m,
 				      u64 mlen, const u8 *ctx, u64 ctxlen,
 				      const u8 *pk);
+i32 pqcrystals_dilithium2_avx2_sk_expand(u8 *esk, const u8 *sk);
+i32 pqcrystals_dilithium2_avx2_signature_expanded(u8 *sig, u64 *siglen,
+						  const u8 *m, u64 mlen,
+						  const u8 *ctx, u64 ctxlen,
+						  const u8 *esk, Rng *rng);
+i32 pqcrystals_dilithium2_avx2_pk_expand(u8 *epk, const u8 *pk);
+i32 pqcrystals_dilithium2_avx2_verify_expanded(const u8 *sig, u64 siglen,
+					       const u8 *m, u64 mlen,
+					       const u8 *ctx, u64 ctxlen,
+					       const u8 *epk);
 
 typedef struct {
 	__attribute__((aligned(32))) u8 data[DILITHIUM_SECRETKEY_SIZE];
@@ -71,32 +91,103 @@ typedef struct {
 	__attribute__((aligned(32))) u8 data[DILITHIUM_SIGNATURE_SIZE];
 } Signature;
 
+/*
+ * Keys with the matrix A expanded and the key vectors unpacked into NTT
+ * form, for signing or verifying many times with the same key. The
+ * layout belongs to the kernel picked at runtime, so an expanded key is
+ * only valid in the process that expanded it.
+ */
+typedef struct {
+	__attribute__((aligned(32))) u8 data[DILITHIUM_SECRETKEY_EXPANDED_SIZE];
+} SecretKeyExpanded;
+
+typedef struct {
+	__attribute__((aligned(32))) u8 data[DILITHIUM_PUBLICKEY_EXPANDED_SIZE];
+} PublicKeyExpanded;
+
 static inline void keyfrom(const u8 seed[32], SecretKey *sk, PublicKey *pk) {
 #ifdef USE_AVX2
-	pqcrystals_dilithium2_avx2_keypair(pk->data, sk->data, seed);
-#else
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_dilithium2_avx2_keypair(pk->data, sk->data, seed);
+		return;
+	}
+#endif /* USE_AVX2 */
 	pqcrystals_dilithium2_ref_keypair(pk->data, sk->data, seed);
-#endif
 }
 static inline void sign(const u8 msg[32], const SecretKey *sk, Signature *out,
 			Rng *rng) {
 	u64 siglen;
 #ifdef USE_AVX2
-	pqcrystals_dilithium2_avx2_signature(out->data, &siglen, msg, 32, NULL,
-					     0, sk->data, rng);
-#else
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_dilithium2_avx2_signature(out->data, &siglen, msg,
+						     32, NULL, 0, sk->data,
+						     rng);
+		return;
+	}
+#endif /* USE_AVX2 */
 	pqcrystals_dilithium2_ref_signature(out->data, &siglen, msg, 32, NULL,
 					    0, sk->data, rng);
-#endif
 }
-i32 verify(const u8 msg[32], const PublicKey *pk, const Signature *sig) {
+static inline i32 verify(const u8 msg[32], const PublicKey *pk,
+			 const Signature *sig) {
 #ifdef USE_AVX2
-	return pqcrystals_dilithium2_avx2_verify(sig->data, 2420, msg, 32, NULL,
-						 0, pk->data);
-#else
+	if (cpu_features() & CPU_AVX2)
+		return pqcrystals_dilithium2_avx2_verify(
+		    sig->data, 2420, msg, 32, NULL, 0, pk->data);
+#endif /* USE_AVX2 */
 	return pqcrystals_dilithium2_ref_verify(sig->data, 2420, msg, 32, NULL,
 						0, pk->data);
-#endif
 }
+static inline void sk_expand(const SecretKey *sk, SecretKeyExpanded *out) {
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_dilithium2_avx2_sk_expand(out->data, sk->data);
+		return;
+	}
+#endif /* USE_AVX2 */
+	pqcrystals_dilithium2_ref_sk_expand(out->data, sk->data);
+}
+static inline void pk_expand(const PublicKey *pk, PublicKeyExpanded *out) {
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_dilithium2_avx2_pk_expand(out->data, pk->data);
+		return;
+	}
+#endif /* USE_AVX2 */
+	pqcrystals_dilithium2_ref_pk_expand(out->data, pk->data);
+}
+static inline void sign_expanded(const u8 msg[32], const SecretKeyExpanded *sk,
+				 Signature *out, Rng *rng) {
+	u64 siglen;
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2) {
+		pqcrystals_dilithium2_avx2_signature_expanded(
+		    out->data, &siglen, msg, 32, NULL, 0, sk->data, rng);
+		return;
+	}
+#endif /* USE_AVX2 */
+	pqcrystals_dilithium2_ref_signature_expanded(out->data, &siglen, msg,
+						     32, NULL, 0, sk->data,
+						     rng);
+}
+static inline i32 verify_expanded(const u8 msg[32], const PublicKeyExpanded *pk,
+				  const Signature *sig) {
+#ifdef USE_AVX2
+	if (cpu_features() & CPU_AVX2)
+		return pqcrystals_dilithium2_avx2_verify_expanded(
+		    sig->data, 2420, msg, 32, NULL, 0, pk->data);
+#endif /* USE_AVX2 */
+	return pqcrystals_dilithium2_ref_verify_expanded(
+	    sig->data, 2420, msg, 32, NULL, 0, pk->data);
+}
+
+/*
+ * Verifies n signatures, msgs[i] under pks[i], and sets results[i] to 0 or
+ * -1 as verify() would. Signatures under the same key share one key
+ * expansion and the work is spread over the global thread pool. Returns
+ * 0 if every signature is valid and -1 otherwise.
+ */
+i32 verify_batch(const u8 msgs[][32], const PublicKey *pks,
+		 const Signature *sigs, u32 n, i32 *results);
 
 #endif /* _SIGN_H */
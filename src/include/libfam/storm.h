@@ -29,13 +29,48 @@
 #include <libfam/types.h>
 
 #define STORM_CONTEXT_SIZE 192
+#define STORM_AEAD_NONCE_SIZE 16
+#define STORM_AEAD_TAG_SIZE 32
 
 typedef struct {
 	__attribute__((aligned(32))) u8 _data[STORM_CONTEXT_SIZE];
 } StormContext;
 
+/*
+ * Four independent contexts advanced in lock-step by one interleaved kernel.
+ * Each lane produces exactly what a StormContext with the same key would.
+ */
+typedef struct {
+	StormContext lane[4];
+} StormContext4x;
+
 void storm_init(StormContext *ctx, const u8 key[32]);
 void storm_next_block(StormContext *ctx, u8 buf[32]);
 void storm_xcrypt_buffer(StormContext *s, u8 buf[32]);
+void storm_xcrypt(StormContext *ctx, void *buf, u64 len);
+
+/* len is the same for every lane and must be a multiple of 32 */
+void storm_init_4x(StormContext4x *ctx, const u8 keys[4][32]);
+void storm_next_block_4x(StormContext4x *ctx, u8 *const blocks[4], u64 len);
+
+/*
+ * Replaces each of the n 32-byte blocks of in with the result of steps[i]
+ * storm_next_block calls, each from a fresh copy of ctx, and writes it to
+ * out. The chains are independent and run side by side; out may equal in.
+ */
+void storm_chain(const StormContext *ctx, void *out, const void *in,
+		 const u32 *steps, u32 n);
+
+/*
+ * Encrypts buf in place and authenticates it together with ad in a single
+ * pass. A nonce must never be reused with the same key. open returns -1 with
+ * errno EBADMSG, and zeroes buf, if the tag does not match.
+ */
+void storm_aead_seal(const u8 key[32], const u8 nonce[STORM_AEAD_NONCE_SIZE],
+		     const void *ad, u64 ad_len, void *buf, u64 len,
+		     u8 tag[STORM_AEAD_TAG_SIZE]);
+i32 storm_aead_open(const u8 key[32], const u8 nonce[STORM_AEAD_NONCE_SIZE],
+		    const void *ad, u64 ad_len, void *buf, u64 len,
+		    const u8 tag[STORM_AEAD_TAG_SIZE]);
 
 #endif /* _STORM_H */
@@ -0,0 +1 @@
+#define LIBFAM_VERSION "unknown"
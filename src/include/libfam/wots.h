@@ -49,7 +49,11 @@ typedef struct {
 } WotsSig;
 
 void wots_keyfrom(const u8 seed[32], WotsPubKey *pk, WotsSecKey *sk);
+void wots_seckeyfrom(const u8 seed[32], WotsSecKey *sk);
 void wots_sign(const WotsSecKey *sk, const u8 message[32], WotsSig *sig);
 i32 wots_verify(const WotsPubKey *pk, const WotsSig *sig, const u8 message[32]);
+/* The public key a valid signature of message chains up to */
+void wots_pk_from_sig(const WotsSig *sig, const u8 message[32],
+		      WotsPubKey *pk);
 
 #endif /* _WOTS_H */
@@ -0,0 +1,64 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2025-2026 Christopher Gilliard
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************/
+
+#ifndef _XMSS_H
+#define _XMSS_H
+
+#include <libfam/types.h>
+#include <libfam/wots.h>
+
+#define XMSS_MIN_HEIGHT 2
+#define XMSS_MAX_HEIGHT 20
+#define XMSS_SECKEY_SIZE 4096
+
+/*
+ * The secret key is a stateful traversal: every xmss_sign advances it, and it
+ * must be stored again before the signature is released. A key of height h
+ * signs 2^h messages.
+ */
+typedef struct {
+	__attribute__((aligned(32))) u8 _data[XMSS_SECKEY_SIZE];
+} XmssSecKey;
+
+typedef struct {
+	u8 root[32];
+	u8 seed[32];
+	u8 height;
+} XmssPubKey;
+
+typedef struct {
+	WotsSig wots;
+	u8 auth[XMSS_MAX_HEIGHT][32];
+	u64 index;
+} XmssSig;
+
+i32 xmss_keyfrom(const u8 seed[32], u8 height, XmssPubKey *pk,
+		 XmssSecKey *sk);
+i32 xmss_sign(XmssSecKey *sk, const u8 message[32], XmssSig *sig);
+i32 xmss_verify(const XmssPubKey *pk, const u8 message[32],
+		const XmssSig *sig);
+u64 xmss_remaining(const XmssSecKey *sk);
+
+#endif /* _XMSS_H */
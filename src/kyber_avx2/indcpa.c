@@ -102,9 +102,11 @@ static unsigned int rej_uniform(i16 *r, unsigned int len, const u8 *buf,
 
 #include <libfam/format.h>
 void gen_matrix(polyvec *a, const u8 seed[32], int transposed) {
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	StormContext4x ctx;
 	unsigned int i, ctr0, ctr1, ctr2, ctr3;
 	ALIGNED_UINT8(REJ_UNIFORM_AVX_NBLOCKS * SHAKE128_RATE + 8) buf[4] = {0};
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
 	__m256i f;
 
 	f = _mm256_loadu_si256((__m256i *)seed);
@@ -138,17 +140,12 @@ void gen_matrix(polyvec *a, const u8 seed[32], int transposed) {
 		}
 	}
 
-	storm_init(&ctx0, GEN_MAT_DOMAIN);
-	storm_init(&ctx1, GEN_MAT_DOMAIN);
-	storm_init(&ctx2, GEN_MAT_DOMAIN);
-	storm_init(&ctx3, GEN_MAT_DOMAIN);
+	storm_init(&ctx.lane[0], GEN_MAT_DOMAIN);
+	storm_init(&ctx.lane[1], GEN_MAT_DOMAIN);
+	storm_init(&ctx.lane[2], GEN_MAT_DOMAIN);
+	storm_init(&ctx.lane[3], GEN_MAT_DOMAIN);
 
-	for (u32 i = 0; i < sizeof(buf[0].coeffs); i += 32) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i);
-	}
+	storm_next_block_4x(&ctx, blocks, sizeof(buf[0].coeffs));
 
 	ctr0 = rej_uniform_avx(a[0].vec[0].coeffs, buf[0].coeffs);
 	ctr1 = rej_uniform_avx(a[0].vec[1].coeffs, buf[1].coeffs);
@@ -161,12 +158,7 @@ void gen_matrix(polyvec *a, const u8 seed[32], int transposed) {
 		fastmemset(buf[1].coeffs, 0, SHAKE256_RATE);
 		fastmemset(buf[2].coeffs, 0, SHAKE256_RATE);
 		fastmemset(buf[3].coeffs, 0, SHAKE256_RATE);
-		for (u32 i = 0; i < 5; i++) {
-			storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i * 32);
-			storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i * 32);
-			storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i * 32);
-			storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i * 32);
-		}
+		storm_next_block_4x(&ctx, blocks, 5 * 32);
 
 		ctr0 += rej_uniform(a[0].vec[0].coeffs + ctr0, KYBER_N - ctr0,
 				    buf[0].coeffs, SHAKE128_RATE);
@@ -222,17 +214,26 @@ void indcpa_keypair_derand(u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
 	pack_pk(pk, &pkpv, publicseed);
 }
 
-void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
-		const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
-		const u8 coins[KYBER_SYMBYTES]) {
-	unsigned int i;
+void indcpa_pk_expand(u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+		      const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES]) {
 	u8 seed[KYBER_SYMBYTES];
-	polyvec sp, pkpv, ep, at[KYBER_K], b;
+	polyvec *at = (polyvec *)epk;
+
+	unpack_pk(at + KYBER_K, seed, pk);
+	gen_at(at, seed);
+}
+
+void indcpa_enc_expanded(u8 c[KYBER_INDCPA_BYTES],
+			 const u8 m[KYBER_INDCPA_MSGBYTES],
+			 const u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+			 const u8 coins[KYBER_SYMBYTES]) {
+	unsigned int i;
+	const polyvec *at = (const polyvec *)epk;
+	const polyvec *pkpv = at + KYBER_K;
+	polyvec sp, ep, b;
 	poly v, k, epp;
 
-	unpack_pk(&pkpv, seed, pk);
 	poly_frommsg(&k, m);
-	gen_at(at, seed);
 
 	poly_getnoise_eta1122_4x(sp.vec + 0, sp.vec + 1, ep.vec + 0, ep.vec + 1,
 				 coins, 0, 1, 2, 3);
@@ -242,7 +243,7 @@ void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
 
 	for (i = 0; i < KYBER_K; i++)
 		polyvec_basemul_acc_montgomery(&b.vec[i], &at[i], &sp);
-	polyvec_basemul_acc_montgomery(&v, &pkpv, &sp);
+	polyvec_basemul_acc_montgomery(&v, pkpv, &sp);
 
 	polyvec_invntt_tomont(&b);
 	poly_invntt_tomont(&v);
@@ -256,6 +257,15 @@ void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
 	pack_ciphertext(c, &b, &v);
 }
 
+void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
+		const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
+		const u8 coins[KYBER_SYMBYTES]) {
+	polyvec epk[KYBER_K + 1];
+
+	indcpa_pk_expand((u8 *)epk, pk);
+	indcpa_enc_expanded(c, m, (const u8 *)epk, coins);
+}
+
 void indcpa_dec(u8 m[KYBER_INDCPA_MSGBYTES], const u8 c[KYBER_INDCPA_BYTES],
 		const u8 sk[KYBER_INDCPA_SECRETKEYBYTES]) {
 	polyvec b, skpv;
@@ -219,7 +219,9 @@ void poly_getnoise_eta1_4x(poly *r0, poly *r1, poly *r2, poly *r3,
 			   const u8 seed[32], u8 nonce0, u8 nonce1, u8 nonce2,
 			   u8 nonce3) {
 	ALIGNED_UINT8(NOISE_NBLOCKS * SHAKE256_RATE + 16) buf[4] = {0};
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
+	StormContext4x ctx;
 	__m256i f;
 
 	f = _mm256_loadu_si256((__m256i *)seed);
@@ -233,10 +235,10 @@ void poly_getnoise_eta1_4x(poly *r0, poly *r1, poly *r2, poly *r3,
 	buf[2].coeffs[32] = nonce2;
 	buf[3].coeffs[32] = nonce3;
 
-	storm_init_nonce1(&ctx0, nonce0);
-	storm_init_nonce1(&ctx1, nonce1);
-	storm_init_nonce1(&ctx2, nonce2);
-	storm_init_nonce1(&ctx3, nonce3);
+	storm_init_nonce1(&ctx.lane[0], nonce0);
+	storm_init_nonce1(&ctx.lane[1], nonce1);
+	storm_init_nonce1(&ctx.lane[2], nonce2);
+	storm_init_nonce1(&ctx.lane[3], nonce3);
 
 	/*
 	storm_init(&ctx0, NOISE_ETA1_DOMAIN);
@@ -245,21 +247,8 @@ void poly_getnoise_eta1_4x(poly *r0, poly *r1, poly *r2, poly *r3,
 	storm_init(&ctx3, NOISE_ETA1_DOMAIN);
 	*/
 
-	storm_next_block(&ctx0, (u8 *)buf[0].coeffs);
-	storm_next_block(&ctx1, (u8 *)buf[1].coeffs);
-	storm_next_block(&ctx2, (u8 *)buf[2].coeffs);
-	storm_next_block(&ctx3, (u8 *)buf[3].coeffs);
-	storm_next_block(&ctx0, (u8 *)buf[0].coeffs + 32);
-	storm_next_block(&ctx1, (u8 *)buf[1].coeffs + 32);
-	storm_next_block(&ctx2, (u8 *)buf[2].coeffs + 32);
-	storm_next_block(&ctx3, (u8 *)buf[3].coeffs + 32);
-
-	for (u32 i = 0; i < sizeof(buf[0]); i += 32) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i);
-	}
+	storm_next_block_4x(&ctx, blocks, 64);
+	storm_next_block_4x(&ctx, blocks, sizeof(buf[0]));
 
 	poly_cbd_eta1(r0, buf[0].vec);
 	poly_cbd_eta1(r1, buf[1].vec);
@@ -272,7 +261,9 @@ void poly_getnoise_eta1122_4x(poly *r0, poly *r1, poly *r2, poly *r3,
 			      u8 nonce2, u8 nonce3) {
 	ALIGNED_UINT8(NOISE_NBLOCKS * SHAKE256_RATE + 16) buf[4] = {0};
 	__m256i f;
-	StormContext ctx0, ctx1, ctx2, ctx3;
+	u8 *const blocks[4] = {buf[0].coeffs, buf[1].coeffs, buf[2].coeffs,
+			       buf[3].coeffs};
+	StormContext4x ctx;
 
 	f = _mm256_loadu_si256((__m256i *)seed);
 	_mm256_store_si256(buf[0].vec, f);
@@ -291,26 +282,13 @@ void poly_getnoise_eta1122_4x(poly *r0, poly *r1, poly *r2, poly *r3,
 	storm_init(&ctx2, NOISE_ETA2_DOMAIN);
 	storm_init(&ctx3, NOISE_ETA2_DOMAIN);
 	*/
-	storm_init_nonce1(&ctx0, nonce0);
-	storm_init_nonce1(&ctx1, nonce1);
-	storm_init_nonce2(&ctx2, nonce2);
-	storm_init_nonce2(&ctx3, nonce3);
-
-	storm_next_block(&ctx0, (u8 *)buf[0].coeffs);
-	storm_next_block(&ctx1, (u8 *)buf[1].coeffs);
-	storm_next_block(&ctx2, (u8 *)buf[2].coeffs);
-	storm_next_block(&ctx3, (u8 *)buf[3].coeffs);
-	storm_next_block(&ctx0, (u8 *)buf[0].coeffs + 32);
-	storm_next_block(&ctx1, (u8 *)buf[1].coeffs + 32);
-	storm_next_block(&ctx2, (u8 *)buf[2].coeffs + 32);
-	storm_next_block(&ctx3, (u8 *)buf[3].coeffs + 32);
-
-	for (u32 i = 0; i < sizeof(buf[0]); i += 32) {
-		storm_next_block(&ctx0, (u8 *)buf[0].coeffs + i);
-		storm_next_block(&ctx1, (u8 *)buf[1].coeffs + i);
-		storm_next_block(&ctx2, (u8 *)buf[2].coeffs + i);
-		storm_next_block(&ctx3, (u8 *)buf[3].coeffs + i);
-	}
+	storm_init_nonce1(&ctx.lane[0], nonce0);
+	storm_init_nonce1(&ctx.lane[1], nonce1);
+	storm_init_nonce2(&ctx.lane[2], nonce2);
+	storm_init_nonce2(&ctx.lane[3], nonce3);
+
+	storm_next_block_4x(&ctx, blocks, 64);
+	storm_next_block_4x(&ctx, blocks, sizeof(buf[0]));
 
 	poly_cbd_eta1(r0, buf[0].vec);
 	poly_cbd_eta1(r1, buf[1].vec);
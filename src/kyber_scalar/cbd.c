@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <libfam/kem_impl.h>
 #include <kyber_scalar/cbd.h>
 
@@ -99,5 +87,3 @@ void poly_cbd_eta1(poly *r, const u8 buf[KYBER_ETA1 * KYBER_N / 4]) {
 void poly_cbd_eta2(poly *r, const u8 buf[KYBER_ETA2 * KYBER_N / 4]) {
 	cbd2(r, buf);
 }
-
-#endif /* !USE_AVX2 */
@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <libfam/kem_impl.h>
 #include <kyber_scalar/indcpa.h>
 #include <kyber_scalar/ntt.h>
@@ -186,18 +174,27 @@ void indcpa_keypair_derand(u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
 	pack_pk(pk, &pkpv, publicseed);
 }
 
-void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
-		const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
-		const u8 coins[KYBER_SYMBYTES]) {
-	unsigned int i;
+void indcpa_pk_expand(u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+		      const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES]) {
 	u8 seed[KYBER_SYMBYTES];
+	polyvec *at = (polyvec *)epk;
+
+	unpack_pk(at + KYBER_K, seed, pk);
+	gen_at(at, seed);
+}
+
+void indcpa_enc_expanded(u8 c[KYBER_INDCPA_BYTES],
+			 const u8 m[KYBER_INDCPA_MSGBYTES],
+			 const u8 epk[KYBER_INDCPA_EXPANDEDBYTES],
+			 const u8 coins[KYBER_SYMBYTES]) {
+	unsigned int i;
 	u8 nonce = 0;
-	polyvec sp, pkpv, ep, at[KYBER_K], b;
+	const polyvec *at = (const polyvec *)epk;
+	const polyvec *pkpv = at + KYBER_K;
+	polyvec sp, ep, b;
 	poly v, k, epp;
 
-	unpack_pk(&pkpv, seed, pk);
 	poly_frommsg(&k, m);
-	gen_at(at, seed);
 
 	for (i = 0; i < KYBER_K; i++)
 		poly_getnoise_eta1(sp.vec + i, coins, nonce++);
@@ -210,7 +207,7 @@ void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
 	for (i = 0; i < KYBER_K; i++)
 		polyvec_basemul_acc_montgomery(&b.vec[i], &at[i], &sp);
 
-	polyvec_basemul_acc_montgomery(&v, &pkpv, &sp);
+	polyvec_basemul_acc_montgomery(&v, pkpv, &sp);
 
 	polyvec_invntt_tomont(&b);
 	poly_invntt_tomont(&v);
@@ -224,6 +221,15 @@ void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
 	pack_ciphertext(c, &b, &v);
 }
 
+void indcpa_enc(u8 c[KYBER_INDCPA_BYTES], const u8 m[KYBER_INDCPA_MSGBYTES],
+		const u8 pk[KYBER_INDCPA_PUBLICKEYBYTES],
+		const u8 coins[KYBER_SYMBYTES]) {
+	polyvec epk[KYBER_K + 1];
+
+	indcpa_pk_expand((u8 *)epk, pk);
+	indcpa_enc_expanded(c, m, (const u8 *)epk, coins);
+}
+
 void indcpa_dec(u8 m[KYBER_INDCPA_MSGBYTES], const u8 c[KYBER_INDCPA_BYTES],
 		const u8 sk[KYBER_INDCPA_SECRETKEYBYTES]) {
 	polyvec b, skpv;
@@ -241,4 +247,3 @@ void indcpa_dec(u8 m[KYBER_INDCPA_MSGBYTES], const u8 c[KYBER_INDCPA_BYTES],
 
 	poly_tomsg(m, &mp);
 }
-#endif /* !USE_AVX2 */
@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <libfam/kem_impl.h>
 #include <kyber_scalar/indcpa.h>
 #include <kyber_scalar/kem.h>
@@ -71,32 +59,55 @@ int crypto_kem_keypair(u8 *pk, u8 *sk, Rng *rng) {
 	return 0;
 }
 
-int crypto_kem_enc_derand(u8 *ct, u8 *ss, const u8 *pk, const u8 *coins) {
+int crypto_kem_pk_expand(u8 *epk, const u8 *pk) {
 	StormContext ctx;
 	__attribute__((aligned(32))) u8 pk_copy[KYBER_PUBLICKEYBYTES] = {0};
 
-	__attribute__((aligned(32))) u8 buf[2 * KYBER_SYMBYTES] = {0};
-	__attribute__((aligned(32))) u8 kr[2 * KYBER_SYMBYTES] = {0};
-
-	fastmemcpy(buf, coins, KYBER_SYMBYTES);
+	indcpa_pk_expand(epk, pk);
 
 	storm_init(&ctx, PUBKEY_HASH_DOMAIN);
 	fastmemcpy(pk_copy, pk, KYBER_PUBLICKEYBYTES);
 	for (u32 i = 0; i < KYBER_PUBLICKEYBYTES; i += 32)
 		storm_next_block(&ctx, pk_copy + i);
-	storm_next_block(&ctx, buf + KYBER_SYMBYTES);
+	fastmemset(epk + KYBER_INDCPA_EXPANDEDBYTES, 0, KYBER_SYMBYTES);
+	storm_next_block(&ctx, epk + KYBER_INDCPA_EXPANDEDBYTES);
+	return 0;
+}
+
+int crypto_kem_enc_expanded_derand(u8 *ct, u8 *ss, const u8 *epk,
+				   const u8 *coins) {
+	StormContext ctx;
+	__attribute__((aligned(32))) u8 buf[2 * KYBER_SYMBYTES] = {0};
+	__attribute__((aligned(32))) u8 kr[2 * KYBER_SYMBYTES] = {0};
+
+	fastmemcpy(buf, coins, KYBER_SYMBYTES);
+	fastmemcpy(buf + KYBER_SYMBYTES, epk + KYBER_INDCPA_EXPANDEDBYTES,
+		   KYBER_SYMBYTES);
 
 	storm_init(&ctx, KR_HASH_DOMAIN);
 	fastmemcpy(kr, buf, 2 * KYBER_SYMBYTES);
 	storm_next_block(&ctx, kr);
 	storm_next_block(&ctx, kr + KYBER_SYMBYTES);
 
-	indcpa_enc(ct, buf, pk, kr + KYBER_SYMBYTES);
+	indcpa_enc_expanded(ct, buf, epk, kr + KYBER_SYMBYTES);
 	fastmemcpy(ss, kr, KYBER_SYMBYTES);
+	return 0;
+}
 
+int crypto_kem_enc_expanded(u8 *ct, u8 *ss, const u8 *epk, Rng *rng) {
+	__attribute__((aligned(32))) u8 coins[KYBER_SYMBYTES] = {0};
+	rng_gen(rng, coins, KYBER_SYMBYTES);
+	crypto_kem_enc_expanded_derand(ct, ss, epk, coins);
 	return 0;
 }
 
+int crypto_kem_enc_derand(u8 *ct, u8 *ss, const u8 *pk, const u8 *coins) {
+	__attribute__((aligned(32))) u8 epk[KYBER_PUBLICKEYEXPANDEDBYTES];
+
+	crypto_kem_pk_expand(epk, pk);
+	return crypto_kem_enc_expanded_derand(ct, ss, epk, coins);
+}
+
 int crypto_kem_enc(u8 *ct, u8 *ss, const u8 *pk, Rng *rng) {
 	__attribute((aligned(32))) u8 coins[KYBER_SYMBYTES] = {0};
 	rng_gen(rng, coins, KYBER_SYMBYTES);
@@ -136,4 +147,3 @@ int crypto_kem_dec(u8 *ss, const u8 *ct, const u8 *sk) {
 
 	return 0;
 }
-#endif /* !USE_AVX2 */
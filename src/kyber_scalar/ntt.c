@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <libfam/kem_impl.h>
 #include <kyber_scalar/ntt.h>
 #include <kyber_scalar/reduce.h>
@@ -133,5 +121,3 @@ void basemul(i16 r[2], const i16 a[2], const i16 b[2], i16 zeta) {
 	r[1] = fqmul(a[0], b[1]);
 	r[1] += fqmul(a[1], b[0]);
 }
-
-#endif /* !USE_AVX2 */
@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <libfam/kem_impl.h>
 #include <kyber_scalar/reduce.h>
 
@@ -54,5 +42,3 @@ i16 barrett_reduce(i16 a) {
 	t *= KYBER_Q;
 	return a - t;
 }
-
-#endif /* !USE_AVX2 */
@@ -23,18 +23,6 @@
  *
  *******************************************************************************/
 
-#ifndef NO_VECTOR
-#ifdef __AVX2__
-#define USE_AVX2
-#endif /* __AVX2__ */
-#endif /* NO_VECTOR */
-
-#ifdef USE_AVX2
-#include <immintrin.h>
-#endif /* USE_AVX2 */
-
-#ifndef USE_AVX2
-
 #include <kyber_scalar/verify.h>
 
 int verify(const u8 *a, const u8 *b, u64 len) {
@@ -65,5 +53,3 @@ void cmov_int16(i16 *r, i16 v, u16 b) {
 	b = -b;
 	*r ^= b & ((*r) ^ v);
 }
-
-#endif /* !USE_AVX2 */